@@ -9,6 +9,8 @@
 * REFERENCES
 * ------------
 *   (1) http://git.musl-libc.org/cgit/musl/plain/src/time/__secs_to_tm.c?h=v0.9.15
+*   (2) C. NERI, L. SCHNEIDER - EUCLIDEAN AFFINE FUNCTIONS AND THEIR
+*       APPLICATION TO CALENDAR ALGORITHMS (ARXIV 2102.06959)
 ****************************************************************/
 
 #include "ESP8266_NTP.h"
@@ -17,49 +19,311 @@
 //DEBUG RELATED
 static uint8_t _esp8266_ntp_debug;
 
-//NTP TIME DATA STRUCTURE
-static ESP8266_NTP_DATA* _esp8266_ntp_data;
-static uint8_t* _esp8266_ntp_data_packet;
+//LIBRARY CONTEXT
+//ALL LIBRARY STATE LIVES IN A CONTEXT (ONE PER CLIENT INSTANCE) IN
+//CALLER STORAGE. THE DEFAULT CONTEXT BACKING THE NON _Ctx API IS ONLY
+//BUILT WITH NTP_LEGACY_API. NO HEAP IS EVER USED
+#if NTP_LEGACY_API
+static ESP8266_NTP_CONTEXT _esp8266_ntp_default_ctx;
+static ESP8266_NTP_CONTEXT* _esp8266_ntp_ctx = &_esp8266_ntp_default_ctx;
+#endif
 
-//IP / HOSTNAME RELATED
-static char* _esp8266_ntp_server_1;
-static char* _esp8266_ntp_server_2;
-static char* _esp8266_ntp_server_3;
-static uint8_t _esp8266_ntp_last_server_used;
+//TRANSPORT SHARING RELATED
+//INSTANCE WHOSE EXCHANGE CURRENTLY OWNS THE UDP CLIENT, AND THE FIFO
+//OF INSTANCES WAITING FOR IT
+static ESP8266_NTP_CONTEXT* _esp8266_ntp_active_ctx;
+static ESP8266_NTP_CONTEXT* _esp8266_ntp_pending_head;
+static ESP8266_NTP_CONTEXT* _esp8266_ntp_pending_tail;
 
-//TIMEZONE RELATED
-static int8_t _esp8266_ntp_timezone_hr;
-static uint8_t _esp8266_ntp_timezone_min;
+//HEAD OF THE LIST OF LIVE INSTANCES, AND THE TIMER THAT KEEPS THEIR
+//CLOCKS READ WHILE ANY EXIST
+static ESP8266_NTP_CONTEXT* _esp8266_ntp_live_head;
+static os_timer_t _esp8266_ntp_tick_timer;
 
-//TIMER RELATED
-static uint16_t _esp8266_ntp_reply_timeout_ms;
+//NETWORK OPERATIONS IN USE. HOST BUILDS HAVE NO DEFAULT
+//ON DEVICE THE EXCHANGE GOES THROUGH ESP8266_UDP_CLIENT. THE QUERIES OF
+//A MULTI SERVER ROUND USE ONE espconn PER NAME LOOKUP, WHICH CARRIES
+//THE LOOKUP TO ITS DNS CALLBACK, AND ONE UDP espconn FOR ALL REQUESTS
+#ifndef ESP8266_NTP_HOST
+static struct espconn _esp8266_ntp_lookup_conn[NTP_MAX_SERVERS];
+static ip_addr_t _esp8266_ntp_lookup_ip[NTP_MAX_SERVERS];
+static void (*_esp8266_ntp_lookup_cb[NTP_MAX_SERVERS])(const char* hostname, ip_addr_t* ip, void* arg);
+static void* _esp8266_ntp_lookup_arg[NTP_MAX_SERVERS];
+static struct espconn _esp8266_ntp_query_conn;
+static esp_udp _esp8266_ntp_query_udp;
+static void (*_esp8266_ntp_query_recv_cb)(char* data, uint16_t length);
 
-//COUNTERS
-static uint8_t _esp8266_ntp_retry_count;
-static uint16_t _esp8266_ntp_cycle_count;
-static uint8_t _esp8266_ntp_total_server_count;
-static uint8_t _esp8266_ntp_server_counter;
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_set_debug(uint8_t debug_on)
+{
+    ESP8266_UDP_CLIENT_SetDebug(debug_on);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_set_dns_server(char num_dns, ip_addr_t* dns)
+{
+    ESP8266_UDP_CLIENT_SetDnsServer(num_dns, dns);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_set_callbacks(void (*sent_cb)(void* arg), void (*recv_cb)(char* data, uint16_t length))
+{
+    ESP8266_UDP_CLIENT_SetCallbackFunctions(sent_cb, recv_cb);
+    _esp8266_ntp_query_recv_cb = recv_cb;
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_initialize(char* hostname, char* host_ip, uint16_t port, uint32_t timeout_ms)
+{
+    ESP8266_UDP_CLIENT_Initialize(hostname, host_ip, port, timeout_ms);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_resolve(void (*resolved_cb)(ip_addr_t* ip))
+{
+    ESP8266_UDP_CLIENT_ResolveHostName(resolved_cb);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_send(uint8_t* data, uint16_t length)
+{
+    ESP8266_UDP_CLIENT_SendData(data, length);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_found(const char* hostname, ip_addr_t* ip, void* arg)
+{
+    //THE DNS CALLBACK ARGUMENT IS THE espconn OF THE LOOKUP SLOT
+
+    uint8_t i = (uint8_t)((struct espconn*)arg - _esp8266_ntp_lookup_conn);
+    void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg) = _esp8266_ntp_lookup_cb[i];
+
+    _esp8266_ntp_lookup_cb[i] = NULL;
+    if(found_cb != NULL)
+    {
+        (*found_cb)(hostname, ip, _esp8266_ntp_lookup_arg[i]);
+    }
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_lookup(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg)
+{
+    //espconn_gethostbyname ANSWERS FROM ITS CACHE AT ONCE (ESPCONN_OK) OR
+    //LATER THROUGH THE CALLBACK. WITH EVERY SLOT BUSY THE LOOKUP IS
+    //DROPPED AND THE LIBRARY TIMES IT OUT
+
+    uint8_t i;
+    err_t err;
+
+    for(i = 0; i < NTP_MAX_SERVERS; i++)
+    {
+        if(_esp8266_ntp_lookup_cb[i] == NULL)
+        {
+            break;
+        }
+    }
+    if(i == NTP_MAX_SERVERS)
+    {
+        return;
+    }
+
+    _esp8266_ntp_lookup_cb[i] = found_cb;
+    _esp8266_ntp_lookup_arg[i] = arg;
+    err = espconn_gethostbyname(&_esp8266_ntp_lookup_conn[i], hostname, &_esp8266_ntp_lookup_ip[i], _esp8266_ntp_udp_found);
+    if(err == ESPCONN_OK)
+    {
+        _esp8266_ntp_udp_found(hostname, &_esp8266_ntp_lookup_ip[i], &_esp8266_ntp_lookup_conn[i]);
+    }
+    else if(err != ESPCONN_INPROGRESS)
+    {
+        _esp8266_ntp_udp_found(hostname, NULL, &_esp8266_ntp_lookup_conn[i]);
+    }
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_udp_query_recv(void* arg, char* data, unsigned short length)
+{
+    (void)arg;
+    if(_esp8266_ntp_query_recv_cb != NULL)
+    {
+        (*_esp8266_ntp_query_recv_cb)(data, length);
+    }
+}
+
+static uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_udp_send_to(ip_addr_t* ip, uint16_t port, uint8_t* data, uint16_t length)
+{
+    //THE QUERY CONNECTION IS OPENED ON FIRST USE. espconn_sendto TAKES
+    //THE PEER FROM THE CONNECTION, SO IT IS SET FOR EVERY REQUEST
+
+    if(_esp8266_ntp_query_conn.proto.udp == NULL)
+    {
+        os_memset(&_esp8266_ntp_query_udp, 0, sizeof(esp_udp));
+        _esp8266_ntp_query_udp.local_port = espconn_port();
+        _esp8266_ntp_query_conn.type = ESPCONN_UDP;
+        _esp8266_ntp_query_conn.proto.udp = &_esp8266_ntp_query_udp;
+        espconn_regist_recvcb(&_esp8266_ntp_query_conn, _esp8266_ntp_udp_query_recv);
+        if(espconn_create(&_esp8266_ntp_query_conn) != ESPCONN_OK)
+        {
+            _esp8266_ntp_query_conn.proto.udp = NULL;
+            return 0;
+        }
+    }
+
+    os_memcpy(_esp8266_ntp_query_udp.remote_ip, &ip->addr, 4);
+    _esp8266_ntp_query_udp.remote_port = port;
+    return (espconn_sendto(&_esp8266_ntp_query_conn, data, length) == ESPCONN_OK);
+}
+
+static const ESP8266_NTP_TRANSPORT _esp8266_ntp_udp_transport = {
+                                        .set_debug = _esp8266_ntp_udp_set_debug,
+                                        .set_dns_server = _esp8266_ntp_udp_set_dns_server,
+                                        .initialize = _esp8266_ntp_udp_initialize,
+                                        .resolve = _esp8266_ntp_udp_resolve,
+                                        .set_callbacks = _esp8266_ntp_udp_set_callbacks,
+                                        .send = _esp8266_ntp_udp_send,
+                                        .rx_tick = NULL,
+                                        .lookup = _esp8266_ntp_udp_lookup,
+                                        .send_to = _esp8266_ntp_udp_send_to
+                                    };
+static const ESP8266_NTP_TRANSPORT* _esp8266_ntp_transport = &_esp8266_ntp_udp_transport;
+#else
+static const ESP8266_NTP_TRANSPORT* _esp8266_ntp_transport;
+#endif
+
+//PERSISTENT STORE IN USE. HOST BUILDS HAVE NO DEFAULT
+#ifndef ESP8266_NTP_HOST
+static uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_rtc_mem_read(void* buf, uint16_t size)
+{
+    return system_rtc_mem_read(NTP_STORE_RTC_BLOCK, buf, size) ? 1 : 0;
+}
+
+static uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_rtc_mem_write(const void* buf, uint16_t size)
+{
+    return system_rtc_mem_write(NTP_STORE_RTC_BLOCK, buf, size) ? 1 : 0;
+}
+
+static uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_rtc_now(uint32_t* ticks, uint32_t* period_q12)
+{
+    //RTC SLOW CLOCK CYCLES AND THEIR CALIBRATED PERIOD
+
+    *ticks = system_get_rtc_time();
+    *period_q12 = system_rtc_clock_cali_proc();
+    return 1;
+}
+
+static uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_rtc_kept(void)
+{
+    //ONLY A DEEP SLEEP WAKE IS KNOWN TO KEEP THE RTC TIMER RUNNING
+
+    return (system_get_rst_info()->reason == REASON_DEEP_SLEEP_AWAKE);
+}
+
+static const ESP8266_NTP_STORE _esp8266_ntp_rtc_store = {
+                                        .read = _esp8266_ntp_rtc_mem_read,
+                                        .write = _esp8266_ntp_rtc_mem_write,
+                                        .rtc_now = _esp8266_ntp_rtc_now,
+                                        .rtc_kept = _esp8266_ntp_rtc_kept
+                                    };
+static const ESP8266_NTP_STORE* _esp8266_ntp_store = &_esp8266_ntp_rtc_store;
+
+//RTC USER MEMORY IS BLOCKS 64 .. 191
+typedef char _esp8266_ntp_store_size_check[(NTP_STORE_RTC_BLOCK >= 64 &&
+                                            (NTP_STORE_RTC_BLOCK * 4) + sizeof(ESP8266_NTP_SNAPSHOT) <= 768) ? 1 : -1];
+#else
+static const ESP8266_NTP_STORE* _esp8266_ntp_store;
+#endif
+
+//SNTP SERVER LISTENER IN USE. HOST BUILDS HAVE NO DEFAULT
+#ifndef ESP8266_NTP_HOST
+static struct espconn _esp8266_ntp_serve_conn;
+static esp_udp _esp8266_ntp_serve_udp;
+static void (*_esp8266_ntp_serve_conn_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick);
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_espconn_recv_cb(void* arg, char* data, unsigned short length)
+{
+    //STAMP THE ARRIVAL FIRST. THE PEER ADDRESS IS ONLY AVAILABLE FROM
+    //INSIDE THE RECEIVE CALLBACK, SO THE REPLY GOES OUT FROM IT TOO
+
+    uint32_t rx_tick = system_get_time();
+    struct espconn* conn = (struct espconn*)arg;
+    remot_info* peer = NULL;
+
+    if(espconn_get_connection_info(conn, &peer, 0) != ESPCONN_OK || peer == NULL)
+    {
+        return;
+    }
+    os_memcpy(conn->proto.udp->remote_ip, peer->remote_ip, 4);
+    conn->proto.udp->remote_port = peer->remote_port;
+    _esp8266_ntp_serve_conn_cb(data, length, conn, rx_tick);
+}
+
+static uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_espconn_open(uint16_t port, void (*recv_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick))
+{
+    os_memset(&_esp8266_ntp_serve_conn, 0, sizeof(struct espconn));
+    os_memset(&_esp8266_ntp_serve_udp, 0, sizeof(esp_udp));
+    _esp8266_ntp_serve_udp.local_port = port;
+    _esp8266_ntp_serve_conn.type = ESPCONN_UDP;
+    _esp8266_ntp_serve_conn.proto.udp = &_esp8266_ntp_serve_udp;
+    _esp8266_ntp_serve_conn_cb = recv_cb;
+
+    espconn_regist_recvcb(&_esp8266_ntp_serve_conn, _esp8266_ntp_espconn_recv_cb);
+    return (espconn_create(&_esp8266_ntp_serve_conn) == ESPCONN_OK);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_espconn_close(void)
+{
+    espconn_delete(&_esp8266_ntp_serve_conn);
+}
+
+static void ICACHE_FLASH_ATTR _esp8266_ntp_espconn_reply(void* peer, uint8_t* data, uint16_t length)
+{
+    espconn_sendto((struct espconn*)peer, data, length);
+}
+
+static const ESP8266_NTP_LISTENER _esp8266_ntp_espconn_listener = {
+                                        .open = _esp8266_ntp_espconn_open,
+                                        .close = _esp8266_ntp_espconn_close,
+                                        .reply = _esp8266_ntp_espconn_reply
+                                    };
+static const ESP8266_NTP_LISTENER* _esp8266_ntp_listener = &_esp8266_ntp_espconn_listener;
+#else
+static const ESP8266_NTP_LISTENER* _esp8266_ntp_listener;
+#endif
+
+//SNTP SERVER RELATED
+//ONE LISTENER SERVES THE CLOCK OF ONE INSTANCE. THE REPLY TEMPLATE IS
+//REBUILT ONCE A SECOND (OR AFTER A SYNC) AND ONLY PATCHED PER REQUEST
+static ESP8266_NTP_CONTEXT* _esp8266_ntp_serve_ctx;
+static uint8_t _esp8266_ntp_serve_template[NTP_PACKET_SIZE];
+static uint8_t _esp8266_ntp_serve_li_mode;
+static uint8_t _esp8266_ntp_serve_valid;
+static uint8_t _esp8266_ntp_serve_fit;
+static uint32_t _esp8266_ntp_serve_sec;
+static ESP8266_NTP_SERVE_STATS _esp8266_ntp_serve_stats;
+
+//LOG RING RELATED
+//SINGLE PRODUCER (LIBRARY) / SINGLE CONSUMER (LogRead). EACH SIDE ONLY
+//WRITES ITS OWN INDEX SO NO LOCK IS NEEDED
+#if NTP_LOG_LEVEL > NTP_LOG_LEVEL_NONE
+static ESP8266_NTP_LOG_RECORD _esp8266_ntp_log_ring[NTP_LOG_RING_SIZE];
+static volatile uint16_t _esp8266_ntp_log_head;
+static volatile uint16_t _esp8266_ntp_log_tail;
+static uint32_t _esp8266_ntp_log_dropped;
 
-//CALLBACK FUNCTION VARIABLES
-static void (*_esp8266_ntp_data_ready_user_cb)(ESP8266_NTP_DATA*, uint16_t);
-static void (*_esp8266_ntp_alarm_cb)(void);
+typedef char _esp8266_ntp_log_ring_size_check[((NTP_LOG_RING_SIZE & (NTP_LOG_RING_SIZE - 1)) == 0) ? 1 : -1];
+#endif
+
+//SOFTWARE CLOCK RELATED
+static uint32_t (*_esp8266_ntp_tick_us_fn)(void) = system_get_time;
 
 //NTP TIME RELATED
-static const char _esp8266_ntp_days_in_month[] = {
-                                                    31, //MARCH
-                                                    30, //APRIL
-                                                    31, //MAY
-                                                    30, //JUNE
-                                                    31, //JULY
-                                                    31, //AUGUST
-                                                    30, //SEPTEMBER
-                                                    31, //OCTOBER
-                                                    30, //NOVEMBER
-                                                    31, //DECEMBER
-                                                    31, //JANUARY
-                                                    29	//FEBRUARY
-							                    };
-							                    
+
+static const uint8_t _esp8266_ntp_days_in_month[12] = {
+                                                        31, //JANUARY
+                                                        28, //FEBRUARY (29 IN LEAP YEARS)
+                                                        31, //MARCH
+                                                        30, //APRIL
+                                                        31, //MAY
+                                                        30, //JUNE
+                                                        31, //JULY
+                                                        31, //AUGUST
+                                                        30, //SEPTEMBER
+                                                        31, //OCTOBER
+                                                        30, //NOVEMBER
+                                                        31  //DECEMBER
+                                                      };
+
 static const char* _esp8266_ntp_month_names[12] =   {   
                                                         "January",
                                                         "February",
@@ -75,19 +339,19 @@ static const char* _esp8266_ntp_month_names[12] =   {
                                                         "December"
 								                    };
 
-static const uint8_t esp8266_ntp_month_names_length[12] = {
+static const uint8_t _esp8266_ntp_month_names_length[12] = {
+                                                            7,	//JANUARY
+                                                            8,	//FEBRUARY
                                                             5,	//MARCH
                                                             5,	//APRIL
                                                             3,	//MAY
                                                             4,	//JUNE
-                                                            4, //JULY
-                                                            6,	//AUG
-                                                            9,	//SEPT
-                                                            7,	//OCT
-                                                            8,	//NOV
-                                                            8,	//DEC
-                                                            7,	//JAN
-                                                            8	//FEB
+                                                            4,	//JULY
+                                                            6,	//AUGUST
+                                                            9,	//SEPTEMBER
+                                                            7,	//OCTOBER
+                                                            8,	//NOVEMBER
+                                                            8	//DECEMBER
 									                      };
 
 static const char* _esp8266_ntp_day_names[7] =   {
@@ -100,337 +364,4444 @@ static const char* _esp8266_ntp_day_names[7] =   {
                                                     "Saturday"
                                                  };
 
-static const uint8_t esp8266_ntp_day_names_length[7] = {
+static const uint8_t _esp8266_ntp_day_names_length[7] = {
                                                             6,  //SUNDAY
                                                             6,  //MONDAY
                                                             7,  //TUESDAY
-                                                            9,  //WENESDAY
+                                                            9,  //WEDNESDAY
                                                             8,  //THURSDAY
                                                             6,  //FRIDAY
                                                             8   //SATURDAY
                                                        };
 
+//TIME FORMAT RELATED
+//"00" ... "99" : TWO DIGIT FIELDS ARE ONE LOOKUP
+static const char _esp8266_ntp_digit_pairs[201] =
+                                                    "0001020304050607080910111213141516171819"
+                                                    "2021222324252627282930313233343536373839"
+                                                    "4041424344454647484950515253545556575859"
+                                                    "6061626364656667686970717273747576777879"
+                                                    "8081828384858687888990919293949596979899";
+
+static const uint32_t _esp8266_ntp_pow10[7] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+#define _NTP_FMT_2(p, v)    do { (p)[0] = _esp8266_ntp_digit_pairs[2 * (v)]; \
+                                 (p)[1] = _esp8266_ntp_digit_pairs[(2 * (v)) + 1]; } while(0)
+
+//SYNC STATE MACHINE TRANSITION TABLE
+//[STATE][EVENT] -> NEXT STATE + ACTION. EVENTS WITHOUT AN ENTRY
+//(NULL ACTION) ARE IGNORED IN THAT STATE
+#define _NTP_T(next, action)    { ESP8266_NTP_SYNC_##next, _esp8266_ntp_act_##action }
+
+static const ESP8266_NTP_TRANSITION _esp8266_ntp_sync_table[ESP8266_NTP_SYNC_STATE_COUNT][ESP8266_NTP_EV_COUNT] = {
+    [ESP8266_NTP_SYNC_IDLE] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(QUEUED, queue),
+    },
+    [ESP8266_NTP_SYNC_QUEUED] = {
+        [ESP8266_NTP_EV_GRANTED]    = _NTP_T(WAITING, begin),
+        [ESP8266_NTP_EV_CANCEL]     = _NTP_T(IDLE, cancel),
+    },
+    [ESP8266_NTP_SYNC_WAITING] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(WAITING, requeue),
+        [ESP8266_NTP_EV_CANCEL]     = _NTP_T(IDLE, cancel),
+        [ESP8266_NTP_EV_DUE]        = _NTP_T(RESOLVING, query),
+        [ESP8266_NTP_EV_ROUND]      = _NTP_T(GATHERING, round),
+        [ESP8266_NTP_EV_COMPLETE]   = _NTP_T(DONE, done),
+        [ESP8266_NTP_EV_GIVE_UP]    = _NTP_T(FAILED, give_up),
+    },
+    [ESP8266_NTP_SYNC_RESOLVING] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(RESOLVING, requeue),
+        [ESP8266_NTP_EV_CANCEL]     = _NTP_T(IDLE, cancel),
+        [ESP8266_NTP_EV_RESOLVED]   = _NTP_T(SENT, send),
+        [ESP8266_NTP_EV_FAIL]       = _NTP_T(WAITING, retry),
+    },
+    [ESP8266_NTP_SYNC_SENT] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(SENT, requeue),
+        [ESP8266_NTP_EV_CANCEL]     = _NTP_T(IDLE, cancel),
+        [ESP8266_NTP_EV_SENT]       = _NTP_T(AWAITING, sent),
+        [ESP8266_NTP_EV_REPLY]      = _NTP_T(WAITING, sample),
+        [ESP8266_NTP_EV_FAIL]       = _NTP_T(WAITING, retry),
+    },
+    [ESP8266_NTP_SYNC_AWAITING] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(AWAITING, requeue),
+        [ESP8266_NTP_EV_CANCEL]     = _NTP_T(IDLE, cancel),
+        [ESP8266_NTP_EV_REPLY]      = _NTP_T(WAITING, sample),
+        [ESP8266_NTP_EV_FAIL]       = _NTP_T(WAITING, retry),
+    },
+    [ESP8266_NTP_SYNC_DONE] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(QUEUED, queue),
+    },
+    [ESP8266_NTP_SYNC_FAILED] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(QUEUED, queue),
+    },
+    [ESP8266_NTP_SYNC_GATHERING] = {
+        [ESP8266_NTP_EV_START]      = _NTP_T(GATHERING, requeue),
+        [ESP8266_NTP_EV_CANCEL]     = _NTP_T(IDLE, cancel),
+        [ESP8266_NTP_EV_ROUND]      = _NTP_T(GATHERING, round),
+        [ESP8266_NTP_EV_COMPLETE]   = _NTP_T(DONE, done),
+        [ESP8266_NTP_EV_GIVE_UP]    = _NTP_T(FAILED, give_up),
+    },
+};
+
+#undef _NTP_T
+
+//COMPILE TIME CHECK THAT THE HEADER VIEW MATCHES THE WIRE FORMAT
+typedef char _esp8266_ntp_header_size_check[(sizeof(ESP8266_NTP_HEADER) == NTP_PACKET_SIZE) ? 1 : -1];
+
+//ALARM IDS AND LINKS ARE 16 BIT
+typedef char _esp8266_ntp_alarm_pool_check[(NTP_MAX_ALARMS > 0 && NTP_MAX_ALARMS <= 0xFFFF) ? 1 : -1];
+
 //END LOCAL LIBRARY VARIABLES/////////////////////////////
 
 void ICACHE_FLASH_ATTR ESP8266_NTP_SetDebug(uint8_t debug_on)
 {
-    //SET DEBUG PRINTF ON(1) OR OFF(0)
-    
+    //SET THE TRANSPORT DEBUG PRINTF ON(1) OR OFF(0). THE LIBRARY ITSELF
+    //ONLY WRITES LOG RECORDS (SEE NTP_LOG_PRINT)
+
     _esp8266_ntp_debug = debug_on;
+    if(_esp8266_ntp_transport != NULL)
+    {
+        _esp8266_ntp_transport->set_debug(debug_on);
+    }
 }
 
-void ICACHE_FLASH_ATTR ESP8266_NTP_Initialize(char* server1,
-                                                	char* server2,
-													char* server3,
-													int8_t timezone_hr,
-													uint8_t timezone_min,
-													uint16_t ntp_timeout_ms)
+void ICACHE_FLASH_ATTR ESP8266_NTP_Create(ESP8266_NTP_CONTEXT* ctx,
+                                            char* server1,
+                                            char* server2,
+                                            char* server3,
+                                            int8_t timezone_hr,
+                                            uint8_t timezone_min,
+                                            uint16_t ntp_timeout_ms)
 {
-    //SET THE NTP CONFIGURATION PARAMETERS
-    
-    _esp8266_ntp_server_1 = server1;
-    _esp8266_ntp_server_2 = server2;
-    _esp8266_ntp_server_3 = server3;
-    
-    _esp8266_ntp_timezone_hr = timezone_hr;
-    _esp8266_ntp_timezone_min = timezone_min;
-    
-    _esp8266_ntp_reply_timeout_ms = ntp_timeout_ms;
+    //SET UP AN NTP CLIENT INSTANCE IN ZERO INITIALIZED CALLER STORAGE
+    //SAFE TO CALL AGAIN ON THE SAME CONTEXT TO RECONFIGURE IT.
+    //THE SOFTWARE CLOCK, DISCIPLINE AND DNS CACHE ARE KEPT
 
-    //CALCULATE TOTAL SERVER COUNT
-    if(server1 == NULL)
-    {
-    	_esp8266_ntp_total_server_count = 0;
-    	os_printf("ESP8266 : NTP : Error - must configure atleast 1 NTP server\n");
-    }
-    else if(server2 == NULL)
+    if(!ctx->created)
     {
-    	//ASSUMES SERVER2 AND SERVER3 NULL
-    	_esp8266_ntp_total_server_count = 1;
+        ctx->poll_exp = NTP_MIN_POLL_EXP;
+        ctx->dns_cache_ttl_s = NTP_DNS_CACHE_TTL_S;
+        ctx->clock_sec = NTP_ERA_PIVOT;
+        ctx->leap_smear_s = NTP_LEAP_SMEAR_S;
+        ctx->sync_threshold_us = NTP_SYNC_THRESHOLD_US;
+        ctx->created = 1;
+        _esp8266_ntp_live_add(ctx);
     }
-    else if(server3 == NULL)
+
+    ctx->timezone_hr = timezone_hr;
+    ctx->timezone_min = timezone_min;
+
+    //MINUTES TAKE THE SIGN OF THE HOUR (-3, 30 IS UTC-03:30)
+    //ESP8266_NTP_SetTimeZone REPLACES THIS WITH A FULL RULE
+    _esp8266_ntp_tz_fixed(&ctx->tz, ((int32_t)timezone_hr * 3600) +
+                            ((timezone_hr < 0) ? -(int32_t)timezone_min : (int32_t)timezone_min) * 60);
+    
+    ctx->reply_timeout_ms = ntp_timeout_ms;
+
+    //(RE)CONFIGURED SERVERS START WITHOUT BACKOFF OR KOD RESTRICTIONS
+    //A NULL SERVER ENDS THE LIST. MORE CAN BE ADDED WITH AddServer
+    ctx->total_server_count = 0;
+    if(server1 == NULL)
     {
-    	_esp8266_ntp_total_server_count = 2;
+    	NTP_LOG_ERROR(NO_SERVER, 0, 0, 0);
     }
     else
     {
-    	_esp8266_ntp_total_server_count = 3;
+        _esp8266_ntp_add_server(ctx, server1);
+        if(server2 != NULL)
+        {
+            _esp8266_ntp_add_server(ctx, server2);
+            if(server3 != NULL)
+            {
+                _esp8266_ntp_add_server(ctx, server3);
+            }
+        }
     }
 
-    //ALLOCATE AND INITIALIZE NTP DATA STRUCTURE
-    _esp8266_ntp_data = (ESP8266_NTP_DATA*)os_zalloc(sizeof(ESP8266_NTP_DATA));
-    
-    //ALLOCATE NTP DATA PACKET
-    _esp8266_ntp_data_packet = (uint8_t*)os_zalloc(NTP_PACKET_SIZE);
-    _esp8266_ntp_data_packet[0] = 0x1B;
+    //INITIALIZE NTP DATA STRUCTURE (CONTEXT STORAGE, SAFE TO REPEAT)
+    os_memset(&ctx->data, 0, sizeof(ESP8266_NTP_DATA));
+    ctx->data.leap = (ESP8266_NTP_LEAP)ctx->leap;
+    ctx->fields_valid = 0;
+
+    //INITIALIZE NTP DATA PACKET
+    os_memset(ctx->data_packet, 0, NTP_PACKET_SIZE);
+    ((ESP8266_NTP_HEADER*)ctx->data_packet)->li_vn_mode = NTP_LI_VN_MODE(0, NTP_VERSION, NTP_MODE_CLIENT);
 
     //SET INITIAL ESP8266 NTP STATUS
-    _esp8266_ntp_data->state = ESP8266_NTP_STATE_OK;
-    _esp8266_ntp_data->timestamp = 0;
+    ctx->data.state = ESP8266_NTP_STATE_OK;
+    ctx->data.timestamp = 0;
     
     //INITIALIZE UDP PARAMETERS
-    ESP8266_UDP_CLIENT_SetDebug(_esp8266_ntp_debug);
-    
-    ip_addr_t dns[2];
-    dns[0].addr = ipaddr_addr("8.8.8.8");
-    dns[0].addr = ipaddr_addr("8.8.4.4");
-    ESP8266_UDP_CLIENT_SetDnsServer(2, dns);
-    
-    //SET UDP DATA CALLBACK FUNCTION
-    ESP8266_UDP_CLIENT_SetCallbackFunctions(_esp8266_ntp_udp_data_sent_cb,
-    											_esp8266_ntp_udp_data_recv_cb);
+    _esp8266_ntp_transport_setup();
 }
 
-void ICACHE_FLASH_ATTR ESP8266_NTP_SetCallbackFunctions(void (*user_data_ready_cb)(ESP8266_NTP_DATA*, uint16_t),
-                                                            void (*user_alarm_cb)())
+void ICACHE_FLASH_ATTR ESP8266_NTP_Destroy(ESP8266_NTP_CONTEXT* ctx)
 {
-    //SET THE LIBRARY CALLBACK FUNCTION POINTERS
-    _esp8266_ntp_data_ready_user_cb = user_data_ready_cb;
-    _esp8266_ntp_alarm_cb = user_alarm_cb;
-}
+    //STOP AN NTP CLIENT INSTANCE. ANY SYNC IT HAS IN FLIGHT OR QUEUED
+    //IS DROPPED AND ITS STORAGE MAY BE REUSED AFTERWARDS
 
-int8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneHour(void)
-{
-    //RETURN NTP TIMEZONE HOUR
-    
-    return _esp8266_ntp_timezone_hr;
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_CANCEL);
+    os_timer_disarm(&ctx->poll_timer);
+    ctx->sync_state = ESP8266_NTP_SYNC_IDLE;
+
+    //ALL ALARMS ARE DROPPED
+    os_timer_disarm(&ctx->alarm_timer);
+    os_memset(ctx->alarms, 0, sizeof(ctx->alarms));
+    os_memset(ctx->alarm_lists, 0, sizeof(ctx->alarm_lists));
+    ctx->alarm_free = 0;
+    ctx->alarm_used = 0;
+    ctx->alarm_count = 0;
+    ctx->alarm_running = 0;
+    ctx->alarm_armed = 0;
+
+    if(_esp8266_ntp_serve_ctx == ctx)
+    {
+        ESP8266_NTP_ServeStop();
+    }
+
+    if(ctx->created)
+    {
+        _esp8266_ntp_live_remove(ctx);
+    }
+    ctx->created = 0;
 }
 
-uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneMinute(void)
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetServersCtx(ESP8266_NTP_CONTEXT* ctx, char** servers, uint8_t count)
 {
-    //RETURN NTP TIMEZONE MINUTE
-    
-    return _esp8266_ntp_timezone_min;
+    uint8_t i;
+
+    //REPLACE THE NTP SERVER LIST OF AN INSTANCE WITH count
+    //HOSTNAMES (UPTO NTP_MAX_SERVERS). A RUNNING SYNC IS CANCELLED
+    //AND THE DNS CACHE FLUSHED
+
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_CANCEL);
+    os_memset(ctx->dns_cache, 0, sizeof(ctx->dns_cache));
+    ctx->total_server_count = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        if(!_esp8266_ntp_add_server(ctx, servers[i]))
+        {
+            break;
+        }
+    }
 }
 
-uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastNTPServerUsedNumber(void)
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AddServerCtx(ESP8266_NTP_CONTEXT* ctx, char* server)
 {
-    //RETURN THE INDEX NUMBER OF THE NTP TIMESERVER USED
-    //FOR THE LAST NTP TIME TRANSACTION (1, 2 OR 3))
-    
-    return _esp8266_ntp_last_server_used;
+    //APPEND AN NTP SERVER HOSTNAME TO THE LIST OF AN INSTANCE
+    //RETURNS 0 IF THE LIST ALREADY HOLDS NTP_MAX_SERVERS
+
+    return _esp8266_ntp_add_server(ctx, server);
 }
 
-ESP8266_NTP_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetState(void)
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_add_server(ESP8266_NTP_CONTEXT* ctx, char* server)
 {
-    //RETURN ESP8266 NTP STATE VARIABLE
-    
-    return _esp8266_ntp_data->state;
+    //APPEND A SERVER WITH A CLEAN CACHE / SCHEDULER SLOT
+
+    uint8_t n = ctx->total_server_count;
+
+    if(n >= NTP_MAX_SERVERS)
+    {
+        NTP_LOG_ERROR(MAX_SERVERS, n, NTP_MAX_SERVERS, 0);
+        return 0;
+    }
+
+    ctx->servers[n] = server;
+    os_memset(&ctx->sched[n], 0, sizeof(ESP8266_NTP_SERVER_SCHED));
+    os_memset(&ctx->samples[n], 0, sizeof(ESP8266_NTP_SAMPLE));
+    os_memset(&ctx->filters[n], 0, sizeof(ESP8266_NTP_FILTER));
+    os_memset(&ctx->server_stats[n], 0, sizeof(ESP8266_NTP_SERVER_STATS));
+    ctx->total_server_count = n + 1;
+    return 1;
 }
 
-ESP8266_NTP_DATA* ICACHE_FLASH_ATTR ESP8266_NTP_GetNTPDataStrcuture(void)
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetCallbackFunctionsCtx(ESP8266_NTP_CONTEXT* ctx,
+                                                            void (*user_data_ready_cb)(ESP8266_NTP_CONTEXT*, ESP8266_NTP_DATA*, uint16_t, void*),
+                                                            void* user_arg)
 {
-    //RETURN ESP8266 NTP DATA STRUCTURE
-    
-    return _esp8266_ntp_data;
+    //SET THE PER INSTANCE DATA READY CALLBACK AND ITS USER POINTER
+
+    ctx->data_ready_ctx_cb = user_data_ready_cb;
+    ctx->user_arg = user_arg;
 }
 
-void ICACHE_FLASH_ATTR ESP8266_NTP_GetTime(void)
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetTickSource(uint32_t (*tick_us_fn)(void))
 {
-    //SEND NTP PACKET TO NTP SERVER THROUGH UDP
-    //SET UDP DATA RECEIVE CALLBACK FUNCTION
-    //START NTP REPLY TIMER
-    
-    //SET THE NTP SERVER COUNTER
-    _esp8266_ntp_server_counter = 1;
-    _esp8266_ntp_retry_count = 0;
-    
-    if(_esp8266_ntp_debug)
+    ESP8266_NTP_CONTEXT* ctx;
+
+    //SET THE MONOTONIC MICROSECOND TICK SOURCE USED BY THE SOFTWARE CLOCK
+    //OF ALL INSTANCES. DEFAULTS TO system_get_time. NULL RESTORES THE
+    //DEFAULT. EVERY LIVE CLOCK IS BROUGHT UP TO DATE ON THE OLD SOURCE
+    //AND THEN REFERENCED TO THE NEW ONE, SO NONE OF THEM JUMPS
+
+    for(ctx = _esp8266_ntp_live_head; ctx != NULL; ctx = ctx->next_live)
     {
-        os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_1);
+        _esp8266_ntp_clock_advance(ctx);
+    }
+
+    _esp8266_ntp_tick_us_fn = (tick_us_fn != NULL) ? tick_us_fn : system_get_time;
+
+    for(ctx = _esp8266_ntp_live_head; ctx != NULL; ctx = ctx->next_live)
+    {
+        ctx->clock_ref_tick = _esp8266_ntp_tick_us_fn();
     }
-    
-    //SELECT NTP SERVER 1 AND START DNS RESOLVE
-    ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_1, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-    ESP8266_UDP_CLIENT_ResolveHostName(_esp8266_ntp_server_resolved_cb);
 }
 
-void ICACHE_FLASH_ATTR _esp8266_ntp_convert_time_to_text(void)
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetTransport(const ESP8266_NTP_TRANSPORT* transport)
 {
-	//CONVERT NTP TIMESTAMP TO HUMAN READABLE TIME TEXT
-	//AND SAVE IN GLOBAL TIME STRUCTURE
+    //SET THE NETWORK OPERATIONS USED BY ALL INSTANCES. NULL RESTORES
+    //ESP8266_UDP_CLIENT (NO DEFAULT ON HOST BUILDS). MUST NOT BE CALLED
+    //WHILE AN EXCHANGE IS IN FLIGHT
 
-	//	YEAR	(BASE 2000)
-	//	MONTH 	(JANUARY = 1)
-	//	DATE 	(1 - 28 or 30/31 (MONTH DEPENDENT)
-	//	WEEKDAY	(SUNDAY = 0)
-	//	HOUR	(24 HOUR BASED)
-	//	MINUTE
-	//	SECOND
+#ifndef ESP8266_NTP_HOST
+    _esp8266_ntp_transport = (transport != NULL) ? transport : &_esp8266_ntp_udp_transport;
+#else
+    _esp8266_ntp_transport = transport;
+#endif
+    if(_esp8266_ntp_transport != NULL)
+    {
+        _esp8266_ntp_transport_setup();
+    }
+}
 
-	//UTC OFFSET FOR USER SPECIFIED TIMEZONE
-	int32_t timezone_offset_seconds = (_esp8266_ntp_timezone_hr * 3600) + (_esp8266_ntp_timezone_min * 60);
-	uint32_t secs = _esp8266_ntp_data->timestamp;
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetStore(const ESP8266_NTP_STORE* store)
+{
+    //SET THE PERSISTENT STORE USED FOR WARM STARTS BY ALL INSTANCES
+    //NULL RESTORES RTC USER MEMORY (NO STORE ON HOST BUILDS)
 
-	secs += timezone_offset_seconds;
-	secs -= LEAPOCH;
+#ifndef ESP8266_NTP_HOST
+    _esp8266_ntp_store = (store != NULL) ? store : &_esp8266_ntp_rtc_store;
+#else
+    _esp8266_ntp_store = store;
+#endif
+}
 
-	uint32_t days = (secs / 86400);
-	uint32_t rem_secs = (secs % 86400);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetSyncThresholdCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t max_error_us)
+{
+    //SET THE ERROR BOUND (US) ABOVE WHICH ESP8266_NTP_SyncIfNeeded
+    //STARTS A NETWORK SYNC ON AN INSTANCE
 
-	if(rem_secs < 0)
-	{
-		rem_secs += 86400;
-		days--;
-	}
+    ctx->sync_threshold_us = max_error_us;
+}
 
-	uint8_t wday = (days % 7) + 3;
-	if(wday > 7)
-	{
-		wday -= 7;
-	}
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetEraPivotCtx(ESP8266_NTP_CONTEXT* ctx, uint64_t seconds)
+{
+    //SET THE ERA EXTENDED TIME THE FIRST SYNC IS DISAMBIGUATED AGAINST
+    //(E.G. A TIME SAVED IN RTC MEMORY). IGNORED ONCE THE CLOCK IS SYNCED
 
-	uint32_t _400y_cycles = days / DAYS_PER_400Y;
-	uint32_t rem_days = days % DAYS_PER_400Y;
+    if(ctx->clock_valid)
+    {
+        return;
+    }
+    ctx->clock_ref_tick = _esp8266_ntp_tick_us_fn();
+    ctx->clock_sec = seconds;
+    ctx->clock_usec = 0;
+}
 
-	if(rem_days < 0)
-	{
-		rem_days += DAYS_PER_400Y;
-		_400y_cycles--;
-	}
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetLeapModeCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_LEAP_MODE mode, uint32_t smear_s)
+{
+    //SET HOW AN ANNOUNCED LEAP SECOND IS APPLIED TO THE SOFTWARE CLOCK
+    //smear_s IS THE SMEAR WINDOW (0 = NTP_LEAP_SMEAR_S). TAKES EFFECT
+    //FOR THE NEXT LEAP, ONE ALREADY BEING APPLIED IS SEEN THROUGH
 
-	uint32_t _100y_cycles = rem_days / DAYS_PER_100Y;
-	if(_100y_cycles == 4)
-	{
-		_100y_cycles--;
-	}
+    if(ctx->leap_applied_us != 0)
+    {
+        return;
+    }
+    ctx->leap_mode = mode;
+    ctx->leap_smear_s = (smear_s != 0) ? smear_s : NTP_LEAP_SMEAR_S;
+}
 
-	rem_days -= (_100y_cycles * DAYS_PER_100Y);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SetTimeZoneCtx(ESP8266_NTP_CONTEXT* ctx, const char* tz)
+{
+    //SET THE TIME ZONE OF AN INSTANCE FROM A POSIX TZ STRING
+    //  std offset [dst [offset] [,start[/time],end[/time]]]
+    //E.G. "EST5EDT,M3.2.0,M11.1.0", "<+0330>-3:30", "NZST-12NZDT,M9.5.0,M4.1.0/3"
+    //RETURNS 0 (ZONE UNCHANGED) IF THE STRING DOES NOT PARSE.
+    //CALL AFTER ESP8266_NTP_Create, WHICH SETS A FIXED ZONE
 
-	uint32_t _4y_cycles = rem_days / DAYS_PER_4Y;
-	if(_4y_cycles == 25)
-	{
-		_4y_cycles--;
-	}
+    if(tz == NULL || !_esp8266_ntp_tz_parse(&ctx->tz, tz))
+    {
+        return 0;
+    }
 
-	rem_days -= (_4y_cycles * DAYS_PER_4Y);
+    if(ctx->fields_valid)
+    {
+        _esp8266_ntp_convert_time_to_text(ctx);
+    }
+    return 1;
+}
 
-	uint32_t rem_years = rem_days / 365;
-	if(rem_years == 4)
-	{
-		rem_years --;
-	}
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetAutoSyncCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t enable)
+{
+    //ENABLE(1) / DISABLE(0) AUTOMATIC RESYNC AT THE DISCIPLINE
+    //POLL INTERVAL AFTER EACH COMPLETED SYNC
 
-	rem_days -= (rem_years * 365);
+    ctx->auto_sync = enable;
+    os_timer_disarm(&ctx->poll_timer);
+    if(enable)
+    {
+        os_timer_setfn(&ctx->poll_timer, _esp8266_ntp_poll_timer_cb, ctx);
+    }
+}
 
-	uint16_t leap = !rem_years && (_4y_cycles || !_100y_cycles);
-	uint16_t yday = rem_days + 31 + 28 + leap;
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetDnsCacheTTLCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t ttl_s)
+{
+    //SET HOW LONG (SECONDS) A RESOLVED SERVER ADDRESS IS USED BEFORE
+    //IT IS RE-RESOLVED. 0 DISABLES THE CACHE
 
-	if(yday > (365 + leap))
-	{
-		yday -= (365 + leap);
-	}
+    ctx->dns_cache_ttl_s = ttl_s;
+}
 
-	uint32_t years = rem_years + (4 * _4y_cycles) + (100 * _100y_cycles) + (400 * _400y_cycles);
-	uint8_t months;
+void ICACHE_FLASH_ATTR ESP8266_NTP_FlushDnsCacheCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //INVALIDATE ALL RESOLVED SERVER ADDRESSES
 
-	for(months = 0; _esp8266_ntp_days_in_month[months] <= rem_days; months++)
-	{
-		rem_days -= _esp8266_ntp_days_in_month[months];
-	}
+    os_memset(ctx->dns_cache, 0, sizeof(ctx->dns_cache));
+}
 
-	_esp8266_ntp_data->year = years;
-	_esp8266_ntp_data->month_num = months + 3;
-	if(_esp8266_ntp_data->month_num > 12)
-	{
-		_esp8266_ntp_data->month_num -= 12;
-		_esp8266_ntp_data->year++;
-	}
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetMultiServerModeCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t enable)
+{
+    //ENABLE(1) / DISABLE(0) MULTI SERVER MODE
+    //IN MULTI SERVER MODE EVERY SYNC QUERIES ALL CONFIGURED SERVERS AT
+    //ONCE AND SELECTS THE RESULT BY INTERSECTION, DROPPING FALSETICKERS.
+    //IT NEEDS A TRANSPORT WITH lookup AND send_to. WITHOUT THEM A SYNC
+    //FAILS OVER FROM SERVER TO SERVER AS IF IT WERE OFF
 
-	//ADD 2000 TO YEAR SINCE OUT CALCULATED YEAR IS BASE 2000
-	_esp8266_ntp_data->year += 2000;
+    ctx->multi_server = enable;
+}
 
-	_esp8266_ntp_data->date = rem_days + 1;
-	_esp8266_ntp_data->day_num = wday;
-	_esp8266_ntp_data->hour = rem_secs / 3600;
-	_esp8266_ntp_data->min = (rem_secs / 60) % 60;
-	_esp8266_ntp_data->sec = rem_secs % 60;
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetBurstCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t count)
+{
+    //QUERY EVERY SERVER count TIMES ON THE FIRST SYNC, SO ITS CLOCK
+    //FILTER STARTS FROM THE BEST OF SEVERAL SAMPLES. 0 OR 1 DISABLES
+    //CAPPED AT NTP_FILTER_STAGES
 
-	//SET THE DAY AND MONTH TEXT STRING POINTERS
-	_esp8266_ntp_data->day_text = _esp8266_ntp_day_names[_esp8266_ntp_data->day_num];
-	_esp8266_ntp_data->month_text = _esp8266_ntp_month_names[(_esp8266_ntp_data->month_num - 1)];
+    ctx->burst = (count > NTP_FILTER_STAGES) ? NTP_FILTER_STAGES : count;
 }
 
-void ICACHE_FLASH_ATTR _esp8266_ntp_server_resolved_cb(ip_addr_t* ip)
+int8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneHourCtx(ESP8266_NTP_CONTEXT* ctx)
 {
-    //ESP8266 NTP SERVER DNS RESOLVED CB
+    //RETURN NTP TIMEZONE HOUR
     
-    //CHECK IF DNS RESOLUTION SUCCESSFULL
-    if(ip != NULL)
-    {
-        //DNS RESOLUTION SUCCESSFULL
-        if(_esp8266_ntp_debug)
-        {
-            os_printf("ESP8266 : NTP : Dns resolution OK\n");
-        }
-                
-        //SEND UDP DATA
-        ESP8266_UDP_CLIENT_SendData(_esp8266_ntp_data_packet, NTP_PACKET_SIZE);
+    return ctx->timezone_hr;
+}
 
-    }
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneMinuteCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN NTP TIMEZONE MINUTE
+    
+    return ctx->timezone_min;
+}
+
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetUtcOffsetCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN LOCAL TIME - UTC IN SECONDS AT THE CURRENT TIME (DST AWARE)
+
+    _esp8266_ntp_clock_advance(ctx);
+    return _esp8266_ntp_tz_offset(&ctx->tz, ctx->clock_sec);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastNTPServerUsedNumberCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE INDEX NUMBER OF THE NTP TIMESERVER USED
+    //FOR THE LAST NTP TIME TRANSACTION (1 BASED)
+    
+    return ctx->last_server_used;
+}
+
+ESP8266_NTP_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetStateCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN ESP8266 NTP STATE VARIABLE
+    
+    return ctx->data.state;
+}
+
+ESP8266_NTP_SYNC_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetSyncStateCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE SYNC STATE MACHINE STATE OF AN INSTANCE
+
+    return ctx->sync_state;
+}
+
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastSyncDurationCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN MILLISECONDS FROM SYNC REQUEST TO DONE / FAILED OF THE
+    //LAST FINISHED SYNC OF AN INSTANCE
+
+    return ctx->last_sync_ms;
+}
+
+ESP8266_NTP_DATA* ICACHE_FLASH_ATTR ESP8266_NTP_GetNTPDataStructureCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN ESP8266 NTP DATA STRUCTURE OF AN INSTANCE
+
+    return &ctx->data;
+}
+
+uint8_t ESP8266_NTP_NowCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t* seconds, uint32_t* fraction)
+{
+    //RETURN CURRENT NTP TIME (SECONDS + 32 BIT FRACTION) EXTENDED
+    //FROM THE LAST SYNC USING THE LOCAL TICK SOURCE. NO NETWORK I/O
+    //SECONDS IS THE ERA OFFSET (WRAPS IN 2036), SEE NowTimeCtx
+    //RETURNS 0 IF THE CLOCK HAS NEVER BEEN SYNCED
+
+    _esp8266_ntp_clock_advance(ctx);
+
+    if(seconds != NULL)
+    {
+        *seconds = (uint32_t)ctx->clock_sec;
+    }
+    if(fraction != NULL)
+    {
+        *fraction = (uint32_t)(((uint64_t)ctx->clock_usec * NTP_USEC_TO_FRAC_MUL) >> 16);
+    }
+    return ctx->clock_valid;
+}
+
+uint8_t ESP8266_NTP_NowTimeCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_TIME* time)
+{
+    //RETURN CURRENT ERA AWARE NTP TIME. RETURNS 0 IF THE CLOCK HAS
+    //NEVER BEEN SYNCED
+
+    _esp8266_ntp_clock_advance(ctx);
+
+    time->seconds = ctx->clock_sec;
+    time->fraction = (uint32_t)(((uint64_t)ctx->clock_usec * NTP_USEC_TO_FRAC_MUL) >> 16);
+    return ctx->clock_valid;
+}
+
+int64_t ESP8266_NTP_TimeToUnix(const ESP8266_NTP_TIME* time)
+{
+    //RETURN UNIX SECONDS (64 BIT, SO PAST 2038-01-19)
+
+    return (int64_t)(time->seconds - NTP_UNIX_EPOCH_OFFSET);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetPollIntervalCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE CURRENT DISCIPLINE POLL INTERVAL IN SECONDS
+
+    return (1 << ctx->poll_exp);
+}
+
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetDriftPPBCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE ESTIMATED LOCAL OSCILLATOR FREQUENCY CORRECTION
+    //IN PARTS PER BILLION
+
+    return (int32_t)(((int64_t)ctx->clock_freq * 1000000000LL) >> 32);
+}
+
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetErrorBoundCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE MAXIMUM ERROR OF THE SOFTWARE CLOCK IN MICROSECONDS
+    //(SATURATED). 0xFFFFFFFF IF THE CLOCK HAS NEVER BEEN SET
+
+    return _esp8266_ntp_error_bound(ctx);
+}
+
+ESP8266_NTP_PACKET_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetPacketStatsCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE REPLY SANITY CHECK COUNTERS OF AN INSTANCE
+
+    return &ctx->packet_stats;
+}
+
+ESP8266_NTP_SERVER_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetServerStatsCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num)
+{
+    //RETURN THE STATISTICS OF A SERVER (1 BASED) OF AN INSTANCE
+    //OR NULL IF NO SUCH SERVER
+
+    if(server_num == 0 || server_num > ctx->total_server_count)
+    {
+        return NULL;
+    }
+    return &ctx->server_stats[server_num - 1];
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetStatsSnapshotCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t* buf, uint16_t size)
+{
+    //WRITE A COMPACT BIG ENDIAN SNAPSHOT OF THE SERVER STATISTICS OF AN
+    //INSTANCE FOR TELEMETRY. RETURNS THE LENGTH WRITTEN OR 0 IF
+    //buf IS SMALLER THAN NTP_STATS_SNAPSHOT_SIZE(SERVER COUNT)
+    //
+    //HEADER : VERSION(1) SERVERS(1) BUCKETS(1) SYNC COUNT(2)
+    //SERVER : QUERIES(4) SUCCESSES(4) TIMEOUTS(4) REJECTS(4)
+    //         DNS FAILURES(4) LAST ERROR(1) LAST ERROR FLAGS(2)
+    //         DNS / RTT / OFFSET HISTOGRAMS(2 EACH BUCKET)
+
+    uint8_t n = ctx->total_server_count;
+    uint8_t* p = buf;
+    uint8_t i, b;
+
+    if(size < NTP_STATS_SNAPSHOT_SIZE(n))
+    {
+        return 0;
+    }
+
+    *p++ = NTP_STATS_SNAPSHOT_VERSION;
+    *p++ = n;
+    *p++ = NTP_HIST_BUCKETS;
+    *p++ = (uint8_t)(ctx->cycle_count >> 8);
+    *p++ = (uint8_t)ctx->cycle_count;
+
+    for(i = 0; i < n; i++)
+    {
+        ESP8266_NTP_SERVER_STATS* st = &ctx->server_stats[i];
+
+        _esp8266_ntp_write_u32(p, st->queries);
+        _esp8266_ntp_write_u32(p + 4, st->successes);
+        _esp8266_ntp_write_u32(p + 8, st->timeouts);
+        _esp8266_ntp_write_u32(p + 12, st->rejects);
+        _esp8266_ntp_write_u32(p + 16, st->dns_failures);
+        p += 20;
+        *p++ = st->last_error;
+        *p++ = (uint8_t)(st->last_error_flags >> 8);
+        *p++ = (uint8_t)st->last_error_flags;
+
+        for(b = 0; b < NTP_HIST_BUCKETS; b++)
+        {
+            p[0] = (uint8_t)(st->dns_hist[b] >> 8);
+            p[1] = (uint8_t)st->dns_hist[b];
+            p[2 * NTP_HIST_BUCKETS] = (uint8_t)(st->rtt_hist[b] >> 8);
+            p[2 * NTP_HIST_BUCKETS + 1] = (uint8_t)st->rtt_hist[b];
+            p[4 * NTP_HIST_BUCKETS] = (uint8_t)(st->offset_hist[b] >> 8);
+            p[4 * NTP_HIST_BUCKETS + 1] = (uint8_t)st->offset_hist[b];
+            p += 2;
+        }
+        p += 4 * NTP_HIST_BUCKETS;
+    }
+    return (uint16_t)(p - buf);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_ResetStatsCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //CLEAR THE SERVER AND PACKET STATISTICS OF AN INSTANCE
+
+    os_memset(ctx->server_stats, 0, sizeof(ctx->server_stats));
+    os_memset(&ctx->packet_stats, 0, sizeof(ESP8266_NTP_PACKET_STATS));
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_FormatCompile(ESP8266_NTP_FORMAT* fmt, const char* pattern, uint8_t utc)
+{
+    //COMPILE A strftime STYLE PATTERN (SEE NTP_FORMAT_*) FOR LOCAL TIME
+    //OR UTC. RETURNS 0 ON AN UNKNOWN CONVERSION OR A PATTERN TOO LONG
+    //FOR THE OP LIST / LITERAL POOL, THE FORMAT THEN OUTPUTS NOTHING
+
+    ESP8266_NTP_FORMAT_STEP* last;
+    const char* p = pattern;
+    uint8_t used = 0;
+    uint8_t ok = 1;
+    uint8_t digits;
+
+    os_memset(fmt, 0, sizeof(ESP8266_NTP_FORMAT));
+    fmt->utc = utc;
+
+    while(ok && *p != '\0')
+    {
+        //LITERAL TEXT. RUNS ARE MERGED INTO A SINGLE COPY
+        if(*p != '%' || p[1] == '%')
+        {
+            last = (fmt->count != 0) ? &fmt->steps[fmt->count - 1] : NULL;
+            if(last != NULL && last->op == ESP8266_NTP_FORMAT_LITERAL && (last->literal + last->arg) == used)
+            {
+                last->arg++;
+                fmt->max_length++;
+            }
+            else
+            {
+                ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_LITERAL, 1, 1);
+                fmt->steps[fmt->count - 1].literal = used;
+            }
+            if(ok && used < NTP_FORMAT_LITERAL_SIZE)
+            {
+                fmt->literal[used++] = *p;
+            }
+            else
+            {
+                ok = 0;
+            }
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+
+        p++;
+        switch(*p)
+        {
+            case 'Y': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_YEAR, 0, 4); break;
+            case 'y': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_YEAR2, 0, 2); break;
+            case 'm': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_MONTH, 0, 2); break;
+            case 'd': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_DATE, 0, 2); break;
+            case 'e': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_DATE_SPACE, 0, 2); break;
+            case 'H': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_HOUR, 0, 2); break;
+            case 'I': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_HOUR12, 0, 2); break;
+            case 'p': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_AM_PM, 0, 2); break;
+            case 'M': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_MIN, 0, 2); break;
+            case 'S': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_SEC, 0, 2); break;
+            case 'A': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_DAY_NAME, 0, 9); break;
+            case 'a': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_DAY_ABBR, 0, 3); break;
+            case 'B': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_MONTH_NAME, 0, 9); break;
+            case 'b': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_MONTH_ABBR, 0, 3); break;
+            case 'z': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_OFFSET, 0, 5); break;
+            case 'Z': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_ZONE, 0, NTP_TZ_NAME_SIZE - 1); break;
+            case 's': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_UNIX, 0, 20); break;
+            case 'N': ok = _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_FRACTION, 6, 6); break;
+
+            case ':':
+                ok = (*++p == 'z') && _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_OFFSET_COLON, 0, 6);
+                break;
+
+            case '1': case '2': case '3': case '4': case '5': case '6':
+                digits = (uint8_t)(*p - '0');
+                ok = (*++p == 'N') && _esp8266_ntp_format_add(fmt, ESP8266_NTP_FORMAT_FRACTION, digits, digits);
+                break;
+
+            default:
+                ok = 0;
+                break;
+        }
+        if(ok)
+        {
+            p++;
+        }
+    }
+
+    if(!ok)
+    {
+        fmt->count = 0;
+        fmt->max_length = 0;
+    }
+    return ok;
+}
+
+uint16_t ESP8266_NTP_FormatCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_FORMAT* fmt, char* buf, uint16_t size)
+{
+    //FORMAT THE CURRENT TIME INTO buf (NUL TERMINATED). RETURNS THE
+    //LENGTH, 0 IF THE CLOCK HAS NEVER BEEN SYNCED OR size IS NOT LARGER
+    //THAN fmt->max_length
+
+    _esp8266_ntp_clock_advance(ctx);
+
+    if(!ctx->clock_valid)
+    {
+        if(size != 0)
+        {
+            buf[0] = '\0';
+        }
+        return 0;
+    }
+    return _esp8266_ntp_format(ctx, fmt, ctx->clock_sec, ctx->clock_usec, buf, size);
+}
+
+uint16_t ESP8266_NTP_FormatTimeCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_FORMAT* fmt, const ESP8266_NTP_TIME* time, char* buf, uint16_t size)
+{
+    //FORMAT A GIVEN ERA AWARE NTP TIME (E.G. A MESSAGE TIMESTAMP) INTO
+    //buf. THE CONTEXT ONLY SUPPLIES THE TIME ZONE
+
+    return _esp8266_ntp_format(ctx, fmt, time->seconds,
+                                (uint32_t)(((uint64_t)time->fraction * NTP_USEC_PER_SEC) >> 32), buf, size);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetListener(const ESP8266_NTP_LISTENER* listener)
+{
+    //SET THE UDP LISTENER USED BY THE SNTP SERVER. NULL RESTORES THE
+    //espconn LISTENER (NONE ON HOST BUILDS). NOT WHILE SERVING
+
+#ifndef ESP8266_NTP_HOST
+    _esp8266_ntp_listener = (listener != NULL) ? listener : &_esp8266_ntp_espconn_listener;
+#else
+    _esp8266_ntp_listener = listener;
+#endif
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_ServeStartCtx(ESP8266_NTP_CONTEXT* ctx, uint16_t port)
+{
+    //ANSWER SNTP REQUESTS ON port (0 = NTP_PORT) FROM THE CLOCK OF AN
+    //INSTANCE, REPLACING ANY INSTANCE ALREADY SERVED. THE INSTANCE KEEPS
+    //SYNCING AS USUAL. RETURNS 0 IF THE PORT COULD NOT BE OPENED
+
+    if(_esp8266_ntp_listener == NULL)
+    {
+        return 0;
+    }
+    if(port == 0)
+    {
+        port = NTP_PORT;
+    }
+
+    ESP8266_NTP_ServeStop();
+    if(!_esp8266_ntp_listener->open(port, _esp8266_ntp_serve_recv_cb))
+    {
+        return 0;
+    }
+
+    _esp8266_ntp_serve_ctx = ctx;
+    _esp8266_ntp_serve_valid = 0;
+    os_memset(&_esp8266_ntp_serve_stats, 0, sizeof(ESP8266_NTP_SERVE_STATS));
+    NTP_LOG_INFO(SERVE_START, 0, (int16_t)port, 0);
+    return 1;
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_ServeStop(void)
+{
+    //STOP ANSWERING SNTP REQUESTS AND CLOSE THE SERVER PORT
+
+    if(_esp8266_ntp_serve_ctx == NULL)
+    {
+        return;
+    }
+    _esp8266_ntp_listener->close();
+    _esp8266_ntp_serve_ctx = NULL;
+    NTP_LOG_INFO(SERVE_STOP, 0, 0, (int32_t)_esp8266_ntp_serve_stats.answered);
+}
+
+ESP8266_NTP_SERVE_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetServeStats(void)
+{
+    //RETURN THE SNTP SERVER COUNTERS SINCE THE LAST ESP8266_NTP_ServeStart
+
+    return &_esp8266_ntp_serve_stats;
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_LogRead(ESP8266_NTP_LOG_RECORD* records, uint16_t max)
+{
+    //MOVE UPTO max OF THE OLDEST LOG RECORDS OUT OF THE RING
+    //RETURNS THE NUMBER OF RECORDS COPIED
+
+    uint16_t n = 0;
+
+#if NTP_LOG_LEVEL > NTP_LOG_LEVEL_NONE
+    uint16_t tail = _esp8266_ntp_log_tail;
+
+    while(n < max && tail != _esp8266_ntp_log_head)
+    {
+        records[n++] = _esp8266_ntp_log_ring[tail];
+        tail = (tail + 1) & (NTP_LOG_RING_SIZE - 1);
+    }
+    _esp8266_ntp_log_tail = tail;
+#else
+    (void)records;
+    (void)max;
+#endif
+    return n;
+}
+
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_LogDropped(void)
+{
+    //RETURN THE NUMBER OF LOG RECORDS DROPPED BECAUSE THE RING WAS FULL
+
+#if NTP_LOG_LEVEL > NTP_LOG_LEVEL_NONE
+    return _esp8266_ntp_log_dropped;
+#else
+    return 0;
+#endif
+}
+
+const ESP8266_NTP_HEADER* ESP8266_NTP_HeaderView(const char* buf, uint16_t length)
+{
+    //RETURN AN IN PLACE HEADER VIEW OVER A RECEIVED NTP PACKET
+    //OR NULL IF IT IS TOO SHORT TO HOLD A HEADER. NOTHING IS COPIED
+
+    if(buf == NULL || length < NTP_PACKET_SIZE)
+    {
+        return NULL;
+    }
+    return (const ESP8266_NTP_HEADER*)buf;
+}
+
+uint32_t ESP8266_NTP_HeaderRootDelay(const ESP8266_NTP_HEADER* hdr)
+{
+    //RETURN ROOT DELAY (16.16 FIXED POINT SECONDS)
+
+    return _esp8266_ntp_read_u32(hdr->root_delay);
+}
+
+uint32_t ESP8266_NTP_HeaderRootDispersion(const ESP8266_NTP_HEADER* hdr)
+{
+    //RETURN ROOT DISPERSION (16.16 FIXED POINT SECONDS)
+
+    return _esp8266_ntp_read_u32(hdr->root_dispersion);
+}
+
+uint32_t ESP8266_NTP_HeaderReferenceId(const ESP8266_NTP_HEADER* hdr)
+{
+    //RETURN REFERENCE ID (KISS CODE IF STRATUM 0)
+
+    return _esp8266_ntp_read_u32(hdr->reference_id);
+}
+
+uint64_t ESP8266_NTP_HeaderTimestamp(const uint8_t* ts)
+{
+    //RETURN A 64 BIT NTP TIMESTAMP FIELD OF THE HEADER
+    //(E.G. hdr->transmit_ts) AS SECONDS << 32 | FRACTION
+
+    return ((uint64_t)_esp8266_ntp_read_u32(&ts[0]) << 32) | _esp8266_ntp_read_u32(&ts[4]);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmAtCtx(ESP8266_NTP_CONTEXT* ctx, uint64_t seconds, void (*cb)(uint16_t, void*), void* arg)
+{
+    //SET A ONE SHOT ALARM AT ERA EXTENDED NTP SECONDS (UTC, SEE
+    //ESP8266_NTP_NowTimeCtx). A TIME ALREADY PASSED FIRES AT THE NEXT
+    //SECOND. cb(id, arg) IS CALLED ON EXPIRY, NULL CALLS THE user_alarm_cb
+    //OF ESP8266_NTP_SetCallbackFunctions. RETURNS THE ALARM ID OR 0 IF
+    //THE POOL IS FULL. ALARMS ONLY RUN ONCE THE CLOCK HAS BEEN SYNCED
+
+    if(seconds == 0)
+    {
+        return 0;
+    }
+    return _esp8266_ntp_alarm_add(ctx, ESP8266_NTP_ALARM_ONCE, seconds, 0, 0, cb, arg);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmEveryCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t period_s, void (*cb)(uint16_t, void*), void* arg)
+{
+    //SET AN ALARM FIRING EVERY period_s SECONDS ON MULTIPLES OF period_s
+    //SINCE THE NTP EPOCH, SO DIVISORS OF A DAY FIRE ON THE UTC GRID
+    //(900 = :00 :15 :30 :45). RETURNS THE ALARM ID OR 0
+
+    if(period_s == 0)
+    {
+        return 0;
+    }
+    return _esp8266_ntp_alarm_add(ctx, ESP8266_NTP_ALARM_EVERY, 0, period_s, 0, cb, arg);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmDailyCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t hour, uint8_t min, uint8_t days, void (*cb)(uint16_t, void*), void* arg)
+{
+    //SET AN ALARM AT hour:min LOCAL TIME ON THE WEEKDAYS IN days
+    //(BIT 0 = SUNDAY, NTP_ALARM_EVERY_DAY). FOLLOWS THE TIME ZONE ACROSS
+    //DST CHANGES. A TIME SKIPPED BY A DST CHANGE FIRES ONE HOUR LATE
+    //RETURNS THE ALARM ID OR 0
+
+    if(hour > 23 || min > 59 || (days & NTP_ALARM_EVERY_DAY) == 0)
+    {
+        return 0;
+    }
+    return _esp8266_ntp_alarm_add(ctx, ESP8266_NTP_ALARM_DAILY, 0, ((uint32_t)hour * 3600) + ((uint32_t)min * 60),
+                                    days & NTP_ALARM_EVERY_DAY, cb, arg);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmCancelCtx(ESP8266_NTP_CONTEXT* ctx, uint16_t id)
+{
+    //CANCEL AN ALARM. RETURNS 0 IF NO SUCH ALARM IS SET (A ONE SHOT
+    //ALARM IS GONE ONCE IT HAS FIRED AND ITS ID MAY BE REUSED)
+
+    ESP8266_NTP_ALARM* alarm;
+
+    if(id == 0 || id > ctx->alarm_used || ctx->alarms[id - 1].kind == ESP8266_NTP_ALARM_FREE)
+    {
+        return 0;
+    }
+
+    alarm = &ctx->alarms[id - 1];
+    _esp8266_ntp_alarm_unlink(ctx, id);
+    alarm->kind = ESP8266_NTP_ALARM_FREE;
+    alarm->next = ctx->alarm_free;
+    ctx->alarm_free = id;
+
+    if(--ctx->alarm_count == 0)
+    {
+        os_timer_disarm(&ctx->alarm_timer);
+        ctx->alarm_armed = 0;
+    }
+    return 1;
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //START A SYNC ON AN INSTANCE. IF ONE IS ALREADY RUNNING IT IS LEFT
+    //TO FINISH AND A NEW ONE STARTS AFTER IT
+
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_START);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_CancelCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //CANCEL A RUNNING OR QUEUED SYNC OF AN INSTANCE (AND ANY SYNC
+    //REQUESTED AFTER IT). THE USER CALLBACK IS NOT CALLED
+
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_CANCEL);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_RefreshDataCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //UPDATE THE NTP DATA STRUCTURE FROM THE SOFTWARE CLOCK
+    //WITHOUT DOING A NETWORK SYNC
+
+    if(!ctx->clock_valid)
+    {
+        return;
+    }
+
+    _esp8266_ntp_clock_advance(ctx);
+    if(ctx->clock_sec < ctx->data.timestamp)
+    {
+        //CLOCK WENT BACK (STEP OR INSERTED LEAP SECOND). RECOMPUTE
+        ctx->data.timestamp = ctx->clock_sec;
+        _esp8266_ntp_convert_time_to_text(ctx);
+        return;
+    }
+    _esp8266_ntp_advance_fields(ctx, (uint32_t)(ctx->clock_sec - ctx->data.timestamp));
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_AdvanceSecondsCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t seconds)
+{
+    //ADVANCE THE NTP DATA STRUCTURE OF AN INSTANCE
+
+    _esp8266_ntp_advance_fields(ctx, seconds);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SaveCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //WRITE A WARM START SNAPSHOT OF AN INSTANCE TO THE STORE. DONE
+    //AFTER EVERY SYNC ONCE THE INSTANCE HAS CALLED RestoreCtx, CALL
+    //IT AGAIN BEFORE A DEEP SLEEP. RETURNS 0 IF NOT WRITTEN
+
+    ESP8266_NTP_SNAPSHOT snap;
+    uint32_t period_q12;
+    uint32_t age;
+    uint8_t i;
+
+    if(_esp8266_ntp_store == NULL)
+    {
+        return 0;
+    }
+
+    os_memset(&snap, 0, sizeof(ESP8266_NTP_SNAPSHOT));
+    snap.magic = NTP_STORE_MAGIC;
+    snap.size = sizeof(ESP8266_NTP_SNAPSHOT);
+    snap.version = NTP_STORE_VERSION;
+
+    //CLOCK AND COUNTER ARE READ BACK TO BACK
+    if(ctx->clock_valid && _esp8266_ntp_store->rtc_now(&snap.rtc_ticks, &period_q12))
+    {
+        _esp8266_ntp_clock_advance(ctx);
+        snap.flags |= NTP_STORE_F_TIME;
+        snap.clock_sec = ctx->clock_sec;
+        snap.clock_usec = ctx->clock_usec;
+        snap.error_us = _esp8266_ntp_error_bound(ctx);
+    }
+    snap.clock_freq = ctx->clock_freq;
+    snap.poll_exp = ctx->poll_exp;
+
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        if(!ctx->dns_cache[i].valid)
+        {
+            continue;
+        }
+        age = _esp8266_ntp_uptime(ctx) - ctx->dns_cache[i].resolved_at;
+        snap.dns_valid |= (1 << i);
+        snap.dns_ip[i] = ctx->dns_cache[i].ip.addr;
+        snap.dns_age_s[i] = age;
+        snap.dns_name_crc[i] = _esp8266_ntp_crc32(ctx->servers[i], os_strlen(ctx->servers[i]));
+    }
+
+    snap.crc = _esp8266_ntp_crc32(&snap, (uint16_t)((uint8_t*)&snap.crc - (uint8_t*)&snap));
+    if(!_esp8266_ntp_store->write(&snap, sizeof(ESP8266_NTP_SNAPSHOT)))
+    {
+        return 0;
+    }
+    NTP_LOG_DEBUG(STORE_SAVED, 0, snap.flags, 0);
+    return 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_RestoreCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //LOAD THE SNAPSHOT INTO AN INSTANCE AFTER ESP8266_NTP_Create AND THE
+    //SERVER SETUP. DRIFT, POLL INTERVAL AND CACHED SERVER IPS ARE ALWAYS
+    //TAKEN. THE CLOCK IS ONLY SET IF THE RTC COUNTER BRIDGED THE GAP
+    //SINCE THE SNAPSHOT. RETURNS 1 IF THE TIME IS USABLE NOW (SEE
+    //ESP8266_NTP_GetErrorBound / ESP8266_NTP_SyncIfNeeded)
+
+    ESP8266_NTP_SNAPSHOT snap;
+    uint32_t ticks;
+    uint32_t period_q12;
+    uint64_t gap_us = 0;
+    uint8_t gap_known = 0;
+    uint8_t i;
+
+    ctx->store_owner = 1;
+
+    if(_esp8266_ntp_store == NULL || !_esp8266_ntp_store->read(&snap, sizeof(ESP8266_NTP_SNAPSHOT)))
+    {
+        NTP_LOG_WARN(STORE_INVALID, 0, 0, 0);
+        return 0;
+    }
+    if(snap.magic != NTP_STORE_MAGIC || snap.size != sizeof(ESP8266_NTP_SNAPSHOT) ||
+        snap.version != NTP_STORE_VERSION ||
+        snap.crc != _esp8266_ntp_crc32(&snap, (uint16_t)((uint8_t*)&snap.crc - (uint8_t*)&snap)))
+    {
+        NTP_LOG_WARN(STORE_INVALID, 0, 1, 0);
+        return 0;
+    }
+
+    //TIME ELAPSED SINCE THE SNAPSHOT. UNSIGNED DIFFERENCE SURVIVES ONE
+    //COUNTER WRAP, THE GAP LIMIT REJECTS WHAT MAY BE MORE
+    if((snap.flags & NTP_STORE_F_TIME) && _esp8266_ntp_store->rtc_kept() &&
+        _esp8266_ntp_store->rtc_now(&ticks, &period_q12))
+    {
+        gap_us = ((uint64_t)(ticks - snap.rtc_ticks) * period_q12) >> 12;
+        gap_known = (gap_us <= (uint64_t)NTP_STORE_MAX_GAP_S * NTP_USEC_PER_SEC);
+    }
+
+    //THE FREQUENCY IS KEPT BUT THE FIRST SYNC MUST NOT TAKE THE RTC
+    //ERROR ACROSS THE GAP FOR FREQUENCY ERROR
+    if(snap.clock_freq <= NTP_MAX_FREQ_Q32 && snap.clock_freq >= -NTP_MAX_FREQ_Q32)
+    {
+        ctx->clock_freq = snap.clock_freq;
+    }
+    if(snap.poll_exp >= NTP_MIN_POLL_EXP && snap.poll_exp <= NTP_MAX_POLL_EXP)
+    {
+        ctx->poll_exp = snap.poll_exp;
+    }
+    ctx->freq_hold = 1;
+
+    //CACHED IPS OF THE SAME HOSTNAMES. OF UNKNOWN AGE THEY ARE EXPIRED
+    //BUT STAY USABLE AS A STALE FALLBACK
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        uint32_t age = ctx->dns_cache_ttl_s;
+
+        if(!(snap.dns_valid & (1 << i)) ||
+            snap.dns_name_crc[i] != _esp8266_ntp_crc32(ctx->servers[i], os_strlen(ctx->servers[i])))
+        {
+            continue;
+        }
+        if(gap_known && snap.dns_age_s[i] < ctx->dns_cache_ttl_s)
+        {
+            age = snap.dns_age_s[i] + (uint32_t)(gap_us / NTP_USEC_PER_SEC);
+        }
+        ctx->dns_cache[i].ip.addr = snap.dns_ip[i];
+        ctx->dns_cache[i].resolved_at = _esp8266_ntp_uptime(ctx) - age;
+        ctx->dns_cache[i].valid = 1;
+    }
+
+    if(!gap_known)
+    {
+        NTP_LOG_INFO(STORE_RESTORED, 0, 0, 0);
+        return 0;
+    }
+
+    gap_us += snap.clock_usec;
+    ctx->clock_ref_tick = _esp8266_ntp_tick_us_fn();
+    ctx->clock_sec = snap.clock_sec + (gap_us / NTP_USEC_PER_SEC);
+    ctx->clock_usec = (uint32_t)(gap_us % NTP_USEC_PER_SEC);
+    ctx->clock_slew_us = 0;
+    ctx->clock_valid = 1;
+    ctx->discipline_last_sec = (uint32_t)ctx->clock_sec;
+
+    gap_us = (uint64_t)snap.error_us + (((gap_us - snap.clock_usec) * NTP_RTC_TOLERANCE_PPM) / NTP_USEC_PER_SEC);
+    ctx->error_us = (gap_us > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)gap_us;
+    ctx->error_ref_sec = _esp8266_ntp_uptime(ctx);
+
+    ctx->data.state = ESP8266_NTP_STATE_OK;
+    ctx->data.timestamp = ctx->clock_sec;
+    _esp8266_ntp_convert_time_to_text(ctx);
+
+    NTP_LOG_INFO(STORE_RESTORED, 0, snap.flags, (int32_t)(ctx->error_us / 1000));
+    return 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SyncIfNeededCtx(ESP8266_NTP_CONTEXT* ctx)
+{
+    //START A SYNC IF THE ERROR BOUND EXCEEDS THE SYNC THRESHOLD (OR THE
+    //CLOCK WAS NEVER SET) AND RETURN 1. OTHERWISE RETURN 0 AND, WITH
+    //AUTO SYNC ON, ARM THE POLL TIMER FOR WHEN THE BOUND WILL PASS IT
+
+    uint32_t bound = _esp8266_ntp_error_bound(ctx);
+    uint32_t wait_s;
+
+    if(bound > ctx->sync_threshold_us)
+    {
+        ESP8266_NTP_GetTimeCtx(ctx);
+        return 1;
+    }
+
+    if(ctx->auto_sync)
+    {
+        wait_s = (ctx->sync_threshold_us - bound) / NTP_CLOCK_TOLERANCE_PPM;
+        if(wait_s > (1UL << NTP_MAX_POLL_EXP))
+        {
+            wait_s = 1UL << NTP_MAX_POLL_EXP;
+        }
+        os_timer_disarm(&ctx->poll_timer);
+        os_timer_arm(&ctx->poll_timer, (wait_s + 1) * 1000, 0);
+    }
+    return 0;
+}
+
+#if NTP_LEGACY_API
+//SINGLE CONTEXT API. EVERY CALL ACTS ON THE CURRENT CONTEXT SELECTED
+//BY ESP8266_NTP_SetContext, WHICH DEFAULTS TO A BUILT IN INSTANCE
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetContext(ESP8266_NTP_CONTEXT* ctx)
+{
+    //SELECT THE CONTEXT USED BY THE NON _Ctx API FUNCTIONS
+    //CALLER SUPPLIED STORAGE MUST BE ZERO INITIALIZED (E.G. STATIC)
+    //OR SET UP WITH ESP8266_NTP_Create. NULL SELECTS THE INTERNAL CONTEXT
+
+    _esp8266_ntp_ctx = (ctx != NULL) ? ctx : &_esp8266_ntp_default_ctx;
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_Initialize(char* server1,
+                                                	char* server2,
+													char* server3,
+													int8_t timezone_hr,
+													uint8_t timezone_min,
+													uint16_t ntp_timeout_ms)
+{
+    //SET THE NTP CONFIGURATION PARAMETERS OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_Create(_esp8266_ntp_ctx, server1, server2, server3, timezone_hr, timezone_min, ntp_timeout_ms);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetServers(char** servers, uint8_t count)
+{
+    //REPLACE THE SERVER LIST OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetServersCtx(_esp8266_ntp_ctx, servers, count);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AddServer(char* server)
+{
+    //APPEND A SERVER TO THE LIST OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_AddServerCtx(_esp8266_ntp_ctx, server);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetCallbackFunctions(void (*user_data_ready_cb)(ESP8266_NTP_DATA*, uint16_t),
+                                                            void (*user_alarm_cb)())
+{
+    //SET THE LIBRARY CALLBACK FUNCTION POINTERS
+    //user_alarm_cb IS CALLED FOR ALARMS SET WITHOUT A CALLBACK OF THEIR OWN
+    _esp8266_ntp_ctx->data_ready_user_cb = user_data_ready_cb;
+    _esp8266_ntp_ctx->alarm_cb = user_alarm_cb;
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetSyncThreshold(uint32_t max_error_us)
+{
+    //SET THE SYNC ERROR THRESHOLD OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetSyncThresholdCtx(_esp8266_ntp_ctx, max_error_us);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetEraPivot(uint64_t seconds)
+{
+    //SET THE ERA PIVOT OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetEraPivotCtx(_esp8266_ntp_ctx, seconds);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetLeapMode(ESP8266_NTP_LEAP_MODE mode, uint32_t smear_s)
+{
+    //SET THE LEAP SECOND MODE OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetLeapModeCtx(_esp8266_ntp_ctx, mode, smear_s);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SetTimeZone(const char* tz)
+{
+    //SET THE TIME ZONE OF THE CURRENT CONTEXT FROM A POSIX TZ STRING
+
+    return ESP8266_NTP_SetTimeZoneCtx(_esp8266_ntp_ctx, tz);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetAutoSync(uint8_t enable)
+{
+    //ENABLE OR DISABLE AUTO SYNC ON THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetAutoSyncCtx(_esp8266_ntp_ctx, enable);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetMultiServerMode(uint8_t enable)
+{
+    //ENABLE OR DISABLE MULTI SERVER MODE ON THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetMultiServerModeCtx(_esp8266_ntp_ctx, enable);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetBurst(uint8_t count)
+{
+    //SET THE BURST LENGTH OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetBurstCtx(_esp8266_ntp_ctx, count);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetDnsCacheTTL(uint32_t ttl_s)
+{
+    //SET THE DNS CACHE LIFETIME OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_SetDnsCacheTTLCtx(_esp8266_ntp_ctx, ttl_s);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_FlushDnsCache(void)
+{
+    //FLUSH THE DNS CACHE OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_FlushDnsCacheCtx(_esp8266_ntp_ctx);
+}
+
+int8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneHour(void)
+{
+    //GET THE TIME ZONE HOUR OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetTimeZoneHourCtx(_esp8266_ntp_ctx);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneMinute(void)
+{
+    //GET THE TIME ZONE MINUTE OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetTimeZoneMinuteCtx(_esp8266_ntp_ctx);
+}
+
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetUtcOffset(void)
+{
+    //GET THE UTC OFFSET OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetUtcOffsetCtx(_esp8266_ntp_ctx);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastNTPServerUsedNumber(void)
+{
+    //GET THE LAST SERVER USED OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetLastNTPServerUsedNumberCtx(_esp8266_ntp_ctx);
+}
+
+ESP8266_NTP_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetState(void)
+{
+    //GET THE LAST SYNC RESULT OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetStateCtx(_esp8266_ntp_ctx);
+}
+
+ESP8266_NTP_SYNC_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetSyncState(void)
+{
+    //GET THE SYNC STATE OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetSyncStateCtx(_esp8266_ntp_ctx);
+}
+
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastSyncDuration(void)
+{
+    //GET THE LAST SYNC DURATION OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetLastSyncDurationCtx(_esp8266_ntp_ctx);
+}
+
+ESP8266_NTP_DATA* ICACHE_FLASH_ATTR ESP8266_NTP_GetNTPDataStrcuture(void)
+{
+    //RETURN ESP8266 NTP DATA STRUCTURE
+    
+    return ESP8266_NTP_GetNTPDataStructureCtx(_esp8266_ntp_ctx);
+}
+
+uint8_t ESP8266_NTP_Now(uint32_t* seconds, uint32_t* fraction)
+{
+    //RETURN CURRENT NTP TIME OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_NowCtx(_esp8266_ntp_ctx, seconds, fraction);
+}
+
+uint8_t ESP8266_NTP_NowTime(ESP8266_NTP_TIME* time)
+{
+    //RETURN CURRENT ERA AWARE NTP TIME OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_NowTimeCtx(_esp8266_ntp_ctx, time);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetPollInterval(void)
+{
+    //GET THE POLL INTERVAL OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetPollIntervalCtx(_esp8266_ntp_ctx);
+}
+
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetDriftPPB(void)
+{
+    //GET THE DRIFT ESTIMATE OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetDriftPPBCtx(_esp8266_ntp_ctx);
+}
+
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetErrorBound(void)
+{
+    //RETURN THE CLOCK ERROR BOUND OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetErrorBoundCtx(_esp8266_ntp_ctx);
+}
+
+ESP8266_NTP_PACKET_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetPacketStats(void)
+{
+    //RETURN THE REPLY SANITY CHECK COUNTERS OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetPacketStatsCtx(_esp8266_ntp_ctx);
+}
+
+ESP8266_NTP_SERVER_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetServerStats(uint8_t server_num)
+{
+    //GET THE STATISTICS OF A SERVER OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetServerStatsCtx(_esp8266_ntp_ctx, server_num);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetStatsSnapshot(uint8_t* buf, uint16_t size)
+{
+    //SERIALIZE THE STATISTICS OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_GetStatsSnapshotCtx(_esp8266_ntp_ctx, buf, size);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_ResetStats(void)
+{
+    //CLEAR THE STATISTICS OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_ResetStatsCtx(_esp8266_ntp_ctx);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmAt(uint64_t seconds, void (*cb)(uint16_t, void*), void* arg)
+{
+    //SET A ONE SHOT ALARM ON THE CURRENT CONTEXT
+
+    return ESP8266_NTP_AlarmAtCtx(_esp8266_ntp_ctx, seconds, cb, arg);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmEvery(uint32_t period_s, void (*cb)(uint16_t, void*), void* arg)
+{
+    //SET A PERIODIC ALARM ON THE CURRENT CONTEXT
+
+    return ESP8266_NTP_AlarmEveryCtx(_esp8266_ntp_ctx, period_s, cb, arg);
+}
+
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmDaily(uint8_t hour, uint8_t min, uint8_t days, void (*cb)(uint16_t, void*), void* arg)
+{
+    //SET A DAILY ALARM ON THE CURRENT CONTEXT
+
+    return ESP8266_NTP_AlarmDailyCtx(_esp8266_ntp_ctx, hour, min, days, cb, arg);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmCancel(uint16_t id)
+{
+    //CANCEL AN ALARM OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_AlarmCancelCtx(_esp8266_ntp_ctx, id);
+}
+
+uint16_t ESP8266_NTP_Format(ESP8266_NTP_FORMAT* fmt, char* buf, uint16_t size)
+{
+    //FORMAT THE CURRENT TIME OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_FormatCtx(_esp8266_ntp_ctx, fmt, buf, size);
+}
+
+uint16_t ESP8266_NTP_FormatTime(ESP8266_NTP_FORMAT* fmt, const ESP8266_NTP_TIME* time, char* buf, uint16_t size)
+{
+    //FORMAT A GIVEN TIME WITH THE TIME ZONE OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_FormatTimeCtx(_esp8266_ntp_ctx, fmt, time, buf, size);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_ServeStart(uint16_t port)
+{
+    //SERVE THE CLOCK OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_ServeStartCtx(_esp8266_ntp_ctx, port);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_GetTime(void)
+{
+    //START A SYNC ON THE CURRENT CONTEXT
+
+    ESP8266_NTP_GetTimeCtx(_esp8266_ntp_ctx);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_Cancel(void)
+{
+    //CANCEL THE SYNC OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_CancelCtx(_esp8266_ntp_ctx);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_RefreshData(void)
+{
+    //UPDATE THE NTP DATA STRUCTURE OF THE CURRENT CONTEXT
+    //FROM ITS SOFTWARE CLOCK WITHOUT DOING A NETWORK SYNC
+
+    ESP8266_NTP_RefreshDataCtx(_esp8266_ntp_ctx);
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_AdvanceSeconds(uint32_t seconds)
+{
+    //ADVANCE THE CLOCK OF THE CURRENT CONTEXT
+
+    ESP8266_NTP_AdvanceSecondsCtx(_esp8266_ntp_ctx, seconds);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_Save(void)
+{
+    //WRITE A WARM START SNAPSHOT OF THE CURRENT CONTEXT
+
+    return ESP8266_NTP_SaveCtx(_esp8266_ntp_ctx);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_Restore(void)
+{
+    //WARM START THE CURRENT CONTEXT FROM THE STORE
+
+    return ESP8266_NTP_RestoreCtx(_esp8266_ntp_ctx);
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SyncIfNeeded(void)
+{
+    //START A SYNC ON THE CURRENT CONTEXT IF ITS ERROR BOUND IS TOO LARGE
+
+    return ESP8266_NTP_SyncIfNeededCtx(_esp8266_ntp_ctx);
+}
+
+#endif
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_advance_fields(ESP8266_NTP_CONTEXT* ctx, uint32_t seconds)
+{
+    //ADVANCE THE NTP DATA STRUCTURE BY THE GIVEN NUMBER OF SECONDS
+    //SMALL STEPS RIPPLE CARRIES THROUGH SEC -> MIN -> HOUR -> DATE ->
+    //MONTH -> YEAR. LARGE STEPS FALL BACK TO A FULL RECOMPUTE
+
+    ESP8266_NTP_DATA* data = &ctx->data;
+
+    ctx->data.timestamp += seconds;
+
+    //A DST TRANSITION CHANGES THE LOCAL TIME BY MORE THAN THE STEP
+    if(!ctx->fields_valid || seconds >= NTP_INCREMENTAL_MAX_SECS ||
+        _esp8266_ntp_tz_offset(&ctx->tz, ctx->data.timestamp) != data->utc_offset_s)
+    {
+        _esp8266_ntp_convert_time_to_text(ctx);
+        return;
+    }
+
+    data->sec += seconds;
+    if(data->sec < 60)
+    {
+        return;
+    }
+    data->sec -= 60;
+
+    if(++data->min < 60)
+    {
+        return;
+    }
+    data->min = 0;
+
+    if(++data->hour < 24)
+    {
+        return;
+    }
+    data->hour = 0;
+
+    data->day_num = (data->day_num == 6) ? 0 : (data->day_num + 1);
+    data->day_text = _esp8266_ntp_day_names[data->day_num];
+
+    if(++data->date <= _esp8266_ntp_month_length(data->month_num, data->year))
+    {
+        return;
+    }
+    data->date = 1;
+
+    if(++data->month_num > 12)
+    {
+        data->month_num = 1;
+        data->year++;
+    }
+    data->month_text = _esp8266_ntp_month_names[(data->month_num - 1)];
+}
+
+void _esp8266_ntp_clock_advance(ESP8266_NTP_CONTEXT* ctx)
+{
+    //EXTEND THE SOFTWARE CLOCK BY THE TICKS ELAPSED SINCE LAST READ
+    //UNSIGNED SUBTRACTION HANDLES A SINGLE TICK COUNTER WRAPAROUND
+
+    uint32_t now = _esp8266_ntp_tick_us_fn();
+    uint32_t delta = now - ctx->clock_ref_tick;
+
+    ctx->clock_ref_tick = now;
+
+    //MONOTONIC UPTIME, UNAFFECTED BY CLOCK STEPS
+    ctx->uptime_sec += delta / NTP_USEC_PER_SEC;
+    ctx->uptime_usec += delta % NTP_USEC_PER_SEC;
+    if(ctx->uptime_usec >= NTP_USEC_PER_SEC)
+    {
+        ctx->uptime_usec -= NTP_USEC_PER_SEC;
+        ctx->uptime_sec++;
+    }
+
+    //SPLIT DELTA SO usec + delta CAN NOT OVERFLOW 32 BITS
+    ctx->clock_sec += delta / NTP_USEC_PER_SEC;
+    ctx->clock_usec += delta % NTP_USEC_PER_SEC;
+    if(ctx->clock_usec >= NTP_USEC_PER_SEC)
+    {
+        ctx->clock_usec -= NTP_USEC_PER_SEC;
+        ctx->clock_sec++;
+    }
+
+    //APPLY FREQUENCY CORRECTION AND PENDING SLEW
+    if(ctx->clock_freq != 0 || ctx->clock_slew_us != 0)
+    {
+        int32_t adj = (int32_t)(((int64_t)delta * ctx->clock_freq) >> 32);
+        int32_t max_slew = (int32_t)(delta >> NTP_SLEW_RATE_SHIFT);
+        int32_t slew = ctx->clock_slew_us;
+
+        if(slew > max_slew)
+        {
+            slew = max_slew;
+        }
+        else if(slew < -max_slew)
+        {
+            slew = -max_slew;
+        }
+        ctx->clock_slew_us -= slew;
+
+        _esp8266_ntp_clock_adjust(ctx, adj + slew);
+    }
+
+    if(ctx->leap != ESP8266_NTP_LEAP_NONE)
+    {
+        _esp8266_ntp_leap_update(ctx);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_clock_step(ESP8266_NTP_CONTEXT* ctx, int64_t offset_us)
+{
+    //STEP THE SOFTWARE CLOCK BY A SIGNED MICROSECOND OFFSET
+    //AND DROP ANY PENDING SLEW
+
+    _esp8266_ntp_clock_advance(ctx);
+    ctx->clock_sec += (uint64_t)(offset_us / (int64_t)NTP_USEC_PER_SEC);
+    _esp8266_ntp_clock_adjust(ctx, (int32_t)(offset_us % (int64_t)NTP_USEC_PER_SEC));
+    ctx->clock_slew_us = 0;
+
+    //FILTERED OFFSETS WERE MEASURED AGAINST THE OLD CLOCK
+    os_memset(ctx->filters, 0, sizeof(ctx->filters));
+}
+
+void _esp8266_ntp_clock_adjust(ESP8266_NTP_CONTEXT* ctx, int32_t adj_us)
+{
+    //APPLY A SIGNED MICROSECOND CORRECTION TO THE SOFTWARE CLOCK
+
+    int32_t usec = (int32_t)ctx->clock_usec + (adj_us % (int32_t)NTP_USEC_PER_SEC);
+
+    ctx->clock_sec += (uint64_t)(int64_t)(adj_us / (int32_t)NTP_USEC_PER_SEC);
+    if(usec < 0)
+    {
+        usec += NTP_USEC_PER_SEC;
+        ctx->clock_sec--;
+    }
+    else if(usec >= (int32_t)NTP_USEC_PER_SEC)
+    {
+        usec -= NTP_USEC_PER_SEC;
+        ctx->clock_sec++;
+    }
+    ctx->clock_usec = (uint32_t)usec;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_clock_set(ESP8266_NTP_CONTEXT* ctx, uint64_t seconds, uint32_t fraction)
+{
+    //STEP THE SOFTWARE CLOCK TO THE GIVEN NTP TIME
+
+    ctx->clock_ref_tick = _esp8266_ntp_tick_us_fn();
+    ctx->clock_sec = seconds;
+    ctx->clock_usec = (uint32_t)(((uint64_t)fraction * NTP_USEC_PER_SEC) >> 32);
+    ctx->clock_slew_us = 0;
+    ctx->clock_valid = 1;
+    os_memset(ctx->filters, 0, sizeof(ctx->filters));
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_uptime(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN MONOTONIC SECONDS SINCE START FROM THE TICK SOURCE
+
+    _esp8266_ntp_clock_advance(ctx);
+    return ctx->uptime_sec;
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_uptime_ms(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN MONOTONIC MILLISECONDS SINCE START. WRAPS EVERY ~49 DAYS
+    //SO COMPARE VALUES BY SIGNED DIFFERENCE
+
+    _esp8266_ntp_clock_advance(ctx);
+    return (ctx->uptime_sec * 1000) + (ctx->uptime_usec / 1000);
+}
+
+uint64_t _esp8266_ntp_now64(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE SOFTWARE CLOCK AS A 64 BIT NTP TIMESTAMP
+    //(SECONDS << 32 | FRACTION)
+
+    uint32_t sec, frac;
+
+    ESP8266_NTP_NowCtx(ctx, &sec, &frac);
+    return ((uint64_t)sec << 32) | frac;
+}
+
+uint64_t _esp8266_ntp_now_secs(ESP8266_NTP_CONTEXT* ctx, int64_t offset_us)
+{
+    //RETURN ERA EXTENDED SECONDS OF THE SOFTWARE CLOCK PLUS A SIGNED
+    //OFFSET. THE ARITHMETIC SHIFT FLOORS NEGATIVE SUMS
+
+    int64_t q32;
+
+    _esp8266_ntp_clock_advance(ctx);
+    q32 = _esp8266_ntp_us_to_q32((int64_t)ctx->clock_usec + offset_us);
+    return ctx->clock_sec + (uint64_t)(q32 >> 32);
+}
+
+uint64_t _esp8266_ntp_era_extend(uint32_t seconds, uint64_t reference)
+{
+    //PLACE 32 BIT NTP SECONDS IN THE ERA THAT PUTS THEM CLOSEST TO AN
+    //ERA EXTENDED REFERENCE (WITHIN -2^31 .. 2^31 - 1 SECONDS). BRANCH FREE
+
+    return reference + (uint64_t)(int64_t)(int32_t)(seconds - (uint32_t)reference);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_live_add(ESP8266_NTP_CONTEXT* ctx)
+{
+    //LINK A NEWLY CREATED INSTANCE INTO THE LIVE LIST. THE FIRST ONE
+    //STARTS THE HOUSEKEEPING TIMER
+
+    if(_esp8266_ntp_live_head == NULL)
+    {
+        os_timer_disarm(&_esp8266_ntp_tick_timer);
+        os_timer_setfn(&_esp8266_ntp_tick_timer, _esp8266_ntp_tick_timer_cb, NULL);
+        os_timer_arm(&_esp8266_ntp_tick_timer, NTP_TICK_HOUSEKEEPING_MS, 1);
+    }
+    ctx->next_live = _esp8266_ntp_live_head;
+    _esp8266_ntp_live_head = ctx;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_live_remove(ESP8266_NTP_CONTEXT* ctx)
+{
+    //UNLINK A DESTROYED INSTANCE FROM THE LIVE LIST
+
+    ESP8266_NTP_CONTEXT** p;
+
+    for(p = &_esp8266_ntp_live_head; *p != NULL; p = &(*p)->next_live)
+    {
+        if(*p == ctx)
+        {
+            *p = ctx->next_live;
+            break;
+        }
+    }
+    ctx->next_live = NULL;
+
+    if(_esp8266_ntp_live_head == NULL)
+    {
+        os_timer_disarm(&_esp8266_ntp_tick_timer);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_tick_timer_cb(void* arg)
+{
+    //HOUSEKEEPING. READ EVERY LIVE CLOCK SO NO TICK WRAP GOES UNSEEN
+
+    ESP8266_NTP_CONTEXT* ctx;
+
+    (void)arg;
+    for(ctx = _esp8266_ntp_live_head; ctx != NULL; ctx = ctx->next_live)
+    {
+        _esp8266_ntp_clock_advance(ctx);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_leap_arm(ESP8266_NTP_CONTEXT* ctx, uint8_t leap)
+{
+    //TRACK THE LEAP ANNOUNCED BY THE SELECTED SERVER. IT TAKES EFFECT
+    //AT THE END OF THE CURRENT UTC MONTH. A WITHDRAWN ANNOUNCEMENT IS
+    //DROPPED UNLESS THE CLOCK HAS ALREADY STARTED APPLYING IT
+
+    ESP8266_NTP_DATA utc;
+    uint64_t midnight;
+
+    //SERVERS MAY KEEP ANNOUNCING A LEAP FOR A WHILE AFTER IT. THAT IS NOT
+    //A NEW ONE AT THE END OF THIS MONTH, SO WAIT FOR A CLEARED INDICATOR
+    if(ctx->leap_stale)
+    {
+        if(leap == ESP8266_NTP_LEAP_NONE)
+        {
+            ctx->leap_stale = 0;
+        }
+        return;
+    }
+
+    if(leap == ctx->leap || ctx->leap_applied_us != 0 || !ctx->clock_valid)
+    {
+        return;
+    }
+
+    ctx->data.leap = (ESP8266_NTP_LEAP)leap;
+    if(leap == ESP8266_NTP_LEAP_NONE)
+    {
+        ctx->leap = leap;
+        return;
+    }
+
+    //leap_at MUST BE SET BEFORE leap, THE CLOCK ADVANCE ACTS ON IT
+    _esp8266_ntp_clock_advance(ctx);
+    _esp8266_ntp_secs_to_fields(ctx->clock_sec, &utc);
+    midnight = ctx->clock_sec - ((uint32_t)utc.hour * 3600 + (uint32_t)utc.min * 60 + utc.sec);
+    ctx->leap_at = midnight + (uint64_t)(_esp8266_ntp_month_length(utc.month_num, utc.year) - utc.date + 1) * 86400;
+    ctx->leap = leap;
+
+    NTP_LOG_INFO(LEAP_ARMED, ctx->server_counter, leap, (int32_t)(ctx->leap_at - ctx->clock_sec));
+}
+
+void _esp8266_ntp_leap_update(ESP8266_NTP_CONTEXT* ctx)
+{
+    //BRING THE LEAP CORRECTION IN THE CLOCK UPTO WHAT IS DUE NOW
+    //TIMES ARE TAKEN ON THE UNCORRECTED (PRE LEAP) TIMESCALE
+    //INSERT SETS THE CLOCK BACK 1 S, DELETE SETS IT FORWARD 1 S
+
+    int32_t full = (ctx->leap == ESP8266_NTP_LEAP_INSERT) ? -(int32_t)NTP_USEC_PER_SEC : (int32_t)NTP_USEC_PER_SEC;
+    int64_t t_us = (int64_t)(ctx->clock_sec - ctx->leap_at) * (int64_t)NTP_USEC_PER_SEC +
+                    (int64_t)ctx->clock_usec - ctx->leap_applied_us;
+    int32_t due;
+
+    if(ctx->leap_mode == ESP8266_NTP_LEAP_MODE_SMEAR)
+    {
+        //LINEAR FROM leap_at - smear/2 TO leap_at + smear/2
+        int64_t window_us = (int64_t)ctx->leap_smear_s * (int64_t)NTP_USEC_PER_SEC;
+        int64_t elapsed_us = t_us + (window_us >> 1);
+
+        if(elapsed_us <= 0)
+        {
+            return;
+        }
+        due = (elapsed_us >= window_us) ? full : (int32_t)((elapsed_us * full) / window_us);
+    }
+    else
+    {
+        //INSERT REPEATS 23:59:59, DELETE SKIPS IT
+        int64_t at_us = (ctx->leap == ESP8266_NTP_LEAP_DELETE) ? -(int64_t)NTP_USEC_PER_SEC : 0;
+
+        if(t_us < at_us)
+        {
+            return;
+        }
+        due = full;
+    }
+
+    _esp8266_ntp_clock_adjust(ctx, due - ctx->leap_applied_us);
+    ctx->leap_applied_us = due;
+
+    if(due == full)
+    {
+        NTP_LOG_INFO(LEAP_APPLIED, 0, ctx->leap, 0);
+        ctx->leap = ESP8266_NTP_LEAP_NONE;
+        ctx->leap_stale = 1;
+        ctx->leap_applied_us = 0;
+        ctx->data.leap = ESP8266_NTP_LEAP_NONE;
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_leap_guard(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN 1 IF THE CLOCK IS CLOSE ENOUGH TO THE LAST ARMED LEAP THAT
+    //A SAMPLE MAY STRADDLE IT OR THE SMEAR
+
+    uint32_t guard_s = NTP_LEAP_GUARD_S;
+    int64_t distance = (int64_t)(ctx->clock_sec - ctx->leap_at);
+
+    if(ctx->leap_at == 0)
+    {
+        return 0;
+    }
+    if(ctx->leap_mode == ESP8266_NTP_LEAP_MODE_SMEAR)
+    {
+        guard_s += ctx->leap_smear_s >> 1;
+    }
+    return (distance > -(int64_t)guard_s && distance < (int64_t)guard_s);
+}
+
+uint16_t ICACHE_FLASH_ATTR _esp8266_ntp_alarm_add(ESP8266_NTP_CONTEXT* ctx, uint8_t kind, uint64_t at, uint32_t period_s, uint8_t days, void (*cb)(uint16_t, void*), void* arg)
+{
+    //TAKE AN ALARM FROM THE POOL AND SCHEDULE IT. O(1) : THE FREE LIST
+    //FIRST, THEN NEVER USED ENTRIES ABOVE THE HIGH WATER MARK
+
+    ESP8266_NTP_ALARM* alarm;
+    uint16_t id = ctx->alarm_free;
+
+    if(id != 0)
+    {
+        ctx->alarm_free = ctx->alarms[id - 1].next;
+    }
+    else if(ctx->alarm_used < NTP_MAX_ALARMS)
+    {
+        id = ++ctx->alarm_used;
+    }
+    else
+    {
+        NTP_LOG_WARN(ALARM_FULL, 0, NTP_MAX_ALARMS, 0);
+        return 0;
+    }
+
+    alarm = &ctx->alarms[id - 1];
+    alarm->at = at;
+    alarm->period_s = period_s;
+    alarm->kind = kind;
+    alarm->days = days;
+    alarm->cb = cb;
+    alarm->arg = arg;
+    ctx->alarm_count++;
+
+    if(!ctx->alarm_running)
+    {
+        //TIMES ARE WORKED OUT WHEN THE WHEEL STARTS ON A SYNCED CLOCK
+        _esp8266_ntp_alarm_link(ctx, NTP_ALARM_LIST_HOLD, id);
+    }
+    else
+    {
+        uint64_t now = _esp8266_ntp_now_secs(ctx, 0);
+
+        //THE WHEEL MAY LAG THE CLOCK BY UPTO A TICK
+        if(now < ctx->alarm_now)
+        {
+            now = ctx->alarm_now;
+        }
+        if(kind != ESP8266_NTP_ALARM_ONCE)
+        {
+            alarm->at = _esp8266_ntp_alarm_next(ctx, alarm, now);
+        }
+        else if(alarm->at <= ctx->alarm_now)
+        {
+            alarm->at = ctx->alarm_now + 1;
+        }
+        _esp8266_ntp_alarm_insert(ctx, id);
+    }
+
+    _esp8266_ntp_alarm_arm(ctx);
+    return id;
+}
+
+void _esp8266_ntp_alarm_link(ESP8266_NTP_CONTEXT* ctx, uint16_t list, uint16_t id)
+{
+    //PUSH AN ALARM ON THE FRONT OF A LIST
+
+    ESP8266_NTP_ALARM* alarm = &ctx->alarms[id - 1];
+    uint16_t head = ctx->alarm_lists[list];
+
+    alarm->list = list;
+    alarm->prev = 0;
+    alarm->next = head;
+    if(head != 0)
+    {
+        ctx->alarms[head - 1].prev = id;
+    }
+    ctx->alarm_lists[list] = id;
+}
+
+void _esp8266_ntp_alarm_unlink(ESP8266_NTP_CONTEXT* ctx, uint16_t id)
+{
+    //REMOVE AN ALARM FROM WHATEVER LIST IT IS ON
+
+    ESP8266_NTP_ALARM* alarm = &ctx->alarms[id - 1];
+
+    if(alarm->prev != 0)
+    {
+        ctx->alarms[alarm->prev - 1].next = alarm->next;
+    }
+    else
+    {
+        ctx->alarm_lists[alarm->list] = alarm->next;
+    }
+    if(alarm->next != 0)
+    {
+        ctx->alarms[alarm->next - 1].prev = alarm->prev;
+    }
+}
+
+void _esp8266_ntp_alarm_insert(ESP8266_NTP_CONTEXT* ctx, uint16_t id)
+{
+    //HASH AN ALARM (at >= alarm_now) INTO THE LOWEST LEVEL WHOSE SPAN
+    //COVERS IT. THE SLOT IS PICKED FROM THE ABSOLUTE TIME SO IT IS
+    //CASCADED EXACTLY WHEN THE WHEEL REACHES THE START OF ITS RANGE
+
+    uint64_t at = ctx->alarms[id - 1].at;
+    uint64_t delta = at - ctx->alarm_now;
+    uint16_t list = NTP_ALARM_LIST_FAR;
+    uint8_t level;
+
+    for(level = 0; level < NTP_ALARM_WHEEL_LEVELS; level++)
+    {
+        if(delta < (1ULL << (NTP_ALARM_WHEEL_BITS * (level + 1))))
+        {
+            list = (level * NTP_ALARM_WHEEL_SLOTS) +
+                    (uint16_t)((at >> (NTP_ALARM_WHEEL_BITS * level)) & (NTP_ALARM_WHEEL_SLOTS - 1));
+            break;
+        }
+    }
+    _esp8266_ntp_alarm_link(ctx, list, id);
+}
+
+void _esp8266_ntp_alarm_cascade(ESP8266_NTP_CONTEXT* ctx, uint16_t list)
+{
+    //RE-HASH EVERY ALARM OF A LIST AGAINST THE CURRENT WHEEL TIME
+
+    uint16_t id = ctx->alarm_lists[list];
+    uint16_t next;
+
+    ctx->alarm_lists[list] = 0;
+    while(id != 0)
+    {
+        next = ctx->alarms[id - 1].next;
+        _esp8266_ntp_alarm_insert(ctx, id);
+        id = next;
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_fire(ESP8266_NTP_CONTEXT* ctx, uint16_t id)
+{
+    //FIRE AN UNLINKED ALARM. A ONE SHOT ALARM IS FREED AND A RECURRING
+    //ONE RESCHEDULED BEFORE THE CALLBACK, SO THE CALLBACK MAY CANCEL OR
+    //ADD ALARMS
+
+    ESP8266_NTP_ALARM* alarm = &ctx->alarms[id - 1];
+    void (*cb)(uint16_t, void*) = alarm->cb;
+    void* arg = alarm->arg;
+
+    if(alarm->kind == ESP8266_NTP_ALARM_ONCE)
+    {
+        alarm->kind = ESP8266_NTP_ALARM_FREE;
+        alarm->next = ctx->alarm_free;
+        ctx->alarm_free = id;
+        ctx->alarm_count--;
+    }
+    else
+    {
+        alarm->at = _esp8266_ntp_alarm_next(ctx, alarm, ctx->alarm_now);
+        _esp8266_ntp_alarm_insert(ctx, id);
+    }
+
+    if(cb != NULL)
+    {
+        (*cb)(id, arg);
+    }
+    else if(ctx->alarm_cb != NULL)
+    {
+        (*ctx->alarm_cb)();
+    }
+}
+
+uint64_t ICACHE_FLASH_ATTR _esp8266_ntp_alarm_next(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_ALARM* alarm, uint64_t after)
+{
+    //RETURN THE FIRST FIRING OF A RECURRING ALARM LATER THAN after
+
+    uint64_t day;
+    uint64_t local;
+    uint64_t utc;
+    int32_t offset;
+    int32_t check;
+    uint8_t i;
+
+    if(alarm->kind == ESP8266_NTP_ALARM_EVERY)
+    {
+        return after - (after % alarm->period_s) + alarm->period_s;
+    }
+
+    //DAILY. 1900-01-01 (LOCAL DAY 0) WAS A MONDAY. THE OFFSET IS TAKEN
+    //AGAIN AT THE CANDIDATE IN CASE A DST CHANGE LIES IN BETWEEN. A
+    //LOCAL TIME IN THE GAP OF A CHANGE HAS NO CONSISTENT OFFSET AND IS
+    //READ WITH THE OFFSET BEFORE IT (ONE HOUR LATE). IN THE OVERLAP THE
+    //FIRST OCCURRENCE IS TAKEN
+    offset = _esp8266_ntp_tz_offset(&ctx->tz, after);
+    day = (after + (uint64_t)(int64_t)offset) / 86400;
+    for(i = 0; i < 8; i++, day++)
+    {
+        if(!(alarm->days & (1 << ((day + 1) % 7))))
+        {
+            continue;
+        }
+        local = (day * 86400) + alarm->period_s;
+        check = _esp8266_ntp_tz_offset(&ctx->tz, local - (uint64_t)(int64_t)offset);
+        utc = local - (uint64_t)(int64_t)check;
+        check = _esp8266_ntp_tz_offset(&ctx->tz, utc);
+        utc = local - (uint64_t)(int64_t)check;
+        if(utc > after)
+        {
+            return utc;
+        }
+    }
+    return after + 86400;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_rehash(ESP8266_NTP_CONTEXT* ctx, uint64_t now)
+{
+    //(RE)START THE WHEEL AT now FROM THE ABSOLUTE ALARM TIMES. ALARMS
+    //A STEP FORWARD SKIPPED FIRE ONCE (RECURRING ONES DO NOT REPLAY
+    //EVERY MISSED PERIOD). A STEP BACK RECOMPUTES RECURRING ALARMS FROM
+    //THE NEW TIME. O(POOL), ONLY ON START AND CLOCK STEPS
+
+    ESP8266_NTP_ALARM* alarm;
+    int32_t jump = ctx->alarm_running ? (int32_t)(int64_t)(now - ctx->alarm_now) : 0;
+    uint16_t id;
+    uint16_t due = 0;
+
+    os_memset(ctx->alarm_lists, 0, sizeof(ctx->alarm_lists));
+    ctx->alarm_now = now;
+    ctx->alarm_running = 1;
+
+    for(id = 1; id <= ctx->alarm_used; id++)
+    {
+        alarm = &ctx->alarms[id - 1];
+        if(alarm->kind == ESP8266_NTP_ALARM_FREE)
+        {
+            continue;
+        }
+        if(alarm->at == 0 || (jump < 0 && alarm->kind != ESP8266_NTP_ALARM_ONCE))
+        {
+            alarm->at = _esp8266_ntp_alarm_next(ctx, alarm, now);
+        }
+        if(alarm->at <= now)
+        {
+            _esp8266_ntp_alarm_link(ctx, NTP_ALARM_LIST_HOLD, id);
+            due++;
+        }
+        else
+        {
+            _esp8266_ntp_alarm_insert(ctx, id);
+        }
+    }
+
+    NTP_LOG_INFO(ALARM_REHASH, 0, (int16_t)due, jump);
+
+    while((id = ctx->alarm_lists[NTP_ALARM_LIST_HOLD]) != 0)
+    {
+        _esp8266_ntp_alarm_unlink(ctx, id);
+        _esp8266_ntp_alarm_fire(ctx, id);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_run(ESP8266_NTP_CONTEXT* ctx)
+{
+    //BRING THE WHEEL UPTO THE SOFTWARE CLOCK ONE SECOND AT A TIME,
+    //CASCADING HIGHER LEVELS AS LOWER ONES WRAP AND FIRING THE LEVEL 0
+    //SLOT OF EACH SECOND. SLEW AND SMALL STEPS FORWARD ARE WALKED, OTHER
+    //JUMPS RE-HASH
+
+    uint64_t now;
+    uint64_t s;
+    uint16_t slot;
+    uint16_t id;
+    uint8_t level;
+
+    if(!ctx->clock_valid)
+    {
+        return;
+    }
+
+    now = _esp8266_ntp_now_secs(ctx, 0);
+    if(!ctx->alarm_running || now < ctx->alarm_now || (now - ctx->alarm_now) > NTP_ALARM_CATCHUP_S)
+    {
+        _esp8266_ntp_alarm_rehash(ctx, now);
+        return;
+    }
+
+    while(ctx->alarm_now < now)
+    {
+        s = ++ctx->alarm_now;
+
+        for(level = 1; level < NTP_ALARM_WHEEL_LEVELS; level++)
+        {
+            if((s & ((1ULL << (NTP_ALARM_WHEEL_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+            _esp8266_ntp_alarm_cascade(ctx, (level * NTP_ALARM_WHEEL_SLOTS) +
+                                        (uint16_t)((s >> (NTP_ALARM_WHEEL_BITS * level)) & (NTP_ALARM_WHEEL_SLOTS - 1)));
+        }
+        if((s & ((1ULL << (NTP_ALARM_WHEEL_BITS * NTP_ALARM_WHEEL_LEVELS)) - 1)) == 0)
+        {
+            _esp8266_ntp_alarm_cascade(ctx, NTP_ALARM_LIST_FAR);
+        }
+
+        slot = (uint16_t)(s & (NTP_ALARM_WHEEL_SLOTS - 1));
+        while((id = ctx->alarm_lists[slot]) != 0)
+        {
+            _esp8266_ntp_alarm_unlink(ctx, id);
+            _esp8266_ntp_alarm_fire(ctx, id);
+        }
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_arm(ESP8266_NTP_CONTEXT* ctx)
+{
+    //ARM THE ALARM TICK TO EXPIRE JUST AFTER THE NEXT SECOND OF THE
+    //SOFTWARE CLOCK, OR EVERY SECOND UNTIL THE CLOCK IS SYNCED
+
+    uint32_t ms = 1000;
+
+    if(ctx->alarm_armed || ctx->alarm_count == 0)
+    {
+        return;
+    }
+
+    if(ctx->clock_valid)
+    {
+        _esp8266_ntp_clock_advance(ctx);
+        ms = ((NTP_USEC_PER_SEC - ctx->clock_usec) / 1000) + 1;
+    }
+
+    os_timer_setfn(&ctx->alarm_timer, _esp8266_ntp_alarm_timer_cb, ctx);
+    os_timer_arm(&ctx->alarm_timer, ms, 0);
+    ctx->alarm_armed = 1;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_timer_cb(void* arg)
+{
+    //ALARM TICK. RUN THE WHEEL AND RE-ARM WHILE ANY ALARM IS SET
+
+    ESP8266_NTP_CONTEXT* ctx = (ESP8266_NTP_CONTEXT*)arg;
+
+    ctx->alarm_armed = 0;
+    _esp8266_ntp_alarm_run(ctx);
+    _esp8266_ntp_alarm_arm(ctx);
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_error_bound(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RETURN THE SOFTWARE CLOCK ERROR BOUND (US, SATURATED) : THE BOUND
+    //AT THE LAST SYNC / RESTORE, GROWN AT THE TICK TOLERANCE, PLUS ANY
+    //OFFSET STILL BEING SLEWED OUT
+
+    uint64_t bound;
+
+    if(!ctx->clock_valid)
+    {
+        return 0xFFFFFFFFUL;
+    }
+
+    bound = (uint64_t)ctx->error_us +
+            ((uint64_t)(_esp8266_ntp_uptime(ctx) - ctx->error_ref_sec) * NTP_CLOCK_TOLERANCE_PPM) +
+            (uint64_t)((ctx->clock_slew_us < 0) ? -(int64_t)ctx->clock_slew_us : ctx->clock_slew_us);
+    return (bound > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)bound;
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_crc32(const void* buf, uint16_t length)
+{
+    //RETURN THE CRC-32 (IEEE 802.3) OF A BUFFER. BITWISE, NO TABLE :
+    //ONLY RUN ON SNAPSHOT SAVE / RESTORE
+
+    const uint8_t* p = (const uint8_t*)buf;
+    uint32_t crc = 0xFFFFFFFFUL;
+    uint8_t bit;
+
+    while(length--)
+    {
+        crc ^= *p++;
+        for(bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_serve_refresh(ESP8266_NTP_CONTEXT* ctx)
+{
+    //REBUILD THE SNTP REPLY TEMPLATE FROM THE SYNC SOURCE AND DECIDE IF
+    //THE CLOCK IS FIT TO SERVE. ROOT DISPERSION GROWS WITH THE ERROR BOUND
+
+    ESP8266_NTP_HEADER* hdr = (ESP8266_NTP_HEADER*)_esp8266_ntp_serve_template;
+    uint32_t bound = _esp8266_ntp_error_bound(ctx);
+    uint32_t disp = _esp8266_ntp_us_to_q16(bound);
+
+    _esp8266_ntp_serve_sec = _esp8266_ntp_uptime(ctx);
+    _esp8266_ntp_serve_valid = 1;
+    _esp8266_ntp_serve_fit = (ctx->ref_stratum != 0 && ctx->ref_stratum < NTP_MAX_STRATUM &&
+                                bound <= NTP_SERVE_MAX_ERROR_US);
+    if(!_esp8266_ntp_serve_fit)
+    {
+        return;
+    }
+
+    os_memset(_esp8266_ntp_serve_template, 0, NTP_PACKET_SIZE);
+    _esp8266_ntp_serve_li_mode = NTP_LI_VN_MODE(ctx->leap, 0, NTP_MODE_SERVER);
+    hdr->stratum = ctx->ref_stratum + 1;
+    hdr->precision = NTP_SERVE_PRECISION;
+    _esp8266_ntp_write_u32(hdr->root_delay, ctx->ref_root_delay);
+    _esp8266_ntp_write_u32(hdr->root_dispersion, (ctx->ref_root_dispersion > ~disp) ? 0xFFFFFFFFUL : (ctx->ref_root_dispersion + disp));
+    os_memcpy(hdr->reference_id, &ctx->ref_id, 4);
+    _esp8266_ntp_write_ts(hdr->reference_ts, ctx->ref_time);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_serve_recv_cb(char* data, uint16_t length, void* peer, uint32_t rx_tick)
+{
+    //ANSWER ONE CLIENT REQUEST. THE RECEIVE TIMESTAMP IS TAKEN FIRST AND
+    //BACKED UP TO THE ARRIVAL TICK, THE TRANSMIT TIMESTAMP LAST
+
+    ESP8266_NTP_CONTEXT* ctx = _esp8266_ntp_serve_ctx;
+    ESP8266_NTP_HEADER* reply = (ESP8266_NTP_HEADER*)_esp8266_ntp_serve_template;
+    const ESP8266_NTP_HEADER* req;
+    uint64_t t2;
+
+    if(ctx == NULL)
+    {
+        return;
+    }
+
+    t2 = _esp8266_ntp_now64(ctx);
+    if((ctx->clock_ref_tick - rx_tick) < NTP_USEC_PER_SEC)
+    {
+        t2 -= (uint64_t)_esp8266_ntp_us_to_q32(ctx->clock_ref_tick - rx_tick);
+    }
+    _esp8266_ntp_serve_stats.requests++;
+
+    req = ESP8266_NTP_HeaderView(data, length);
+    if(req == NULL || NTP_HDR_MODE(req) != NTP_MODE_CLIENT || NTP_HDR_VN(req) < 1 || NTP_HDR_VN(req) > 4)
+    {
+        _esp8266_ntp_serve_stats.invalid++;
+        NTP_LOG_DEBUG(SERVE_DROP, 0, 0, 0);
+        return;
+    }
+
+    if(!_esp8266_ntp_serve_valid || _esp8266_ntp_serve_sec != _esp8266_ntp_uptime(ctx))
+    {
+        _esp8266_ntp_serve_refresh(ctx);
+    }
+    if(!ctx->clock_valid || !_esp8266_ntp_serve_fit)
+    {
+        _esp8266_ntp_serve_stats.unsynced++;
+        NTP_LOG_DEBUG(SERVE_DROP, 0, 1, 0);
+        return;
+    }
+
+    //THE REPLY CARRIES THE VERSION OF THE REQUEST (RFC 4330 SECTION 5)
+    reply->li_vn_mode = _esp8266_ntp_serve_li_mode | (req->li_vn_mode & 0x38);
+    reply->poll = req->poll;
+    os_memcpy(reply->originate_ts, req->transmit_ts, 8);
+    _esp8266_ntp_write_ts(reply->receive_ts, t2);
+    _esp8266_ntp_write_ts(reply->transmit_ts, _esp8266_ntp_now64(ctx));
+
+    _esp8266_ntp_listener->reply(peer, _esp8266_ntp_serve_template, NTP_PACKET_SIZE);
+    _esp8266_ntp_serve_stats.answered++;
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_us_to_q16(uint64_t us)
+{
+    //CONVERT MICROSECONDS TO 16.16 FIXED POINT SECONDS (SATURATED)
+
+    uint64_t q16 = (us << 16) / NTP_USEC_PER_SEC;
+
+    return (q16 > 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)q16;
+}
+
+int64_t ICACHE_FLASH_ATTR _esp8266_ntp_q32_to_us(int64_t q32)
+{
+    //CONVERT A SIGNED 32.32 FIXED POINT SECONDS VALUE TO MICROSECONDS
+
+    return (q32 >> 32) * (int64_t)NTP_USEC_PER_SEC +
+            (int64_t)(((uint64_t)(q32 & 0xFFFFFFFFLL) * NTP_USEC_PER_SEC) >> 32);
+}
+
+int64_t ICACHE_FLASH_ATTR _esp8266_ntp_us_to_q32(int64_t us)
+{
+    //CONVERT SIGNED MICROSECONDS TO A 32.32 FIXED POINT SECONDS VALUE
+
+    int64_t sec = us / (int64_t)NTP_USEC_PER_SEC;
+    int64_t rem = us % (int64_t)NTP_USEC_PER_SEC;
+
+    return (sec * 4294967296LL) + ((rem * 4294967296LL) / (int64_t)NTP_USEC_PER_SEC);
+}
+
+uint32_t _esp8266_ntp_read_u32(const uint8_t* buf)
+{
+    //READ A BIG ENDIAN 32 BIT VALUE FROM AN NTP PACKET
+
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+void _esp8266_ntp_write_ts(uint8_t* ts, uint64_t val)
+{
+    //WRITE A 64 BIT NTP TIMESTAMP INTO AN NTP PACKET
+
+    _esp8266_ntp_write_u32(&ts[0], (uint32_t)(val >> 32));
+    _esp8266_ntp_write_u32(&ts[4], (uint32_t)val);
+}
+
+void _esp8266_ntp_write_u32(uint8_t* buf, uint32_t val)
+{
+    //WRITE A BIG ENDIAN 32 BIT VALUE INTO AN NTP PACKET
+
+    buf[0] = (uint8_t)(val >> 24);
+    buf[1] = (uint8_t)(val >> 16);
+    buf[2] = (uint8_t)(val >> 8);
+    buf[3] = (uint8_t)val;
+}
+
+void _esp8266_ntp_log(uint8_t id, uint8_t server, int16_t a, int32_t b)
+{
+    //APPEND A LOG RECORD TO THE RING. ONLY REACHED THROUGH THE
+    //NTP_LOG_* MACROS OF ENABLED LEVELS
+
+#if NTP_LOG_LEVEL > NTP_LOG_LEVEL_NONE
+    uint16_t head = _esp8266_ntp_log_head;
+    uint16_t next = (head + 1) & (NTP_LOG_RING_SIZE - 1);
+    ESP8266_NTP_LOG_RECORD* rec = &_esp8266_ntp_log_ring[head];
+
+    if(next == _esp8266_ntp_log_tail)
+    {
+        _esp8266_ntp_log_dropped++;
+        return;
+    }
+
+    rec->tick_us = _esp8266_ntp_tick_us_fn();
+    rec->id = id;
+    rec->server = server;
+    rec->a = a;
+    rec->b = b;
+
+    //PUBLISH ONLY ONCE THE RECORD IS COMPLETE
+    _esp8266_ntp_log_head = next;
+
+#if NTP_LOG_PRINT
+    os_printf("ESP8266 : NTP : log %d server %d %d %d\n", id, server, a, b);
+#endif
+#else
+    (void)id;
+    (void)server;
+    (void)a;
+    (void)b;
+#endif
+}
+
+void _esp8266_ntp_hist_add(uint16_t* hist, uint32_t value)
+{
+    //COUNT value IN ITS LOG2 BUCKET (SATURATING)
+
+    uint8_t b = (value == 0) ? 0 : (uint8_t)(32 - __builtin_clz(value));
+
+    if(b >= NTP_HIST_BUCKETS)
+    {
+        b = NTP_HIST_BUCKETS - 1;
+    }
+    if(hist[b] != 0xFFFF)
+    {
+        hist[b]++;
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_stats_error(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_ERROR error, uint16_t flags)
+{
+    //COUNT A FAILED QUERY AGAINST THE CURRENT SERVER
+
+    ESP8266_NTP_SERVER_STATS* st = &ctx->server_stats[ctx->server_counter - 1];
+
+    switch(error)
+    {
+        case ESP8266_NTP_ERROR_DNS:
+            st->dns_failures++;
+            break;
+        case ESP8266_NTP_ERROR_TIMEOUT:
+            st->timeouts++;
+            break;
+        default:
+            st->rejects++;
+            break;
+    }
+    st->last_error = error;
+    st->last_error_flags = flags;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_discipline_update(ESP8266_NTP_CONTEXT* ctx, int64_t offset_us)
+{
+    //FEED A NEW MEASURED CLOCK OFFSET INTO THE CLOCK DISCIPLINE
+    //LARGE OFFSETS STEP THE CLOCK. SMALL OFFSETS ARE SLEWED OUT AND
+    //USED TO REFINE THE FREQUENCY ESTIMATE (FLL) AND POLL INTERVAL
+
+    uint32_t local_sec;
+    uint32_t interval_s;
+
+    ESP8266_NTP_NowCtx(ctx, &local_sec, NULL);
+    interval_s = local_sec - ctx->discipline_last_sec;
+    ctx->discipline_last_sec = local_sec;
+
+    if(offset_us > NTP_STEP_THRESHOLD_US || offset_us < -NTP_STEP_THRESHOLD_US)
+    {
+        //OFFSET TOO LARGE TO SLEW. STEP AND FALL BACK TO FAST POLLING
+        NTP_LOG_INFO(CLOCK_STEP, ctx->server_counter, 0, (int32_t)(offset_us / 1000));
+        _esp8266_ntp_clock_step(ctx, offset_us);
+        ctx->discipline_last_sec = (uint32_t)ctx->clock_sec;
+        ctx->poll_exp = NTP_MIN_POLL_EXP;
+        ctx->poll_counter = 0;
+        return;
+    }
+
+    //FREQUENCY UPDATE. OFFSET ACCUMULATED OVER THE INTERVAL IS THE
+    //RESIDUAL FREQUENCY ERROR. ANY SLEW STILL PENDING IS NOT YET ERROR.
+    //OVER LESS THAN NTP_FREQ_MIN_INTERVAL_S JITTER WOULD DOMINATE
+    if(ctx->freq_hold)
+    {
+        ctx->freq_hold = 0;
+    }
+    else if(interval_s >= NTP_FREQ_MIN_INTERVAL_S)
+    {
+        int64_t residual_us = offset_us - ctx->clock_slew_us;
+        int64_t freq_err = (residual_us * 4294967296LL) / ((int64_t)interval_s * (int64_t)NTP_USEC_PER_SEC);
+        int64_t freq = (int64_t)ctx->clock_freq + (freq_err >> NTP_FREQ_GAIN_SHIFT);
+
+        if(freq > NTP_MAX_FREQ_Q32)
+        {
+            freq = NTP_MAX_FREQ_Q32;
+        }
+        else if(freq < -NTP_MAX_FREQ_Q32)
+        {
+            freq = -NTP_MAX_FREQ_Q32;
+        }
+        ctx->clock_freq = (int32_t)freq;
+    }
+
+    //PHASE UPDATE. SLEW OUT THE MEASURED OFFSET
+    ctx->clock_slew_us = (int32_t)offset_us;
+
+    //POLL INTERVAL UPDATE (HYSTERESIS COUNTER)
+    if(offset_us < NTP_POLL_ADJ_THRESHOLD_US && offset_us > -NTP_POLL_ADJ_THRESHOLD_US)
+    {
+        ctx->poll_counter += ctx->poll_exp;
+        if(ctx->poll_counter >= NTP_POLL_LIMIT)
+        {
+            ctx->poll_counter = 0;
+            if(ctx->poll_exp < NTP_MAX_POLL_EXP)
+            {
+                ctx->poll_exp++;
+            }
+        }
+    }
+    else
+    {
+        ctx->poll_counter -= (2 * ctx->poll_exp);
+        if(ctx->poll_counter <= -NTP_POLL_LIMIT)
+        {
+            ctx->poll_counter = 0;
+            if(ctx->poll_exp > NTP_MIN_POLL_EXP)
+            {
+                ctx->poll_exp--;
+            }
+        }
+    }
+
+    NTP_LOG_DEBUG(DISCIPLINE, ctx->poll_exp, (int16_t)(((int64_t)ctx->clock_freq * 10000000LL) >> 32), (int32_t)offset_us);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_schedule_next_sync(ESP8266_NTP_CONTEXT* ctx, uint8_t success)
+{
+    //ARM THE AUTO SYNC TIMER FOR THE NEXT POLL IF ENABLED
+    //FAILED SYNCS BACK OFF EXPONENTIALLY FROM THE MINIMUM POLL
+    //INTERVAL UP TO THE MAXIMUM. THE INTERVAL IS JITTERED
+
+    uint8_t exp;
+
+    if(success)
+    {
+        ctx->fail_exp = 0;
+        exp = ctx->poll_exp;
+    }
+    else
+    {
+        if(ctx->fail_exp < (NTP_MAX_POLL_EXP - NTP_MIN_POLL_EXP))
+        {
+            ctx->fail_exp++;
+        }
+        exp = NTP_MIN_POLL_EXP + ctx->fail_exp;
+    }
+
+    if(!ctx->auto_sync)
+    {
+        return;
+    }
+
+    os_timer_disarm(&ctx->poll_timer);
+    os_timer_arm(&ctx->poll_timer, _esp8266_ntp_jitter((uint32_t)(1 << exp) * 1000), 0);
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_jitter(uint32_t interval_ms)
+{
+    //RETURN interval_ms RANDOMLY SHORTENED BY UP TO HALF
+
+    uint32_t half = interval_ms >> 1;
+
+    return interval_ms - ((half != 0) ? (os_random() % half) : 0);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_poll_timer_cb(void* arg)
+{
+    //AUTO SYNC TIMER EXPIRED. START A NEW SYNC
+
+    ESP8266_NTP_GetTimeCtx((ESP8266_NTP_CONTEXT*)arg);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_convert_time_to_text(ESP8266_NTP_CONTEXT* ctx)
+{
+	//CONVERT NTP TIMESTAMP TO HUMAN READABLE TIME TEXT
+	//AND SAVE IN GLOBAL TIME STRUCTURE
+
+	//UTC OFFSET OF THE TIME ZONE AT THIS INSTANT
+	int32_t timezone_offset_seconds = _esp8266_ntp_tz_offset(&ctx->tz, ctx->data.timestamp);
+
+	_esp8266_ntp_secs_to_fields(ctx->data.timestamp + (uint64_t)(int64_t)timezone_offset_seconds, &ctx->data);
+	ctx->data.utc_offset_s = timezone_offset_seconds;
+	ctx->data.dst = ctx->tz.dst;
+	ctx->data.tz_name = ctx->tz.dst ? ctx->tz.dst_name : ctx->tz.std_name;
+	ctx->fields_valid = 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_month_length(uint8_t month_num, uint16_t year)
+{
+    //RETURN NUMBER OF DAYS IN MONTH (JANUARY = 1) OF GIVEN YEAR
+
+    if(month_num == 2 && (year & 3) == 0 && ((year % 100) != 0 || (year % 400) == 0))
+    {
+        return 29;
+    }
+    return _esp8266_ntp_days_in_month[month_num - 1];
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_days_from_civil(uint16_t year, uint8_t month, uint8_t date)
+{
+    //RETURN DAYS FROM 1900-01-01 TO A GREGORIAN DATE (YEAR >= 1900)
+    //COMPUTATIONAL CALENDAR : YEARS START ON MARCH 1 SO THE LEAP DAY
+    //IS THE LAST DAY OF THE YEAR. OFF THE HOT PATH, PLAIN DIVISIONS
+
+    uint32_t y = year - (month <= 2);
+    uint32_t m = (month > 2) ? (month - 3) : (month + 9);
+    uint32_t yoe = y % 400;
+    uint32_t doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + (((153 * m) + 2) / 5) + date - 1;
+
+    return ((y / 400) * 146097) + doe - NTP_RATA_DIE_1900;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_tz_fixed(ESP8266_NTP_TZ* tz, int32_t offset_s)
+{
+    //SET A ZONE WITH A FIXED UTC OFFSET AND NO DST. NAMED "UTC" OR
+    //NUMERICALLY ("+0530") AS TZDATA DOES FOR ZONES WITHOUT A NAME
+
+    uint32_t a = (offset_s < 0) ? (uint32_t)-offset_s : (uint32_t)offset_s;
+
+    os_memset(tz, 0, sizeof(ESP8266_NTP_TZ));
+    tz->std_offset_s = offset_s;
+    tz->dst_offset_s = offset_s;
+    if(offset_s == 0)
+    {
+        os_memcpy(tz->std_name, "UTC", 4);
+    }
+    else
+    {
+        os_sprintf(tz->std_name, "%c%02u%02u", (offset_s < 0) ? '-' : '+',
+                    (unsigned int)((a / 3600) % 100), (unsigned int)((a / 60) % 60));
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse(ESP8266_NTP_TZ* tz, const char* str)
+{
+    //COMPILE A POSIX TZ STRING. tz IS ONLY WRITTEN ON SUCCESS
+    //POSIX OFFSETS ARE WEST OF UTC, STORED OFFSETS EAST OF UTC
+
+    ESP8266_NTP_TZ t;
+    const char* p;
+    int32_t offset;
+
+    os_memset(&t, 0, sizeof(ESP8266_NTP_TZ));
+
+    p = _esp8266_ntp_tz_parse_name(str, t.std_name);
+    p = (p != NULL) ? _esp8266_ntp_tz_parse_time(p, &offset, NTP_TZ_MAX_OFFSET_S) : NULL;
+    if(p == NULL)
+    {
+        return 0;
+    }
+    t.std_offset_s = -offset;
+    t.dst_offset_s = -offset;
+
+    if(*p != '\0')
+    {
+        p = _esp8266_ntp_tz_parse_name(p, t.dst_name);
+        if(p == NULL)
+        {
+            return 0;
+        }
+
+        //DST OFFSET DEFAULTS TO ONE HOUR AHEAD OF STANDARD TIME
+        t.dst_offset_s = t.std_offset_s + 3600;
+        if(*p != ',' && *p != '\0')
+        {
+            p = _esp8266_ntp_tz_parse_time(p, &offset, NTP_TZ_MAX_OFFSET_S);
+            if(p == NULL)
+            {
+                return 0;
+            }
+            t.dst_offset_s = -offset;
+        }
+
+        if(*p == '\0')
+        {
+            p = NTP_TZ_DEFAULT_RULES;
+        }
+        if(*p++ != ',' || (p = _esp8266_ntp_tz_parse_rule(p, &t.start)) == NULL ||
+            *p++ != ',' || (p = _esp8266_ntp_tz_parse_rule(p, &t.end)) == NULL ||
+            *p != '\0')
+        {
+            return 0;
+        }
+        t.has_dst = 1;
+    }
+
+    //EMPTY CACHE, REBUILT ON THE FIRST LOOKUP
+    *tz = t;
+    return 1;
+}
+
+const char* ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse_name(const char* p, char* name)
+{
+    //PARSE A ZONE ABBREVIATION : 3+ LETTERS, OR <...> QUOTED (LETTERS,
+    //DIGITS, + AND -). RETURNS THE POSITION AFTER IT OR NULL
+
+    uint8_t quoted = (*p == '<');
+    uint8_t n = 0;
+
+    p += quoted;
+    while((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') ||
+            (quoted && ((*p >= '0' && *p <= '9') || *p == '+' || *p == '-')))
+    {
+        if(n == NTP_TZ_NAME_SIZE - 1)
+        {
+            return NULL;
+        }
+        name[n++] = *p++;
+    }
+    name[n] = '\0';
+
+    if(n < 3 || (quoted && *p++ != '>'))
+    {
+        return NULL;
+    }
+    return p;
+}
+
+const char* ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse_time(const char* p, int32_t* time_s, int32_t max_s)
+{
+    //PARSE [+|-]hh[:mm[:ss]] INTO SIGNED SECONDS, |time| <= max_s
+    //RETURNS THE POSITION AFTER IT OR NULL
+
+    int32_t sign = 1;
+    int32_t value = 0;
+    int32_t part;
+    uint8_t field, digits;
+
+    if(*p == '+' || *p == '-')
+    {
+        sign = (*p++ == '-') ? -1 : 1;
+    }
+
+    for(field = 0; field < 3; field++)
+    {
+        part = 0;
+        for(digits = 0; *p >= '0' && *p <= '9' && digits < 3; digits++)
+        {
+            part = (part * 10) + (*p++ - '0');
+        }
+        if(digits == 0 || (field != 0 && (digits != 2 || part > 59)))
+        {
+            return NULL;
+        }
+        value += part * ((field == 0) ? 3600 : (field == 1) ? 60 : 1);
+
+        if(*p != ':')
+        {
+            break;
+        }
+        p++;
+    }
+
+    if(value > max_s)
+    {
+        return NULL;
+    }
+    *time_s = sign * value;
+    return p;
+}
+
+const char* ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse_rule(const char* p, ESP8266_NTP_TZ_RULE* rule)
+{
+    //PARSE Jn, n OR Mm.w.d WITH AN OPTIONAL /time (DEFAULT 02:00:00)
+    //RETURNS THE POSITION AFTER IT OR NULL
+
+    uint16_t v[3] = {0, 0, 0};
+    uint8_t count = (*p == 'M') ? 3 : 1;
+    uint8_t i, digits;
+
+    os_memset(rule, 0, sizeof(ESP8266_NTP_TZ_RULE));
+    rule->type = (*p == 'M' || *p == 'J') ? *p++ : 'D';
+
+    for(i = 0; i < count; i++)
+    {
+        if(i != 0 && *p++ != '.')
+        {
+            return NULL;
+        }
+        for(digits = 0; *p >= '0' && *p <= '9' && digits < 3; digits++)
+        {
+            v[i] = (v[i] * 10) + (*p++ - '0');
+        }
+        if(digits == 0)
+        {
+            return NULL;
+        }
+    }
+
+    if((rule->type == 'J' && (v[0] < 1 || v[0] > 365)) ||
+        (rule->type == 'D' && v[0] > 365) ||
+        (rule->type == 'M' && (v[0] < 1 || v[0] > 12 || v[1] < 1 || v[1] > 5 || v[2] > 6)))
+    {
+        return NULL;
+    }
+    rule->day = v[0];
+    rule->month = (uint8_t)v[0];
+    rule->week = (uint8_t)v[1];
+    rule->wday = (uint8_t)v[2];
+
+    rule->time_s = 7200;
+    if(*p == '/')
+    {
+        p = _esp8266_ntp_tz_parse_time(p + 1, &rule->time_s, NTP_TZ_MAX_RULE_TIME_S);
+    }
+    return p;
+}
+
+uint64_t ICACHE_FLASH_ATTR _esp8266_ntp_tz_transition(const ESP8266_NTP_TZ_RULE* rule, uint16_t year, int32_t offset_s)
+{
+    //RETURN THE UTC (ERA EXTENDED SECONDS) A RULE FIRES IN A YEAR, GIVEN
+    //THE UTC OFFSET IN EFFECT UP TO THAT MOMENT
+
+    uint32_t days = _esp8266_ntp_days_from_civil(year, 1, 1);
+    uint32_t first;
+    uint8_t date;
+
+    if(rule->type == 'J')
+    {
+        //FEBRUARY 29 IS NEVER COUNTED
+        days += rule->day - 1 + (rule->day >= 60 && _esp8266_ntp_month_length(2, year) == 29);
+    }
+    else if(rule->type == 'D')
+    {
+        days += rule->day;
+    }
+    else
+    {
+        //FIRST WEEKDAY d OF THE MONTH, THEN w - 1 WEEKS ON. WEEK 5 IS THE
+        //LAST ONE, WHICH MAY BE THE 4TH. 1900-01-01 WAS A MONDAY
+        first = _esp8266_ntp_days_from_civil(year, rule->month, 1);
+        date = 1 + ((rule->wday + 7 - ((first + 1) % 7)) % 7) + ((rule->week - 1) * 7);
+        if(date > _esp8266_ntp_month_length(rule->month, year))
+        {
+            date -= 7;
+        }
+        days = first + date - 1;
+    }
+
+    return (uint64_t)(((int64_t)days * 86400) + rule->time_s - offset_s);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_tz_rebuild(ESP8266_NTP_TZ* tz, uint64_t utc)
+{
+    //RECOMPUTE THE OFFSET IN EFFECT AT utc AND THE SPAN IT HOLDS FOR
+    //FROM THE TRANSITIONS OF THE CURRENT AND NEXT (LOCAL) YEAR
+
+    ESP8266_NTP_DATA local;
+    uint64_t t[4];
+    uint64_t next = 0xFFFFFFFFFFFFFFFFULL;
+    uint8_t i;
+
+    if(!tz->has_dst)
+    {
+        tz->valid_from = 0;
+        tz->valid_len = 0xFFFFFFFFFFFFFFFFULL;
+        tz->offset_s = tz->std_offset_s;
+        tz->dst = 0;
+        return;
+    }
+
+    _esp8266_ntp_secs_to_fields(utc + (uint64_t)(int64_t)tz->std_offset_s, &local);
+    t[0] = _esp8266_ntp_tz_transition(&tz->start, local.year, tz->std_offset_s);
+    t[1] = _esp8266_ntp_tz_transition(&tz->end, local.year, tz->dst_offset_s);
+    t[2] = _esp8266_ntp_tz_transition(&tz->start, local.year + 1, tz->std_offset_s);
+    t[3] = _esp8266_ntp_tz_transition(&tz->end, local.year + 1, tz->dst_offset_s);
+
+    //BEFORE THIS YEAR'S TRANSITIONS THE STATE IS THE ONE LAST YEAR ENDED
+    //IN : DST FOR SOUTHERN ZONES, WHOSE DST ENDS BEFORE IT STARTS.
+    //TWO DAYS BEFORE THE LOCAL NEW YEAR IS A SAFE LOWER BOUND
+    tz->valid_from = (uint64_t)(_esp8266_ntp_days_from_civil(local.year, 1, 1) - 2) * 86400;
+    tz->dst = (t[1] < t[0]);
+
+    //THE STATE FOLLOWS THE LATEST TRANSITION AT OR BEFORE utc
+    for(i = 0; i < 4; i++)
+    {
+        if(t[i] <= utc)
+        {
+            if(t[i] >= tz->valid_from)
+            {
+                tz->valid_from = t[i];
+                tz->dst = ((i & 1) == 0);
+            }
+        }
+        else if(t[i] < next)
+        {
+            next = t[i];
+        }
+    }
+
+    tz->valid_len = next - tz->valid_from;
+    tz->offset_s = tz->dst ? tz->dst_offset_s : tz->std_offset_s;
+}
+
+int32_t _esp8266_ntp_tz_offset(ESP8266_NTP_TZ* tz, uint64_t utc)
+{
+    //RETURN THE UTC OFFSET IN EFFECT AT utc. ONE UNSIGNED COMPARE
+    //COVERS BOTH ENDS OF THE CACHED SPAN (BELOW valid_from WRAPS)
+
+    if((utc - tz->valid_from) >= tz->valid_len)
+    {
+        _esp8266_ntp_tz_rebuild(tz, utc);
+    }
+    return tz->offset_s;
+}
+
+void _esp8266_ntp_secs_to_fields(uint64_t secs, ESP8266_NTP_DATA* data)
+{
+	//DIVISION FREE ERA EXTENDED NTP SECONDS -> BROKEN DOWN TIME
+	//ALL DIVISIONS ARE MULTIPLY-SHIFT RECIPROCALS, EXHAUSTIVELY CHECKED
+	//OVER THEIR INPUT RANGE (SECS < 2^33, ERAS 0 AND 1) BY
+	//test/test_calendar.c. DATE PART IS NERI-SCHNEIDER (REFERENCE 2)
+
+	//	YEAR	(FULL, E.G. 2017)
+	//	MONTH 	(JANUARY = 1)
+	//	DATE 	(1 - 28 or 30/31 (MONTH DEPENDENT)
+	//	WEEKDAY	(SUNDAY = 0)
+	//	HOUR	(24 HOUR BASED)
+	//	MINUTE
+	//	SECOND
+
+	//DAYS = SECS / 86400 = (SECS >> 7) / 675
+	uint32_t days = (uint32_t)(((secs >> 7) * NTP_DIV675_MUL) >> NTP_DIV675_SHIFT);
+	uint32_t rem_secs = (uint32_t)(secs - ((uint64_t)days * 86400));
+
+	uint32_t hour = (rem_secs * NTP_DIV3600_MUL) >> NTP_DIV3600_SHIFT;
+	rem_secs -= hour * 3600;
+	uint32_t min = (rem_secs * NTP_DIV60_MUL) >> NTP_DIV60_SHIFT;
+	rem_secs -= min * 60;
+
+	//1900-01-01 (NTP DAY 0) WAS A MONDAY
+	uint32_t wday = days + 1;
+	wday -= 7 * (uint32_t)(((uint64_t)wday * NTP_DIV7_MUL) >> NTP_DIV7_SHIFT);
+
+	//COMPUTATIONAL CALENDAR : YEARS START ON MARCH 1 SO THE LEAP DAY
+	//IS THE LAST DAY OF THE YEAR
+	uint32_t n1 = (4 * (days + NTP_RATA_DIE_1900)) + 3;
+	uint32_t centuries = (uint32_t)(((uint64_t)n1 * NTP_DIV146097_MUL) >> NTP_DIV146097_SHIFT);
+	uint32_t n2 = (n1 - (centuries * 146097)) | 3;
+	uint64_t p2 = 2939745ULL * n2;
+	uint32_t year_of_century = (uint32_t)(p2 >> 32);
+	uint32_t day_of_year = (uint32_t)(((uint64_t)(uint32_t)p2 * NTP_DIV11758980_MUL) >> NTP_DIV11758980_SHIFT);
+	uint32_t n3 = (2141 * day_of_year) + 197913;
+	uint32_t month = n3 >> 16;
+	uint32_t date = ((n3 & 0xFFFF) * NTP_DIV2141_MUL) >> NTP_DIV2141_SHIFT;
+	uint32_t jan_feb = (day_of_year >= 306);
+
+	data->year = (100 * centuries) + year_of_century + jan_feb;
+	data->month_num = month - (12 * jan_feb);
+	data->date = date + 1;
+	data->day_num = wday;
+	data->hour = hour;
+	data->min = min;
+	data->sec = rem_secs;
+
+	//SET THE DAY AND MONTH TEXT STRING POINTERS
+	data->day_text = _esp8266_ntp_day_names[data->day_num];
+	data->month_text = _esp8266_ntp_month_names[(data->month_num - 1)];
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_format_add(ESP8266_NTP_FORMAT* fmt, uint8_t op, uint8_t arg, uint8_t max_length)
+{
+    //APPEND AN OP TO A PATTERN BEING COMPILED. RETURNS 0 IF FULL
+
+    if(fmt->count >= NTP_FORMAT_MAX_OPS)
+    {
+        return 0;
+    }
+    fmt->steps[fmt->count].op = op;
+    fmt->steps[fmt->count].arg = arg;
+    fmt->count++;
+    fmt->max_length += max_length;
+    return 1;
+}
+
+uint16_t _esp8266_ntp_format(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_FORMAT* fmt, uint64_t secs, uint32_t usec, char* buf, uint16_t size)
+{
+    //RUN A COMPILED PATTERN. THE BUFFER IS CHECKED ONCE AGAINST THE
+    //LONGEST OUTPUT, SO THE OPS COPY WITHOUT BOUNDS CHECKS. THE CALENDAR
+    //FIELDS ARE ONLY RECOMPUTED WHEN THE SECOND CHANGES
+
+    const ESP8266_NTP_FORMAT_STEP* step = fmt->steps;
+    const ESP8266_NTP_FORMAT_STEP* end = fmt->steps + fmt->count;
+    ESP8266_NTP_DATA* f = &fmt->cache;
+    const char* zone = "UTC";
+    int32_t offset_s = 0;
+    uint64_t local;
+    uint64_t u;
+    char digits[20];
+    char* p = buf;
+    uint32_t v;
+    uint8_t n;
+
+    if(size <= fmt->max_length)
+    {
+        if(size != 0)
+        {
+            buf[0] = '\0';
+        }
+        return 0;
+    }
+
+    if(!fmt->utc)
+    {
+        offset_s = _esp8266_ntp_tz_offset(&ctx->tz, secs);
+        zone = ctx->tz.dst ? ctx->tz.dst_name : ctx->tz.std_name;
+    }
+    local = secs + (uint64_t)(int64_t)offset_s;
+    if(!fmt->cache_valid || fmt->cache_sec != local)
+    {
+        _esp8266_ntp_secs_to_fields(local, f);
+        fmt->cache_sec = local;
+        fmt->cache_valid = 1;
+    }
+
+    for(; step < end; step++)
+    {
+        switch(step->op)
+        {
+            case ESP8266_NTP_FORMAT_LITERAL:
+                os_memcpy(p, &fmt->literal[step->literal], step->arg);
+                p += step->arg;
+                break;
+
+            case ESP8266_NTP_FORMAT_YEAR:
+                v = f->year / 100;
+                _NTP_FMT_2(p, v);
+                _NTP_FMT_2(p + 2, f->year - (v * 100));
+                p += 4;
+                break;
+
+            case ESP8266_NTP_FORMAT_YEAR2:
+                _NTP_FMT_2(p, f->year % 100);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_MONTH:
+                _NTP_FMT_2(p, f->month_num);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_DATE:
+                _NTP_FMT_2(p, f->date);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_DATE_SPACE:
+                _NTP_FMT_2(p, f->date);
+                if(p[0] == '0')
+                {
+                    p[0] = ' ';
+                }
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_HOUR:
+                _NTP_FMT_2(p, f->hour);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_HOUR12:
+                v = (f->hour >= 12) ? (f->hour - 12) : f->hour;
+                _NTP_FMT_2(p, (v == 0) ? 12 : v);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_AM_PM:
+                p[0] = (f->hour >= 12) ? 'P' : 'A';
+                p[1] = 'M';
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_MIN:
+                _NTP_FMT_2(p, f->min);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_SEC:
+                _NTP_FMT_2(p, f->sec);
+                p += 2;
+                break;
+
+            case ESP8266_NTP_FORMAT_DAY_NAME:
+                n = _esp8266_ntp_day_names_length[f->day_num];
+                os_memcpy(p, _esp8266_ntp_day_names[f->day_num], n);
+                p += n;
+                break;
+
+            case ESP8266_NTP_FORMAT_DAY_ABBR:
+                os_memcpy(p, _esp8266_ntp_day_names[f->day_num], 3);
+                p += 3;
+                break;
+
+            case ESP8266_NTP_FORMAT_MONTH_NAME:
+                n = _esp8266_ntp_month_names_length[f->month_num - 1];
+                os_memcpy(p, _esp8266_ntp_month_names[f->month_num - 1], n);
+                p += n;
+                break;
+
+            case ESP8266_NTP_FORMAT_MONTH_ABBR:
+                os_memcpy(p, _esp8266_ntp_month_names[f->month_num - 1], 3);
+                p += 3;
+                break;
+
+            case ESP8266_NTP_FORMAT_FRACTION:
+                //TRUNCATED, NOT ROUNDED, SO IT NEVER CARRIES INTO THE SECOND
+                v = usec / _esp8266_ntp_pow10[6 - step->arg];
+                for(n = step->arg; n != 0; n--)
+                {
+                    p[n - 1] = (char)('0' + (v % 10));
+                    v /= 10;
+                }
+                p += step->arg;
+                break;
+
+            case ESP8266_NTP_FORMAT_OFFSET:
+            case ESP8266_NTP_FORMAT_OFFSET_COLON:
+                p = _esp8266_ntp_format_offset(p, offset_s, (step->op == ESP8266_NTP_FORMAT_OFFSET_COLON));
+                break;
+
+            case ESP8266_NTP_FORMAT_ZONE:
+                n = (uint8_t)os_strlen(zone);
+                os_memcpy(p, zone, n);
+                p += n;
+                break;
+
+            case ESP8266_NTP_FORMAT_UNIX:
+                //64 BIT DIVISIONS, BUT ONLY HERE
+                if(secs < NTP_UNIX_EPOCH_OFFSET)
+                {
+                    *p++ = '-';
+                    u = NTP_UNIX_EPOCH_OFFSET - secs;
+                }
+                else
+                {
+                    u = secs - NTP_UNIX_EPOCH_OFFSET;
+                }
+                n = sizeof(digits);
+                do
+                {
+                    digits[--n] = (char)('0' + (u % 10));
+                    u /= 10;
+                } while(u != 0);
+                os_memcpy(p, &digits[n], sizeof(digits) - n);
+                p += sizeof(digits) - n;
+                break;
+        }
+    }
+
+    *p = '\0';
+    return (uint16_t)(p - buf);
+}
+
+char* _esp8266_ntp_format_offset(char* p, int32_t offset_s, uint8_t colon)
+{
+    //WRITE A UTC OFFSET AS +hhmm OR +hh:mm. RETURN THE END
+
+    uint32_t min = ((offset_s < 0) ? (uint32_t)-offset_s : (uint32_t)offset_s) / 60;
+    uint32_t hour = min / 60;
+
+    *p++ = (offset_s < 0) ? '-' : '+';
+    _NTP_FMT_2(p, hour);
+    p += 2;
+    if(colon)
+    {
+        *p++ = ':';
+    }
+    _NTP_FMT_2(p, min - (hour * 60));
+    return p + 2;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_transport_setup(void)
+{
+    //PUSH DEBUG, DNS SERVERS AND CALLBACKS TO THE TRANSPORT IN USE
+
+    ip_addr_t dns[2];
+
+    _esp8266_ntp_transport->set_debug(_esp8266_ntp_debug);
+
+    dns[0].addr = ipaddr_addr("8.8.8.8");
+    dns[1].addr = ipaddr_addr("8.8.4.4");
+    _esp8266_ntp_transport->set_dns_server(2, dns);
+
+    //SET UDP DATA CALLBACK FUNCTION
+    _esp8266_ntp_transport->set_callbacks(_esp8266_ntp_udp_data_sent_cb,
+                                            _esp8266_ntp_udp_data_recv_cb);
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_transport_acquire(ESP8266_NTP_CONTEXT* ctx)
+{
+    //TAKE OWNERSHIP OF THE UDP CLIENT FOR A SYNC. IF ANOTHER INSTANCE
+    //OWNS IT, APPEND THIS ONE TO THE PENDING FIFO AND RETURN 0
+
+    if(_esp8266_ntp_active_ctx == NULL || _esp8266_ntp_active_ctx == ctx)
+    {
+        _esp8266_ntp_active_ctx = ctx;
+        return 1;
+    }
+
+    if(!ctx->sync_pending)
+    {
+        ctx->sync_pending = 1;
+        ctx->next_pending = NULL;
+        if(_esp8266_ntp_pending_tail != NULL)
+        {
+            _esp8266_ntp_pending_tail->next_pending = ctx;
+        }
+        else
+        {
+            _esp8266_ntp_pending_head = ctx;
+        }
+        _esp8266_ntp_pending_tail = ctx;
+    }
+    return 0;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_transport_release(ESP8266_NTP_CONTEXT* ctx)
+{
+    //GIVE UP THE UDP CLIENT (OR A PENDING SLOT) AND START THE NEXT
+    //QUEUED INSTANCE IF ANY
+
+    ESP8266_NTP_CONTEXT* prev = NULL;
+    ESP8266_NTP_CONTEXT* cur = _esp8266_ntp_pending_head;
+
+    //DROP FROM THE PENDING FIFO
+    while(cur != NULL && cur != ctx)
+    {
+        prev = cur;
+        cur = cur->next_pending;
+    }
+    if(cur != NULL)
+    {
+        if(prev != NULL)
+        {
+            prev->next_pending = cur->next_pending;
+        }
+        else
+        {
+            _esp8266_ntp_pending_head = cur->next_pending;
+        }
+        if(_esp8266_ntp_pending_tail == cur)
+        {
+            _esp8266_ntp_pending_tail = prev;
+        }
+        cur->sync_pending = 0;
+        cur->next_pending = NULL;
+    }
+
+    if(_esp8266_ntp_active_ctx != ctx)
+    {
+        return;
+    }
+    _esp8266_ntp_active_ctx = NULL;
+    os_timer_disarm(&ctx->query_timer);
+
+    //HAND THE UDP CLIENT TO THE NEXT WAITING INSTANCE
+    cur = _esp8266_ntp_pending_head;
+    if(cur != NULL)
+    {
+        _esp8266_ntp_pending_head = cur->next_pending;
+        if(_esp8266_ntp_pending_head == NULL)
+        {
+            _esp8266_ntp_pending_tail = NULL;
+        }
+        cur->sync_pending = 0;
+        cur->next_pending = NULL;
+        _esp8266_ntp_active_ctx = cur;
+        _esp8266_ntp_sync_event(cur, ESP8266_NTP_EV_GRANTED);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_sync_event(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_SYNC_EVENT event)
+{
+    //SYNC STATE MACHINE TRANSITION FUNCTION. EVERY CHANGE OF SYNC STATE
+    //GOES THROUGH HERE. LOOK UP (STATE, EVENT) IN THE TRANSITION TABLE,
+    //ENTER THE NEXT STATE AND RUN ITS ACTION. ACTIONS MAY POST FURTHER
+    //EVENTS. EVENTS WITH NO TABLE ENTRY ARE IGNORED
+
+    const ESP8266_NTP_TRANSITION* t = &_esp8266_ntp_sync_table[ctx->sync_state][event];
+
+    if(t->action == NULL)
+    {
+        NTP_LOG_DEBUG(EVENT_IGNORED, ctx->server_counter, ctx->sync_state, event);
+        return;
+    }
+
+    NTP_LOG_DEBUG(SYNC_STATE, ctx->server_counter, (int16_t)((ctx->sync_state << 8) | t->next), event);
+    ctx->sync_state = t->next;
+    (t->action)(ctx);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_queue(ESP8266_NTP_CONTEXT* ctx)
+{
+    //SYNC REQUESTED. WAIT FOR THE UDP CLIENT. THE UDP CLIENT CARRIES
+    //ONE EXCHANGE AT A TIME SO IF ANOTHER INSTANCE OWNS IT, THIS ONE
+    //STAYS QUEUED UNTIL IT IS RELEASED
+
+    ctx->sync_requested = 0;
+    ctx->sync_start_ms = _esp8266_ntp_uptime_ms(ctx);
+
+    if(_esp8266_ntp_transport_acquire(ctx))
+    {
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_GRANTED);
+    }
+    else
+    {
+        NTP_LOG_INFO(TRANSPORT_BUSY, 0, 0, 0);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_begin(ESP8266_NTP_CONTEXT* ctx)
+{
+    //UDP CLIENT ACQUIRED. START THE ROUND WITH THE FIRST SERVER NOT
+    //DISABLED BY A KISS-O'-DEATH
+
+    uint8_t server_num;
+
+    ctx->retry_count = 0;
+    ctx->burst_left = _esp8266_ntp_burst_count(ctx);
+
+    //MULTI SERVER MODE COLLECTS A FRESH SAMPLE FROM EVERY SERVER
+    os_memset(ctx->samples, 0, sizeof(ctx->samples));
+    _esp8266_ntp_gather_reset(ctx);
+
+    if(_esp8266_ntp_gather_usable(ctx))
+    {
+        _esp8266_ntp_gather_schedule(ctx);
+        return;
+    }
+
+    server_num = _esp8266_ntp_next_server(ctx, 0, 0);
+    if(server_num == 0)
+    {
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_GIVE_UP);
+        return;
+    }
+    _esp8266_ntp_schedule_query(ctx, server_num);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_query(ESP8266_NTP_CONTEXT* ctx)
+{
+    //SELECTED SERVER IS DUE. POINT THE UDP CLIENT STRAIGHT AT THE
+    //CACHED IP IF THE CACHE ENTRY IS FRESH, OTHERWISE START ITS DNS
+    //RESOLVE
+
+    uint8_t server_num = ctx->server_counter;
+    ESP8266_NTP_DNS_CACHE* entry = &ctx->dns_cache[server_num - 1];
+
+    //HOLD OFF THE NEXT QUERY TO THIS SERVER
+    ctx->sched[server_num - 1].next_allowed_ms = _esp8266_ntp_uptime_ms(ctx) + NTP_MIN_QUERY_INTERVAL_MS;
+
+    if(entry->valid && (_esp8266_ntp_uptime(ctx) - entry->resolved_at) < ctx->dns_cache_ttl_s)
+    {
+        NTP_LOG_DEBUG(CACHE_HIT, server_num, 0, 0);
+        _esp8266_ntp_use_cached_ip(ctx, entry);
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_RESOLVED);
+        return;
+    }
+
+    NTP_LOG_DEBUG(DNS_START, server_num, 0, 0);
+
+    ctx->dns_start_ms = _esp8266_ntp_uptime_ms(ctx);
+    _esp8266_ntp_transport->initialize(ctx->servers[server_num - 1], NULL, NTP_PORT, ctx->reply_timeout_ms);
+    _esp8266_ntp_transport->resolve(_esp8266_ntp_server_resolved_cb);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_send(ESP8266_NTP_CONTEXT* ctx)
+{
+    //SERVER ADDRESS KNOWN. STAMP CLIENT TRANSMIT TIME (T1) AND SEND
+
+    //THE FRACTION BITS BELOW CLOCK RESOLUTION (~1 US) CARRY A RANDOM
+    //NONCE SO THE ECHOED ORIGINATE TIMESTAMP CAN NOT BE GUESSED
+    ctx->t1 = _esp8266_ntp_now64(ctx) ^ (os_random() & 0xFFF);
+    _esp8266_ntp_write_ts(((ESP8266_NTP_HEADER*)ctx->data_packet)->transmit_ts, ctx->t1);
+    ctx->sent_ms = _esp8266_ntp_uptime_ms(ctx);
+    ctx->server_stats[ctx->server_counter - 1].queries++;
+    _esp8266_ntp_transport->send(ctx->data_packet, NTP_PACKET_SIZE);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_sent(ESP8266_NTP_CONTEXT* ctx)
+{
+    //REQUEST IS ON THE WIRE. THE UDP CLIENT REPORTS THE REPLY OR
+    //A TIMEOUT
+
+    (void)ctx;
+    NTP_LOG_DEBUG(SENT, ctx->server_counter, 0, 0);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_sample(ESP8266_NTP_CONTEXT* ctx)
+{
+    //REPLY ACCEPTED AND ITS SAMPLE FILTERED. A BURST QUERIES THE SAME
+    //SERVER AGAIN, OTHERWISE THE FILTER OUTPUT IS THE RESULT
+
+    if(ctx->burst_left > 0)
+    {
+        ctx->burst_left--;
+        NTP_LOG_DEBUG(BURST, ctx->server_counter, ctx->burst_left, 0);
+        ctx->sched[ctx->server_counter - 1].next_allowed_ms = _esp8266_ntp_uptime_ms(ctx) + NTP_BURST_INTERVAL_MS;
+        _esp8266_ntp_schedule_query(ctx, ctx->server_counter);
+        return;
+    }
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_COMPLETE);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_retry(ESP8266_NTP_CONTEXT* ctx)
+{
+    //CURRENT SERVER FAILED (DNS FAIL, REPLY TIMEOUT OR REJECTED REPLY)
+
+    ctx->data.state = ESP8266_NTP_STATE_ERROR;
+    ctx->samples[ctx->server_counter - 1].valid = 0;
+    ctx->burst_left = 0;
+
+    //NO QUERY IS OUTSTANDING UNTIL THE NEXT SEND. A LATE REPLY TO
+    //THIS ONE NO LONGER MATCHES AND IS REJECTED
+    ctx->t1 = 0;
+
+    //A SEND TO A CACHED IP FAILED. FORCE A FRESH RESOLVE NEXT TIME
+    if(ctx->used_cached_ip)
+    {
+        ctx->dns_cache[ctx->server_counter - 1].valid = 0;
+        ctx->used_cached_ip = 0;
+    }
+
+    //BACK OFF FURTHER QUERIES TO THIS SERVER
+    _esp8266_ntp_server_backoff(ctx, ctx->server_counter, 0);
+
+    //CHANGE SERVER AND QUERY IT ONCE ITS BACKOFF HAS PASSED
+    if(ctx->retry_count < NTP_MAX_TRIES)
+    {
+        uint8_t next = _esp8266_ntp_next_server(ctx, ctx->server_counter, 1);
+        if(next != 0)
+        {
+            ctx->retry_count++;
+            _esp8266_ntp_schedule_query(ctx, next);
+            return;
+        }
+    }
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_GIVE_UP);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_done(ESP8266_NTP_CONTEXT* ctx)
+{
+    //A SAMPLE HAS BEEN SELECTED. DISCIPLINE THE CLOCK, UPDATE THE
+    //NTP DATA STRUCTURE AND CALL USER NTP DATA READY CALLBACK
+
+    ESP8266_NTP_SAMPLE* sample = &ctx->samples[ctx->server_counter - 1];
+
+    ctx->last_server_used = ctx->server_counter;
+    ctx->cycle_count++;
+
+    //RESET COUNTERS
+    ctx->retry_count = 0;
+
+    ctx->data.state = ESP8266_NTP_STATE_OK;
+    ctx->data.offset_us = (sample->offset_us > 2147483647LL) ? 2147483647L :
+                                    (sample->offset_us < -2147483647LL) ? -2147483647L : (int32_t)sample->offset_us;
+    ctx->data.delay_us = sample->delay_us;
+    ctx->data.jitter_us = sample->jitter_us;
+    ctx->data.dispersion_us = sample->dispersion_us;
+
+    //TIMESTAMP IS THE BEST ESTIMATE OF SERVER TIME, WHICH THE
+    //DISCIPLINE MAY STILL BE SLEWING TOWARDS
+    ctx->data.timestamp = _esp8266_ntp_now_secs(ctx, sample->offset_us);
+    if(!ctx->clock_valid)
+    {
+        //FIRST SYNC FROM A MULTI SERVER ROUND. THE OFFSET IS FROM THE
+        //UNSYNCED CLOCK, SO STEP BY IT WHATEVER ITS SIZE
+        _esp8266_ntp_clock_step(ctx, sample->offset_us);
+        ctx->clock_valid = 1;
+        ctx->discipline_last_sec = (uint32_t)ctx->clock_sec;
+    }
+    else if(!sample->fresh)
+    {
+        //THE OFFSET WAS ALREADY APPLIED. USING IT AGAIN WOULD DOUBLE IT
+        NTP_LOG_DEBUG(FILTER_HOLD, ctx->server_counter, 0, 0);
+    }
+    else if(_esp8266_ntp_leap_guard(ctx) &&
+        sample->offset_us < 2 * (int64_t)NTP_USEC_PER_SEC &&
+        sample->offset_us > -2 * (int64_t)NTP_USEC_PER_SEC)
+    {
+        NTP_LOG_DEBUG(LEAP_HOLD, ctx->server_counter, 0, 0);
+    }
+    else
+    {
+        ctx->filters[ctx->server_counter - 1].used_ms = sample->epoch_ms;
+        ctx->filters[ctx->server_counter - 1].used_valid = 1;
+        _esp8266_ntp_discipline_update(ctx, sample->offset_us);
+    }
+    _esp8266_ntp_leap_arm(ctx, sample->leap);
+    _esp8266_ntp_schedule_next_sync(ctx, 1);
+
+    //A PENDING SLEW IS ADDED TO THE BOUND AS IT IS READ
+    ctx->error_us = (ctx->data.delay_us >> 1) + ctx->data.dispersion_us;
+    ctx->error_ref_sec = _esp8266_ntp_uptime(ctx);
+
+    //SYNC SOURCE, AS ADVERTISED BY THE SNTP SERVER
+    ctx->ref_stratum = sample->stratum;
+    ctx->ref_id = ctx->dns_cache[ctx->server_counter - 1].ip.addr;
+    ctx->ref_root_delay = sample->root_delay + _esp8266_ntp_us_to_q16(sample->delay_us);
+    ctx->ref_root_dispersion = sample->root_dispersion;
+    ctx->ref_time = _esp8266_ntp_now64(ctx);
+    if(ctx == _esp8266_ntp_serve_ctx)
+    {
+        _esp8266_ntp_serve_valid = 0;
+    }
+
+    if(ctx->store_owner)
+    {
+        ESP8266_NTP_SaveCtx(ctx);
+    }
+
+    NTP_LOG_INFO(SYNC_DONE, ctx->server_counter, (int16_t)((ctx->data.delay_us > 32767000UL) ? 32767 : (ctx->data.delay_us / 1000)), ctx->data.offset_us);
+
+    //CONVERT NTP TIME TO HUMAN READABLE
+    _esp8266_ntp_convert_time_to_text(ctx);
+
+    _esp8266_ntp_sync_finish(ctx, NTP_PACKET_SIZE);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_give_up(ESP8266_NTP_CONTEXT* ctx)
+{
+    //ALL NTP TRIES DONE. NTP FAIL. CALL USERCALLBACK WITH NTP_ERROR
+
+    NTP_LOG_WARN(SYNC_FAILED, ctx->server_counter, ctx->retry_count, 0);
+    ctx->data.state = ESP8266_NTP_STATE_ERROR;
+
+    //RESET COUNTERS
+    ctx->retry_count = 0;
+
+    _esp8266_ntp_schedule_next_sync(ctx, 0);
+    _esp8266_ntp_sync_finish(ctx, 0);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_requeue(ESP8266_NTP_CONTEXT* ctx)
+{
+    //SYNC REQUESTED WHILE ONE IS RUNNING. LET THE RUNNING SYNC FINISH
+    //AND START THE REQUESTED ONE AFTER IT
+
+    ctx->sync_requested = 1;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_cancel(ESP8266_NTP_CONTEXT* ctx)
+{
+    //SYNC CANCELLED. DROP ANY DEFERRED OR OUTSTANDING QUERY AND GIVE
+    //UP THE UDP CLIENT. NO USER CALLBACK IS CALLED
+
+    os_timer_disarm(&ctx->query_timer);
+    ctx->t1 = 0;
+    ctx->used_cached_ip = 0;
+    ctx->sync_requested = 0;
+    _esp8266_ntp_gather_reset(ctx);
+    _esp8266_ntp_transport_release(ctx);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_round(ESP8266_NTP_CONTEXT* ctx)
+{
+    //MULTI SERVER ROUND IS DUE. QUERY EVERY USABLE SERVER THAT IS DUE AT
+    //ONCE. ALL ARE MARKED BEFORE THE FIRST IS ISSUED, SO A LOOKUP THAT
+    //FINISHES INSIDE lookup CAN NOT END THE ROUND EARLY
+
+    ESP8266_NTP_SERVER_SCHED* sched;
+    uint32_t now = _esp8266_ntp_uptime_ms(ctx);
+    uint8_t i;
+
+    ctx->round_queried = 0;
+    ctx->round_answered = 0;
+    ctx->grace_set = 0;
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        sched = &ctx->sched[i];
+        if(!sched->disabled && sched->pending == ESP8266_NTP_GATHER_IDLE &&
+            (int32_t)(sched->next_allowed_ms - now) <= 0)
+        {
+            sched->pending = ESP8266_NTP_GATHER_QUEUED;
+            ctx->round_queried++;
+        }
+    }
+
+    //NONE DUE (TIMER FIRED EARLY). WAIT AGAIN
+    if(ctx->round_queried == 0)
+    {
+        _esp8266_ntp_gather_schedule(ctx);
+        return;
+    }
+
+    NTP_LOG_DEBUG(ROUND, 0, ctx->round_queried, 0);
+    for(i = 0; i < ctx->total_server_count && ctx->sync_state == ESP8266_NTP_SYNC_GATHERING; i++)
+    {
+        if(ctx->sched[i].pending == ESP8266_NTP_GATHER_QUEUED)
+        {
+            _esp8266_ntp_gather_issue(ctx, i + 1);
+        }
+    }
+    if(ctx->sync_state == ESP8266_NTP_SYNC_GATHERING)
+    {
+        _esp8266_ntp_gather_check(ctx);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_sync_finish(ESP8266_NTP_CONTEXT* ctx, uint16_t length)
+{
+    //SYNC REACHED DONE OR FAILED. RELEASE THE UDP CLIENT, CALL THE USER
+    //CALLBACKS AND START A SYNC REQUESTED MEANWHILE
+
+    ctx->last_sync_ms = _esp8266_ntp_uptime_ms(ctx) - ctx->sync_start_ms;
+
+    _esp8266_ntp_transport_release(ctx);
+
+    //CALL USER CB IF NOT NULL WITH EXTRACTED DATA IN STRUCTURE
+    //(0 LENGTH ON FAILURE)
+    if(ctx->data_ready_user_cb != NULL)
+    {
+        (ctx->data_ready_user_cb)(&ctx->data, length);
+    }
+    if(ctx->data_ready_ctx_cb != NULL)
+    {
+        (ctx->data_ready_ctx_cb)(ctx, &ctx->data, length, ctx->user_arg);
+    }
+
+    if(ctx->sync_requested)
+    {
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_START);
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_next_server(ESP8266_NTP_CONTEXT* ctx, uint8_t after, uint8_t wrap)
+{
+    //RETURN THE FIRST USABLE SERVER NUMBER (1 BASED) AFTER SERVER
+    //after, WRAPPING AROUND TO SERVER 1 IF wrap IS SET. 0 IF NONE
+
+    uint8_t i;
+    uint8_t n = after;
+
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        n++;
+        if(n > ctx->total_server_count)
+        {
+            if(!wrap)
+            {
+                return 0;
+            }
+            n = 1;
+        }
+        if(!ctx->sched[n - 1].disabled)
+        {
+            return n;
+        }
+    }
+    return 0;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_schedule_query(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num)
+{
+    //QUERY SCHEDULER. EVERY OUTGOING QUERY PASSES THROUGH HERE
+    //SELECT NTP SERVER (1 BASED) AND POST EV_DUE NOW, OR ONCE ITS
+    //BACKOFF / MINIMUM QUERY INTERVAL HAS PASSED
+
+    int32_t wait_ms = (int32_t)(ctx->sched[server_num - 1].next_allowed_ms - _esp8266_ntp_uptime_ms(ctx));
+
+    ctx->server_counter = server_num;
+    ctx->used_cached_ip = 0;
+
+    os_timer_disarm(&ctx->query_timer);
+    if(wait_ms > 0)
+    {
+        NTP_LOG_DEBUG(QUERY_DEFERRED, server_num, 0, wait_ms);
+        os_timer_setfn(&ctx->query_timer, _esp8266_ntp_query_timer_cb, ctx);
+        os_timer_arm(&ctx->query_timer, (uint32_t)wait_ms, 0);
+        return;
+    }
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_DUE);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_query_timer_cb(void* arg)
+{
+    //DEFERRED QUERY IS DUE
+
+    _esp8266_ntp_sync_event((ESP8266_NTP_CONTEXT*)arg, ESP8266_NTP_EV_DUE);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_use_cached_ip(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_DNS_CACHE* entry)
+{
+    //POINT THE UDP CLIENT AT A CACHED SERVER IP, BYPASSING DNS
+
+    os_sprintf(ctx->ip_text, IPSTR, IP2STR(&entry->ip));
+    ctx->used_cached_ip = 1;
+
+    _esp8266_ntp_transport->initialize(NULL, ctx->ip_text, NTP_PORT, ctx->reply_timeout_ms);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_server_backoff(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num, uint32_t min_wait_ms)
+{
+    //A QUERY TO THIS SERVER FAILED. HOLD OFF ITS NEXT QUERY FOR A
+    //JITTERED EXPONENTIAL BACKOFF, BUT ATLEAST min_wait_ms AND NEVER
+    //EARLIER THAN ALREADY SCHEDULED
+
+    ESP8266_NTP_SERVER_SCHED* sched = &ctx->sched[server_num - 1];
+    uint32_t now = _esp8266_ntp_uptime_ms(ctx);
+    uint32_t wait = _esp8266_ntp_jitter(NTP_BACKOFF_BASE_MS << sched->backoff_exp);
+
+    if(sched->backoff_exp < NTP_BACKOFF_MAX_EXP)
+    {
+        sched->backoff_exp++;
+    }
+    if(wait < min_wait_ms)
+    {
+        wait = min_wait_ms;
+    }
+    if((int32_t)(now + wait - sched->next_allowed_ms) > 0)
+    {
+        sched->next_allowed_ms = now + wait;
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_handle_kod(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr)
+{
+    //HONOR A KISS-O'-DEATH FROM THE CURRENT SERVER (RFC 5905 7.4)
+    //DENY / RSTR : STOP USING THE SERVER UNTIL RECONFIGURED
+    //RATE : SLOW DOWN. RAISE THE POLL INTERVAL AND HOLD THE SERVER
+    //OFF FOR ATLEAST ONE FULL POLL INTERVAL
+
+    ESP8266_NTP_SERVER_SCHED* sched = &ctx->sched[ctx->server_counter - 1];
+
+    NTP_LOG_WARN(KOD, ctx->server_counter, 0, (int32_t)ESP8266_NTP_HeaderReferenceId(hdr));
+
+    if(os_memcmp(hdr->reference_id, "DENY", 4) == 0 || os_memcmp(hdr->reference_id, "RSTR", 4) == 0)
+    {
+        sched->disabled = 1;
+    }
+    else if(os_memcmp(hdr->reference_id, "RATE", 4) == 0)
+    {
+        if(ctx->poll_exp < NTP_MAX_POLL_EXP)
+        {
+            ctx->poll_exp++;
+        }
+        ctx->poll_counter = 0;
+        sched->backoff_exp = NTP_BACKOFF_MAX_EXP;
+        _esp8266_ntp_server_backoff(ctx, ctx->server_counter, (uint32_t)(1 << ctx->poll_exp) * 1000);
+    }
+}
+
+uint16_t ICACHE_FLASH_ATTR _esp8266_ntp_check_reply(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr, uint64_t t4)
+{
+    //RUN THE RFC 5905 PACKET SANITY TESTS ON A REPLY AND RETURN THE
+    //NTP_TEST_* FLAGS OF THE FAILED ONES (0 = ACCEPT). EVERY TEST IS
+    //EVALUATED ON EVERY PACKET SO THE COST IS THE SAME FOR ALL VERDICTS
+
+    uint64_t org = ESP8266_NTP_HeaderTimestamp(hdr->originate_ts);
+    uint64_t rec = ESP8266_NTP_HeaderTimestamp(hdr->receive_ts);
+    uint64_t xmt = ESP8266_NTP_HeaderTimestamp(hdr->transmit_ts);
+    uint64_t ref = ESP8266_NTP_HeaderTimestamp(hdr->reference_ts);
+    uint32_t root_dist = (ESP8266_NTP_HeaderRootDelay(hdr) >> 1) + ESP8266_NTP_HeaderRootDispersion(hdr);
+    int64_t delay = (int64_t)((t4 - ctx->t1) - (xmt - rec));
+    uint8_t mode = NTP_HDR_MODE(hdr);
+    uint8_t version = NTP_HDR_VN(hdr);
+    uint16_t flags = 0;
+
+    flags |= (xmt == ctx->sched[ctx->server_counter - 1].last_xmt) ? NTP_TEST_DUPLICATE : 0;
+    flags |= (org != ctx->t1) ? NTP_TEST_BOGUS : 0;
+    flags |= (org == 0 || rec == 0 || xmt == 0) ? NTP_TEST_INVALID : 0;
+    flags |= (hdr->stratum == 0) ? NTP_TEST_KOD : 0;
+    flags |= (NTP_HDR_LI(hdr) == 3 || ref == 0 || (int64_t)(xmt - ref) < 0) ? NTP_TEST_UNSYNC : 0;
+    flags |= (hdr->stratum > NTP_MAX_STRATUM) ? NTP_TEST_STRATUM : 0;
+    flags |= (mode != NTP_MODE_SERVER || version < 1 || version > 4) ? NTP_TEST_MODE : 0;
+    flags |= (root_dist >= NTP_MAX_DIST_Q16) ? NTP_TEST_DISTANCE : 0;
+    flags |= (delay >= ((int64_t)NTP_MAX_DIST_Q16 << 16)) ? NTP_TEST_DELAY : 0;
+    flags |= (((xmt - ref) >> 32) > NTP_MAX_REF_AGE_S) ? NTP_TEST_STALE : 0;
+
+    return flags;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_measure_reply(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr, uint64_t t4, int64_t* offset_us, uint32_t* delay_us)
+{
+    //COMPUTE CLOCK OFFSET AND ROUND TRIP DELAY FROM AN NTP REPLY
+    //RECEIVED AT CLIENT TIME T4
+
+    //EXTRACT SERVER RECEIVE (T2) AND TRANSMIT (T3) TIMESTAMPS FROM REPLY
+    uint64_t t2 = ESP8266_NTP_HeaderTimestamp(hdr->receive_ts);
+    uint64_t t3 = ESP8266_NTP_HeaderTimestamp(hdr->transmit_ts);
+
+    //RFC 5905 : DELAY = (T4 - T1) - (T3 - T2)
+    //SUBTRACTED UNSIGNED SO GARBAGE TIMESTAMPS WRAP INSTEAD OF OVERFLOWING
+    int64_t delay = (int64_t)((t4 - ctx->t1) - (t3 - t2));
+    if(delay < 0)
+    {
+        delay = 0;
+    }
+    *delay_us = (uint32_t)_esp8266_ntp_q32_to_us(delay);
+
+    //A MULTI SERVER ROUND MEASURES EVERY REPLY AGAINST THE SAME CLOCK,
+    //EVEN AN UNSYNCED ONE, AND ONLY THE SELECTED SAMPLE SETS IT
+    if(ctx->clock_valid || ctx->sync_state == ESP8266_NTP_SYNC_GATHERING)
+    {
+        //RFC 5905 : OFFSET = ((T2 - T1) + (T3 - T4)) / 2
+        int64_t offset = ((int64_t)(t2 - ctx->t1) >> 1) + ((int64_t)(t3 - t4) >> 1);
+        *offset_us = _esp8266_ntp_q32_to_us(offset);
+    }
     else
     {
-        //DNS RESOLUTION FAIL
-        if(_esp8266_ntp_debug)
+        //FIRST SYNC. LOCAL CLOCK HAS NO REFERENCE SO SET IT TO
+        //SERVER TRANSMIT TIME PLUS HALF THE ROUND TRIP, IN THE ERA
+        //CLOSEST TO THE PIVOT THE UNSYNCED CLOCK STARTED FROM
+        uint64_t now = t3 + (uint64_t)(delay >> 1);
+
+        _esp8266_ntp_clock_advance(ctx);
+        _esp8266_ntp_clock_set(ctx, _esp8266_ntp_era_extend((uint32_t)(now >> 32), ctx->clock_sec), (uint32_t)now);
+        ctx->discipline_last_sec = (uint32_t)(now >> 32);
+        *offset_us = 0;
+
+        //THE REST OF A BURST IS MEASURED AGAINST THIS CLOCK SECONDS
+        //LATER. ITS OFFSET IS JITTER, NOT FREQUENCY ERROR
+        ctx->freq_hold = 1;
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_select_sample(ESP8266_NTP_CONTEXT* ctx)
+{
+    //MARZULLO STYLE INTERSECTION OVER THE CORRECTNESS INTERVALS
+    //[OFFSET - DELAY/2, OFFSET + DELAY/2] OF ALL VALID SAMPLES.
+    //SAMPLES NOT OVERLAPPING THE MAJORITY INTERSECTION ARE FALSETICKERS.
+    //RETURNS THE SERVER NUMBER OF THE LOWEST DELAY TRUECHIMER, OR 0
+
+    int64_t edge_val[2 * NTP_MAX_SERVERS];
+    int8_t edge_type[2 * NTP_MAX_SERVERS];
+    uint8_t n = 0;
+    uint8_t edges = 0;
+    uint8_t i, j, f;
+    int64_t low = 0, high = 0;
+    uint8_t best = 0;
+
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        if(!ctx->samples[i].valid)
+        {
+            continue;
+        }
+        edge_val[edges] = (int64_t)ctx->samples[i].offset_us - (ctx->samples[i].delay_us >> 1);
+        edge_type[edges++] = -1;
+        edge_val[edges] = (int64_t)ctx->samples[i].offset_us + (ctx->samples[i].delay_us >> 1);
+        edge_type[edges++] = 1;
+        n++;
+    }
+
+    if(n == 0)
+    {
+        return 0;
+    }
+
+    //INSERTION SORT EDGES. LOWER EDGES FIRST ON TIES
+    for(i = 1; i < edges; i++)
+    {
+        int64_t v = edge_val[i];
+        int8_t t = edge_type[i];
+        for(j = i; j > 0 && (edge_val[j - 1] > v || (edge_val[j - 1] == v && edge_type[j - 1] > t)); j--)
+        {
+            edge_val[j] = edge_val[j - 1];
+            edge_type[j] = edge_type[j - 1];
+        }
+        edge_val[j] = v;
+        edge_type[j] = t;
+    }
+
+    //FIND THE SMALLEST NUMBER OF FALSETICKERS f (< n/2) FOR WHICH
+    //n - f INTERVALS SHARE A COMMON INTERSECTION
+    for(f = 0; (2 * f) < n; f++)
+    {
+        int8_t chime = 0;
+        uint8_t found_low = 0, found_high = 0;
+
+        for(i = 0; i < edges; i++)
+        {
+            chime -= edge_type[i];
+            if(chime >= (n - f))
+            {
+                low = edge_val[i];
+                found_low = 1;
+                break;
+            }
+        }
+
+        chime = 0;
+        for(i = edges; i > 0; i--)
+        {
+            chime += edge_type[i - 1];
+            if(chime >= (n - f))
+            {
+                high = edge_val[i - 1];
+                found_high = 1;
+                break;
+            }
+        }
+
+        if(found_low && found_high && low <= high)
+        {
+            break;
+        }
+    }
+
+    if((2 * f) >= n)
+    {
+        NTP_LOG_WARN(NO_MAJORITY, 0, n, 0);
+        return 0;
+    }
+
+    //PICK THE LOWEST DELAY SAMPLE OVERLAPPING THE INTERSECTION
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        ESP8266_NTP_SAMPLE* sample = &ctx->samples[i];
+        int64_t s_low = (int64_t)sample->offset_us - (sample->delay_us >> 1);
+        int64_t s_high = (int64_t)sample->offset_us + (sample->delay_us >> 1);
+
+        if(!sample->valid || s_high < low || s_low > high)
+        {
+            if(sample->valid)
+            {
+                NTP_LOG_WARN(FALSETICKER, i + 1, 0, (int32_t)sample->offset_us);
+            }
+            continue;
+        }
+        if(best == 0 || sample->delay_us < ctx->samples[best - 1].delay_us)
+        {
+            best = i + 1;
+        }
+    }
+    return best;
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_gather_usable(ESP8266_NTP_CONTEXT* ctx)
+{
+    //MULTI SERVER MODE IS ON AND THE TRANSPORT CAN CARRY ITS ROUNDS
+
+    return (ctx->multi_server &&
+            _esp8266_ntp_transport->lookup != NULL &&
+            _esp8266_ntp_transport->send_to != NULL);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_schedule(ESP8266_NTP_CONTEXT* ctx)
+{
+    //START THE NEXT MULTI SERVER ROUND ONCE THE FIRST USABLE SERVER IS
+    //DUE. GIVE UP IF THERE IS NONE
+
+    uint32_t now = _esp8266_ntp_uptime_ms(ctx);
+    int32_t wait_ms = 0;
+    int32_t w;
+    uint8_t found = 0;
+    uint8_t i;
+
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        if(ctx->sched[i].disabled)
+        {
+            continue;
+        }
+        w = (int32_t)(ctx->sched[i].next_allowed_ms - now);
+        if(!found || w < wait_ms)
+        {
+            wait_ms = w;
+            found = 1;
+        }
+    }
+    if(!found)
+    {
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_GIVE_UP);
+        return;
+    }
+
+    os_timer_disarm(&ctx->query_timer);
+    if(wait_ms > 0)
+    {
+        NTP_LOG_DEBUG(QUERY_DEFERRED, 0, 0, wait_ms);
+        os_timer_setfn(&ctx->query_timer, _esp8266_ntp_round_timer_cb, ctx);
+        os_timer_arm(&ctx->query_timer, (uint32_t)wait_ms, 0);
+        return;
+    }
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_ROUND);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_reset(ESP8266_NTP_CONTEXT* ctx)
+{
+    //FORGET EVERY LOOKUP AND REQUEST OF THE ROUND. LATE ANSWERS TO THEM
+    //NO LONGER MATCH
+
+    uint8_t i;
+
+    for(i = 0; i < NTP_MAX_SERVERS; i++)
+    {
+        ctx->sched[i].pending = ESP8266_NTP_GATHER_IDLE;
+        ctx->sched[i].t1 = 0;
+        ctx->sched[i].from_cache = 0;
+    }
+    ctx->round_queried = 0;
+    ctx->round_answered = 0;
+    ctx->grace_set = 0;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_issue(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num)
+{
+    //QUERY ONE SERVER OF THE ROUND. A FRESH CACHE ENTRY IS SENT TO
+    //STRAIGHT AWAY, OTHERWISE ITS NAME IS LOOKED UP FIRST
+
+    ESP8266_NTP_SERVER_SCHED* sched = &ctx->sched[server_num - 1];
+    ESP8266_NTP_DNS_CACHE* entry = &ctx->dns_cache[server_num - 1];
+    uint32_t now = _esp8266_ntp_uptime_ms(ctx);
+
+    //HOLD OFF THE NEXT QUERY TO THIS SERVER
+    sched->next_allowed_ms = now + NTP_MIN_QUERY_INTERVAL_MS;
+    sched->from_cache = 0;
+
+    if(entry->valid && (_esp8266_ntp_uptime(ctx) - entry->resolved_at) < ctx->dns_cache_ttl_s)
+    {
+        NTP_LOG_DEBUG(CACHE_HIT, server_num, 0, 0);
+        sched->from_cache = 1;
+        _esp8266_ntp_gather_send(ctx, server_num);
+        return;
+    }
+
+    NTP_LOG_DEBUG(DNS_START, server_num, 0, 0);
+    sched->pending = ESP8266_NTP_GATHER_LOOKUP;
+    sched->started_ms = now;
+    sched->deadline_ms = now + ctx->reply_timeout_ms;
+    _esp8266_ntp_transport->lookup(ctx->servers[server_num - 1], _esp8266_ntp_gather_found_cb, sched);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_send(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num)
+{
+    //SEND THE REQUEST OF ONE SERVER OF THE ROUND. ITS TRANSMIT TIMESTAMP
+    //TELLS ITS REPLY APART FROM THOSE OF THE OTHER SERVERS, SO IT IS
+    //KEPT UNIQUE AMONG THE REQUESTS IN FLIGHT. A REQUEST THE TRANSPORT
+    //COULD NOT SEND TIMES OUT AT ONCE
+
+    ESP8266_NTP_SERVER_SCHED* sched = &ctx->sched[server_num - 1];
+    uint64_t t1;
+    uint8_t i;
+
+    do
+    {
+        t1 = _esp8266_ntp_now64(ctx) ^ (os_random() & 0xFFF);
+        for(i = 0; i < ctx->total_server_count; i++)
+        {
+            if(ctx->sched[i].pending == ESP8266_NTP_GATHER_REPLY && ctx->sched[i].t1 == t1)
+            {
+                break;
+            }
+        }
+    } while(i < ctx->total_server_count);
+
+    _esp8266_ntp_write_ts(((ESP8266_NTP_HEADER*)ctx->data_packet)->transmit_ts, t1);
+    ctx->server_stats[server_num - 1].queries++;
+    sched->t1 = t1;
+    sched->pending = ESP8266_NTP_GATHER_REPLY;
+    sched->deadline_ms = _esp8266_ntp_uptime_ms(ctx) + ctx->reply_timeout_ms;
+
+    if(!_esp8266_ntp_transport->send_to(&ctx->dns_cache[server_num - 1].ip, NTP_PORT, ctx->data_packet, NTP_PACKET_SIZE))
+    {
+        sched->deadline_ms = _esp8266_ntp_uptime_ms(ctx);
+        return;
+    }
+    NTP_LOG_DEBUG(SENT, server_num, 0, 0);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_fail(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num)
+{
+    //NO SAMPLE FROM THIS SERVER THIS ROUND. BACK IT OFF AND, IF ITS
+    //REQUEST WENT TO A CACHED IP, FORCE A FRESH LOOKUP NEXT TIME
+
+    ESP8266_NTP_SERVER_SCHED* sched = &ctx->sched[server_num - 1];
+
+    sched->pending = ESP8266_NTP_GATHER_IDLE;
+    sched->t1 = 0;
+    ctx->samples[server_num - 1].valid = 0;
+    if(sched->from_cache)
+    {
+        ctx->dns_cache[server_num - 1].valid = 0;
+        sched->from_cache = 0;
+    }
+    _esp8266_ntp_server_backoff(ctx, server_num, 0);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_recv(ESP8266_NTP_CONTEXT* ctx, char* pusrdata, uint16_t length)
+{
+    //DATAGRAM DURING A MULTI SERVER ROUND. FIND THE SERVER WHOSE REQUEST
+    //IT ECHOES AND RUN THE USUAL CHECKS AS ITS REPLY. ANYTHING ELSE IS
+    //COUNTED AS A STRAY AND DROPPED
+
+    const ESP8266_NTP_HEADER* hdr;
+    ESP8266_NTP_SERVER_SCHED* sched;
+    ESP8266_NTP_REPLY verdict;
+    uint64_t org;
+    uint64_t t4;
+    uint8_t n;
+
+    //NO EXCHANGE IS OUTSTANDING, SO A TRANSPORT TIMEOUT MEANS NOTHING
+    if(length == 0)
+    {
+        return;
+    }
+
+    hdr = ESP8266_NTP_HeaderView(pusrdata, length);
+    if(hdr == NULL)
+    {
+        NTP_LOG_WARN(SHORT_REPLY, 0, (int16_t)length, 0);
+        ctx->packet_stats.stray++;
+        return;
+    }
+
+    t4 = _esp8266_ntp_rx_time(ctx);
+    org = ESP8266_NTP_HeaderTimestamp(hdr->originate_ts);
+    for(n = 1; n <= ctx->total_server_count; n++)
+    {
+        if(ctx->sched[n - 1].pending == ESP8266_NTP_GATHER_REPLY && ctx->sched[n - 1].t1 == org)
+        {
+            break;
+        }
+    }
+    if(n > ctx->total_server_count)
+    {
+        ctx->packet_stats.received++;
+        ctx->packet_stats.stray++;
+        _esp8266_ntp_reply_reject(ctx, 0, NTP_TEST_BOGUS);
+        return;
+    }
+
+    sched = &ctx->sched[n - 1];
+    ctx->server_counter = n;
+    ctx->t1 = sched->t1;
+    verdict = _esp8266_ntp_reply_accept(ctx, hdr, t4);
+    ctx->t1 = 0;
+
+    switch(verdict)
+    {
+        case ESP8266_NTP_REPLY_STRAY:
+            //A COPY OF AN ACCEPTED REPLY. THE REQUEST IS STILL IN FLIGHT
+            return;
+
+        case ESP8266_NTP_REPLY_FAILED:
+            _esp8266_ntp_gather_fail(ctx, n);
+            break;
+
+        default:
+            sched->pending = ESP8266_NTP_GATHER_IDLE;
+            sched->t1 = 0;
+            sched->from_cache = 0;
+            ctx->round_answered++;
+            break;
+    }
+    _esp8266_ntp_gather_check(ctx);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_check(ESP8266_NTP_CONTEXT* ctx)
+{
+    //RUN AFTER EVERY ANSWER, FAILURE OR TIMEOUT IN A ROUND. WHILE
+    //QUERIES ARE OUTSTANDING TIME OUT THE EARLIEST, GIVING THE REST
+    //NTP_GATHER_GRACE_MS ONCE A MAJORITY OF THE QUERIED SERVERS HAS
+    //ANSWERED. WITH NONE LEFT START THE NEXT BURST ROUND OR SELECT
+    //THE RESULT
+
+    ESP8266_NTP_SERVER_SCHED* sched;
+    uint32_t now = _esp8266_ntp_uptime_ms(ctx);
+    uint32_t deadline = 0;
+    int32_t wait_ms;
+    uint8_t open = 0;
+    uint8_t timed = 0;
+    uint8_t answered;
+    uint8_t best;
+    uint8_t i;
+
+    //ROUND ALREADY OVER
+    if(ctx->round_queried == 0)
+    {
+        return;
+    }
+
+    if(!ctx->grace_set && (2 * ctx->round_answered) > ctx->round_queried)
+    {
+        ctx->grace_set = 1;
+        ctx->grace_ms = now + NTP_GATHER_GRACE_MS;
+    }
+
+    for(i = 0; i < ctx->total_server_count; i++)
+    {
+        sched = &ctx->sched[i];
+        if(sched->pending == ESP8266_NTP_GATHER_IDLE)
         {
-            os_printf("ESP8266 : NTP : Dns resolution FAIL\n");
+            continue;
         }
-        //CHANGE SERVER AND DO NEXT DNS RESOLUTION
-        if(_esp8266_ntp_retry_count < NTP_MAX_TRIES)
+        open = 1;
+        if(sched->pending == ESP8266_NTP_GATHER_QUEUED)
         {
-            _esp8266_ntp_server_counter++;
-            if(_esp8266_ntp_server_counter > _esp8266_ntp_total_server_count)
-            {
-                _esp8266_ntp_server_counter = 1;
-            }
-            _esp8266_ntp_retry_count++;
+            continue;
+        }
+        if(ctx->grace_set && (int32_t)(sched->deadline_ms - ctx->grace_ms) > 0)
+        {
+            sched->deadline_ms = ctx->grace_ms;
+        }
+        if(!timed || (int32_t)(sched->deadline_ms - deadline) < 0)
+        {
+            deadline = sched->deadline_ms;
+            timed = 1;
+        }
+    }
+
+    if(open)
+    {
+        if(timed)
+        {
+            wait_ms = (int32_t)(deadline - now);
+            os_timer_disarm(&ctx->query_timer);
+            os_timer_setfn(&ctx->query_timer, _esp8266_ntp_gather_timer_cb, ctx);
+            os_timer_arm(&ctx->query_timer, (wait_ms > 0) ? (uint32_t)wait_ms : 0, 0);
+        }
+        return;
+    }
 
-            //START THE NEXT DNS RESOLUTION
-            switch(_esp8266_ntp_server_counter)
+    //ROUND OVER
+    os_timer_disarm(&ctx->query_timer);
+    answered = ctx->round_answered;
+    ctx->round_queried = 0;
+
+    //A BURST QUERIES THE SERVERS THAT ANSWERED AGAIN
+    if(ctx->burst_left > 0 && answered > 0)
+    {
+        ctx->burst_left--;
+        NTP_LOG_DEBUG(BURST, 0, ctx->burst_left, 0);
+        for(i = 0; i < ctx->total_server_count; i++)
+        {
+            if(ctx->samples[i].valid)
             {
-                case 1:
-                        ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_1, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-                        if(_esp8266_ntp_debug)
-						{
-							os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_1);
-						}
-                        break;
-                case 2:
-                        ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_2, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-                        if(_esp8266_ntp_debug)
-						{
-							os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_2);
-						}
-                        break;
-                case 3:
-                        ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_3, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-                        if(_esp8266_ntp_debug)
-						{
-							os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_3);
-						}
-                        break;
+                ctx->sched[i].next_allowed_ms = now + NTP_BURST_INTERVAL_MS;
             }
-            ESP8266_UDP_CLIENT_ResolveHostName(_esp8266_ntp_server_resolved_cb);
+        }
+        _esp8266_ntp_gather_schedule(ctx);
+        return;
+    }
+
+    best = _esp8266_ntp_select_sample(ctx);
+    if(best == 0)
+    {
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_GIVE_UP);
+        return;
+    }
+    ctx->server_counter = best;
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_COMPLETE);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_filter_add(ESP8266_NTP_FILTER* filter, int64_t offset_us, uint32_t delay_us, uint32_t disp_us, uint32_t now_ms)
+{
+    //SHIFT A NEW SAMPLE INTO A SERVER CLOCK FILTER OVER THE OLDEST ONE
+
+    ESP8266_NTP_FILTER_STAGE* stage = &filter->stages[filter->next];
+
+    stage->offset_us = offset_us;
+    stage->delay_us = delay_us;
+    stage->disp_us = disp_us;
+    stage->epoch_ms = now_ms;
+
+    if(++filter->next == NTP_FILTER_STAGES)
+    {
+        filter->next = 0;
+    }
+    if(filter->count < NTP_FILTER_STAGES)
+    {
+        filter->count++;
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_filter_run(ESP8266_NTP_FILTER* filter, ESP8266_NTP_SAMPLE* sample, uint32_t now_ms)
+{
+    //RFC 5905 CLOCK FILTER. SORT THE STORED SAMPLES BY DISTANCE (HALF
+    //THE DELAY PLUS THE DISPERSION GROWN SINCE THEY WERE TAKEN, SO AN
+    //OLD SAMPLE MUST BE CLEARLY BETTER TO BEAT A NEW ONE) AND TAKE THE
+    //FIRST. DISPERSION IS THE SUM OF THE AGED STAGE DISPERSIONS
+    //WEIGHTED 1/2, 1/4, ... IN SORTED ORDER (EMPTY STAGES LEFT OUT).
+    //JITTER IS THE RMS OFFSET DIFFERENCE TO THE SELECTED SAMPLE
+
+    uint8_t order[NTP_FILTER_STAGES];
+    uint32_t disp[NTP_FILTER_STAGES];
+    uint32_t dist[NTP_FILTER_STAGES];
+    uint8_t n = filter->count;
+    uint8_t i, j;
+    uint64_t sum = 0;
+    const ESP8266_NTP_FILTER_STAGE* best;
+
+    //NOTHING TO SELECT FROM. LEAVE THE SAMPLE AS IT IS
+    if(n == 0)
+    {
+        return;
+    }
+
+    //NEWEST FIRST, SO THE NEWER OF TWO EQUAL DISTANCES WINS
+    for(i = 0; i < n; i++)
+    {
+        uint8_t k = (uint8_t)((filter->next + NTP_FILTER_STAGES - 1 - i) % NTP_FILTER_STAGES);
+        uint8_t idx = i;
+
+        disp[k] = filter->stages[k].disp_us +
+                    (uint32_t)(((uint64_t)(now_ms - filter->stages[k].epoch_ms) * NTP_CLOCK_TOLERANCE_PPM) / 1000);
+        dist[k] = (filter->stages[k].delay_us >> 1) + disp[k];
+        while(idx > 0 && dist[order[idx - 1]] > dist[k])
+        {
+            order[idx] = order[idx - 1];
+            idx--;
+        }
+        order[idx] = k;
+    }
+
+    best = &filter->stages[order[0]];
+    sample->offset_us = best->offset_us;
+    sample->delay_us = best->delay_us;
+    sample->epoch_ms = best->epoch_ms;
+    sample->fresh = !filter->used_valid || (int32_t)(best->epoch_ms - filter->used_ms) > 0;
+
+    sample->dispersion_us = 0;
+    for(i = 0; i < n; i++)
+    {
+        sample->dispersion_us += disp[order[i]] >> (i + 1);
+    }
+
+    //DIFFERENCES SATURATE AT 2^30 US SO THE SQUARES CAN NOT OVERFLOW
+    for(j = 1; j < n; j++)
+    {
+        int64_t diff = filter->stages[order[j]].offset_us - best->offset_us;
+
+        if(diff > (1LL << 30) || diff < -(1LL << 30))
+        {
+            diff = 1LL << 30;
+        }
+        sum += (uint64_t)(diff * diff);
+    }
+    sample->jitter_us = (n > 1) ? _esp8266_ntp_isqrt(sum / (n - 1)) : 0;
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_filter_disp(int8_t precision, uint32_t delay_us)
+{
+    //DISPERSION OF A FRESH SAMPLE : SERVER AND LOCAL (1 US) CLOCK
+    //PRECISION PLUS THE DRIFT OVER THE ROUND TRIP
+
+    uint32_t server_us = 1;
+
+    //0 OR ABOVE IS NOT A REAL CLOCK BUT A FIELD LEFT UNSET
+    if(precision < 0 && precision > -20)
+    {
+        server_us = NTP_USEC_PER_SEC >> -precision;
+    }
+    return server_us + 1 + (uint32_t)(((uint64_t)delay_us * NTP_CLOCK_TOLERANCE_PPM) / NTP_USEC_PER_SEC);
+}
+
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_isqrt(uint64_t value)
+{
+    //INTEGER SQUARE ROOT, ROUNDED DOWN. ONE RESULT BIT PER ROUND
+
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while(bit > value)
+    {
+        bit >>= 2;
+    }
+    while(bit != 0)
+    {
+        if(value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
         }
         else
         {
-            //ALL NTP TRIES DONE. NTP FAIL. CALL USERCALLBACK WITH NTP_ERROR
-            if(_esp8266_ntp_debug)
-            {
-                os_printf("ESP8266 : NTP : NTP retires finished. TERMINATED\n");
-            }
-            _esp8266_ntp_data->state = ESP8266_NTP_STATE_ERROR;
-            
-            //RESET COUNTERS
-            _esp8266_ntp_retry_count = 0;
-            _esp8266_ntp_server_counter = 1;
-
-            //CALL USER CB IF NOT NULL WITH 0 ARGUMENT
-            if(_esp8266_ntp_data_ready_user_cb != NULL)
-            {
-                _esp8266_ntp_data_ready_user_cb(_esp8266_ntp_data, 0);
-            }
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_burst_count(ESP8266_NTP_CONTEXT* ctx)
+{
+    //EXTRA QUERIES TO SEND A SERVER THIS ROUND. ONLY BEFORE THE FIRST
+    //NETWORK SYNC (NO SYNC SOURCE YET)
+
+    if(ctx->burst < 2 || ctx->ref_stratum != 0)
+    {
+        return 0;
+    }
+    return ctx->burst - 1;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_server_resolved_cb(ip_addr_t* ip)
+{
+    //ESP8266 NTP SERVER DNS RESOLVED CB
+
+    ESP8266_NTP_CONTEXT* ctx = _esp8266_ntp_active_ctx;
+
+    //INSTANCE DESTROYED OR CANCELLED WHILE RESOLVING
+    if(ctx == NULL || ctx->sync_state != ESP8266_NTP_SYNC_RESOLVING)
+    {
+        return;
+    }
+
+    //CHECK IF DNS RESOLUTION SUCCESSFULL
+    if(ip != NULL)
+    {
+        //DNS RESOLUTION SUCCESSFULL
+        ESP8266_NTP_DNS_CACHE* entry = &ctx->dns_cache[ctx->server_counter - 1];
+
+        NTP_LOG_DEBUG(DNS_OK, ctx->server_counter, 0, (int32_t)(_esp8266_ntp_uptime_ms(ctx) - ctx->dns_start_ms));
+
+        _esp8266_ntp_hist_add(ctx->server_stats[ctx->server_counter - 1].dns_hist,
+                                _esp8266_ntp_uptime_ms(ctx) - ctx->dns_start_ms);
+
+        //UPDATE THE RESOLVED ADDRESS CACHE
+        entry->ip.addr = ip->addr;
+        entry->resolved_at = _esp8266_ntp_uptime(ctx);
+        entry->valid = 1;
+
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_RESOLVED);
+    }
+    else
+    {
+        //DNS RESOLUTION FAIL
+        ESP8266_NTP_DNS_CACHE* entry = &ctx->dns_cache[ctx->server_counter - 1];
+
+        NTP_LOG_WARN(DNS_FAIL, ctx->server_counter, 0, 0);
+        _esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_DNS, 0);
+
+        //DURING A DNS OUTAGE FALL BACK TO A STALE CACHED ADDRESS
+        //FOR THIS SERVER IF ONE IS AVAILABLE
+        if(entry->valid)
+        {
+            NTP_LOG_INFO(DNS_STALE, ctx->server_counter, 0, 0);
+            _esp8266_ntp_use_cached_ip(ctx, entry);
+            _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_RESOLVED);
+            return;
         }
+        _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_FAIL);
     }
 }
 
@@ -438,120 +4809,343 @@ void ICACHE_FLASH_ATTR _esp8266_ntp_udp_data_sent_cb(void* arg)
 {
 	//NTP DATA SENT THROUGH THE UDP LIBRARY
 
-	if(_esp8266_ntp_debug)
+	ESP8266_NTP_CONTEXT* ctx = _esp8266_ntp_active_ctx;
+
+	(void)arg;
+	if(ctx != NULL)
 	{
-		os_printf("ESP8266 : NTP : Data sent to NTP server index %d\n", _esp8266_ntp_server_counter);
+		_esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_SENT);
 	}
 }
 
 void ICACHE_FLASH_ATTR _esp8266_ntp_udp_data_recv_cb(char* pusrdata, uint16_t length)
 {
     //NTP UDP DATA RECEIVED
-    //DISABLE NTP TIMER
-    //UPDATE TIMESTAMP IN NTP DATA STRUCTURE
-    //DO NTP TIME CONVERSION TO THE SET TIMEZONE
-    //CONVERT TIMESTAMP TO HUMAN READABLE DATETIME FORMAT
-    //CALL USER NTP DATA READY CALLBACK FUNCTION
-    
+    //CHECK THE REPLY, COMPUTE OFFSET / DELAY FROM ITS TIMESTAMPS AND
+    //STORE THEM AS THE SAMPLE OF THE CURRENT SERVER
+
+    ESP8266_NTP_CONTEXT* ctx = _esp8266_ntp_active_ctx;
+    const ESP8266_NTP_HEADER* hdr;
+    uint64_t t4;
+
+	//A MULTI SERVER ROUND FIRST MATCHES THE REPLY TO ONE OF ITS QUERIES
+	if(ctx != NULL && ctx->sync_state == ESP8266_NTP_SYNC_GATHERING)
+	{
+		_esp8266_ntp_gather_recv(ctx, pusrdata, length);
+		return;
+	}
+
+	//INSTANCE DESTROYED OR CANCELLED, OR NO REQUEST OUTSTANDING
+	if(ctx == NULL || (ctx->sync_state != ESP8266_NTP_SYNC_SENT &&
+						ctx->sync_state != ESP8266_NTP_SYNC_AWAITING))
+	{
+		return;
+	}
+
 	//CHECK FOR THE VALIDITY OF DATA
 	if(length == 0)
 	{
-		_esp8266_ntp_data->state = ESP8266_NTP_STATE_ERROR;
-		if(_esp8266_ntp_debug)
+		_esp8266_ntp_reply_timeout(ctx);
+		return;
+	}
+
+	//PARSE THE REPLY IN PLACE. A RUNT CAN NOT BE MATCHED TO THE REQUEST
+	//SO IT IS DROPPED AND THE EXCHANGE GOES ON
+	hdr = ESP8266_NTP_HeaderView(pusrdata, length);
+	if(hdr == NULL)
+	{
+		NTP_LOG_WARN(SHORT_REPLY, ctx->server_counter, (int16_t)length, 0);
+		ctx->packet_stats.stray++;
+		_esp8266_ntp_reply_guard(ctx);
+		return;
+	}
+
+	t4 = _esp8266_ntp_rx_time(ctx);
+	switch(_esp8266_ntp_reply_accept(ctx, hdr, t4))
+	{
+		case ESP8266_NTP_REPLY_STRAY:
+			_esp8266_ntp_reply_guard(ctx);
+			break;
+
+		case ESP8266_NTP_REPLY_FAILED:
+			_esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_FAIL);
+			break;
+
+		default:
+			_esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_REPLY);
+			break;
+	}
+}
+
+uint64_t ICACHE_FLASH_ATTR _esp8266_ntp_rx_time(ESP8266_NTP_CONTEXT* ctx)
+{
+	//CLIENT RECEIVE TIME (T4) OF THE DATAGRAM BEING DELIVERED. TAKEN
+	//BEFORE ANY FURTHER PROCESSING AND BACKED UP TO THE ARRIVAL TIME IF
+	//THE TRANSPORT STAMPED IT
+
+	uint64_t t4 = _esp8266_ntp_now64(ctx);
+	uint32_t rx_tick;
+
+	if(_esp8266_ntp_transport->rx_tick != NULL &&
+		_esp8266_ntp_transport->rx_tick(&rx_tick) &&
+		(ctx->clock_ref_tick - rx_tick) < NTP_USEC_PER_SEC)
+	{
+		t4 -= (uint64_t)_esp8266_ntp_us_to_q32(ctx->clock_ref_tick - rx_tick);
+	}
+	return t4;
+}
+
+ESP8266_NTP_REPLY ICACHE_FLASH_ATTR _esp8266_ntp_reply_accept(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr, uint64_t t4)
+{
+	//SANITY CHECK A REPLY TO THE REQUEST OF THE CURRENT SERVER (SENT AT
+	//ctx->t1) BEFORE IT CAN TOUCH THE CLOCK. IF IT PASSES, FILTER ITS
+	//OFFSET / DELAY INTO THE SAMPLE OF THE SERVER
+
+	ESP8266_NTP_PACKET_STATS* stats = &ctx->packet_stats;
+	ESP8266_NTP_SAMPLE* sample;
+	ESP8266_NTP_SERVER_STATS* server_stats;
+	uint16_t flags;
+	int64_t offset_us;
+	int64_t abs_offset;
+	uint32_t delay_us;
+
+	stats->received++;
+	flags = _esp8266_ntp_check_reply(ctx, hdr, t4);
+	if(flags != 0)
+	{
+		_esp8266_ntp_reply_reject(ctx, ctx->server_counter, flags);
+
+		//NOT THE REPLY TO THE OUTSTANDING REQUEST (STRAY, REPLAYED OR
+		//SPOOFED). IT SAYS NOTHING ABOUT THE SERVER, KEEP WAITING
+		if(flags & (NTP_TEST_DUPLICATE | NTP_TEST_BOGUS))
 		{
-			os_printf("ESP8266 : NTP : Reply timeout\n");
+			stats->stray++;
+			return ESP8266_NTP_REPLY_STRAY;
 		}
 
-		//DO NTP CALL AGAIN WITH THE NEXT SERVER GIVEN RETRY COUNT
-		//NO EXCEEDED
-
-		 //CHANGE SERVER AND DO NEXT DNS RESOLUTION
-		if(_esp8266_ntp_retry_count < NTP_MAX_TRIES)
+		//ONLY A KISS THAT ECHOES OUR REQUEST CAN RESTRICT THE SERVER
+		if((flags & (NTP_TEST_KOD | NTP_TEST_MODE)) == NTP_TEST_KOD)
 		{
-			_esp8266_ntp_server_counter++;
-			if(_esp8266_ntp_server_counter > _esp8266_ntp_total_server_count)
-			{
-				_esp8266_ntp_server_counter = 1;
-			}
-			_esp8266_ntp_retry_count++;
-
-			//START THE NEXT DNS RESOLUTION
-			switch(_esp8266_ntp_server_counter)
-			{
-				case 1:
-						ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_1, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-						if(_esp8266_ntp_debug)
-						{
-							os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_1);
-						}
-						break;
-				case 2:
-						ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_2, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-						if(_esp8266_ntp_debug)
-						{
-							os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_2);
-						}
-						break;
-				case 3:
-						ESP8266_UDP_CLIENT_Initialize(_esp8266_ntp_server_3, NULL, NTP_PORT, _esp8266_ntp_reply_timeout_ms);
-						if(_esp8266_ntp_debug)
-						{
-							os_printf("ESP8266 : NTP : Started DNS resolve NTP server %d %s\n", _esp8266_ntp_server_counter, _esp8266_ntp_server_3);
-						}
-						break;
-			}
-			ESP8266_UDP_CLIENT_ResolveHostName(_esp8266_ntp_server_resolved_cb);
+			_esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_KOD, flags);
+			_esp8266_ntp_handle_kod(ctx, hdr);
 		}
 		else
 		{
-			//ALL NTP TRIES DONE. NTP FAIL. CALL USERCALLBACK WITH NTP_ERROR
-			if(_esp8266_ntp_debug)
-			{
-				os_printf("ESP8266 : NTP : NTP RETRIES finished. TERMINATED\n");
-			}
-			_esp8266_ntp_data->state = ESP8266_NTP_STATE_ERROR;
-
-			//RESET COUNTERS
-			_esp8266_ntp_retry_count = 0;
-			_esp8266_ntp_server_counter = 1;
-
-			 //CALL USER CB IF NOT NULL WITH EXTRACTED DATA IN STRUCTURE
-			if(_esp8266_ntp_data_ready_user_cb != NULL)
-			{
-			   (_esp8266_ntp_data_ready_user_cb)(_esp8266_ntp_data, 0);
-			}
+			_esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_REJECTED, flags);
 		}
+		return ESP8266_NTP_REPLY_FAILED;
 	}
-	else
-	{
-		_esp8266_ntp_last_server_used = _esp8266_ntp_server_counter;
-		_esp8266_ntp_cycle_count++;
+	stats->accepted++;
+	ctx->sched[ctx->server_counter - 1].last_xmt = ESP8266_NTP_HeaderTimestamp(hdr->transmit_ts);
+	ctx->sched[ctx->server_counter - 1].backoff_exp = 0;
 
-		//RESET COUNTERS
-		_esp8266_ntp_retry_count = 0;
-		_esp8266_ntp_server_counter = 1;
+	_esp8266_ntp_measure_reply(ctx, hdr, t4, &offset_us, &delay_us);
+	ctx->dns_cache[ctx->server_counter - 1].last_success = _esp8266_ntp_uptime(ctx);
+	ctx->used_cached_ip = 0;
 
-		_esp8266_ntp_data->state = ESP8266_NTP_STATE_OK;
+	//THE SERVER SAMPLE IS THE OUTPUT OF ITS CLOCK FILTER
+	sample = &ctx->samples[ctx->server_counter - 1];
+	_esp8266_ntp_filter_add(&ctx->filters[ctx->server_counter - 1], offset_us, delay_us,
+							_esp8266_ntp_filter_disp(hdr->precision, delay_us), _esp8266_ntp_uptime_ms(ctx));
+	_esp8266_ntp_filter_run(&ctx->filters[ctx->server_counter - 1], sample, _esp8266_ntp_uptime_ms(ctx));
+	sample->root_delay = ESP8266_NTP_HeaderRootDelay(hdr);
+	sample->root_dispersion = ESP8266_NTP_HeaderRootDispersion(hdr);
+	sample->stratum = hdr->stratum;
+	sample->leap = NTP_HDR_LI(hdr);
+	sample->valid = 1;
 
-		//EXTRACT 32 BIT NTP TIMESTAMP FROM REPLY
-		_esp8266_ntp_data->timestamp = pusrdata[40]; _esp8266_ntp_data->timestamp = (_esp8266_ntp_data->timestamp << 8);
-		_esp8266_ntp_data->timestamp |= pusrdata[41]; _esp8266_ntp_data->timestamp = (_esp8266_ntp_data->timestamp << 8);
-		_esp8266_ntp_data->timestamp |= pusrdata[42]; _esp8266_ntp_data->timestamp = (_esp8266_ntp_data->timestamp << 8);
-		_esp8266_ntp_data->timestamp |= pusrdata[43];
+	server_stats = &ctx->server_stats[ctx->server_counter - 1];
+	server_stats->successes++;
+	_esp8266_ntp_hist_add(server_stats->rtt_hist, delay_us / 1000);
+	abs_offset = ((offset_us < 0) ? -offset_us : offset_us) >> NTP_HIST_OFFSET_SHIFT;
+	_esp8266_ntp_hist_add(server_stats->offset_hist, (abs_offset > 0xFFFFFFFFLL) ? 0xFFFFFFFFUL : (uint32_t)abs_offset);
 
-		if(_esp8266_ntp_debug)
-		{
-			os_printf("ESP8266 : NTP : NTP data received of length %d\n", length);
-			os_printf("ESP8266 : NTP : timestamp = %u\n", _esp8266_ntp_data->timestamp);
-		}
+	NTP_LOG_DEBUG(SAMPLE, ctx->server_counter, (int16_t)((delay_us > 32767000UL) ? 32767 : (delay_us / 1000)), (int32_t)offset_us);
+	return ESP8266_NTP_REPLY_OK;
+}
 
-		//CONVERT NTP TIME TO HUMAN READABLE
-		_esp8266_ntp_convert_time_to_text();
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_reject(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num, uint16_t flags)
+{
+	//COUNT AND LOG A REPLY THAT FAILED THE NTP_TEST_* flags. server_num
+	//IS THE SERVER IT CLAIMS TO BE FROM, 0 IF UNKNOWN
 
-		 //CALL USER CB IF NOT NULL WITH EXTRACTED DATA IN STRUCTURE
-		if(_esp8266_ntp_data_ready_user_cb != NULL)
-		{
-		   (_esp8266_ntp_data_ready_user_cb)(_esp8266_ntp_data, length);
-		}
+	ESP8266_NTP_PACKET_STATS* stats = &ctx->packet_stats;
+	uint8_t i;
+
+	stats->rejected++;
+	stats->last_flags = flags;
+	stats->last_reason = __builtin_ctz(flags) + 1;
+	for(i = 0; i < NTP_TEST_COUNT; i++)
+	{
+		stats->test_failed[i] += (flags >> i) & 1;
 	}
+
+#if NTP_LOG_LEVEL >= NTP_LOG_LEVEL_WARN
+	NTP_LOG_WARN(REJECTED, server_num, stats->last_reason, flags);
+#else
+	(void)server_num;
+#endif
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_timeout(ESP8266_NTP_CONTEXT* ctx)
+{
+    //NO REPLY TO THE OUTSTANDING REQUEST IN TIME
+
+    NTP_LOG_WARN(TIMEOUT, ctx->server_counter, 0, 0);
+    _esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_TIMEOUT, 0);
+
+    //DO NTP CALL AGAIN WITH THE NEXT SERVER GIVEN RETRY COUNT
+    //NO EXCEEDED
+    _esp8266_ntp_sync_event(ctx, ESP8266_NTP_EV_FAIL);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_guard(ESP8266_NTP_CONTEXT* ctx)
+{
+    //A STRAY DATAGRAM WAS DROPPED WHILE WAITING FOR THE REPLY. A
+    //TRANSPORT MAY STOP WAITING AFTER THE FIRST DATAGRAM, SO TIME THE
+    //REQUEST OUT HERE AS WELL, NTP_REPLY_GUARD_MS AFTER THE TRANSPORT
+    //WOULD HAVE
+
+    int32_t wait_ms = (int32_t)(ctx->sent_ms + ctx->reply_timeout_ms + NTP_REPLY_GUARD_MS - _esp8266_ntp_uptime_ms(ctx));
+
+    os_timer_disarm(&ctx->query_timer);
+    os_timer_setfn(&ctx->query_timer, _esp8266_ntp_reply_guard_cb, ctx);
+    os_timer_arm(&ctx->query_timer, (wait_ms > 0) ? (uint32_t)wait_ms : 0, 0);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_guard_cb(void* arg)
+{
+    //THE TRANSPORT NEVER REPORTED THE REPLY OR ITS TIMEOUT
+
+    ESP8266_NTP_CONTEXT* ctx = (ESP8266_NTP_CONTEXT*)arg;
+
+    if(ctx->sync_state == ESP8266_NTP_SYNC_SENT || ctx->sync_state == ESP8266_NTP_SYNC_AWAITING)
+    {
+        _esp8266_ntp_reply_timeout(ctx);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_round_timer_cb(void* arg)
+{
+    //DEFERRED MULTI SERVER ROUND IS DUE
+
+    _esp8266_ntp_sync_event((ESP8266_NTP_CONTEXT*)arg, ESP8266_NTP_EV_ROUND);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_timer_cb(void* arg)
+{
+    //A LOOKUP OR REQUEST OF THE ROUND RAN OUT OF TIME. A FAILED LOOKUP
+    //FALLS BACK TO A STALE CACHED ADDRESS IF THERE IS ONE
+
+    ESP8266_NTP_CONTEXT* ctx = (ESP8266_NTP_CONTEXT*)arg;
+    ESP8266_NTP_SERVER_SCHED* sched;
+    uint32_t now;
+    uint8_t n;
+
+    if(ctx->sync_state != ESP8266_NTP_SYNC_GATHERING)
+    {
+        return;
+    }
+
+    now = _esp8266_ntp_uptime_ms(ctx);
+    for(n = 1; n <= ctx->total_server_count; n++)
+    {
+        sched = &ctx->sched[n - 1];
+        if((sched->pending != ESP8266_NTP_GATHER_LOOKUP && sched->pending != ESP8266_NTP_GATHER_REPLY) ||
+            (int32_t)(now - sched->deadline_ms) < 0)
+        {
+            continue;
+        }
+
+        ctx->server_counter = n;
+        if(sched->pending == ESP8266_NTP_GATHER_LOOKUP)
+        {
+            NTP_LOG_WARN(DNS_FAIL, n, 0, 0);
+            _esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_DNS, 0);
+            if(ctx->dns_cache[n - 1].valid)
+            {
+                NTP_LOG_INFO(DNS_STALE, n, 0, 0);
+                sched->from_cache = 1;
+                _esp8266_ntp_gather_send(ctx, n);
+                continue;
+            }
+        }
+        else
+        {
+            NTP_LOG_WARN(TIMEOUT, n, 0, 0);
+            _esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_TIMEOUT, 0);
+        }
+        _esp8266_ntp_gather_fail(ctx, n);
+    }
+    _esp8266_ntp_gather_check(ctx);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_found_cb(const char* hostname, ip_addr_t* ip, void* arg)
+{
+    //NAME LOOKUP OF A SERVER IN A MULTI SERVER ROUND FINISHED. arg IS
+    //ITS SCHEDULER ENTRY, WHICH NAMES THE INSTANCE AND THE SERVER. THE
+    //ANSWER IS IGNORED IF THE INSTANCE WAS DESTROYED OR THE LOOKUP
+    //TIMED OUT OR WAS CANCELLED MEANWHILE
+
+    ESP8266_NTP_CONTEXT* ctx;
+    ESP8266_NTP_SERVER_SCHED* sched = NULL;
+    ESP8266_NTP_DNS_CACHE* entry;
+    uint32_t now;
+    uint8_t n = 0;
+
+    (void)hostname;
+    ctx = _esp8266_ntp_live_head;
+    while(ctx != NULL && sched == NULL)
+    {
+        for(n = 1; n <= NTP_MAX_SERVERS; n++)
+        {
+            if(arg == (void*)&ctx->sched[n - 1])
+            {
+                sched = &ctx->sched[n - 1];
+                break;
+            }
+        }
+        if(sched == NULL)
+        {
+            ctx = ctx->next_live;
+        }
+    }
+    if(sched == NULL || ctx->sync_state != ESP8266_NTP_SYNC_GATHERING ||
+        sched->pending != ESP8266_NTP_GATHER_LOOKUP)
+    {
+        return;
+    }
+
+    now = _esp8266_ntp_uptime_ms(ctx);
+    entry = &ctx->dns_cache[n - 1];
+    ctx->server_counter = n;
+    if(ip != NULL)
+    {
+        NTP_LOG_DEBUG(DNS_OK, n, 0, (int32_t)(now - sched->started_ms));
+        _esp8266_ntp_hist_add(ctx->server_stats[n - 1].dns_hist, now - sched->started_ms);
+
+        //UPDATE THE RESOLVED ADDRESS CACHE
+        entry->ip.addr = ip->addr;
+        entry->resolved_at = _esp8266_ntp_uptime(ctx);
+        entry->valid = 1;
+        _esp8266_ntp_gather_send(ctx, n);
+    }
+    else
+    {
+        NTP_LOG_WARN(DNS_FAIL, n, 0, 0);
+        _esp8266_ntp_stats_error(ctx, ESP8266_NTP_ERROR_DNS, 0);
+
+        //DURING A DNS OUTAGE FALL BACK TO A STALE CACHED ADDRESS
+        if(entry->valid)
+        {
+            NTP_LOG_INFO(DNS_STALE, n, 0, 0);
+            sched->from_cache = 1;
+            _esp8266_ntp_gather_send(ctx, n);
+        }
+        else
+        {
+            _esp8266_ntp_gather_fail(ctx, n);
+        }
+    }
+    _esp8266_ntp_gather_check(ctx);
 }
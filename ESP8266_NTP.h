@@ -9,24 +9,298 @@
 * REFERENCES
 * ------------
 *   (1) http://git.musl-libc.org/cgit/musl/plain/src/time/__secs_to_tm.c?h=v0.9.15
+*   (2) C. NERI, L. SCHNEIDER - EUCLIDEAN AFFINE FUNCTIONS AND THEIR
+*       APPLICATION TO CALENDAR ALGORITHMS (ARXIV 2102.06959)
+*
+* BUILD WITH -DESP8266_NTP_HOST TO RUN OFF DEVICE (SEE ESP8266_NTP_HOST.h)
 ****************************************************************/
 
 #ifndef _ESP8266_NTP_H_
 #define _ESP8266_NTP_H_
 
+#ifdef ESP8266_NTP_HOST
+#include "ESP8266_NTP_HOST.h"
+#else
 #include "osapi.h"
 #include "mem.h"
+#include "user_interface.h"
 #include "ip_addr.h"
+#include "espconn.h"
 #include "ESP8266_UDP_CLIENT.h"
+#endif
 
 #define NTP_PORT				123
 #define NTP_PACKET_SIZE			48
 #define NTP_MAX_TRIES			5
+//CAPACITY OF THE PER CONTEXT SERVER LIST. OVERRIDE AT BUILD TIME
+#ifndef NTP_MAX_SERVERS
+#define NTP_MAX_SERVERS			4
+#endif
+#define NTP_DNS_CACHE_TTL_S		3600
+//SINGLE CONTEXT API (NON _Ctx FUNCTIONS) AND THE DEFAULT CONTEXT BEHIND
+//IT. BUILD WITH NTP_LEGACY_API 0 TO DROP BOTH, AND THE RAM OF THE
+//DEFAULT CONTEXT, WHEN ONLY CALLER OWNED CONTEXTS ARE USED
+#ifndef NTP_LEGACY_API
+#define NTP_LEGACY_API			1
+#endif
+
+//QUERY SCHEDULER RELATED
+//NO SERVER IS QUERIED MORE OFTEN THAN NTP_MIN_QUERY_INTERVAL_MS, WHATEVER
+//STARTED THE QUERY. FAILED QUERIES BACK OFF PER SERVER FROM
+//NTP_BACKOFF_BASE_MS, DOUBLING UP TO NTP_BACKOFF_MAX_EXP TIMES, WITH
+//RANDOM JITTER SO A FLEET OF DEVICES DOES NOT RETRY IN LOCKSTEP
+#define NTP_MIN_QUERY_INTERVAL_MS	16000UL
+#define NTP_BACKOFF_BASE_MS			2000UL
+#define NTP_BACKOFF_MAX_EXP			5
+//SLACK OVER THE REPLY TIMEOUT BEFORE THE LIBRARY TIMES A QUERY OUT
+//ITSELF, IN CASE THE TRANSPORT STOPPED WAITING AT A STRAY DATAGRAM
+#define NTP_REPLY_GUARD_MS			1000UL
+//A MULTI SERVER ROUND STOPS WAITING FOR THE SLOWER SERVERS
+//NTP_GATHER_GRACE_MS AFTER A MAJORITY OF THE QUERIED ONES HAVE ANSWERED
+#define NTP_GATHER_GRACE_MS			250UL
+
+//CLOCK FILTER RELATED (RFC 5905 SECTION 10)
+//EVERY SERVER KEEPS ITS LAST NTP_FILTER_STAGES SAMPLES. THE ONE WITH THE
+//LOWEST DELAY / 2 + DISPERSION STANDS FOR THE SERVER, SO A REPLY HELD UP
+//IN A QUEUE IS OUTVOTED BY A CLEAN ONE, AND IS ONLY USED IF NEWER THAN
+//THE LAST ONE USED. STORED DISPERSION GROWS BY NTP_CLOCK_TOLERANCE_PPM
+//WITH AGE. A CLOCK STEP EMPTIES THE FILTERS. IN BURST MODE (ESP8266_NTP_SetBurst) THE FIRST
+//SYNC QUERIES EACH SERVER SEVERAL TIMES NTP_BURST_INTERVAL_MS APART, THE
+//ONLY EXCEPTION TO NTP_MIN_QUERY_INTERVAL_MS
+#define NTP_FILTER_STAGES			8
+#define NTP_BURST_INTERVAL_MS		2000UL
+
+//ERA RELATED (RFC 5905 SECTION 6)
+//ON THE WIRE SECONDS WRAP EVERY 2^32 S (ERA 1 STARTS 2036-02-07). THE
+//CLOCK KEEPS ERA EXTENDED SECONDS AND PLACES EVERY 32 BIT VALUE IN THE
+//ERA CLOSEST TO A REFERENCE : THE CLOCK ITSELF, WHICH BEFORE THE FIRST
+//SYNC STARTS AT NTP_ERA_PIVOT (OR ESP8266_NTP_SetEraPivot). CORRECT
+//WHILE THE TRUE TIME IS WITHIN 68 YEARS OF THE PIVOT. OVERRIDE AT BUILD
+//TIME (ERA EXTENDED NTP SECONDS, DEFAULT 2026-01-01)
+#ifndef NTP_ERA_PIVOT
+#define NTP_ERA_PIVOT				3976214400ULL
+#endif
+//NTP SECONDS AT THE UNIX EPOCH (1970-01-01)
+#define NTP_UNIX_EPOCH_OFFSET		2208988800ULL
+
+//LEAP SECOND RELATED
+//A LEAP ANNOUNCED IN THE LI BITS TAKES EFFECT AT THE END OF THE
+//CURRENT UTC MONTH. SMEAR MODE SPREADS IT LINEARLY OVER A WINDOW
+//CENTERED ON THAT MIDNIGHT (DEFAULT NOON TO NOON). SAMPLES TAKEN
+//WITHIN NTP_LEAP_GUARD_S OF THE LEAP (OR OF THE SMEAR WINDOW) DO NOT
+//DISCIPLINE THE CLOCK UNLESS THEY ARE OFF BY MORE THAN A LEAP CAN
+//EXPLAIN (2 S), SO THE LEAP ITSELF NEVER LOOKS LIKE AN OFFSET
+#define NTP_LEAP_SMEAR_S			86400UL
+#define NTP_LEAP_GUARD_S			600UL
+
+//TIME ZONE RELATED
+//ZONES ARE POSIX TZ STRINGS (E.G. "CET-1CEST,M3.5.0,M10.5.0/3"). THE
+//RULES ARE COMPILED ONCE AND THE TRANSITIONS OF THE CURRENT AND NEXT
+//YEAR CACHED, SO A LOOKUP IS ONE COMPARE UNTIL THE NEXT TRANSITION
+#define NTP_TZ_NAME_SIZE			8		//ABBREVIATION + NUL
+#define NTP_TZ_DEFAULT_RULES		",M3.2.0,M11.1.0"	//DST NAME WITHOUT RULES
+#define NTP_TZ_MAX_OFFSET_S			(25L * 3600)
+#define NTP_TZ_MAX_RULE_TIME_S		(167L * 3600)
+
+//ALARM SCHEDULER RELATED
+//WALL CLOCK ALARMS (UTC, 1 S RESOLUTION) COME FROM A PREALLOCATED PER
+//CONTEXT POOL AND ARE HASHED INTO A HIERARCHICAL TIMING WHEEL OF
+//NTP_ALARM_WHEEL_LEVELS LEVELS OF 2^NTP_ALARM_WHEEL_BITS SLOTS. A SLOT
+//OF ONE LEVEL SPANS A FULL TURN OF THE LEVEL BELOW AND IS CASCADED
+//DOWN WHEN THAT TURN STARTS. ALARMS PAST THE TOP LEVEL (~3 DAYS) WAIT
+//ON AN OVERFLOW LIST RE-HASHED ONCE PER TOP LEVEL TURN. A CLOCK STEP
+//BACK, OR FORWARD BY MORE THAN NTP_ALARM_CATCHUP_S, RE-HASHES THE POOL
+//AND FIRES WHAT THE STEP SKIPPED ONCE. OVERRIDE THE POOL SIZE AT BUILD
+//TIME (UPTO 65535)
+#ifndef NTP_MAX_ALARMS
+#define NTP_MAX_ALARMS				16
+#endif
+#define NTP_ALARM_WHEEL_BITS		6
+#define NTP_ALARM_WHEEL_SLOTS		(1 << NTP_ALARM_WHEEL_BITS)
+#define NTP_ALARM_WHEEL_LEVELS		3
+#define NTP_ALARM_LIST_FAR			(NTP_ALARM_WHEEL_LEVELS * NTP_ALARM_WHEEL_SLOTS)
+#define NTP_ALARM_LIST_HOLD			(NTP_ALARM_LIST_FAR + 1)	//CLOCK NOT SYNCED YET / DUE
+#define NTP_ALARM_LIST_COUNT		(NTP_ALARM_LIST_FAR + 2)
+#define NTP_ALARM_CATCHUP_S			120
+#define NTP_ALARM_EVERY_DAY			0x7F	//WEEKDAY MASK, BIT 0 = SUNDAY
+
+//WARM START RELATED
+//A CHECKSUMMED SNAPSHOT (CLOCK, RTC COUNTER READING, ERROR BOUND, DRIFT,
+//CACHED SERVER IPS) IS KEPT IN A PERSISTENT STORE (RTC USER MEMORY ON
+//DEVICE). ON BOOT THE CLOCK IS CARRIED ACROSS THE RESET / DEEP SLEEP BY
+//THE RTC COUNTER. THE ERROR BOUND GROWS BY NTP_RTC_TOLERANCE_PPM OVER
+//THAT GAP AND BY NTP_CLOCK_TOLERANCE_PPM WHILE RUNNING. A NETWORK SYNC
+//IS ONLY DUE ONCE THE BOUND PASSES THE SYNC THRESHOLD
+#define NTP_STORE_MAGIC				0x4E545053UL	//"NTPS"
+#define NTP_STORE_VERSION			1
+#define NTP_STORE_F_TIME			0x01	//SNAPSHOT CARRIES A USABLE CLOCK
+#ifndef NTP_STORE_RTC_BLOCK
+#define NTP_STORE_RTC_BLOCK			64		//FIRST RTC USER MEMORY BLOCK (4 BYTES EACH)
+#endif
+#define NTP_STORE_MAX_GAP_S			21600UL	//LONGER GAPS (OR A WRAPPED COUNTER) START COLD
+#ifndef NTP_RTC_TOLERANCE_PPM
+#define NTP_RTC_TOLERANCE_PPM		2000	//CALIBRATED RTC SLOW CLOCK
+#endif
+#define NTP_CLOCK_TOLERANCE_PPM		15		//DISCIPLINED TICK (RFC 5905 PHI)
+#define NTP_SYNC_THRESHOLD_US		1000000UL
+
+//TIME FORMAT RELATED
+//A strftime SUBSET. PATTERNS ARE COMPILED ONCE INTO AN OP LIST AND
+//FORMATTED INTO A CALLER BUFFER WITHOUT sprintf OR HEAP. CONVERSIONS :
+//%Y %y %m %d %e %H %I %p %M %S %a %A %b %B %s (UNIX SECONDS)
+//%N / %1N-%6N (FRACTION, 6 DIGITS MAX) %z (+hhmm) %:z (+hh:mm) %Z %%
+#ifndef NTP_FORMAT_MAX_OPS
+#define NTP_FORMAT_MAX_OPS			32
+#endif
+#ifndef NTP_FORMAT_LITERAL_SIZE
+#define NTP_FORMAT_LITERAL_SIZE		32
+#endif
+#define NTP_FORMAT_ISO8601			"%Y-%m-%dT%H:%M:%S%:z"
+#define NTP_FORMAT_RFC3339			"%Y-%m-%dT%H:%M:%S.%3N%:z"
+#define NTP_FORMAT_HTTP_DATE		"%a, %d %b %Y %H:%M:%S GMT"	//COMPILE WITH utc = 1
+
+//SNTP SERVER RELATED
+//A SYNCED NODE ANSWERS CLIENT (MODE 3) REQUESTS FROM ITS DISCIPLINED
+//CLOCK AS A SERVER ONE STRATUM BELOW ITS SOURCE (RFC 4330). REPLIES ARE
+//A PREBUILT 48 BYTE TEMPLATE, REFRESHED AT MOST ONCE A SECOND, WITH
+//ONLY THE VERSION, POLL AND TIMESTAMPS PATCHED IN PER REQUEST. NOTHING
+//IS ANSWERED BEFORE THE FIRST NETWORK SYNC OR WHILE THE ERROR BOUND IS
+//ABOVE NTP_SERVE_MAX_ERROR_US, SO CLIENTS MOVE ON TO ANOTHER SERVER
+#ifndef NTP_SERVE_MAX_ERROR_US
+#define NTP_SERVE_MAX_ERROR_US		100000UL
+#endif
+#define NTP_SERVE_PRECISION			-20		//1 US TICK
+
+//CALENDAR CONVERSION RELATED
+//COVERS ERAS 0 AND 1 (1900-01-01 UPTO 2172-03-15, SECONDS < 2^33)
+//STEPS OF THIS MANY SECONDS OR MORE DO A FULL RECOMPUTE INSTEAD OF
+//AN INCREMENTAL UPDATE (A SINGLE CARRY PER FIELD IS ASSUMED)
+#define NTP_INCREMENTAL_MAX_SECS	60
+//DAYS FROM 0000-03-01 (COMPUTATIONAL CALENDAR DAY 0) TO 1900-01-01
+#define NTP_RATA_DIE_1900		693901UL
+//MULTIPLY-SHIFT RECIPROCALS : x / d == (x * MUL) >> SHIFT OVER THE
+//RANGE USED BY THE CONVERSION
+#define NTP_DIV675_MUL			101806633ULL	//x < 2^26
+#define NTP_DIV675_SHIFT		36
+#define NTP_DIV3600_MUL			37283UL		//x < 86400
+#define NTP_DIV3600_SHIFT		27
+#define NTP_DIV60_MUL			2185UL		//x < 3600
+#define NTP_DIV60_SHIFT			17
+#define NTP_DIV7_MUL			4793491ULL	//x < 2^22
+#define NTP_DIV7_SHIFT			25
+#define NTP_DIV146097_MUL		3762951ULL
+#define NTP_DIV146097_SHIFT		39
+#define NTP_DIV11758980_MUL		1461ULL
+#define NTP_DIV11758980_SHIFT	34
+#define NTP_DIV2141_MUL			31345UL
+#define NTP_DIV2141_SHIFT		26
+
+#define NTP_USEC_PER_SEC		1000000UL
+//THE 32 BIT MICROSECOND TICK WRAPS EVERY ~71.6 MINUTES AND THE CLOCK CAN
+//ONLY EXTEND ACROSS ONE WRAP. A HOUSEKEEPING TIMER READS EVERY LIVE CLOCK
+//AT THIS PERIOD, HOWEVER LONG AN INSTANCE IS OTHERWISE LEFT IDLE
+#define NTP_TICK_HOUSEKEEPING_MS	(30UL * 60 * 1000)
+//2^48 / 10^6 (MICROSECONDS -> 32 BIT NTP FRACTION, MULTIPLY THEN >> 16)
+#define NTP_USEC_TO_FRAC_MUL	281474977ULL
+
+//CLOCK DISCIPLINE RELATED
+#define NTP_STEP_THRESHOLD_US	128000L
+#define NTP_SLEW_RATE_SHIFT		11		//MAX SLEW = TICKS >> 11 (~488 PPM)
+#define NTP_MAX_FREQ_Q32		2147484L	//500 PPM IN 2^-32 UNITS
+#define NTP_FREQ_GAIN_SHIFT		2		//FREQUENCY UPDATE GAIN = 1/4
+#define NTP_MIN_POLL_EXP		6		//64 SECONDS
+#define NTP_MAX_POLL_EXP		10		//1024 SECONDS
+//SHORTEST INTERVAL A FREQUENCY UPDATE IS MEASURED OVER : THE SHORTEST
+//JITTERED POLL (HALF OF 2^NTP_MIN_POLL_EXP)
+#define NTP_FREQ_MIN_INTERVAL_S	(1UL << (NTP_MIN_POLL_EXP - 1))
+#define NTP_POLL_ADJ_THRESHOLD_US	20000L
+#define NTP_POLL_LIMIT			30
 
-#define LEAPOCH 				(36584UL) * 86400
-#define DAYS_PER_4Y				(365*4 +1)
-#define DAYS_PER_100Y			(365*100UL + 24)
-#define DAYS_PER_400Y			(365*400UL + 97)
+//LOGGING RELATED
+//LOG CALLS BELOW NTP_LOG_LEVEL COMPILE TO NOTHING (NO CODE, NO STRINGS).
+//ENABLED CALLS APPEND A BINARY ESP8266_NTP_LOG_RECORD TO A RING OF
+//NTP_LOG_RING_SIZE (POWER OF 2) RECORDS, READ WITH ESP8266_NTP_LogRead
+//AND DECODED OFF DEVICE. WHEN THE RING IS FULL NEW RECORDS ARE DROPPED.
+//NTP_LOG_PRINT 1 ALSO PRINTS EVERY RECORD AS IT IS WRITTEN (BENCH
+//BUILDS ONLY, IT SLOWS THE RECEIVE PATH)
+#define NTP_LOG_LEVEL_NONE				0
+#define NTP_LOG_LEVEL_ERROR				1
+#define NTP_LOG_LEVEL_WARN				2
+#define NTP_LOG_LEVEL_INFO				3
+#define NTP_LOG_LEVEL_DEBUG				4
+#ifndef NTP_LOG_LEVEL
+#define NTP_LOG_LEVEL					NTP_LOG_LEVEL_WARN
+#endif
+#ifndef NTP_LOG_RING_SIZE
+#define NTP_LOG_RING_SIZE				32
+#endif
+#ifndef NTP_LOG_PRINT
+#define NTP_LOG_PRINT					0
+#endif
+
+#if NTP_LOG_LEVEL >= NTP_LOG_LEVEL_ERROR
+#define NTP_LOG_ERROR(id, server, a, b)	_esp8266_ntp_log(ESP8266_NTP_LOG_##id, (server), (a), (b))
+#else
+#define NTP_LOG_ERROR(id, server, a, b)
+#endif
+#if NTP_LOG_LEVEL >= NTP_LOG_LEVEL_WARN
+#define NTP_LOG_WARN(id, server, a, b)	_esp8266_ntp_log(ESP8266_NTP_LOG_##id, (server), (a), (b))
+#else
+#define NTP_LOG_WARN(id, server, a, b)
+#endif
+#if NTP_LOG_LEVEL >= NTP_LOG_LEVEL_INFO
+#define NTP_LOG_INFO(id, server, a, b)	_esp8266_ntp_log(ESP8266_NTP_LOG_##id, (server), (a), (b))
+#else
+#define NTP_LOG_INFO(id, server, a, b)
+#endif
+#if NTP_LOG_LEVEL >= NTP_LOG_LEVEL_DEBUG
+#define NTP_LOG_DEBUG(id, server, a, b)	_esp8266_ntp_log(ESP8266_NTP_LOG_##id, (server), (a), (b))
+#else
+#define NTP_LOG_DEBUG(id, server, a, b)
+#endif
+
+//SERVER STATISTICS RELATED
+//HISTOGRAMS HAVE FIXED LOG2 BUCKETS. BUCKET 0 COUNTS VALUES BELOW 1
+//UNIT, BUCKET i COUNTS [2^(i-1), 2^i) UNITS AND THE LAST BUCKET ALSO
+//EVERYTHING ABOVE. LATENCIES ARE IN MS, OFFSETS IN UNITS OF
+//2^NTP_HIST_OFFSET_SHIFT US (64 US). COUNTS SATURATE
+#define NTP_HIST_BUCKETS				12
+#define NTP_HIST_OFFSET_SHIFT			6
+#define NTP_STATS_SNAPSHOT_VERSION		1
+#define NTP_STATS_SNAPSHOT_HDR_SIZE		5
+#define NTP_STATS_SNAPSHOT_SERVER_SIZE	(23 + (3 * 2 * NTP_HIST_BUCKETS))
+#define NTP_STATS_SNAPSHOT_SIZE(n)		(NTP_STATS_SNAPSHOT_HDR_SIZE + ((n) * NTP_STATS_SNAPSHOT_SERVER_SIZE))
+
+//NTP HEADER FIELD HELPERS
+#define NTP_LI_VN_MODE(li, vn, mode)	((uint8_t)(((li) << 6) | ((vn) << 3) | (mode)))
+#define NTP_HDR_LI(hdr)					((hdr)->li_vn_mode >> 6)
+#define NTP_HDR_VN(hdr)					(((hdr)->li_vn_mode >> 3) & 0x07)
+#define NTP_HDR_MODE(hdr)				((hdr)->li_vn_mode & 0x07)
+#define NTP_MODE_CLIENT					3
+#define NTP_MODE_SERVER					4
+#define NTP_VERSION						3
+
+//PACKET SANITY TESTS (RFC 5905 SECTION 8, NUMBERED AS IN THE REFERENCE
+//IMPLEMENTATION). A REPLY IS ACCEPTED ONLY IF NO TEST FLAG IS SET.
+//TESTS 5, 9 AND 12 (AUTHENTICATION / AUTOKEY / SYNC LOOP) DO NOT APPLY
+//TO AN UNAUTHENTICATED CLIENT AND ARE NEVER SET
+#define NTP_TEST_COUNT					13
+#define NTP_TEST_DUPLICATE				(1 << 0)	//1  TRANSMIT TIMESTAMP ALREADY SEEN
+#define NTP_TEST_BOGUS					(1 << 1)	//2  ORIGINATE DOES NOT ECHO OUR REQUEST
+#define NTP_TEST_INVALID				(1 << 2)	//3  ZERO ORIGINATE / RECEIVE / TRANSMIT TIMESTAMP
+#define NTP_TEST_KOD					(1 << 3)	//4  KISS-O'-DEATH (STRATUM 0)
+#define NTP_TEST_AUTH					(1 << 4)	//5  NOT USED
+#define NTP_TEST_UNSYNC					(1 << 5)	//6  LEAP ALARM OR NO / FUTURE REFERENCE TIME
+#define NTP_TEST_STRATUM				(1 << 6)	//7  STRATUM ABOVE NTP_MAX_STRATUM
+#define NTP_TEST_MODE					(1 << 7)	//8  NOT A SERVER REPLY OR UNKNOWN VERSION
+#define NTP_TEST_AUTOKEY				(1 << 8)	//9  NOT USED
+#define NTP_TEST_DISTANCE				(1 << 9)	//10 ROOT DISTANCE ABOVE NTP_MAX_DIST
+#define NTP_TEST_DELAY					(1 << 10)	//11 ROUND TRIP DELAY ABOVE NTP_MAX_DIST
+#define NTP_TEST_LOOP					(1 << 11)	//12 NOT USED
+#define NTP_TEST_STALE					(1 << 12)	//13 REFERENCE TIME OLDER THAN NTP_MAX_REF_AGE_S
+#define NTP_MAX_STRATUM					15
+#define NTP_MAX_DIST_Q16				98304UL		//1.5 S IN 16.16 FIXED POINT
+#define NTP_MAX_REF_AGE_S				86400UL
 
 //CUSTOM VARIABLE STRUCTURES/////////////////////////////
 typedef enum
@@ -36,6 +310,289 @@ typedef enum
 	ESP8266_NTP_STATE_OK
 } ESP8266_NTP_STATE;
 
+//SYNC STATE MACHINE
+//IDLE -> QUEUED (WAITING FOR THE UDP CLIENT) -> WAITING (FOR THE SELECTED
+//SERVER TO BE DUE) -> RESOLVING -> SENT -> AWAITING -> WAITING (NEXT
+//SERVER / RETRY) ... -> DONE / FAILED
+//IN MULTI SERVER MODE : WAITING (FOR THE FIRST SERVER TO BE DUE) ->
+//GATHERING (ALL DUE SERVERS QUERIED AT ONCE, ONE ROUND PER BURST
+//QUERY) -> DONE / FAILED
+typedef enum
+{
+	ESP8266_NTP_SYNC_IDLE,
+	ESP8266_NTP_SYNC_QUEUED,
+	ESP8266_NTP_SYNC_WAITING,
+	ESP8266_NTP_SYNC_RESOLVING,
+	ESP8266_NTP_SYNC_SENT,
+	ESP8266_NTP_SYNC_AWAITING,
+	ESP8266_NTP_SYNC_DONE,
+	ESP8266_NTP_SYNC_FAILED,
+	ESP8266_NTP_SYNC_GATHERING,
+	ESP8266_NTP_SYNC_STATE_COUNT
+} ESP8266_NTP_SYNC_STATE;
+
+typedef enum
+{
+	ESP8266_NTP_EV_START,		//SYNC REQUESTED
+	ESP8266_NTP_EV_CANCEL,		//SYNC CANCELLED
+	ESP8266_NTP_EV_GRANTED,		//UDP CLIENT ACQUIRED
+	ESP8266_NTP_EV_DUE,			//SELECTED SERVER MAY BE QUERIED
+	ESP8266_NTP_EV_RESOLVED,	//SERVER ADDRESS KNOWN
+	ESP8266_NTP_EV_SENT,		//REQUEST SENT
+	ESP8266_NTP_EV_REPLY,		//REPLY ACCEPTED, SAMPLE STORED
+	ESP8266_NTP_EV_FAIL,		//DNS FAIL, REPLY TIMEOUT OR REJECTED REPLY
+	ESP8266_NTP_EV_COMPLETE,	//SAMPLE SELECTED
+	ESP8266_NTP_EV_GIVE_UP,		//NO USABLE SERVER OR RETRIES LEFT
+	ESP8266_NTP_EV_ROUND,		//MULTI SERVER ROUND IS DUE
+	ESP8266_NTP_EV_COUNT
+} ESP8266_NTP_SYNC_EVENT;
+
+//QUERY OF ONE SERVER IN A MULTI SERVER ROUND
+typedef enum
+{
+	ESP8266_NTP_GATHER_IDLE,		//NOT PART OF THE ROUND, OR DONE WITH IT
+	ESP8266_NTP_GATHER_QUEUED,		//DUE, NOT YET ISSUED
+	ESP8266_NTP_GATHER_LOOKUP,		//RESOLVING ITS NAME
+	ESP8266_NTP_GATHER_REPLY		//REQUEST SENT, AWAITING THE REPLY
+} ESP8266_NTP_GATHER;
+
+//VERDICT ON A REPLY TO THE OUTSTANDING REQUEST OF A SERVER
+typedef enum
+{
+	ESP8266_NTP_REPLY_OK,			//ACCEPTED, SAMPLE STORED
+	ESP8266_NTP_REPLY_STRAY,		//NOT THE REPLY (DUPLICATE / BOGUS), KEEP WAITING
+	ESP8266_NTP_REPLY_FAILED		//THE SERVER ANSWERED, BUT UNUSABLY (REJECTED / KOD)
+} ESP8266_NTP_REPLY;
+
+//LOG EVENT IDS. VALUES ARE PART OF THE RECORD FORMAT, ONLY APPEND
+//ARGUMENTS ARE (SERVER, a, b). UNLISTED ARGUMENTS ARE 0
+typedef enum
+{
+	ESP8266_NTP_LOG_NO_SERVER,		//ERROR : NO NTP SERVER CONFIGURED
+	ESP8266_NTP_LOG_MAX_SERVERS,	//ERROR : SERVER LIST FULL. a = CAPACITY
+	ESP8266_NTP_LOG_CLOCK_STEP,		//INFO  : b = STEP (MS)
+	ESP8266_NTP_LOG_DISCIPLINE,		//DEBUG : SERVER = POLL EXPONENT, a = DRIFT (0.1 PPM), b = OFFSET (US)
+	ESP8266_NTP_LOG_EVENT_IGNORED,	//DEBUG : a = STATE, b = EVENT
+	ESP8266_NTP_LOG_SYNC_STATE,		//DEBUG : a = OLD STATE << 8 | NEW STATE, b = EVENT
+	ESP8266_NTP_LOG_TRANSPORT_BUSY,	//INFO  : SYNC QUEUED BEHIND ANOTHER INSTANCE
+	ESP8266_NTP_LOG_CACHE_HIT,		//DEBUG : CACHED SERVER IP USED
+	ESP8266_NTP_LOG_DNS_START,		//DEBUG
+	ESP8266_NTP_LOG_SENT,			//DEBUG
+	ESP8266_NTP_LOG_SYNC_DONE,		//INFO  : a = DELAY (MS), b = OFFSET (US)
+	ESP8266_NTP_LOG_SYNC_FAILED,	//WARN  : a = RETRIES
+	ESP8266_NTP_LOG_QUERY_DEFERRED,	//DEBUG : b = WAIT (MS)
+	ESP8266_NTP_LOG_KOD,			//WARN  : b = KISS CODE
+	ESP8266_NTP_LOG_NO_MAJORITY,	//WARN  : a = SAMPLE COUNT
+	ESP8266_NTP_LOG_FALSETICKER,	//WARN  : b = OFFSET (US)
+	ESP8266_NTP_LOG_DNS_OK,			//DEBUG : b = DNS LATENCY (MS)
+	ESP8266_NTP_LOG_DNS_FAIL,		//WARN
+	ESP8266_NTP_LOG_DNS_STALE,		//INFO  : STALE CACHED IP USED
+	ESP8266_NTP_LOG_TIMEOUT,		//WARN
+	ESP8266_NTP_LOG_SHORT_REPLY,	//WARN  : a = LENGTH
+	ESP8266_NTP_LOG_REJECTED,		//WARN  : a = FIRST FAILED TEST, b = NTP_TEST_* FLAGS
+	ESP8266_NTP_LOG_SAMPLE,			//DEBUG : a = DELAY (MS), b = OFFSET (US)
+	ESP8266_NTP_LOG_LEAP_ARMED,		//INFO  : a = ESP8266_NTP_LEAP, b = SECONDS UNTIL THE LEAP
+	ESP8266_NTP_LOG_LEAP_APPLIED,	//INFO  : a = ESP8266_NTP_LEAP
+	ESP8266_NTP_LOG_LEAP_HOLD,		//DEBUG : SAMPLE NEAR A LEAP NOT USED FOR DISCIPLINE
+	ESP8266_NTP_LOG_ALARM_FULL,		//WARN  : ALARM POOL EXHAUSTED. a = CAPACITY
+	ESP8266_NTP_LOG_ALARM_REHASH,	//INFO  : a = ALARMS DUE, b = CLOCK JUMP (S)
+	ESP8266_NTP_LOG_STORE_SAVED,	//DEBUG : a = NTP_STORE_F_* FLAGS
+	ESP8266_NTP_LOG_STORE_RESTORED,	//INFO  : a = NTP_STORE_F_* FLAGS, b = ERROR BOUND (MS)
+	ESP8266_NTP_LOG_STORE_INVALID,	//WARN  : a = 0 NOT READ, 1 BAD FORMAT / CHECKSUM
+	ESP8266_NTP_LOG_SERVE_START,	//INFO  : a = PORT
+	ESP8266_NTP_LOG_SERVE_STOP,		//INFO  : b = REQUESTS ANSWERED
+	ESP8266_NTP_LOG_SERVE_DROP,		//DEBUG : a = 0 NOT A CLIENT REQUEST, 1 NOT SYNCED
+	ESP8266_NTP_LOG_FILTER_HOLD,	//DEBUG : BEST FILTERED SAMPLE ALREADY USED. CLOCK NOT UPDATED
+	ESP8266_NTP_LOG_BURST,			//DEBUG : a = BURST QUERIES LEFT TO THIS SERVER
+	ESP8266_NTP_LOG_ROUND,			//DEBUG : MULTI SERVER ROUND. a = SERVERS QUERIED
+	ESP8266_NTP_LOG_LINUX_NO_STAMP,	//WARN  : NO KERNEL RECEIVE TIMESTAMPS. b = ERRNO
+	ESP8266_NTP_LOG_LINUX_DROPPED,	//DEBUG : DATAGRAM ANSWERS NO QUERY. a = SOURCE PORT, b = SOURCE IPv4
+	ESP8266_NTP_LOG_LINUX_NO_LOOKUP,//WARN  : LOOKUP TABLE FULL. a = CAPACITY
+	ESP8266_NTP_LOG_LINUX_SEND,		//WARN  : sendto FAILED. b = ERRNO
+	ESP8266_NTP_LOG_LINUX_SERVE		//ERROR : CAN NOT SERVE. a = PORT, b = ERRNO
+} ESP8266_NTP_LOG_EVENT;
+
+//NETWORK TRANSPORT
+//THE LIBRARY REACHES THE NETWORK ONLY THROUGH THESE OPERATIONS. THE
+//EXCHANGE HAS THE SAME CONTRACT AS ESP8266_UDP_CLIENT (THE DEFAULT ON
+//DEVICE) : ONE AT A TIME, resolve REPORTS NULL ON FAILURE AND recv_cb
+//WITH LENGTH 0 REPORTS A REPLY TIMEOUT. A DATAGRAM THAT DOES NOT ECHO
+//THE REQUEST IS DROPPED AND THE LIBRARY KEEPS WAITING, UNTIL THE
+//TRANSPORT TIMEOUT OR ITS OWN GUARD NTP_REPLY_GUARD_MS LATER.
+//SIMULATIONS AND HOST BUILDS INSTALL THEIR OWN WITH
+//ESP8266_NTP_SetTransport.
+//rx_tick IS OPTIONAL (NULL) : CALLED FROM INSIDE recv_cb IT RETURNS 1
+//AND THE TICK SOURCE TIME THE DATAGRAM ARRIVED, SO T4 EXCLUDES THE
+//LATENCY BETWEEN ARRIVAL AND DELIVERY.
+//lookup AND send_to ARE OPTIONAL (NULL) AND CARRY MANY QUERIES AT ONCE.
+//lookup RESOLVES hostname ALONGSIDE ANY OTHER LOOKUP OR EXCHANGE AND
+//CALLS found_cb ONCE WITH arg (ip NULL ON FAILURE), POSSIBLY BEFORE IT
+//RETURNS. send_to SENDS A REQUEST TO ip:port WITHOUT ENDING ANY OTHER
+//OUTSTANDING ONE, 0 IF IT COULD NOT. ITS REPLY ARRIVES THROUGH recv_cb
+//AND IS MATCHED BY ITS ORIGINATE TIMESTAMP. THE LIBRARY TIMES THESE
+//QUERIES OUT ITSELF. MULTI SERVER MODE NEEDS BOTH
+typedef struct
+{
+	void (*set_debug)(uint8_t debug_on);
+	void (*set_dns_server)(char num_dns, ip_addr_t* dns);
+	void (*initialize)(char* hostname, char* host_ip, uint16_t port, uint32_t timeout_ms);
+	void (*resolve)(void (*resolved_cb)(ip_addr_t* ip));
+	void (*set_callbacks)(void (*sent_cb)(void* arg), void (*recv_cb)(char* data, uint16_t length));
+	void (*send)(uint8_t* data, uint16_t length);
+	uint8_t (*rx_tick)(uint32_t* tick_us);
+	void (*lookup)(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg);
+	uint8_t (*send_to)(ip_addr_t* ip, uint16_t port, uint8_t* data, uint16_t length);
+} ESP8266_NTP_TRANSPORT;
+
+//SNTP SERVER LISTENER
+//open BINDS THE SERVER PORT (1 ON SUCCESS) AND HANDS EVERY DATAGRAM TO
+//recv_cb WITH AN OPAQUE PEER HANDLE AND THE TICK SOURCE TIME IT ARRIVED.
+//reply SENDS TO THAT PEER AND IS ONLY VALID INSIDE recv_cb. THE DEFAULT
+//ON DEVICE IS AN espconn UDP LISTENER, HOST BUILDS INSTALL THEIR OWN
+//WITH ESP8266_NTP_SetListener
+typedef struct
+{
+	uint8_t (*open)(uint16_t port, void (*recv_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick));
+	void (*close)(void);
+	void (*reply)(void* peer, uint8_t* data, uint16_t length);
+} ESP8266_NTP_LISTENER;
+
+typedef struct
+{
+	uint32_t requests;		//DATAGRAMS RECEIVED
+	uint32_t answered;
+	uint32_t invalid;		//RUNT OR NOT A CLIENT REQUEST
+	uint32_t unsynced;		//DROPPED, CLOCK NOT FIT TO SERVE
+} ESP8266_NTP_SERVE_STATS;
+
+//PERSISTENT STORE
+//THE WARM START SNAPSHOT IS READ AND WRITTEN WHOLE THROUGH read / write
+//(1 ON SUCCESS). rtc_now READS A COUNTER THAT KEEPS RUNNING THROUGH THE
+//RESETS / SLEEP THE SNAPSHOT HAS TO BRIDGE, WITH ITS PERIOD IN 2^-12 US
+//UNITS, AND RETURNS 0 IF THERE IS NONE. rtc_kept RETURNS 1 IF THAT
+//COUNTER HAS RUN WITHOUT A RESET SINCE THE PREVIOUS BOOT. THE DEFAULT
+//ON DEVICE IS RTC USER MEMORY AND THE RTC TIMER (KEPT ON DEEP SLEEP WAKE)
+typedef struct
+{
+	uint8_t (*read)(void* buf, uint16_t size);
+	uint8_t (*write)(const void* buf, uint16_t size);
+	uint8_t (*rtc_now)(uint32_t* ticks, uint32_t* period_q12);
+	uint8_t (*rtc_kept)(void);
+} ESP8266_NTP_STORE;
+
+//WARM START SNAPSHOT. HOST BYTE ORDER, ONLY READ BACK BY THE SAME BUILD
+typedef struct
+{
+	uint32_t magic;			//NTP_STORE_MAGIC
+	uint16_t size;			//sizeof(ESP8266_NTP_SNAPSHOT)
+	uint8_t version;		//NTP_STORE_VERSION
+	uint8_t flags;			//NTP_STORE_F_*
+	uint64_t clock_sec;		//SOFTWARE CLOCK WHEN rtc_ticks WAS READ
+	uint32_t clock_usec;
+	uint32_t rtc_ticks;
+	uint32_t error_us;		//ERROR BOUND AT THAT TIME
+	int32_t clock_freq;
+	uint8_t poll_exp;
+	uint8_t dns_valid;		//BIT PER SERVER SLOT
+	uint16_t reserved;
+	uint32_t dns_ip[NTP_MAX_SERVERS];
+	uint32_t dns_age_s[NTP_MAX_SERVERS];
+	uint32_t dns_name_crc[NTP_MAX_SERVERS];	//SLOT IS ONLY RESTORED FOR THE SAME HOSTNAME
+	uint32_t crc;			//CRC-32 OF THE FIELDS ABOVE
+} ESP8266_NTP_SNAPSHOT;
+
+typedef struct
+{
+	uint32_t tick_us;		//TICK SOURCE TIME OF THE EVENT
+	uint8_t id;				//ESP8266_NTP_LOG_EVENT
+	uint8_t server;
+	int16_t a;
+	int32_t b;
+} ESP8266_NTP_LOG_RECORD;
+
+typedef enum
+{
+	ESP8266_NTP_ERROR_NONE,
+	ESP8266_NTP_ERROR_DNS,			//DNS RESOLUTION FAILED
+	ESP8266_NTP_ERROR_TIMEOUT,		//NO REPLY
+	ESP8266_NTP_ERROR_SHORT,		//REPLY SHORTER THAN AN NTP HEADER
+	ESP8266_NTP_ERROR_REJECTED,		//REPLY FAILED A SANITY TEST
+	ESP8266_NTP_ERROR_KOD			//KISS-O'-DEATH
+} ESP8266_NTP_ERROR;
+
+//PENDING LEAP SECOND. VALUES MATCH THE LI FIELD OF THE NTP HEADER
+typedef enum
+{
+	ESP8266_NTP_LEAP_NONE,
+	ESP8266_NTP_LEAP_INSERT,		//LAST MINUTE OF THE MONTH HAS 61 SECONDS
+	ESP8266_NTP_LEAP_DELETE			//LAST MINUTE OF THE MONTH HAS 59 SECONDS
+} ESP8266_NTP_LEAP;
+
+typedef enum
+{
+	ESP8266_NTP_LEAP_MODE_STEP,		//REPEAT (INSERT) OR SKIP (DELETE) 23:59:59
+	ESP8266_NTP_LEAP_MODE_SMEAR		//SLEW 1 S LINEARLY OVER THE SMEAR WINDOW
+} ESP8266_NTP_LEAP_MODE;
+
+//COMPILED POSIX TZ TRANSITION RULE
+typedef struct
+{
+	uint8_t type;			//'J' (1-365, NO FEB 29), 'D' (0-365) OR 'M'
+	uint8_t month;			//'M' : MONTH (1-12)
+	uint8_t week;			//'M' : WEEK (1-5, 5 = LAST)
+	uint8_t wday;			//'M' : WEEKDAY (SUNDAY = 0)
+	uint16_t day;			//'J' / 'D' : DAY
+	int32_t time_s;			//LOCAL TIME OF THE CHANGE (-167 H .. 167 H)
+} ESP8266_NTP_TZ_RULE;
+
+typedef struct
+{
+	char std_name[NTP_TZ_NAME_SIZE];
+	char dst_name[NTP_TZ_NAME_SIZE];
+	int32_t std_offset_s;	//EAST OF UTC (POSIX SIGN REVERSED)
+	int32_t dst_offset_s;
+	uint8_t has_dst;
+	ESP8266_NTP_TZ_RULE start;
+	ESP8266_NTP_TZ_RULE end;
+
+	//TRANSITION CACHE. offset_s HOLDS FOR ERA EXTENDED UTC SECONDS IN
+	//[valid_from, valid_from + valid_len). valid_len = 0 FORCES A REBUILD
+	uint64_t valid_from;
+	uint64_t valid_len;
+	int32_t offset_s;
+	uint8_t dst;
+} ESP8266_NTP_TZ;
+
+typedef enum
+{
+	ESP8266_NTP_ALARM_FREE,
+	ESP8266_NTP_ALARM_ONCE,			//AT A GIVEN UTC TIME
+	ESP8266_NTP_ALARM_EVERY,		//EVERY period_s, ALIGNED TO MULTIPLES OF IT
+	ESP8266_NTP_ALARM_DAILY			//AT A LOCAL TIME OF DAY (DST AWARE)
+} ESP8266_NTP_ALARM_KIND;
+
+typedef struct
+{
+	uint64_t at;			//NEXT FIRING (ERA EXTENDED UTC SECONDS), 0 = NOT COMPUTED YET
+	uint32_t period_s;		//EVERY : PERIOD. DAILY : LOCAL SECONDS AFTER MIDNIGHT
+	uint8_t kind;			//ESP8266_NTP_ALARM_KIND
+	uint8_t days;			//DAILY : WEEKDAY MASK (BIT 0 = SUNDAY)
+	uint16_t list;			//alarm_lists INDEX THE ALARM IS LINKED ON
+	uint16_t next;			//LIST LINKS (ALARM IDS, 0 = NONE)
+	uint16_t prev;
+	void (*cb)(uint16_t id, void* arg);
+	void* arg;
+} ESP8266_NTP_ALARM;
+
+//ERA AWARE NTP TIME. seconds COUNTS FROM 1900-01-01 00:00:00 UTC OF
+//ERA 0 : ERA = seconds >> 32, ERA OFFSET (THE ON THE WIRE VALUE) =
+//(uint32_t)seconds
+typedef struct
+{
+	uint64_t seconds;
+	uint32_t fraction;
+} ESP8266_NTP_TIME;
+
 typedef struct
 {
 	uint8_t hour;
@@ -47,39 +604,610 @@ typedef struct
 	uint8_t month_num;
 	const char* month_text;
 	uint16_t year;
-	uint32_t timestamp;
+	uint64_t timestamp;		//ERA EXTENDED NTP SECONDS (UTC)
+	int32_t offset_us;		//LAST MEASURED CLOCK OFFSET (SATURATED)
+	uint32_t delay_us;		//LAST MEASURED ROUND TRIP DELAY
+	uint32_t jitter_us;		//RMS OFFSET SPREAD OF THE SERVER CLOCK FILTER
+	uint32_t dispersion_us;	//CLOCK FILTER DISPERSION OF THE SAMPLE USED
+	ESP8266_NTP_LEAP leap;	//LEAP SECOND PENDING AT THE END OF THE MONTH
+	int32_t utc_offset_s;	//LOCAL TIME - UTC OF THE FIELDS ABOVE
+	uint8_t dst;			//1 IF DAYLIGHT SAVING TIME IS IN EFFECT
+	const char* tz_name;	//ZONE ABBREVIATION IN EFFECT (E.G. "CEST")
 	ESP8266_NTP_STATE state;
 } ESP8266_NTP_DATA;
+
+typedef enum
+{
+	ESP8266_NTP_FORMAT_LITERAL,
+	ESP8266_NTP_FORMAT_YEAR,
+	ESP8266_NTP_FORMAT_YEAR2,
+	ESP8266_NTP_FORMAT_MONTH,
+	ESP8266_NTP_FORMAT_DATE,
+	ESP8266_NTP_FORMAT_DATE_SPACE,
+	ESP8266_NTP_FORMAT_HOUR,
+	ESP8266_NTP_FORMAT_HOUR12,
+	ESP8266_NTP_FORMAT_AM_PM,
+	ESP8266_NTP_FORMAT_MIN,
+	ESP8266_NTP_FORMAT_SEC,
+	ESP8266_NTP_FORMAT_DAY_NAME,
+	ESP8266_NTP_FORMAT_DAY_ABBR,
+	ESP8266_NTP_FORMAT_MONTH_NAME,
+	ESP8266_NTP_FORMAT_MONTH_ABBR,
+	ESP8266_NTP_FORMAT_FRACTION,
+	ESP8266_NTP_FORMAT_OFFSET,
+	ESP8266_NTP_FORMAT_OFFSET_COLON,
+	ESP8266_NTP_FORMAT_ZONE,
+	ESP8266_NTP_FORMAT_UNIX
+} ESP8266_NTP_FORMAT_OP;
+
+typedef struct
+{
+	uint8_t op;
+	uint8_t arg;			//LITERAL : LENGTH, FRACTION : DIGITS
+	uint8_t literal;		//LITERAL : OFFSET IN THE LITERAL POOL
+} ESP8266_NTP_FORMAT_STEP;
+
+//COMPILED PATTERN. KEEPS THE FIELDS OF THE LAST SECOND IT FORMATTED,
+//SO USE ONE PER TASK / CONTEXT
+typedef struct
+{
+	ESP8266_NTP_FORMAT_STEP steps[NTP_FORMAT_MAX_OPS];
+	char literal[NTP_FORMAT_LITERAL_SIZE];
+	uint8_t count;
+	uint8_t utc;			//1 : FORMAT UTC, 0 : LOCAL TIME OF THE CONTEXT
+	uint16_t max_length;	//LONGEST OUTPUT EXCLUDING THE NUL
+
+	uint8_t cache_valid;
+	uint64_t cache_sec;		//LOCAL SECONDS THE CACHED FIELDS ARE FOR
+	ESP8266_NTP_DATA cache;
+} ESP8266_NTP_FORMAT;
+
+//ON THE WIRE NTP HEADER (RFC 5905 FIGURE 8)
+//MULTI BYTE FIELDS ARE BIG ENDIAN BYTE ARRAYS SO THE VIEW CAN BE LAID
+//OVER ANY RECEIVE BUFFER WITHOUT ALIGNMENT FAULTS. USE THE
+//ESP8266_NTP_Header* ACCESSORS TO READ THEM
+typedef struct
+{
+	uint8_t li_vn_mode;
+	uint8_t stratum;
+	int8_t poll;
+	int8_t precision;
+	uint8_t root_delay[4];
+	uint8_t root_dispersion[4];
+	uint8_t reference_id[4];
+	uint8_t reference_ts[8];
+	uint8_t originate_ts[8];
+	uint8_t receive_ts[8];
+	uint8_t transmit_ts[8];
+} __attribute__((packed)) ESP8266_NTP_HEADER;
+
+typedef struct
+{
+	int64_t offset_us;
+	uint32_t delay_us;
+	uint32_t root_delay;		//SERVER ROOT DELAY / DISPERSION (16.16 S)
+	uint32_t root_dispersion;
+	uint32_t dispersion_us;		//CLOCK FILTER OUTPUT
+	uint32_t jitter_us;
+	uint32_t epoch_ms;			//UPTIME MS THE SELECTED SAMPLE WAS TAKEN
+	uint8_t stratum;
+	uint8_t leap;
+	uint8_t valid;
+	uint8_t fresh;				//SELECTED SAMPLE NOT USED BEFORE
+} ESP8266_NTP_SAMPLE;
+
+typedef struct
+{
+	int64_t offset_us;
+	uint32_t delay_us;
+	uint32_t disp_us;			//DISPERSION WHEN TAKEN
+	uint32_t epoch_ms;			//UPTIME MS WHEN TAKEN
+} ESP8266_NTP_FILTER_STAGE;
+
+typedef struct
+{
+	ESP8266_NTP_FILTER_STAGE stages[NTP_FILTER_STAGES];
+	uint8_t next;				//STAGE THE NEXT SAMPLE GOES TO
+	uint8_t count;				//STAGES HOLDING A SAMPLE
+	uint8_t used_valid;
+	uint32_t used_ms;			//EPOCH OF THE LAST SAMPLE USED
+} ESP8266_NTP_FILTER;
+
+typedef struct
+{
+	uint32_t next_allowed_ms;	//UPTIME MS BEFORE WHICH THE SERVER IS NOT QUERIED
+	uint8_t backoff_exp;		//CONSECUTIVE FAILURES (CAPPED)
+	uint8_t disabled;			//KOD DENY / RSTR RECEIVED. CLEARED BY Create
+	uint64_t last_xmt;			//TRANSMIT TIMESTAMP OF THE LAST REPLY ACCEPTED
+
+	//MULTI SERVER ROUND. t1 IS THE TRANSMIT TIMESTAMP OF THE REQUEST IN
+	//FLIGHT, deadline_ms WHEN ITS LOOKUP OR REPLY TIMES OUT
+	uint64_t t1;
+	uint32_t started_ms;		//UPTIME MS THE LOOKUP STARTED
+	uint32_t deadline_ms;
+	uint8_t pending;			//ESP8266_NTP_GATHER
+	uint8_t from_cache;			//REQUEST WENT TO A CACHED IP
+} ESP8266_NTP_SERVER_SCHED;
+
+typedef struct
+{
+	uint32_t queries;		//REQUESTS SENT
+	uint32_t successes;		//REPLIES ACCEPTED
+	uint32_t timeouts;
+	uint32_t rejects;		//SHORT, REJECTED OR KOD REPLIES
+	uint32_t dns_failures;
+	uint8_t last_error;		//ESP8266_NTP_ERROR
+	uint16_t last_error_flags;	//NTP_TEST_* FLAGS IF REJECTED
+	uint16_t dns_hist[NTP_HIST_BUCKETS];	//DNS LATENCY (MS)
+	uint16_t rtt_hist[NTP_HIST_BUCKETS];	//ROUND TRIP DELAY (MS)
+	uint16_t offset_hist[NTP_HIST_BUCKETS];	//ABS OFFSET (64 US)
+} ESP8266_NTP_SERVER_STATS;
+
+typedef struct
+{
+	uint32_t received;		//REPLIES OF VALID LENGTH
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t test_failed[NTP_TEST_COUNT];	//PER TEST FAILURE COUNT (INDEX = TEST - 1)
+	uint16_t last_flags;	//NTP_TEST_* FLAGS OF THE LAST REJECTED REPLY
+	uint8_t last_reason;	//FIRST FAILED TEST NUMBER OF THE LAST REJECTED REPLY
+	uint32_t stray;			//RUNT, DUPLICATE OR BOGUS. DROPPED, THE EXCHANGE GOES ON
+} ESP8266_NTP_PACKET_STATS;
+
+typedef struct
+{
+	ip_addr_t ip;
+	uint32_t resolved_at;	//UPTIME SECONDS
+	uint32_t last_success;	//UPTIME SECONDS
+	uint8_t valid;
+} ESP8266_NTP_DNS_CACHE;
+
+typedef struct ESP8266_NTP_CONTEXT ESP8266_NTP_CONTEXT;
+
+typedef struct
+{
+	uint8_t next;		//ESP8266_NTP_SYNC_STATE
+	void (*action)(ESP8266_NTP_CONTEXT*);
+} ESP8266_NTP_TRANSITION;
+
+struct ESP8266_NTP_CONTEXT
+{
+	uint8_t created;
+
+	//NTP TIME DATA STRUCTURE
+	ESP8266_NTP_DATA data;
+	uint8_t data_packet[NTP_PACKET_SIZE];
+	uint8_t fields_valid;
+
+	//IP / HOSTNAME RELATED
+	char* servers[NTP_MAX_SERVERS];
+	uint8_t last_server_used;
+
+	//TIMEZONE RELATED
+	int8_t timezone_hr;
+	uint8_t timezone_min;
+	ESP8266_NTP_TZ tz;
+
+	//TIMER RELATED
+	uint16_t reply_timeout_ms;
+
+	//COUNTERS
+	uint8_t retry_count;
+	uint16_t cycle_count;
+	uint8_t total_server_count;
+	uint8_t server_counter;
+
+	//SOFTWARE CLOCK RELATED
+	//CLOCK IS KEPT AS ERA EXTENDED NTP SECONDS + MICROSECONDS AND
+	//EXTENDED FROM THE LOCAL TICK SOURCE ON EVERY READ. A READ IS
+	//REQUIRED ATLEAST ONCE EVERY 2^32 US (~71 MINUTES) TO ACCOUNT FOR
+	//TICK WRAPAROUND
+	uint32_t clock_ref_tick;
+	uint64_t clock_sec;
+	uint32_t clock_usec;
+	uint8_t clock_valid;
+	uint32_t uptime_sec;
+	uint32_t uptime_usec;
+
+	//CLOCK DISCIPLINE RELATED
+	//FREQUENCY CORRECTION IS A SIGNED FRACTION OF THE TICK RATE IN 2^-32
+	//UNITS. OFFSETS BELOW THE STEP THRESHOLD ARE SLEWED OUT GRADUALLY
+	int32_t clock_freq;
+	int32_t clock_slew_us;
+	uint32_t discipline_last_sec;
+	uint8_t poll_exp;
+	int8_t poll_counter;
+	uint8_t auto_sync;
+	uint8_t freq_hold;			//SKIP THE NEXT FREQUENCY UPDATE (CLOCK SET OR RESTORED)
+	os_timer_t poll_timer;
+
+	//WARM START RELATED
+	//THE ERROR BOUND IS error_us AT UPTIME error_ref_sec, GROWING FROM
+	//THERE. store_owner IS SET ON THE INSTANCE THAT RESTORED FROM THE
+	//STORE, WHICH THEN SAVES A SNAPSHOT AFTER EVERY SYNC
+	uint32_t error_us;
+	uint32_t error_ref_sec;
+	uint32_t sync_threshold_us;
+	uint8_t store_owner;
+
+	//SYNC SOURCE RELATED
+	//THE SERVER OF THE LAST NETWORK SYNC, AS ADVERTISED BY THE SNTP
+	//SERVER. ROOT DELAY INCLUDES THE ROUND TRIP TO IT. ref_stratum 0 :
+	//NEVER SYNCED OVER THE NETWORK (E.G. ONLY RESTORED)
+	uint8_t ref_stratum;
+	uint32_t ref_id;			//SERVER IPV4 ADDRESS (NETWORK BYTE ORDER)
+	uint32_t ref_root_delay;
+	uint32_t ref_root_dispersion;
+	uint64_t ref_time;			//64 BIT NTP TIMESTAMP OF THE SYNC
+
+	//LEAP SECOND RELATED
+	//leap_at IS THE UTC MIDNIGHT (ERA EXTENDED SECONDS) OF THE LAST
+	//ARMED LEAP AND IS KEPT AFTER IT IS APPLIED FOR THE GUARD WINDOW.
+	//leap_applied_us IS THE CORRECTION ALREADY IN THE CLOCK. leap_stale
+	//IS SET ONCE A LEAP IS APPLIED, UNTIL A REPLY STOPS ANNOUNCING IT
+	uint8_t leap;
+	uint8_t leap_stale;
+	uint8_t leap_mode;
+	uint32_t leap_smear_s;
+	uint64_t leap_at;
+	int32_t leap_applied_us;
+
+	//NTP EXCHANGE RELATED
+	uint64_t t1;
+	uint32_t sent_ms;			//UPTIME MS THE OUTSTANDING REQUEST WENT OUT
+	ESP8266_NTP_PACKET_STATS packet_stats;
+
+	//QUERY SCHEDULER RELATED
+	ESP8266_NTP_SERVER_SCHED sched[NTP_MAX_SERVERS];
+	uint8_t fail_exp;
+	os_timer_t query_timer;
+
+	//SERVER STATISTICS RELATED
+	ESP8266_NTP_SERVER_STATS server_stats[NTP_MAX_SERVERS];
+	uint32_t dns_start_ms;
+
+	//MULTI SERVER RELATED
+	//PER ROUND : SERVERS QUERIED AND ANSWERED, AND THE UPTIME MS A
+	//MAJORITY HAD ANSWERED (grace_set)
+	uint8_t multi_server;
+	ESP8266_NTP_SAMPLE samples[NTP_MAX_SERVERS];
+	uint8_t round_queried;
+	uint8_t round_answered;
+	uint8_t grace_set;
+	uint32_t grace_ms;
+
+	//CLOCK FILTER RELATED
+	ESP8266_NTP_FILTER filters[NTP_MAX_SERVERS];
+	uint8_t burst;
+	uint8_t burst_left;
+
+	//RESOLVED ADDRESS CACHE RELATED
+	ESP8266_NTP_DNS_CACHE dns_cache[NTP_MAX_SERVERS];
+	uint32_t dns_cache_ttl_s;
+	uint8_t used_cached_ip;
+	char ip_text[16];
+
+	//SYNC STATE MACHINE RELATED
+	ESP8266_NTP_SYNC_STATE sync_state;
+	uint8_t sync_requested;
+	uint32_t sync_start_ms;
+	uint32_t last_sync_ms;
+
+	//TRANSPORT SHARING RELATED
+	//THE UDP CLIENT CARRIES ONE EXCHANGE AT A TIME. INSTANCES WAITING
+	//FOR IT ARE CHAINED IN A FIFO THROUGH next_pending
+	uint8_t sync_pending;
+	ESP8266_NTP_CONTEXT* next_pending;
+
+	//LIVE INSTANCES (CREATED, NOT YET DESTROYED) ARE CHAINED THROUGH
+	//next_live SO PROCESS WIDE SETTINGS CAN REACH ALL OF THEM
+	ESP8266_NTP_CONTEXT* next_live;
+
+	//ALARM SCHEDULER RELATED
+	//ALARM IDS ARE 1 BASED POOL INDEXES SO A ZERO INITIALIZED CONTEXT HAS
+	//EMPTY LISTS. alarm_now IS THE LAST SECOND THE WHEEL HAS PROCESSED
+	ESP8266_NTP_ALARM alarms[NTP_MAX_ALARMS];
+	uint16_t alarm_lists[NTP_ALARM_LIST_COUNT];
+	uint16_t alarm_free;		//FREE LIST HEAD
+	uint16_t alarm_used;		//POOL HIGH WATER MARK
+	uint16_t alarm_count;
+	uint64_t alarm_now;
+	uint8_t alarm_running;
+	uint8_t alarm_armed;
+	os_timer_t alarm_timer;
+
+	//CALLBACK FUNCTION VARIABLES
+	void (*data_ready_user_cb)(ESP8266_NTP_DATA*, uint16_t);
+	void (*data_ready_ctx_cb)(ESP8266_NTP_CONTEXT*, ESP8266_NTP_DATA*, uint16_t, void*);
+	void* user_arg;
+	void (*alarm_cb)(void);
+};
 //END CUSTOM VARIABLE STRUCTURES/////////////////////////
 
 //FUNCTION PROTOTYPES/////////////////////////////////////
 //CONFIGURATION FUNCTIONS
 void ICACHE_FLASH_ATTR ESP8266_NTP_SetDebug(uint8_t debug_on);
+void ICACHE_FLASH_ATTR ESP8266_NTP_Create(ESP8266_NTP_CONTEXT* ctx,
+                                            char* server1,
+                                            char* server2,
+                                            char* server3,
+                                            int8_t timezone_hr,
+                                            uint8_t timezone_min,
+                                            uint16_t ntp_timeout_ms);
+void ICACHE_FLASH_ATTR ESP8266_NTP_Destroy(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetServersCtx(ESP8266_NTP_CONTEXT* ctx, char** servers, uint8_t count);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AddServerCtx(ESP8266_NTP_CONTEXT* ctx, char* server);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetCallbackFunctionsCtx(ESP8266_NTP_CONTEXT* ctx,
+                                                            void (*user_data_ready_cb)(ESP8266_NTP_CONTEXT*, ESP8266_NTP_DATA*, uint16_t, void*),
+                                                            void* user_arg);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetTickSource(uint32_t (*tick_us_fn)(void));
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetTransport(const ESP8266_NTP_TRANSPORT* transport);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetStore(const ESP8266_NTP_STORE* store);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetSyncThresholdCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t max_error_us);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetEraPivotCtx(ESP8266_NTP_CONTEXT* ctx, uint64_t seconds);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetLeapModeCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_LEAP_MODE mode, uint32_t smear_s);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SetTimeZoneCtx(ESP8266_NTP_CONTEXT* ctx, const char* tz);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetAutoSyncCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t enable);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetMultiServerModeCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t enable);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetBurstCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t count);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetDnsCacheTTLCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t ttl_s);
+void ICACHE_FLASH_ATTR ESP8266_NTP_FlushDnsCacheCtx(ESP8266_NTP_CONTEXT* ctx);
+
+//GET PARAMETERS FUNCTIONS
+int8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneHourCtx(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneMinuteCtx(ESP8266_NTP_CONTEXT* ctx);
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetUtcOffsetCtx(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastNTPServerUsedNumberCtx(ESP8266_NTP_CONTEXT* ctx);
+ESP8266_NTP_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetStateCtx(ESP8266_NTP_CONTEXT* ctx);
+ESP8266_NTP_SYNC_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetSyncStateCtx(ESP8266_NTP_CONTEXT* ctx);
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastSyncDurationCtx(ESP8266_NTP_CONTEXT* ctx);
+ESP8266_NTP_DATA* ICACHE_FLASH_ATTR ESP8266_NTP_GetNTPDataStructureCtx(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ESP8266_NTP_NowCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t* seconds, uint32_t* fraction);
+uint8_t ESP8266_NTP_NowTimeCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_TIME* time);
+int64_t ESP8266_NTP_TimeToUnix(const ESP8266_NTP_TIME* time);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetPollIntervalCtx(ESP8266_NTP_CONTEXT* ctx);
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetDriftPPBCtx(ESP8266_NTP_CONTEXT* ctx);
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetErrorBoundCtx(ESP8266_NTP_CONTEXT* ctx);
+ESP8266_NTP_PACKET_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetPacketStatsCtx(ESP8266_NTP_CONTEXT* ctx);
+ESP8266_NTP_SERVER_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetServerStatsCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetStatsSnapshotCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t* buf, uint16_t size);
+void ICACHE_FLASH_ATTR ESP8266_NTP_ResetStatsCtx(ESP8266_NTP_CONTEXT* ctx);
+
+//NTP HEADER VIEW FUNCTIONS
+const ESP8266_NTP_HEADER* ESP8266_NTP_HeaderView(const char* buf, uint16_t length);
+uint32_t ESP8266_NTP_HeaderRootDelay(const ESP8266_NTP_HEADER* hdr);
+uint32_t ESP8266_NTP_HeaderRootDispersion(const ESP8266_NTP_HEADER* hdr);
+uint32_t ESP8266_NTP_HeaderReferenceId(const ESP8266_NTP_HEADER* hdr);
+uint64_t ESP8266_NTP_HeaderTimestamp(const uint8_t* ts);
+
+//ALARM FUNCTIONS
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmAtCtx(ESP8266_NTP_CONTEXT* ctx, uint64_t seconds, void (*cb)(uint16_t, void*), void* arg);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmEveryCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t period_s, void (*cb)(uint16_t, void*), void* arg);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmDailyCtx(ESP8266_NTP_CONTEXT* ctx, uint8_t hour, uint8_t min, uint8_t days, void (*cb)(uint16_t, void*), void* arg);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmCancelCtx(ESP8266_NTP_CONTEXT* ctx, uint16_t id);
+
+//TIME FORMAT FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_FormatCompile(ESP8266_NTP_FORMAT* fmt, const char* pattern, uint8_t utc);
+uint16_t ESP8266_NTP_FormatCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_FORMAT* fmt, char* buf, uint16_t size);
+uint16_t ESP8266_NTP_FormatTimeCtx(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_FORMAT* fmt, const ESP8266_NTP_TIME* time, char* buf, uint16_t size);
+
+//SNTP SERVER FUNCTIONS
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetListener(const ESP8266_NTP_LISTENER* listener);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_ServeStartCtx(ESP8266_NTP_CONTEXT* ctx, uint16_t port);
+void ICACHE_FLASH_ATTR ESP8266_NTP_ServeStop(void);
+ESP8266_NTP_SERVE_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetServeStats(void);
+
+//LOG FUNCTIONS
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_LogRead(ESP8266_NTP_LOG_RECORD* records, uint16_t max);
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_LogDropped(void);
+
+//CONTROL FUNCTIONS
+void ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeCtx(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR ESP8266_NTP_CancelCtx(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR ESP8266_NTP_RefreshDataCtx(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR ESP8266_NTP_AdvanceSecondsCtx(ESP8266_NTP_CONTEXT* ctx, uint32_t seconds);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SaveCtx(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_RestoreCtx(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SyncIfNeededCtx(ESP8266_NTP_CONTEXT* ctx);
+
+//LEGACY SINGLE CONTEXT FUNCTIONS (ACT ON THE ESP8266_NTP_SetContext CONTEXT)
+#if NTP_LEGACY_API
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetContext(ESP8266_NTP_CONTEXT* ctx);
 void ICACHE_FLASH_ATTR ESP8266_NTP_Initialize(char* server1,
                                                 	char* server2,
 													char* server3,
 													int8_t timezone_hr,
 													uint8_t timezone_min,
 													uint16_t ntp_timeout_ms);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetServers(char** servers, uint8_t count);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AddServer(char* server);
 void ICACHE_FLASH_ATTR ESP8266_NTP_SetCallbackFunctions(void (*user_data_ready_cb)(ESP8266_NTP_DATA*, uint16_t),
                                                             void (*user_alarm_cb)());
-
-//GET PARAMETERS FUNCTIONS
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetSyncThreshold(uint32_t max_error_us);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetEraPivot(uint64_t seconds);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetLeapMode(ESP8266_NTP_LEAP_MODE mode, uint32_t smear_s);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SetTimeZone(const char* tz);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetAutoSync(uint8_t enable);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetMultiServerMode(uint8_t enable);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetBurst(uint8_t count);
+void ICACHE_FLASH_ATTR ESP8266_NTP_SetDnsCacheTTL(uint32_t ttl_s);
+void ICACHE_FLASH_ATTR ESP8266_NTP_FlushDnsCache(void);
 int8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneHour(void);
 uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetTimeZoneMinute(void);
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetUtcOffset(void);
 uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastNTPServerUsedNumber(void);
 ESP8266_NTP_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetState(void);
+ESP8266_NTP_SYNC_STATE ICACHE_FLASH_ATTR ESP8266_NTP_GetSyncState(void);
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetLastSyncDuration(void);
 ESP8266_NTP_DATA* ICACHE_FLASH_ATTR ESP8266_NTP_GetNTPDataStrcuture(void);
-
-//CONTROL FUNCTIONS
+uint8_t ESP8266_NTP_Now(uint32_t* seconds, uint32_t* fraction);
+uint8_t ESP8266_NTP_NowTime(ESP8266_NTP_TIME* time);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetPollInterval(void);
+int32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetDriftPPB(void);
+uint32_t ICACHE_FLASH_ATTR ESP8266_NTP_GetErrorBound(void);
+ESP8266_NTP_PACKET_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetPacketStats(void);
+ESP8266_NTP_SERVER_STATS* ICACHE_FLASH_ATTR ESP8266_NTP_GetServerStats(uint8_t server_num);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_GetStatsSnapshot(uint8_t* buf, uint16_t size);
+void ICACHE_FLASH_ATTR ESP8266_NTP_ResetStats(void);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmAt(uint64_t seconds, void (*cb)(uint16_t, void*), void* arg);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmEvery(uint32_t period_s, void (*cb)(uint16_t, void*), void* arg);
+uint16_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmDaily(uint8_t hour, uint8_t min, uint8_t days, void (*cb)(uint16_t, void*), void* arg);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_AlarmCancel(uint16_t id);
+uint16_t ESP8266_NTP_Format(ESP8266_NTP_FORMAT* fmt, char* buf, uint16_t size);
+uint16_t ESP8266_NTP_FormatTime(ESP8266_NTP_FORMAT* fmt, const ESP8266_NTP_TIME* time, char* buf, uint16_t size);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_ServeStart(uint16_t port);
 void ICACHE_FLASH_ATTR ESP8266_NTP_GetTime(void);
+void ICACHE_FLASH_ATTR ESP8266_NTP_Cancel(void);
+void ICACHE_FLASH_ATTR ESP8266_NTP_RefreshData(void);
+void ICACHE_FLASH_ATTR ESP8266_NTP_AdvanceSeconds(uint32_t seconds);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_Save(void);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_Restore(void);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_SyncIfNeeded(void);
+#endif
 
 //INITERNAL NTP TIME -> TEXT CONVERT FUNCTION
-void ICACHE_FLASH_ATTR _esp8266_ntp_convert_time_to_text(void);
+void ICACHE_FLASH_ATTR _esp8266_ntp_convert_time_to_text(ESP8266_NTP_CONTEXT* ctx);
+void _esp8266_ntp_secs_to_fields(uint64_t secs, ESP8266_NTP_DATA* data);
+void ICACHE_FLASH_ATTR _esp8266_ntp_advance_fields(ESP8266_NTP_CONTEXT* ctx, uint32_t seconds);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_month_length(uint8_t month_num, uint16_t year);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_days_from_civil(uint16_t year, uint8_t month, uint8_t date);
+
+//INTERNAL TIME FORMAT FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_format_add(ESP8266_NTP_FORMAT* fmt, uint8_t op, uint8_t arg, uint8_t max_length);
+uint16_t _esp8266_ntp_format(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_FORMAT* fmt, uint64_t secs, uint32_t usec, char* buf, uint16_t size);
+char* _esp8266_ntp_format_offset(char* p, int32_t offset_s, uint8_t colon);
+
+//INTERNAL TIME ZONE FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_tz_fixed(ESP8266_NTP_TZ* tz, int32_t offset_s);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse(ESP8266_NTP_TZ* tz, const char* str);
+const char* ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse_name(const char* p, char* name);
+const char* ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse_time(const char* p, int32_t* time_s, int32_t max_s);
+const char* ICACHE_FLASH_ATTR _esp8266_ntp_tz_parse_rule(const char* p, ESP8266_NTP_TZ_RULE* rule);
+uint64_t ICACHE_FLASH_ATTR _esp8266_ntp_tz_transition(const ESP8266_NTP_TZ_RULE* rule, uint16_t year, int32_t offset_s);
+void ICACHE_FLASH_ATTR _esp8266_ntp_tz_rebuild(ESP8266_NTP_TZ* tz, uint64_t utc);
+int32_t _esp8266_ntp_tz_offset(ESP8266_NTP_TZ* tz, uint64_t utc);
+
+//INTERNAL SOFTWARE CLOCK FUNCTIONS
+void _esp8266_ntp_clock_advance(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_clock_set(ESP8266_NTP_CONTEXT* ctx, uint64_t seconds, uint32_t fraction);
+void ICACHE_FLASH_ATTR _esp8266_ntp_clock_step(ESP8266_NTP_CONTEXT* ctx, int64_t offset_us);
+void _esp8266_ntp_clock_adjust(ESP8266_NTP_CONTEXT* ctx, int32_t adj_us);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_uptime(ESP8266_NTP_CONTEXT* ctx);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_uptime_ms(ESP8266_NTP_CONTEXT* ctx);
+uint64_t _esp8266_ntp_now64(ESP8266_NTP_CONTEXT* ctx);
+uint64_t _esp8266_ntp_now_secs(ESP8266_NTP_CONTEXT* ctx, int64_t offset_us);
+uint64_t _esp8266_ntp_era_extend(uint32_t seconds, uint64_t reference);
+void ICACHE_FLASH_ATTR _esp8266_ntp_live_add(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_live_remove(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_tick_timer_cb(void* arg);
+
+//INTERNAL LEAP SECOND FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_leap_arm(ESP8266_NTP_CONTEXT* ctx, uint8_t leap);
+void _esp8266_ntp_leap_update(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_leap_guard(ESP8266_NTP_CONTEXT* ctx);
+
+//INTERNAL ALARM SCHEDULER FUNCTIONS
+uint16_t ICACHE_FLASH_ATTR _esp8266_ntp_alarm_add(ESP8266_NTP_CONTEXT* ctx, uint8_t kind, uint64_t at, uint32_t period_s, uint8_t days, void (*cb)(uint16_t, void*), void* arg);
+void _esp8266_ntp_alarm_link(ESP8266_NTP_CONTEXT* ctx, uint16_t list, uint16_t id);
+void _esp8266_ntp_alarm_unlink(ESP8266_NTP_CONTEXT* ctx, uint16_t id);
+void _esp8266_ntp_alarm_insert(ESP8266_NTP_CONTEXT* ctx, uint16_t id);
+void _esp8266_ntp_alarm_cascade(ESP8266_NTP_CONTEXT* ctx, uint16_t list);
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_fire(ESP8266_NTP_CONTEXT* ctx, uint16_t id);
+uint64_t ICACHE_FLASH_ATTR _esp8266_ntp_alarm_next(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_ALARM* alarm, uint64_t after);
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_rehash(ESP8266_NTP_CONTEXT* ctx, uint64_t now);
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_run(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_arm(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_alarm_timer_cb(void* arg);
+
+//INTERNAL WARM START FUNCTIONS
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_error_bound(ESP8266_NTP_CONTEXT* ctx);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_crc32(const void* buf, uint16_t length);
+
+//INTERNAL SNTP SERVER FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_serve_refresh(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_serve_recv_cb(char* data, uint16_t length, void* peer, uint32_t rx_tick);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_us_to_q16(uint64_t us);
+
+//INTERNAL NTP PACKET / FIXED POINT HELPERS
+int64_t ICACHE_FLASH_ATTR _esp8266_ntp_q32_to_us(int64_t q32);
+int64_t ICACHE_FLASH_ATTR _esp8266_ntp_us_to_q32(int64_t us);
+uint32_t _esp8266_ntp_read_u32(const uint8_t* buf);
+void _esp8266_ntp_write_u32(uint8_t* buf, uint32_t val);
+void _esp8266_ntp_write_ts(uint8_t* ts, uint64_t val);
+
+//INTERNAL LOG FUNCTIONS
+void _esp8266_ntp_log(uint8_t id, uint8_t server, int16_t a, int32_t b);
+
+//INTERNAL STATISTICS FUNCTIONS
+void _esp8266_ntp_hist_add(uint16_t* hist, uint32_t value);
+void ICACHE_FLASH_ATTR _esp8266_ntp_stats_error(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_ERROR error, uint16_t flags);
+
+//INTERNAL CLOCK DISCIPLINE FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_discipline_update(ESP8266_NTP_CONTEXT* ctx, int64_t offset_us);
+void ICACHE_FLASH_ATTR _esp8266_ntp_schedule_next_sync(ESP8266_NTP_CONTEXT* ctx, uint8_t success);
+void ICACHE_FLASH_ATTR _esp8266_ntp_poll_timer_cb(void* arg);
+
+//INTERNAL SYNC STATE MACHINE FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_sync_event(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_SYNC_EVENT event);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_queue(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_begin(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_query(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_send(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_sent(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_sample(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_retry(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_done(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_give_up(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_requeue(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_cancel(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_act_round(ESP8266_NTP_CONTEXT* ctx);
+
+//INTERNAL SYNC FLOW FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_transport_setup(void);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_transport_acquire(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_transport_release(ESP8266_NTP_CONTEXT* ctx);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_add_server(ESP8266_NTP_CONTEXT* ctx, char* server);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_next_server(ESP8266_NTP_CONTEXT* ctx, uint8_t after, uint8_t wrap);
+void ICACHE_FLASH_ATTR _esp8266_ntp_schedule_query(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num);
+void ICACHE_FLASH_ATTR _esp8266_ntp_query_timer_cb(void* arg);
+void ICACHE_FLASH_ATTR _esp8266_ntp_use_cached_ip(ESP8266_NTP_CONTEXT* ctx, ESP8266_NTP_DNS_CACHE* entry);
+void ICACHE_FLASH_ATTR _esp8266_ntp_server_backoff(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num, uint32_t min_wait_ms);
+void ICACHE_FLASH_ATTR _esp8266_ntp_handle_kod(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_jitter(uint32_t interval_ms);
+uint16_t ICACHE_FLASH_ATTR _esp8266_ntp_check_reply(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr, uint64_t t4);
+void ICACHE_FLASH_ATTR _esp8266_ntp_measure_reply(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr, uint64_t t4, int64_t* offset_us, uint32_t* delay_us);
+uint64_t ICACHE_FLASH_ATTR _esp8266_ntp_rx_time(ESP8266_NTP_CONTEXT* ctx);
+ESP8266_NTP_REPLY ICACHE_FLASH_ATTR _esp8266_ntp_reply_accept(ESP8266_NTP_CONTEXT* ctx, const ESP8266_NTP_HEADER* hdr, uint64_t t4);
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_reject(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num, uint16_t flags);
+void ICACHE_FLASH_ATTR _esp8266_ntp_sync_finish(ESP8266_NTP_CONTEXT* ctx, uint16_t length);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_select_sample(ESP8266_NTP_CONTEXT* ctx);
+
+//INTERNAL MULTI SERVER ROUND FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_gather_usable(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_schedule(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_reset(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_issue(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_send(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_fail(ESP8266_NTP_CONTEXT* ctx, uint8_t server_num);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_recv(ESP8266_NTP_CONTEXT* ctx, char* pusrdata, uint16_t length);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_check(ESP8266_NTP_CONTEXT* ctx);
+
+//INTERNAL CLOCK FILTER FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_filter_add(ESP8266_NTP_FILTER* filter, int64_t offset_us, uint32_t delay_us, uint32_t disp_us, uint32_t now_ms);
+void ICACHE_FLASH_ATTR _esp8266_ntp_filter_run(ESP8266_NTP_FILTER* filter, ESP8266_NTP_SAMPLE* sample, uint32_t now_ms);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_filter_disp(int8_t precision, uint32_t delay_us);
+uint32_t ICACHE_FLASH_ATTR _esp8266_ntp_isqrt(uint64_t value);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_burst_count(ESP8266_NTP_CONTEXT* ctx);
 
 //INTERNAL CALLBACK FUNCTIONS
 void ICACHE_FLASH_ATTR _esp8266_ntp_server_resolved_cb(ip_addr_t* ip);
 void ICACHE_FLASH_ATTR _esp8266_ntp_udp_data_sent_cb(void* arg);
 void ICACHE_FLASH_ATTR _esp8266_ntp_udp_data_recv_cb(char* pusrdata, uint16_t length);
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_timeout(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_guard(ESP8266_NTP_CONTEXT* ctx);
+void ICACHE_FLASH_ATTR _esp8266_ntp_reply_guard_cb(void* arg);
+void ICACHE_FLASH_ATTR _esp8266_ntp_round_timer_cb(void* arg);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_timer_cb(void* arg);
+void ICACHE_FLASH_ATTR _esp8266_ntp_gather_found_cb(const char* hostname, ip_addr_t* ip, void* arg);
 //END FUNCTION PROTOTYPES/////////////////////////////////
 #endif
@@ -0,0 +1,64 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* HOST PLATFORM LAYER
+*
+* REPLACES THE ESP8266 SDK HEADERS WHEN THE LIBRARY IS BUILT FOR A
+* HOST (LINUX) WITH -DESP8266_NTP_HOST. OS_* STRING AND MEMORY CALLS
+* MAP TO LIBC. TIMERS, THE MICROSECOND TICK AND RANDOM NUMBERS ARE
+* ONLY DECLARED HERE : THE HOST PROGRAM (A SIMULATION WITH A VIRTUAL
+* CLOCK OR A REAL EVENT LOOP) PROVIDES THEM, ALONG WITH A TRANSPORT
+* INSTALLED WITH ESP8266_NTP_SetTransport BEFORE ESP8266_NTP_Create
+****************************************************************/
+
+#ifndef _ESP8266_NTP_HOST_H_
+#define _ESP8266_NTP_HOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+
+#define os_printf				printf
+#define os_sprintf				sprintf
+#define os_memcpy				memcpy
+#define os_memset				memset
+#define os_memcmp				memcmp
+#define os_strlen				strlen
+
+//SAME LAYOUT AS LWIP (NETWORK BYTE ORDER)
+typedef struct ip_addr
+{
+	uint32_t addr;
+} ip_addr_t;
+
+#define IP2STR(ipaddr)	((uint8_t*)(ipaddr))[0], \
+						((uint8_t*)(ipaddr))[1], \
+						((uint8_t*)(ipaddr))[2], \
+						((uint8_t*)(ipaddr))[3]
+#define IPSTR			"%d.%d.%d.%d"
+
+//ONE SHOT / PERIODIC SOFTWARE TIMER, SAME CONTRACT AS THE SDK os_timer
+typedef void os_timer_func_t(void* arg);
+
+typedef struct _os_timer_t
+{
+	struct _os_timer_t* next;
+	uint32_t expire_us;
+	uint32_t period_ms;
+	os_timer_func_t* func;
+	void* arg;
+	uint8_t armed;
+} os_timer_t;
+
+//PROVIDED BY THE HOST PROGRAM
+void os_timer_setfn(os_timer_t* timer, os_timer_func_t* func, void* arg);
+void os_timer_arm(os_timer_t* timer, uint32_t ms, uint8_t repeat);
+void os_timer_disarm(os_timer_t* timer);
+unsigned long os_random(void);
+uint32_t system_get_time(void);
+uint32_t ipaddr_addr(const char* cp);
+
+#endif
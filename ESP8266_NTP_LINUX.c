@@ -0,0 +1,1100 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* LINUX BACKEND
+*
+* REFERENCES
+* ------------
+*   (1) socket(7) : SO_TIMESTAMPNS
+*   (2) epoll(7)
+*   (3) eventfd(2)
+****************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ESP8266_NTP_LINUX.h"
+
+//LOCAL LIBRARY VARIABLES////////////////////////////////
+//EVENT LOOP RELATED
+static int _esp8266_ntp_linux_epoll_fd = -1;
+static int _esp8266_ntp_linux_sock_fd = -1;
+
+//SOFTWARE TIMER RELATED
+//UNSORTED LIST OF ARMED TIMERS. A HANDFUL AT MOST ARE EVER ARMED
+static os_timer_t* _esp8266_ntp_linux_timers;
+
+//EXCHANGE RELATED
+//ONE SOCKET SERVES EVERY INSTANCE AND CARRIES THE EXCHANGE STARTED BY
+//send ALONGSIDE ANY NUMBER OF send_to QUERIES. EVERY REQUEST IS KEPT IN
+//THE OUTSTANDING QUERY TABLE UNDER ITS TRANSMIT TIMESTAMP, AND A
+//DATAGRAM IS ONLY DELIVERED IF ITS ORIGINATE TIMESTAMP AND SOURCE
+//ADDRESS / PORT MATCH AN ENTRY. LATE REPLIES AND STRAY TRAFFIC ARE
+//DROPPED HERE
+static char* _esp8266_ntp_linux_hostname;
+static struct sockaddr_in _esp8266_ntp_linux_server;
+static uint32_t _esp8266_ntp_linux_timeout_ms;
+static uint8_t _esp8266_ntp_linux_awaiting;
+static ESP8266_NTP_LINUX_QUERY _esp8266_ntp_linux_queries[NTP_LINUX_MAX_QUERIES];
+static ip_addr_t _esp8266_ntp_linux_resolved_ip;
+static uint8_t _esp8266_ntp_linux_resolved_ok;
+static uint32_t _esp8266_ntp_linux_rx_tick_us;
+static uint8_t _esp8266_ntp_linux_rx_tick_valid;
+static uint8_t _esp8266_ntp_linux_rx_buffer[NTP_LINUX_RX_BUFFER_SIZE];
+
+//CALLBACKS INTO THE LIBRARY. THE SDK DELIVERS THEM FROM ITS OWN EVENT
+//LOOP, NEVER FROM INSIDE THE CALL THAT STARTED THE OPERATION, SO THEY
+//ARE DEFERRED THROUGH ZERO DELAY TIMERS HERE AS WELL
+static void (*_esp8266_ntp_linux_resolved_cb)(ip_addr_t* ip);
+static void (*_esp8266_ntp_linux_sent_cb)(void* arg);
+static void (*_esp8266_ntp_linux_recv_cb)(char* data, uint16_t length);
+static os_timer_t _esp8266_ntp_linux_resolved_timer;
+static os_timer_t _esp8266_ntp_linux_sent_timer;
+static os_timer_t _esp8266_ntp_linux_reply_timer;
+
+//RESOLVER THREAD RELATED
+//THE LOCK GUARDS THE LOOKUP TABLE AND stop. A FINISHED LOOKUP BUMPS
+//THE EVENTFD, WHICH IS IN THE EPOLL SET. resolve_gen COUNTS resolve
+//CALLS, ONLY THE LATEST ONE IS ANSWERED
+static ESP8266_NTP_LINUX_LOOKUP _esp8266_ntp_linux_lookups[NTP_LINUX_MAX_LOOKUPS];
+static pthread_mutex_t _esp8266_ntp_linux_dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _esp8266_ntp_linux_dns_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t _esp8266_ntp_linux_dns_thread;
+static uint8_t _esp8266_ntp_linux_dns_running;
+static uint8_t _esp8266_ntp_linux_dns_stop;
+static int _esp8266_ntp_linux_dns_fd = -1;
+static uint32_t _esp8266_ntp_linux_resolve_gen;
+
+static const ESP8266_NTP_TRANSPORT _esp8266_ntp_linux_transport = {
+                                        .set_debug = _esp8266_ntp_linux_set_debug,
+                                        .set_dns_server = _esp8266_ntp_linux_set_dns_server,
+                                        .initialize = _esp8266_ntp_linux_initialize,
+                                        .resolve = _esp8266_ntp_linux_resolve,
+                                        .set_callbacks = _esp8266_ntp_linux_set_callbacks,
+                                        .send = _esp8266_ntp_linux_send,
+                                        .rx_tick = _esp8266_ntp_linux_rx_tick,
+                                        .lookup = _esp8266_ntp_linux_lookup,
+                                        .send_to = _esp8266_ntp_linux_send_to
+                                    };
+
+//SNTP SERVER LISTENER RELATED
+static int _esp8266_ntp_linux_serve_fd = -1;
+static void (*_esp8266_ntp_linux_serve_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick);
+
+static const ESP8266_NTP_LISTENER _esp8266_ntp_linux_listener = {
+                                        .open = _esp8266_ntp_linux_serve_open,
+                                        .close = _esp8266_ntp_linux_serve_close,
+                                        .reply = _esp8266_ntp_linux_serve_reply
+                                    };
+
+//WARM START STORE RELATED
+static char _esp8266_ntp_linux_store_path[NTP_LINUX_STORE_PATH_SIZE];
+
+static const ESP8266_NTP_STORE _esp8266_ntp_linux_store = {
+                                        .read = _esp8266_ntp_linux_store_read,
+                                        .write = _esp8266_ntp_linux_store_write,
+                                        .rtc_now = _esp8266_ntp_linux_rtc_now,
+                                        .rtc_kept = _esp8266_ntp_linux_rtc_kept
+                                    };
+//END LOCAL LIBRARY VARIABLES/////////////////////////////
+
+//PLATFORM HOOKS (ESP8266_NTP_HOST.h)
+uint32_t system_get_time(void)
+{
+    //MICROSECOND TICK, WRAPS LIKE THE SDK COUNTER (~71 MINUTES)
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * NTP_USEC_PER_SEC + (uint64_t)(ts.tv_nsec / 1000));
+}
+
+unsigned long os_random(void)
+{
+    return (unsigned long)random();
+}
+
+uint32_t ipaddr_addr(const char* cp)
+{
+    //NETWORK BYTE ORDER, 0xFFFFFFFF IF INVALID (AS LWIP)
+
+    return (uint32_t)inet_addr(cp);
+}
+
+void os_timer_setfn(os_timer_t* timer, os_timer_func_t* func, void* arg)
+{
+    os_timer_disarm(timer);
+    timer->func = func;
+    timer->arg = arg;
+}
+
+void os_timer_arm(os_timer_t* timer, uint32_t ms, uint8_t repeat)
+{
+    //(RE)ARM A TIMER. ARMING AN ARMED TIMER RESTARTS IT
+
+    os_timer_disarm(timer);
+    timer->expire_us = system_get_time() + (ms * 1000);
+    timer->period_ms = repeat ? ms : 0;
+    timer->armed = 1;
+    timer->next = _esp8266_ntp_linux_timers;
+    _esp8266_ntp_linux_timers = timer;
+}
+
+void os_timer_disarm(os_timer_t* timer)
+{
+    os_timer_t** p;
+
+    if(!timer->armed)
+    {
+        return;
+    }
+
+    for(p = &_esp8266_ntp_linux_timers; *p != NULL; p = &(*p)->next)
+    {
+        if(*p == timer)
+        {
+            *p = timer->next;
+            break;
+        }
+    }
+    timer->armed = 0;
+}
+
+//CONTROL FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_Open(void)
+{
+    //CREATE THE SOCKET AND EVENT LOOP AND MAKE THIS BACKEND THE LIBRARY
+    //TRANSPORT. CALL BEFORE ESP8266_NTP_Initialize / Create
+    //RETURNS 0 ON FAILURE (errno SET)
+
+    struct sockaddr_in local;
+    struct epoll_event ev;
+    int on = 1;
+
+    if(_esp8266_ntp_linux_sock_fd >= 0)
+    {
+        return 1;
+    }
+
+    srandom((unsigned int)(system_get_time() ^ (uint32_t)getpid()));
+
+    _esp8266_ntp_linux_sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    _esp8266_ntp_linux_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(_esp8266_ntp_linux_sock_fd < 0 || _esp8266_ntp_linux_epoll_fd < 0)
+    {
+        ESP8266_NTP_LINUX_Close();
+        return 0;
+    }
+
+    //KERNEL RECEIVE TIMESTAMPS. NOT FATAL IF UNAVAILABLE, T4 THEN FALLS
+    //BACK TO THE DELIVERY TIME
+    if(setsockopt(_esp8266_ntp_linux_sock_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0)
+    {
+        NTP_LOG_WARN(LINUX_NO_STAMP, 0, 0, errno);
+    }
+
+    //EPHEMERAL LOCAL PORT
+    os_memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(_esp8266_ntp_linux_sock_fd, (struct sockaddr*)&local, sizeof(local)) != 0)
+    {
+        ESP8266_NTP_LINUX_Close();
+        return 0;
+    }
+
+    os_memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _esp8266_ntp_linux_sock_fd;
+    if(epoll_ctl(_esp8266_ntp_linux_epoll_fd, EPOLL_CTL_ADD, _esp8266_ntp_linux_sock_fd, &ev) != 0)
+    {
+        ESP8266_NTP_LINUX_Close();
+        return 0;
+    }
+
+    //RESOLVER THREAD AND ITS WAKEUP
+    _esp8266_ntp_linux_dns_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.data.fd = _esp8266_ntp_linux_dns_fd;
+    if(_esp8266_ntp_linux_dns_fd < 0 ||
+        epoll_ctl(_esp8266_ntp_linux_epoll_fd, EPOLL_CTL_ADD, _esp8266_ntp_linux_dns_fd, &ev) != 0)
+    {
+        ESP8266_NTP_LINUX_Close();
+        return 0;
+    }
+    _esp8266_ntp_linux_dns_stop = 0;
+    if(pthread_create(&_esp8266_ntp_linux_dns_thread, NULL, _esp8266_ntp_linux_resolver, NULL) != 0)
+    {
+        ESP8266_NTP_LINUX_Close();
+        return 0;
+    }
+    _esp8266_ntp_linux_dns_running = 1;
+
+    os_timer_setfn(&_esp8266_ntp_linux_resolved_timer, _esp8266_ntp_linux_resolved_timer_cb, NULL);
+    os_timer_setfn(&_esp8266_ntp_linux_sent_timer, _esp8266_ntp_linux_sent_timer_cb, NULL);
+    os_timer_setfn(&_esp8266_ntp_linux_reply_timer, _esp8266_ntp_linux_reply_timer_cb, NULL);
+
+    ESP8266_NTP_SetTransport(&_esp8266_ntp_linux_transport);
+    ESP8266_NTP_SetListener(&_esp8266_ntp_linux_listener);
+    return 1;
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_Close(void)
+{
+    //RELEASE THE SOCKETS, RESOLVER AND EVENT LOOP. AN EXCHANGE IN
+    //FLIGHT IS REPORTED TO THE LIBRARY AS A TIMEOUT, ITS NAME LOOKUP AS
+    //A FAILURE, ON THE NEXT Poll. send_to QUERIES AND THEIR LOOKUPS ARE
+    //FORGOTTEN AND TIMED OUT BY THE LIBRARY. WAITS FOR A getaddrinfo
+    //IN PROGRESS TO RETURN
+
+    uint8_t i;
+
+    ESP8266_NTP_ServeStop();
+    if(_esp8266_ntp_linux_dns_running)
+    {
+        pthread_mutex_lock(&_esp8266_ntp_linux_dns_lock);
+        _esp8266_ntp_linux_dns_stop = 1;
+        pthread_cond_signal(&_esp8266_ntp_linux_dns_cond);
+        pthread_mutex_unlock(&_esp8266_ntp_linux_dns_lock);
+        pthread_join(_esp8266_ntp_linux_dns_thread, NULL);
+        _esp8266_ntp_linux_dns_running = 0;
+    }
+    if(_esp8266_ntp_linux_dns_fd >= 0)
+    {
+        close(_esp8266_ntp_linux_dns_fd);
+        _esp8266_ntp_linux_dns_fd = -1;
+    }
+    for(i = 0; i < NTP_LINUX_MAX_LOOKUPS; i++)
+    {
+        if(_esp8266_ntp_linux_lookups[i].state != ESP8266_NTP_LINUX_LOOKUP_FREE &&
+            _esp8266_ntp_linux_lookups[i].exchange &&
+            _esp8266_ntp_linux_lookups[i].gen == _esp8266_ntp_linux_resolve_gen)
+        {
+            _esp8266_ntp_linux_resolved_ok = 0;
+            os_timer_arm(&_esp8266_ntp_linux_resolved_timer, 0, 0);
+        }
+    }
+    os_memset(_esp8266_ntp_linux_lookups, 0, sizeof(_esp8266_ntp_linux_lookups));
+
+    if(_esp8266_ntp_linux_sock_fd >= 0)
+    {
+        close(_esp8266_ntp_linux_sock_fd);
+        _esp8266_ntp_linux_sock_fd = -1;
+    }
+    if(_esp8266_ntp_linux_epoll_fd >= 0)
+    {
+        close(_esp8266_ntp_linux_epoll_fd);
+        _esp8266_ntp_linux_epoll_fd = -1;
+    }
+    os_memset(_esp8266_ntp_linux_queries, 0, sizeof(_esp8266_ntp_linux_queries));
+    if(_esp8266_ntp_linux_awaiting)
+    {
+        os_timer_arm(&_esp8266_ntp_linux_reply_timer, 0, 0);
+    }
+}
+
+void ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_Poll(int32_t max_wait_ms)
+{
+    //RUN ONE ITERATION OF THE EVENT LOOP : EXPIRED TIMERS, THEN WAIT
+    //FOR DATAGRAMS UNTIL THE NEXT TIMER IS DUE OR max_wait_ms PASSES
+    //(-1 WAITS FOR THE NEXT TIMER ONLY)
+
+    struct epoll_event events[NTP_LINUX_MAX_EVENTS];
+    int32_t wait_ms;
+    int n, i;
+
+    _esp8266_ntp_linux_run_timers();
+
+    wait_ms = _esp8266_ntp_linux_next_timer_ms();
+    if(max_wait_ms >= 0 && (wait_ms < 0 || max_wait_ms < wait_ms))
+    {
+        wait_ms = max_wait_ms;
+    }
+
+    if(_esp8266_ntp_linux_epoll_fd < 0)
+    {
+        return;
+    }
+
+    n = epoll_wait(_esp8266_ntp_linux_epoll_fd, events, NTP_LINUX_MAX_EVENTS, wait_ms);
+    for(i = 0; i < n; i++)
+    {
+        if(events[i].data.fd == _esp8266_ntp_linux_sock_fd)
+        {
+            _esp8266_ntp_linux_read();
+        }
+        else if(events[i].data.fd == _esp8266_ntp_linux_serve_fd)
+        {
+            _esp8266_ntp_linux_serve_read();
+        }
+        else if(events[i].data.fd == _esp8266_ntp_linux_dns_fd)
+        {
+            _esp8266_ntp_linux_lookup_deliver();
+        }
+    }
+
+    _esp8266_ntp_linux_run_timers();
+}
+
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_SetStoreFile(const char* path)
+{
+    //KEEP THE WARM START SNAPSHOT IN A FILE AND MAKE IT THE LIBRARY
+    //STORE. NULL REMOVES THE STORE. RETURNS 0 IF THE PATH IS TOO LONG
+
+    if(path == NULL)
+    {
+        _esp8266_ntp_linux_store_path[0] = '\0';
+        ESP8266_NTP_SetStore(NULL);
+        return 1;
+    }
+
+    if(os_strlen(path) >= sizeof(_esp8266_ntp_linux_store_path))
+    {
+        return 0;
+    }
+    os_memcpy(_esp8266_ntp_linux_store_path, path, os_strlen(path) + 1);
+    ESP8266_NTP_SetStore(&_esp8266_ntp_linux_store);
+    return 1;
+}
+
+//INTERNAL FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_run_timers(void)
+{
+    //FIRE EVERY DUE TIMER. CALLBACKS MAY ARM / DISARM ANY TIMER SO THE
+    //SCAN RESTARTS AFTER EACH ONE
+
+    os_timer_t* t;
+    uint32_t now;
+
+    do
+    {
+        now = system_get_time();
+        for(t = _esp8266_ntp_linux_timers; t != NULL; t = t->next)
+        {
+            if((int32_t)(now - t->expire_us) >= 0)
+            {
+                break;
+            }
+        }
+
+        if(t != NULL)
+        {
+            if(t->period_ms != 0)
+            {
+                t->expire_us += t->period_ms * 1000;
+            }
+            else
+            {
+                os_timer_disarm(t);
+            }
+            t->func(t->arg);
+        }
+    } while(t != NULL);
+}
+
+int32_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_next_timer_ms(void)
+{
+    //MILLISECONDS UNTIL THE NEXT TIMER IS DUE (ROUNDED UP), -1 IF NONE
+
+    os_timer_t* t;
+    uint32_t now = system_get_time();
+    int32_t min_us = -1;
+    int32_t left;
+
+    for(t = _esp8266_ntp_linux_timers; t != NULL; t = t->next)
+    {
+        left = (int32_t)(t->expire_us - now);
+        if(left < 0)
+        {
+            left = 0;
+        }
+        if(min_us < 0 || left < min_us)
+        {
+            min_us = left;
+        }
+    }
+
+    return (min_us < 0) ? -1 : (min_us + 999) / 1000;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_read(void)
+{
+    //DRAIN THE SOCKET, DELIVERING ONLY REPLIES TO OUTSTANDING QUERIES
+
+    const ESP8266_NTP_HEADER* hdr;
+    ESP8266_NTP_LINUX_QUERY* query = NULL;
+    struct sockaddr_in from;
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    uint32_t age_us;
+    ssize_t len;
+
+    while(1)
+    {
+        iov.iov_base = _esp8266_ntp_linux_rx_buffer;
+        iov.iov_len = sizeof(_esp8266_ntp_linux_rx_buffer);
+        os_memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        len = recvmsg(_esp8266_ntp_linux_sock_fd, &msg, 0);
+        if(len < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            //EAGAIN : DRAINED. OTHER ERRORS (ICMP UNREACHABLE REPORTED
+            //AS ECONNREFUSED) LEAVE THE EXCHANGE TO ITS TIMEOUT
+            return;
+        }
+
+        //A DATAGRAM IS NEVER LONGER THAN THE BUFFER, SO IT FITS uint16_t
+        hdr = ESP8266_NTP_HeaderView((char*)_esp8266_ntp_linux_rx_buffer, (uint16_t)len);
+        if(hdr != NULL)
+        {
+            query = _esp8266_ntp_linux_query_find(ESP8266_NTP_HeaderTimestamp(hdr->originate_ts), &from);
+        }
+        if(hdr == NULL || query == NULL)
+        {
+            NTP_LOG_DEBUG(LINUX_DROPPED, 0, (int16_t)ntohs(from.sin_port), (int32_t)ntohl(from.sin_addr.s_addr));
+            continue;
+        }
+
+        //ANSWERED. A SECOND COPY NO LONGER MATCHES
+        if(query->exchange)
+        {
+            _esp8266_ntp_linux_awaiting = 0;
+            os_timer_disarm(&_esp8266_ntp_linux_reply_timer);
+        }
+        query->used = 0;
+        query->exchange = 0;
+
+        //ARRIVAL TIME IN THE TICK SOURCE TIMEBASE
+        _esp8266_ntp_linux_rx_tick_valid = _esp8266_ntp_linux_rx_age_us(&msg, &age_us);
+        _esp8266_ntp_linux_rx_tick_us = system_get_time() - age_us;
+
+        _esp8266_ntp_linux_recv_cb((char*)_esp8266_ntp_linux_rx_buffer, (uint16_t)len);
+        _esp8266_ntp_linux_rx_tick_valid = 0;
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rx_age_us(struct msghdr* msg, uint32_t* age_us)
+{
+    //HOW LONG AGO THE KERNEL STAMPED THE DATAGRAM. THE STAMP IS
+    //CLOCK_REALTIME, SO ONLY THE (SHORT) AGE IS CARRIED ACROSS TO THE
+    //MONOTONIC TICK. RETURNS 0 IF THERE IS NO USABLE STAMP
+
+    struct cmsghdr* cmsg;
+    struct timespec stamp, now;
+    int64_t age;
+
+    *age_us = 0;
+    for(cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            os_memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            age = (int64_t)(now.tv_sec - stamp.tv_sec) * NTP_USEC_PER_SEC +
+                    (now.tv_nsec - stamp.tv_nsec) / 1000;
+
+            //A REALTIME STEP BETWEEN STAMP AND NOW MAKES THE AGE MEANINGLESS
+            if(age < 0 || age >= (int64_t)NTP_USEC_PER_SEC)
+            {
+                return 0;
+            }
+            *age_us = (uint32_t)age;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//INTERNAL TRANSPORT FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_set_debug(uint8_t debug_on)
+{
+    //NOTHING IS PRINTED. EVENTS GO TO THE LIBRARY LOG RING
+
+    (void)debug_on;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_set_dns_server(char num_dns, ip_addr_t* dns)
+{
+    //THE SYSTEM RESOLVER CONFIGURATION IS USED
+
+    (void)num_dns;
+    (void)dns;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_initialize(char* hostname, char* host_ip, uint16_t port, uint32_t timeout_ms)
+{
+    //SET THE PEER OF THE NEXT EXCHANGE, BY NAME (RESOLVED LATER) OR IP
+
+    _esp8266_ntp_linux_hostname = hostname;
+    _esp8266_ntp_linux_timeout_ms = timeout_ms;
+
+    os_memset(&_esp8266_ntp_linux_server, 0, sizeof(_esp8266_ntp_linux_server));
+    _esp8266_ntp_linux_server.sin_family = AF_INET;
+    _esp8266_ntp_linux_server.sin_port = htons(port);
+    if(host_ip != NULL)
+    {
+        inet_pton(AF_INET, host_ip, &_esp8266_ntp_linux_server.sin_addr);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolve(void (*resolved_cb)(ip_addr_t* ip))
+{
+    //RESOLVE THE HOSTNAME OF THE EXCHANGE ON THE RESOLVER THREAD. A
+    //LOOKUP THAT CAN NOT EVEN BE QUEUED FAILS FROM A TIMER, AS THE
+    //LIBRARY EXPECTS THE CALLBACK AFTER THIS RETURNS
+
+    _esp8266_ntp_linux_resolved_cb = resolved_cb;
+    _esp8266_ntp_linux_resolve_gen++;
+
+    if(!_esp8266_ntp_linux_lookup_queue(_esp8266_ntp_linux_hostname, NULL, NULL, 1))
+    {
+        _esp8266_ntp_linux_resolved_ok = 0;
+        os_timer_arm(&_esp8266_ntp_linux_resolved_timer, 0, 0);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_set_callbacks(void (*sent_cb)(void* arg), void (*recv_cb)(char* data, uint16_t length))
+{
+    _esp8266_ntp_linux_sent_cb = sent_cb;
+    _esp8266_ntp_linux_recv_cb = recv_cb;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_send(uint8_t* data, uint16_t length)
+{
+    //SEND THE REQUEST AND START WAITING FOR ITS REPLY. A FAILED SEND IS
+    //REPORTED AS AN IMMEDIATE TIMEOUT SO THE LIBRARY MOVES ON
+
+    _esp8266_ntp_linux_awaiting = 1;
+    if(!_esp8266_ntp_linux_query_send(&_esp8266_ntp_linux_server, data, length, 1))
+    {
+        os_timer_arm(&_esp8266_ntp_linux_reply_timer, 0, 0);
+        return;
+    }
+
+    os_timer_arm(&_esp8266_ntp_linux_sent_timer, 0, 0);
+    os_timer_arm(&_esp8266_ntp_linux_reply_timer, _esp8266_ntp_linux_timeout_ms, 0);
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rx_tick(uint32_t* tick_us)
+{
+    *tick_us = _esp8266_ntp_linux_rx_tick_us;
+    return _esp8266_ntp_linux_rx_tick_valid;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_lookup(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg)
+{
+    //RESOLVE hostname FOR A send_to QUERY WITHOUT DISTURBING THE
+    //EXCHANGE. WITH EVERY SLOT TAKEN THE LOOKUP IS DROPPED AND THE
+    //LIBRARY TIMES IT OUT
+
+    if(!_esp8266_ntp_linux_lookup_queue(hostname, found_cb, arg, 0))
+    {
+        NTP_LOG_WARN(LINUX_NO_LOOKUP, 0, NTP_LINUX_MAX_LOOKUPS, 0);
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_send_to(ip_addr_t* ip, uint16_t port, uint8_t* data, uint16_t length)
+{
+    //SEND A REQUEST ALONGSIDE THE EXCHANGE. ITS REPLY IS DELIVERED BY
+    //_esp8266_ntp_linux_read ONCE MATCHED IN THE QUERY TABLE
+
+    struct sockaddr_in peer;
+
+    os_memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = ip->addr;
+    peer.sin_port = htons(port);
+
+    return _esp8266_ntp_linux_query_send(&peer, data, length, 0);
+}
+
+//INTERNAL RESOLVER FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_lookup_queue(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg, uint8_t exchange)
+{
+    //HAND hostname TO THE RESOLVER THREAD. A NAME TOO LONG TO COPY
+    //FAILS THROUGH THE SAME DELIVERY. RETURNS 0 IF THE BACKEND IS NOT
+    //OPEN OR EVERY SLOT IS TAKEN
+
+    ESP8266_NTP_LINUX_LOOKUP* l = NULL;
+    size_t len = (hostname != NULL) ? os_strlen(hostname) : NTP_LINUX_NAME_SIZE;
+    uint64_t one = 1;
+    uint8_t i;
+
+    if(!_esp8266_ntp_linux_dns_running)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&_esp8266_ntp_linux_dns_lock);
+    for(i = 0; i < NTP_LINUX_MAX_LOOKUPS && l == NULL; i++)
+    {
+        if(_esp8266_ntp_linux_lookups[i].state == ESP8266_NTP_LINUX_LOOKUP_FREE)
+        {
+            l = &_esp8266_ntp_linux_lookups[i];
+        }
+    }
+    if(l != NULL)
+    {
+        l->hostname = hostname;
+        l->found_cb = found_cb;
+        l->arg = arg;
+        l->exchange = exchange;
+        l->gen = _esp8266_ntp_linux_resolve_gen;
+        l->ok = 0;
+        l->ip.addr = 0;
+        if(len < sizeof(l->name))
+        {
+            os_memcpy(l->name, hostname, len + 1);
+            l->state = ESP8266_NTP_LINUX_LOOKUP_QUEUED;
+            pthread_cond_signal(&_esp8266_ntp_linux_dns_cond);
+        }
+        else if(write(_esp8266_ntp_linux_dns_fd, &one, sizeof(one)) == sizeof(one))
+        {
+            l->state = ESP8266_NTP_LINUX_LOOKUP_DONE;
+        }
+        else
+        {
+            l = NULL;
+        }
+    }
+    pthread_mutex_unlock(&_esp8266_ntp_linux_dns_lock);
+    return (l != NULL);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_lookup_deliver(void)
+{
+    //ON THE EVENT LOOP : HAND EVERY FINISHED LOOKUP TO THE LIBRARY. THE
+    //SLOT IS FREED FIRST SO THE CALLBACK MAY START ANOTHER ONE. AN
+    //EXCHANGE LOOKUP OVERTAKEN BY A LATER resolve IS DROPPED
+
+    ESP8266_NTP_LINUX_LOOKUP done;
+    uint64_t count;
+    uint8_t i;
+
+    if(read(_esp8266_ntp_linux_dns_fd, &count, sizeof(count)) != sizeof(count))
+    {
+        return;
+    }
+
+    while(1)
+    {
+        pthread_mutex_lock(&_esp8266_ntp_linux_dns_lock);
+        for(i = 0; i < NTP_LINUX_MAX_LOOKUPS; i++)
+        {
+            if(_esp8266_ntp_linux_lookups[i].state == ESP8266_NTP_LINUX_LOOKUP_DONE)
+            {
+                break;
+            }
+        }
+        if(i < NTP_LINUX_MAX_LOOKUPS)
+        {
+            done = _esp8266_ntp_linux_lookups[i];
+            _esp8266_ntp_linux_lookups[i].state = ESP8266_NTP_LINUX_LOOKUP_FREE;
+        }
+        pthread_mutex_unlock(&_esp8266_ntp_linux_dns_lock);
+
+        if(i == NTP_LINUX_MAX_LOOKUPS)
+        {
+            return;
+        }
+
+        if(!done.exchange)
+        {
+            (*done.found_cb)(done.hostname, done.ok ? &done.ip : NULL, done.arg);
+        }
+        else if(done.gen == _esp8266_ntp_linux_resolve_gen)
+        {
+            if(done.ok)
+            {
+                _esp8266_ntp_linux_server.sin_addr.s_addr = done.ip.addr;
+                _esp8266_ntp_linux_resolved_ip = done.ip;
+            }
+            _esp8266_ntp_linux_resolved_cb(done.ok ? &_esp8266_ntp_linux_resolved_ip : NULL);
+        }
+    }
+}
+
+void* ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolver(void* arg)
+{
+    //RESOLVER THREAD. TAKES THE QUEUED LOOKUPS ONE BY ONE, RUNS THE
+    //BLOCKING getaddrinfo WITHOUT THE LOCK AND WAKES THE EVENT LOOP.
+    //NOTHING ELSE OF THE LIBRARY IS TOUCHED FROM HERE
+
+    char name[NTP_LINUX_NAME_SIZE];
+    struct in_addr addr;
+    ESP8266_NTP_LINUX_LOOKUP* l;
+    uint64_t one = 1;
+    ssize_t written;
+    uint8_t ok;
+    uint8_t i;
+
+    (void)arg;
+    pthread_mutex_lock(&_esp8266_ntp_linux_dns_lock);
+    while(!_esp8266_ntp_linux_dns_stop)
+    {
+        for(i = 0; i < NTP_LINUX_MAX_LOOKUPS; i++)
+        {
+            if(_esp8266_ntp_linux_lookups[i].state == ESP8266_NTP_LINUX_LOOKUP_QUEUED)
+            {
+                break;
+            }
+        }
+        if(i == NTP_LINUX_MAX_LOOKUPS)
+        {
+            pthread_cond_wait(&_esp8266_ntp_linux_dns_cond, &_esp8266_ntp_linux_dns_lock);
+            continue;
+        }
+
+        l = &_esp8266_ntp_linux_lookups[i];
+        l->state = ESP8266_NTP_LINUX_LOOKUP_BUSY;
+        os_memcpy(name, l->name, sizeof(name));
+        pthread_mutex_unlock(&_esp8266_ntp_linux_dns_lock);
+
+        ok = _esp8266_ntp_linux_resolve_name(name, &addr);
+
+        pthread_mutex_lock(&_esp8266_ntp_linux_dns_lock);
+        l->ok = ok;
+        l->ip.addr = addr.s_addr;
+        l->state = ESP8266_NTP_LINUX_LOOKUP_DONE;
+
+        //FAILS ONLY WITH THE COUNTER SATURATED, WHEN THE LOOP IS AWAKE ANYWAY
+        written = write(_esp8266_ntp_linux_dns_fd, &one, sizeof(one));
+        (void)written;
+    }
+    pthread_mutex_unlock(&_esp8266_ntp_linux_dns_lock);
+    return NULL;
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolve_name(const char* hostname, struct in_addr* addr)
+{
+    //RESOLVE hostname (IPv4). getaddrinfo BLOCKS (UP TO THE RESOLVER
+    //TIMEOUT WHEN DNS IS DOWN), SO ONLY THE RESOLVER THREAD CALLS THIS
+
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    uint8_t ok = 0;
+
+    addr->s_addr = 0;
+    os_memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(hostname != NULL &&
+        getaddrinfo(hostname, NULL, &hints, &res) == 0 && res != NULL)
+    {
+        *addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+        ok = 1;
+    }
+    if(res != NULL)
+    {
+        freeaddrinfo(res);
+    }
+    return ok;
+}
+
+//INTERNAL OUTSTANDING QUERY FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_query_send(const struct sockaddr_in* peer, uint8_t* data, uint16_t length, uint8_t exchange)
+{
+    //SEND data TO peer AND RECORD IT UNDER ITS TRANSMIT TIMESTAMP. THE
+    //LIBRARY WRITES A FRESH ONE INTO EVERY REQUEST, SO THE KEY IS UNIQUE
+    //AMONG OUTSTANDING QUERIES. EXPIRED ENTRIES ARE PURGED HERE, AND
+    //WITH NONE FREE THE OLDEST IS REUSED
+
+    const ESP8266_NTP_HEADER* hdr = ESP8266_NTP_HeaderView((char*)data, length);
+    ESP8266_NTP_LINUX_QUERY* slot = NULL;
+    uint32_t now = system_get_time();
+    ssize_t sent = -1;
+    uint8_t i;
+
+    if(exchange)
+    {
+        _esp8266_ntp_linux_query_end_exchange();
+    }
+
+    if(hdr != NULL && _esp8266_ntp_linux_sock_fd >= 0)
+    {
+        sent = sendto(_esp8266_ntp_linux_sock_fd, data, length, 0,
+                        (const struct sockaddr*)peer, sizeof(*peer));
+    }
+    if(sent != (ssize_t)length)
+    {
+        NTP_LOG_WARN(LINUX_SEND, 0, 0, errno);
+        return 0;
+    }
+
+    for(i = 0; i < NTP_LINUX_MAX_QUERIES; i++)
+    {
+        ESP8266_NTP_LINUX_QUERY* q = &_esp8266_ntp_linux_queries[i];
+
+        if(q->used && !q->exchange && (now - q->sent_us) >= (NTP_LINUX_QUERY_TTL_MS * 1000UL))
+        {
+            q->used = 0;
+        }
+        if(!q->used)
+        {
+            if(slot == NULL || slot->used)
+            {
+                slot = q;
+            }
+        }
+        else if(!q->exchange && (slot == NULL || (slot->used && (now - q->sent_us) > (now - slot->sent_us))))
+        {
+            slot = q;
+        }
+    }
+
+    slot->org = ESP8266_NTP_HeaderTimestamp(hdr->transmit_ts);
+    slot->peer = *peer;
+    slot->sent_us = now;
+    slot->exchange = exchange;
+    slot->used = 1;
+    return 1;
+}
+
+ESP8266_NTP_LINUX_QUERY* ICACHE_FLASH_ATTR _esp8266_ntp_linux_query_find(uint64_t org, const struct sockaddr_in* from)
+{
+    //THE OUTSTANDING QUERY A REPLY ANSWERS, NULL IF NONE
+
+    uint8_t i;
+
+    for(i = 0; i < NTP_LINUX_MAX_QUERIES; i++)
+    {
+        ESP8266_NTP_LINUX_QUERY* q = &_esp8266_ntp_linux_queries[i];
+
+        if(q->used && q->org == org &&
+            q->peer.sin_addr.s_addr == from->sin_addr.s_addr &&
+            q->peer.sin_port == from->sin_port)
+        {
+            return q;
+        }
+    }
+    return NULL;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_query_end_exchange(void)
+{
+    //FORGET THE QUERY OF THE EXCHANGE, ANSWERED OR NOT
+
+    uint8_t i;
+
+    for(i = 0; i < NTP_LINUX_MAX_QUERIES; i++)
+    {
+        if(_esp8266_ntp_linux_queries[i].exchange)
+        {
+            _esp8266_ntp_linux_queries[i].used = 0;
+            _esp8266_ntp_linux_queries[i].exchange = 0;
+        }
+    }
+}
+
+//INTERNAL LISTENER FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_open(uint16_t port, void (*recv_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick))
+{
+    //BIND THE SERVER SOCKET AND ADD IT TO THE EVENT LOOP OPENED BY
+    //ESP8266_NTP_LINUX_Open
+
+    struct sockaddr_in local;
+    struct epoll_event ev;
+    int on = 1;
+
+    if(_esp8266_ntp_linux_epoll_fd < 0)
+    {
+        return 0;
+    }
+
+    _esp8266_ntp_linux_serve_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(_esp8266_ntp_linux_serve_fd < 0)
+    {
+        return 0;
+    }
+    setsockopt(_esp8266_ntp_linux_serve_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(_esp8266_ntp_linux_serve_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+    os_memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+
+    os_memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _esp8266_ntp_linux_serve_fd;
+
+    if(bind(_esp8266_ntp_linux_serve_fd, (struct sockaddr*)&local, sizeof(local)) != 0 ||
+        epoll_ctl(_esp8266_ntp_linux_epoll_fd, EPOLL_CTL_ADD, _esp8266_ntp_linux_serve_fd, &ev) != 0)
+    {
+        NTP_LOG_ERROR(LINUX_SERVE, 0, (int16_t)port, errno);
+        close(_esp8266_ntp_linux_serve_fd);
+        _esp8266_ntp_linux_serve_fd = -1;
+        return 0;
+    }
+
+    _esp8266_ntp_linux_serve_cb = recv_cb;
+    return 1;
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_close(void)
+{
+    //CLOSING THE SOCKET ALSO REMOVES IT FROM THE EPOLL SET
+
+    if(_esp8266_ntp_linux_serve_fd >= 0)
+    {
+        close(_esp8266_ntp_linux_serve_fd);
+        _esp8266_ntp_linux_serve_fd = -1;
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_reply(void* peer, uint8_t* data, uint16_t length)
+{
+    //PEER IS THE SOURCE ADDRESS OF THE REQUEST BEING ANSWERED. A FULL
+    //SEND BUFFER DROPS THE REPLY, THE CLIENT RETRIES
+
+    sendto(_esp8266_ntp_linux_serve_fd, data, length, 0, (struct sockaddr*)peer, sizeof(struct sockaddr_in));
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_read(void)
+{
+    //DRAIN THE SERVER SOCKET, HANDING EVERY REQUEST TO THE LIBRARY WITH
+    //ITS ARRIVAL TICK. THE CALLBACK MAY STOP THE SERVER
+
+    struct sockaddr_in from;
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    uint32_t age_us;
+    ssize_t len;
+
+    while(_esp8266_ntp_linux_serve_fd >= 0)
+    {
+        iov.iov_base = _esp8266_ntp_linux_rx_buffer;
+        iov.iov_len = sizeof(_esp8266_ntp_linux_rx_buffer);
+        os_memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        len = recvmsg(_esp8266_ntp_linux_serve_fd, &msg, 0);
+        if(len < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        _esp8266_ntp_linux_rx_age_us(&msg, &age_us);
+        _esp8266_ntp_linux_serve_cb((char*)_esp8266_ntp_linux_rx_buffer, (uint16_t)len, &from, system_get_time() - age_us);
+    }
+}
+
+//INTERNAL STORE FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_store_read(void* buf, uint16_t size)
+{
+    FILE* f = fopen(_esp8266_ntp_linux_store_path, "rb");
+    size_t n;
+
+    if(f == NULL)
+    {
+        return 0;
+    }
+    n = fread(buf, 1, size, f);
+    fclose(f);
+    return (n == size);
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_store_write(const void* buf, uint16_t size)
+{
+    //WRITE A TEMPORARY FILE AND RENAME IT OVER THE STORE, SO A CRASH
+    //MID WRITE LEAVES THE PREVIOUS SNAPSHOT
+
+    char tmp[NTP_LINUX_STORE_PATH_SIZE + sizeof(NTP_LINUX_STORE_TMP_SUFFIX)];
+    FILE* f;
+    size_t n;
+    int len;
+
+    len = snprintf(tmp, sizeof(tmp), "%s" NTP_LINUX_STORE_TMP_SUFFIX, _esp8266_ntp_linux_store_path);
+    if(len < 0 || (size_t)len >= sizeof(tmp))
+    {
+        return 0;
+    }
+    f = fopen(tmp, "wb");
+    if(f == NULL)
+    {
+        return 0;
+    }
+    n = fwrite(buf, 1, size, f);
+    if(fclose(f) != 0 || n != size || rename(tmp, _esp8266_ntp_linux_store_path) != 0)
+    {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rtc_now(uint32_t* ticks, uint32_t* period_q12)
+{
+    //MILLISECONDS OF THE HOST REAL TIME CLOCK, WHICH KEEPS RUNNING WHILE
+    //THE PROCESS OR MACHINE IS DOWN. A STEP BACK SHOWS UP AS A GAP LONGER
+    //THAN THE LIBRARY ACCEPTS
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *ticks = (uint32_t)(((uint64_t)ts.tv_sec * 1000) + (uint64_t)(ts.tv_nsec / 1000000));
+    *period_q12 = 1000UL << 12;
+    return 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rtc_kept(void)
+{
+    return 1;
+}
+
+//INTERNAL CALLBACK FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolved_timer_cb(void* arg)
+{
+    (void)arg;
+    _esp8266_ntp_linux_resolved_cb(_esp8266_ntp_linux_resolved_ok ? &_esp8266_ntp_linux_resolved_ip : NULL);
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_sent_timer_cb(void* arg)
+{
+    (void)arg;
+    if(_esp8266_ntp_linux_sent_cb != NULL)
+    {
+        _esp8266_ntp_linux_sent_cb(NULL);
+    }
+}
+
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_reply_timer_cb(void* arg)
+{
+    //NO REPLY WITHIN THE TIMEOUT : LENGTH 0 TELLS THE LIBRARY
+
+    (void)arg;
+    _esp8266_ntp_linux_query_end_exchange();
+    _esp8266_ntp_linux_awaiting = 0;
+    _esp8266_ntp_linux_recv_cb(NULL, 0);
+}
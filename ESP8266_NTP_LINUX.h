@@ -0,0 +1,145 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* LINUX BACKEND
+*
+* RUNS THE LIBRARY AS A HOST PROCESS (BUILD BOTH FILES WITH
+* -DESP8266_NTP_HOST AND LINK WITH -lpthread). PROVIDES THE PLATFORM
+* HOOKS DECLARED IN ESP8266_NTP_HOST.h (CLOCK_MONOTONIC TICK, SOFTWARE
+* TIMERS, RANDOM) AND A NON BLOCKING UDP TRANSPORT DRIVEN BY EPOLL.
+*
+* NAMES ARE RESOLVED ON A RESOLVER THREAD, SO A SLOW OR DEAD DNS SERVER
+* NEVER STALLS THE EVENT LOOP. THE THREAD ONLY RUNS getaddrinfo AND
+* WAKES THE LOOP THROUGH AN EVENTFD, EVERY CALLBACK RUNS ON THE LOOP
+*
+* REPLIES ARE STAMPED BY THE KERNEL (SO_TIMESTAMPNS) SO T4 IS THE
+* ARRIVAL TIME, NOT THE TIME THE PROCESS GOT SCHEDULED
+*
+* ONE SOCKET CARRIES MANY OUTSTANDING QUERIES. EACH IS RECORDED UNDER
+* ITS TRANSMIT TIMESTAMP AND A REPLY IS ONLY DELIVERED IF ITS ORIGINATE
+* TIMESTAMP AND SOURCE MATCH ONE
+*
+* THE SNTP SERVER LISTENS ON A SECOND SOCKET IN THE SAME EVENT LOOP
+* (PORT 123 NEEDS CAP_NET_BIND_SERVICE, ANY OTHER PORT DOES NOT)
+*
+* THE WARM START STORE IS A FILE. THE HOST REAL TIME CLOCK STANDS IN
+* FOR THE RTC COUNTER THAT BRIDGES A RESTART
+*
+* USAGE
+* ------------
+*   ESP8266_NTP_LINUX_Open();
+*   ESP8266_NTP_Initialize("127.0.0.1", NULL, NULL, 0, 0, 1000);
+*   ESP8266_NTP_LINUX_SetStoreFile("/var/tmp/ntp.snap");
+*   ESP8266_NTP_Restore();
+*   ESP8266_NTP_SyncIfNeeded();
+*   while(1) ESP8266_NTP_LINUX_Poll(-1);
+****************************************************************/
+
+#ifndef _ESP8266_NTP_LINUX_H_
+#define _ESP8266_NTP_LINUX_H_
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "ESP8266_NTP.h"
+
+//DATAGRAMS ARE READ INTO A BUFFER OF THIS SIZE. LONGER ONES (NTP
+//EXTENSION FIELDS / MAC) ARE TRUNCATED, THE HEADER IS ALL THAT IS USED
+#define NTP_LINUX_RX_BUFFER_SIZE		512
+#define NTP_LINUX_MAX_EVENTS			8
+#define NTP_LINUX_STORE_PATH_SIZE		256
+#define NTP_LINUX_STORE_TMP_SUFFIX		".tmp"		//NAME WRITTEN BEFORE THE RENAME
+//OUTSTANDING QUERY TABLE. A FULL TABLE REUSES THE OLDEST ENTRY. ENTRIES
+//OF send_to ARE TIMED OUT BY THE LIBRARY AND FORGOTTEN HERE AFTER
+//NTP_LINUX_QUERY_TTL_MS
+#define NTP_LINUX_MAX_QUERIES			16
+#define NTP_LINUX_QUERY_TTL_MS			60000UL
+//NAME LOOKUPS IN FLIGHT : ONE PER SERVER PLUS THE EXCHANGE. LONGER
+//NAMES THAN NTP_LINUX_NAME_SIZE - 1 FAIL
+#define NTP_LINUX_MAX_LOOKUPS			(NTP_MAX_SERVERS + 1)
+#define NTP_LINUX_NAME_SIZE				256
+
+//CUSTOM VARIABLE STRUCTURES/////////////////////////////
+//LOOKUP SLOT. THE EVENT LOOP QUEUES AND FREES, THE RESOLVER THREAD
+//TAKES (BUSY) AND FINISHES (DONE). ALL UNDER THE RESOLVER LOCK
+typedef enum
+{
+	ESP8266_NTP_LINUX_LOOKUP_FREE,
+	ESP8266_NTP_LINUX_LOOKUP_QUEUED,
+	ESP8266_NTP_LINUX_LOOKUP_BUSY,
+	ESP8266_NTP_LINUX_LOOKUP_DONE
+} ESP8266_NTP_LINUX_LOOKUP_STATE;
+
+typedef struct
+{
+	uint64_t org;				//TRANSMIT TIMESTAMP OF THE REQUEST
+	struct sockaddr_in peer;	//WHERE IT WENT
+	uint32_t sent_us;
+	uint8_t used;
+	uint8_t exchange;			//SENT BY send, OWNS THE REPLY TIMER
+} ESP8266_NTP_LINUX_QUERY;
+
+typedef struct
+{
+	char* hostname;				//AS PASSED IN, HANDED BACK TO found_cb
+	char name[NTP_LINUX_NAME_SIZE];	//COPY THE RESOLVER THREAD READS
+	ip_addr_t ip;
+	uint8_t ok;
+	uint8_t state;				//ESP8266_NTP_LINUX_LOOKUP_STATE
+	uint8_t exchange;			//STARTED BY resolve, NOT lookup
+	uint32_t gen;				//resolve CALL IT ANSWERS (exchange ONLY)
+	void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg);
+	void* arg;
+} ESP8266_NTP_LINUX_LOOKUP;
+//END CUSTOM VARIABLE STRUCTURES/////////////////////////
+
+//CONTROL FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_Open(void);
+void ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_Close(void);
+void ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_Poll(int32_t max_wait_ms);
+uint8_t ICACHE_FLASH_ATTR ESP8266_NTP_LINUX_SetStoreFile(const char* path);
+
+//INTERNAL FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_run_timers(void);
+int32_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_next_timer_ms(void);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_read(void);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rx_age_us(struct msghdr* msg, uint32_t* age_us);
+
+//INTERNAL TRANSPORT FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_set_debug(uint8_t debug_on);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_set_dns_server(char num_dns, ip_addr_t* dns);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_initialize(char* hostname, char* host_ip, uint16_t port, uint32_t timeout_ms);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolve(void (*resolved_cb)(ip_addr_t* ip));
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_set_callbacks(void (*sent_cb)(void* arg), void (*recv_cb)(char* data, uint16_t length));
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_send(uint8_t* data, uint16_t length);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rx_tick(uint32_t* tick_us);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_lookup(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_send_to(ip_addr_t* ip, uint16_t port, uint8_t* data, uint16_t length);
+
+//INTERNAL RESOLVER FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_lookup_queue(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg, uint8_t exchange);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_lookup_deliver(void);
+void* ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolver(void* arg);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolve_name(const char* hostname, struct in_addr* addr);
+
+//INTERNAL OUTSTANDING QUERY FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_query_send(const struct sockaddr_in* peer, uint8_t* data, uint16_t length, uint8_t exchange);
+ESP8266_NTP_LINUX_QUERY* ICACHE_FLASH_ATTR _esp8266_ntp_linux_query_find(uint64_t org, const struct sockaddr_in* from);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_query_end_exchange(void);
+
+//INTERNAL LISTENER FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_open(uint16_t port, void (*recv_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick));
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_close(void);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_reply(void* peer, uint8_t* data, uint16_t length);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_serve_read(void);
+
+//INTERNAL STORE FUNCTIONS
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_store_read(void* buf, uint16_t size);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_store_write(const void* buf, uint16_t size);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rtc_now(uint32_t* ticks, uint32_t* period_q12);
+uint8_t ICACHE_FLASH_ATTR _esp8266_ntp_linux_rtc_kept(void);
+
+//INTERNAL CALLBACK FUNCTIONS
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_resolved_timer_cb(void* arg);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_sent_timer_cb(void* arg);
+void ICACHE_FLASH_ATTR _esp8266_ntp_linux_reply_timer_cb(void* arg);
+
+#endif
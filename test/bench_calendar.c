@@ -0,0 +1,83 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* CALENDAR CONVERSION BENCHMARK
+*
+* TIME PER CALL OF _esp8266_ntp_secs_to_fields, THE INCREMENTAL ONE
+* SECOND UPDATE AND THE HOST gmtime_r FOR COMPARISON. HOST NUMBERS
+* ONLY SHOW THE RELATIVE COST, RUN ON THE TARGET FOR CYCLE COUNTS
+****************************************************************/
+
+#include <time.h>
+#include "ntp_sim.h"
+
+#define NTP_BENCH_CALLS			10000000UL
+
+static uint64_t secs[1024];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char* name, uint64_t ns, uint32_t check)
+{
+	//check KEEPS THE RESULTS LIVE SO THE LOOP IS NOT OPTIMISED OUT
+
+	printf("  %-24s %6.2f ns / call  (%u)\n", name, (double)ns / NTP_BENCH_CALLS, check);
+}
+
+int main(void)
+{
+	ESP8266_NTP_CONTEXT ctx;
+	ESP8266_NTP_DATA d;
+	struct tm tm;
+	time_t t;
+	uint64_t start;
+	uint32_t i;
+	uint32_t check;
+
+	printf("bench_calendar\n");
+	NTP_SIM_Reset();
+	for(i = 0; i < 1024; i++)
+	{
+		secs[i] = ((((uint64_t)NTP_SIM_Random()) << 32) | NTP_SIM_Random()) & ((1ULL << 33) - 1);
+	}
+
+	check = 0;
+	start = now_ns();
+	for(i = 0; i < NTP_BENCH_CALLS; i++)
+	{
+		_esp8266_ntp_secs_to_fields(secs[i & 1023], &d);
+		check += d.date;
+	}
+	report("secs_to_fields", now_ns() - start, check);
+
+	//A STEP OF NTP_INCREMENTAL_MAX_SECS FILLS THE FIELDS BY A FULL
+	//CONVERSION, THE ONE SECOND STEPS AFTER IT ARE INCREMENTAL
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_AdvanceSecondsCtx(&ctx, NTP_INCREMENTAL_MAX_SECS);
+	check = 0;
+	start = now_ns();
+	for(i = 0; i < NTP_BENCH_CALLS; i++)
+	{
+		_esp8266_ntp_advance_fields(&ctx, 1);
+		check += ctx.data.sec;
+	}
+	report("advance_fields (1 s)", now_ns() - start, check);
+	ESP8266_NTP_Destroy(&ctx);
+
+	check = 0;
+	start = now_ns();
+	for(i = 0; i < NTP_BENCH_CALLS; i++)
+	{
+		t = (time_t)((int64_t)secs[i & 1023] - (int64_t)NTP_UNIX_EPOCH_OFFSET);
+		gmtime_r(&t, &tm);
+		check += (uint32_t)tm.tm_mday;
+	}
+	report("gmtime_r", now_ns() - start, check);
+	return 0;
+}
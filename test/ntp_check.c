@@ -0,0 +1,46 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* TEST CHECKS AND REPORTING
+*
+* SEE ntp_check.h
+****************************************************************/
+
+#include <stdio.h>
+#include "ntp_check.h"
+
+static const char* _ntp_check_name;
+static uint32_t _ntp_check_checks;
+static uint32_t _ntp_check_failures;
+
+void NTP_CHECK_Begin(const char* name)
+{
+	_ntp_check_name = name;
+	printf("  %s\n", name);
+}
+
+int NTP_CHECK_Done(void)
+{
+	printf("%u checks, %u failed\n", _ntp_check_checks, _ntp_check_failures);
+	return (_ntp_check_failures > 0) ? 1 : 0;
+}
+
+void _ntp_check(int ok, const char* expr, const char* file, int line)
+{
+	_ntp_check_checks++;
+	if(!ok)
+	{
+		_ntp_check_failures++;
+		printf("%s:%d: %s: CHECK FAILED: %s\n", file, line, _ntp_check_name, expr);
+	}
+}
+
+void _ntp_check_range(int64_t v, int64_t lo, int64_t hi, const char* expr, const char* file, int line)
+{
+	_ntp_check_checks++;
+	if(v < lo || v > hi)
+	{
+		_ntp_check_failures++;
+		printf("%s:%d: %s: CHECK FAILED: %s = %lld NOT IN [%lld, %lld]\n",
+				file, line, _ntp_check_name, expr, (long long)v, (long long)lo, (long long)hi);
+	}
+}
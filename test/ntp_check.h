@@ -0,0 +1,27 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* TEST CHECKS AND REPORTING
+*
+* SHARED BY THE SIMULATED (ntp_sim.h) AND THE LINUX BACKEND TESTS.
+* A FAILED CHECK IS REPORTED WITH ITS FILE, LINE AND CASE AND
+* COUNTED, AND THE TEST GOES ON. NTP_CHECK_Done PRINTS THE TOTALS AND
+* RETURNS THE PROCESS EXIT CODE
+****************************************************************/
+
+#ifndef _NTP_CHECK_H_
+#define _NTP_CHECK_H_
+
+#include <stdint.h>
+
+//DEFINES////////////////////////////////////////////////
+#define NTP_CHECK(cond)				_ntp_check((cond), #cond, __FILE__, __LINE__)
+#define NTP_CHECK_RANGE(v, lo, hi)	_ntp_check_range((int64_t)(v), (int64_t)(lo), (int64_t)(hi), #v, __FILE__, __LINE__)
+//END DEFINES////////////////////////////////////////////
+
+//FUNCTION PROTOTYPES/////////////////////////////////////
+void NTP_CHECK_Begin(const char* name);
+int NTP_CHECK_Done(void);
+void _ntp_check(int ok, const char* expr, const char* file, int line);
+void _ntp_check_range(int64_t v, int64_t lo, int64_t hi, const char* expr, const char* file, int line);
+//END FUNCTION PROTOTYPES/////////////////////////////////
+#endif
@@ -0,0 +1,630 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* HOST TEST HARNESS
+*
+* VIRTUAL CLOCK, os_timer, FAKE TRANSPORT AND FAKE NTP SERVERS.
+* SEE ntp_sim.h
+****************************************************************/
+
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include "ntp_sim.h"
+
+//THE WORLD
+static uint64_t _ntp_sim_true_us;			//TRUE MICROSECONDS SINCE START, NEVER RESET
+static uint64_t _ntp_sim_reset_us;			//TRUE TIME OF THE LAST NTP_SIM_Reset
+static uint64_t _ntp_sim_start_sec;			//ERA EXTENDED NTP SECONDS AT THAT TIME
+static uint64_t _ntp_sim_anchor_true_us;	//DEVICE TICK = ANCHOR + ELAPSED * (1 + DRIFT)
+static uint64_t _ntp_sim_anchor_dev_us;
+static int32_t _ntp_sim_drift_ppb;
+static uint32_t _ntp_sim_random;
+static uint32_t _ntp_sim_seq;
+
+static os_timer_t* _ntp_sim_timers;
+static NTP_SIM_EVENT _ntp_sim_events[NTP_SIM_MAX_EVENTS];
+static NTP_SIM_SERVER _ntp_sim_servers[NTP_SIM_MAX_SERVERS];
+static uint8_t _ntp_sim_server_count;
+
+//THE EXCHANGE (ESP8266_UDP_CLIENT LOOKALIKE)
+static const char* _ntp_sim_hostname;
+static uint32_t _ntp_sim_dest_ip;
+static uint32_t _ntp_sim_timeout_ms;
+static void (*_ntp_sim_resolved_cb)(ip_addr_t* ip);
+static void (*_ntp_sim_sent_cb)(void* arg);
+static void (*_ntp_sim_recv_cb)(char* data, uint16_t length);
+static uint32_t _ntp_sim_exchange;
+static uint8_t _ntp_sim_awaiting;
+
+static void _ntp_sim_set_debug(uint8_t debug_on);
+static void _ntp_sim_set_dns_server(char num_dns, ip_addr_t* dns);
+static void _ntp_sim_initialize(char* hostname, char* host_ip, uint16_t port, uint32_t timeout_ms);
+static void _ntp_sim_resolve(void (*resolved_cb)(ip_addr_t* ip));
+static void _ntp_sim_set_callbacks(void (*sent_cb)(void* arg), void (*recv_cb)(char* data, uint16_t length));
+static void _ntp_sim_send(uint8_t* data, uint16_t length);
+static void _ntp_sim_lookup(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg);
+static uint8_t _ntp_sim_send_to(ip_addr_t* ip, uint16_t port, uint8_t* data, uint16_t length);
+
+static const ESP8266_NTP_TRANSPORT _ntp_sim_exchange_transport =
+{
+	_ntp_sim_set_debug,
+	_ntp_sim_set_dns_server,
+	_ntp_sim_initialize,
+	_ntp_sim_resolve,
+	_ntp_sim_set_callbacks,
+	_ntp_sim_send,
+	NULL,
+	NULL,
+	NULL
+};
+
+static const ESP8266_NTP_TRANSPORT _ntp_sim_concurrent_transport =
+{
+	_ntp_sim_set_debug,
+	_ntp_sim_set_dns_server,
+	_ntp_sim_initialize,
+	_ntp_sim_resolve,
+	_ntp_sim_set_callbacks,
+	_ntp_sim_send,
+	NULL,
+	_ntp_sim_lookup,
+	_ntp_sim_send_to
+};
+
+//////////////////////////////////////////////////////////////////
+//VIRTUAL CLOCK
+
+static uint64_t _ntp_sim_device_us(uint64_t true_us)
+{
+	//DEVICE TICK AT A TRUE TIME, 64 BITS
+
+	int64_t elapsed = (int64_t)(true_us - _ntp_sim_anchor_true_us);
+
+	return _ntp_sim_anchor_dev_us + elapsed + (elapsed * _ntp_sim_drift_ppb) / 1000000000LL;
+}
+
+static uint64_t _ntp_sim_true_at(uint64_t device_us)
+{
+	//FIRST TRUE TIME (NOT BEFORE NOW) THE DEVICE TICK REACHES device_us
+
+	uint64_t now_dev = _ntp_sim_device_us(_ntp_sim_true_us);
+	uint64_t t;
+
+	if(device_us <= now_dev)
+	{
+		return _ntp_sim_true_us;
+	}
+	t = _ntp_sim_true_us + ((device_us - now_dev) * 1000000000ULL) / (uint64_t)(1000000000LL + _ntp_sim_drift_ppb);
+	while(_ntp_sim_device_us(t) < device_us)
+	{
+		t++;
+	}
+	return t;
+}
+
+static uint64_t _ntp_sim_ntp(int64_t offset_us)
+{
+	//NTP TIMESTAMP OF TRUE TIME + offset_us (MOD 2^64)
+
+	int64_t us = (int64_t)(_ntp_sim_start_sec * 1000000ULL) + (int64_t)(_ntp_sim_true_us - _ntp_sim_reset_us) + offset_us;
+
+	return ((uint64_t)(us / 1000000) << 32) | ((((uint64_t)(us % 1000000)) << 32) / 1000000);
+}
+
+void NTP_SIM_SetStart(uint64_t seconds)
+{
+	//MOVE TRUE TIME AT THE LAST NTP_SIM_Reset TO ERA EXTENDED NTP
+	//seconds, E.G. JUST BEFORE AN ERA ROLLOVER. CALL BEFORE ANY CONTEXT
+	//IS CREATED
+
+	_ntp_sim_start_sec = seconds;
+}
+
+uint64_t NTP_SIM_TrueUs(void)
+{
+	//TRUE MICROSECONDS SINCE NTP_SIM_Reset
+
+	return _ntp_sim_true_us - _ntp_sim_reset_us;
+}
+
+uint64_t NTP_SIM_TrueNtp(void)
+{
+	//TRUE TIME AS A 64 BIT NTP TIMESTAMP (ERA OFFSET IN THE TOP 32 BITS)
+
+	return _ntp_sim_ntp(0);
+}
+
+void NTP_SIM_SetDrift(int32_t ppb)
+{
+	//DEVICE TICK RUNS ppb FAST (NEGATIVE : SLOW) FROM NOW ON
+
+	_ntp_sim_anchor_dev_us = _ntp_sim_device_us(_ntp_sim_true_us);
+	_ntp_sim_anchor_true_us = _ntp_sim_true_us;
+	_ntp_sim_drift_ppb = ppb;
+}
+
+uint32_t NTP_SIM_Random(void)
+{
+	//XORSHIFT, RESEEDED BY NTP_SIM_Reset
+
+	_ntp_sim_random ^= _ntp_sim_random << 13;
+	_ntp_sim_random ^= _ntp_sim_random >> 17;
+	_ntp_sim_random ^= _ntp_sim_random << 5;
+	return _ntp_sim_random;
+}
+
+uint32_t system_get_time(void)
+{
+	return (uint32_t)_ntp_sim_device_us(_ntp_sim_true_us);
+}
+
+unsigned long os_random(void)
+{
+	return NTP_SIM_Random();
+}
+
+uint32_t ipaddr_addr(const char* cp)
+{
+	return (uint32_t)inet_addr(cp);
+}
+
+//////////////////////////////////////////////////////////////////
+//TIMERS
+
+static void _ntp_sim_timer_unlink(os_timer_t* timer)
+{
+	os_timer_t** p;
+
+	for(p = &_ntp_sim_timers; *p != NULL; p = &(*p)->next)
+	{
+		if(*p == timer)
+		{
+			*p = timer->next;
+			break;
+		}
+	}
+	timer->next = NULL;
+	timer->armed = 0;
+}
+
+void os_timer_setfn(os_timer_t* timer, os_timer_func_t* func, void* arg)
+{
+	timer->func = func;
+	timer->arg = arg;
+}
+
+void os_timer_arm(os_timer_t* timer, uint32_t ms, uint8_t repeat)
+{
+	if(timer->armed)
+	{
+		_ntp_sim_timer_unlink(timer);
+	}
+	timer->expire_us = system_get_time() + ms * 1000;
+	timer->period_ms = repeat ? ms : 0;
+	timer->armed = 1;
+	timer->next = _ntp_sim_timers;
+	_ntp_sim_timers = timer;
+}
+
+void os_timer_disarm(os_timer_t* timer)
+{
+	if(timer->armed)
+	{
+		_ntp_sim_timer_unlink(timer);
+	}
+}
+
+//////////////////////////////////////////////////////////////////
+//FAKE NETWORK
+
+static NTP_SIM_EVENT* _ntp_sim_event_add(uint8_t type, uint64_t due_us)
+{
+	uint8_t i;
+
+	for(i = 0; i < NTP_SIM_MAX_EVENTS; i++)
+	{
+		if(!_ntp_sim_events[i].used)
+		{
+			os_memset(&_ntp_sim_events[i], 0, sizeof(NTP_SIM_EVENT));
+			_ntp_sim_events[i].used = 1;
+			_ntp_sim_events[i].type = type;
+			_ntp_sim_events[i].due_us = due_us;
+			_ntp_sim_events[i].seq = _ntp_sim_seq++;
+			return &_ntp_sim_events[i];
+		}
+	}
+	printf("ntp_sim: event table full\n");
+	exit(2);
+}
+
+static NTP_SIM_SERVER* _ntp_sim_server_by_name(const char* name)
+{
+	uint8_t i;
+
+	for(i = 0; name != NULL && i < _ntp_sim_server_count; i++)
+	{
+		if(strcmp(_ntp_sim_servers[i].name, name) == 0)
+		{
+			return &_ntp_sim_servers[i];
+		}
+	}
+	return NULL;
+}
+
+static NTP_SIM_SERVER* _ntp_sim_server_by_ip(uint32_t ip)
+{
+	uint8_t i;
+
+	for(i = 0; i < _ntp_sim_server_count; i++)
+	{
+		if(_ntp_sim_servers[i].ip == ip)
+		{
+			return &_ntp_sim_servers[i];
+		}
+	}
+	return NULL;
+}
+
+static uint32_t _ntp_sim_jitter(NTP_SIM_SERVER* s)
+{
+	return (s->jitter_us > 0) ? NTP_SIM_Random() % (s->jitter_us + 1) : 0;
+}
+
+static void _ntp_sim_put(uint8_t* p, uint64_t v)
+{
+	uint8_t i;
+
+	for(i = 0; i < 8; i++)
+	{
+		p[i] = (uint8_t)(v >> (56 - 8 * i));
+	}
+}
+
+static void _ntp_sim_datagram(uint64_t due_us, const uint8_t* data, uint16_t length, uint32_t exchange)
+{
+	NTP_SIM_EVENT* e = _ntp_sim_event_add(NTP_SIM_EV_DATAGRAM, due_us);
+
+	os_memcpy(e->data, data, length);
+	e->length = length;
+	e->exchange = exchange;
+}
+
+static void _ntp_sim_serve(uint32_t ip, const uint8_t* request, uint32_t exchange)
+{
+	//A FAKE SERVER ANSWERS A REQUEST THAT LEAVES THE DEVICE NOW
+
+	NTP_SIM_SERVER* s = _ntp_sim_server_by_ip(ip);
+	uint8_t reply[NTP_SIM_MAX_DATAGRAM];
+	uint16_t length = NTP_PACKET_SIZE;
+	uint64_t arrive;
+	uint64_t deliver;
+	uint64_t t2;
+	uint64_t t3;
+
+	if(s == NULL)
+	{
+		return;
+	}
+	s->requests++;
+	if(s->silent || (s->loss_pct > 0 && (NTP_SIM_Random() % 100) < s->loss_pct))
+	{
+		return;
+	}
+
+	arrive = _ntp_sim_true_us + s->delay_us + _ntp_sim_jitter(s);
+	deliver = arrive + 50 + s->delay_us + _ntp_sim_jitter(s);
+	t2 = _ntp_sim_ntp((int64_t)(arrive - _ntp_sim_true_us) + s->offset_us);
+	t3 = _ntp_sim_ntp((int64_t)(arrive + 50 - _ntp_sim_true_us) + s->offset_us);
+
+	os_memset(reply, 0, sizeof(reply));
+	reply[0] = NTP_LI_VN_MODE(s->leap, 4, NTP_MODE_SERVER);
+	reply[1] = s->stratum;
+	reply[2] = request[2];
+	reply[3] = (uint8_t)-20;
+	reply[6] = 1;					//ROOT DELAY ~15 MS
+	reply[10] = 1;					//ROOT DISPERSION ~15 MS
+	if(s->kod[0] != '\0')
+	{
+		reply[1] = 0;
+		os_memcpy(reply + 12, s->kod, 4);
+	}
+	else
+	{
+		os_memcpy(reply + 12, "TEST", 4);
+	}
+	_ntp_sim_put(reply + 16, t3 - (10ULL << 32));
+	os_memcpy(reply + 24, request + 40, 8);
+	_ntp_sim_put(reply + 32, t2);
+	_ntp_sim_put(reply + 40, t3);
+	if(s->mangle != NULL)
+	{
+		s->mangle(s, reply, &length);
+	}
+
+	if(s->bogus)
+	{
+		reply[31] ^= 0x5A;
+		_ntp_sim_datagram(deliver, reply, length, exchange);
+		reply[31] ^= 0x5A;
+	}
+	_ntp_sim_datagram(deliver, reply, length, exchange);
+	if(s->duplicate)
+	{
+		_ntp_sim_datagram(deliver + 1000, reply, length, exchange);
+	}
+	s->replies++;
+}
+
+static void _ntp_sim_set_debug(uint8_t debug_on)
+{
+	(void)debug_on;
+}
+
+static void _ntp_sim_set_dns_server(char num_dns, ip_addr_t* dns)
+{
+	(void)num_dns;
+	(void)dns;
+}
+
+static void _ntp_sim_initialize(char* hostname, char* host_ip, uint16_t port, uint32_t timeout_ms)
+{
+	(void)port;
+	_ntp_sim_hostname = hostname;
+	_ntp_sim_dest_ip = (host_ip != NULL) ? ipaddr_addr(host_ip) : 0;
+	_ntp_sim_timeout_ms = timeout_ms;
+}
+
+static NTP_SIM_EVENT* _ntp_sim_name_event(uint8_t type, const char* hostname)
+{
+	//SCHEDULE THE ANSWER TO A NAME LOOKUP
+
+	NTP_SIM_SERVER* s = _ntp_sim_server_by_name(hostname);
+	NTP_SIM_EVENT* e;
+
+	e = _ntp_sim_event_add(type, _ntp_sim_true_us + ((s != NULL) ? (uint64_t)s->dns_ms * 1000 : 0));
+	e->hostname = hostname;
+	if(s != NULL)
+	{
+		s->lookups++;
+		e->ip = s->dns_fail ? 0 : s->ip;
+	}
+	return e;
+}
+
+static void _ntp_sim_resolve(void (*resolved_cb)(ip_addr_t* ip))
+{
+	_ntp_sim_resolved_cb = resolved_cb;
+	_ntp_sim_name_event(NTP_SIM_EV_RESOLVED, _ntp_sim_hostname);
+}
+
+static void _ntp_sim_set_callbacks(void (*sent_cb)(void* arg), void (*recv_cb)(char* data, uint16_t length))
+{
+	_ntp_sim_sent_cb = sent_cb;
+	_ntp_sim_recv_cb = recv_cb;
+}
+
+static void _ntp_sim_send(uint8_t* data, uint16_t length)
+{
+	//ONE EXCHANGE : SENT NOW, THEN THE FIRST DATAGRAM OR THE TIMEOUT
+
+	NTP_SIM_EVENT* e;
+
+	(void)length;
+	_ntp_sim_exchange++;
+	_ntp_sim_awaiting = 1;
+	_ntp_sim_event_add(NTP_SIM_EV_SENT, _ntp_sim_true_us);
+	e = _ntp_sim_event_add(NTP_SIM_EV_TIMEOUT, _ntp_sim_true_us + (uint64_t)_ntp_sim_timeout_ms * 1000);
+	e->exchange = _ntp_sim_exchange;
+	_ntp_sim_serve(_ntp_sim_dest_ip, data, _ntp_sim_exchange);
+}
+
+static void _ntp_sim_lookup(char* hostname, void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg), void* arg)
+{
+	NTP_SIM_EVENT* e = _ntp_sim_name_event(NTP_SIM_EV_FOUND, hostname);
+
+	e->found_cb = found_cb;
+	e->arg = arg;
+}
+
+static uint8_t _ntp_sim_send_to(ip_addr_t* ip, uint16_t port, uint8_t* data, uint16_t length)
+{
+	(void)port;
+	(void)length;
+	_ntp_sim_serve(ip->addr, data, 0);
+	return 1;
+}
+
+static void _ntp_sim_fire(NTP_SIM_EVENT* e)
+{
+	ip_addr_t ip;
+
+	ip.addr = e->ip;
+	switch(e->type)
+	{
+		case NTP_SIM_EV_RESOLVED:
+			_ntp_sim_dest_ip = e->ip;
+			_ntp_sim_resolved_cb((e->ip != 0) ? &ip : NULL);
+			break;
+
+		case NTP_SIM_EV_FOUND:
+			e->found_cb(e->hostname, (e->ip != 0) ? &ip : NULL, e->arg);
+			break;
+
+		case NTP_SIM_EV_SENT:
+			_ntp_sim_sent_cb(NULL);
+			break;
+
+		case NTP_SIM_EV_TIMEOUT:
+			if(_ntp_sim_awaiting && e->exchange == _ntp_sim_exchange)
+			{
+				_ntp_sim_awaiting = 0;
+				_ntp_sim_recv_cb(NULL, 0);
+			}
+			break;
+
+		case NTP_SIM_EV_DATAGRAM:
+			if(e->exchange != 0)
+			{
+				//THE UDP CLIENT ONLY LISTENS UNTIL ITS FIRST DATAGRAM
+				if(!_ntp_sim_awaiting || e->exchange != _ntp_sim_exchange)
+				{
+					break;
+				}
+				_ntp_sim_awaiting = 0;
+			}
+			_ntp_sim_recv_cb((char*)e->data, e->length);
+			break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////
+//WORLD
+
+void NTP_SIM_Reset(void)
+{
+	//FORGET SERVERS AND PENDING NETWORK EVENTS AND RESTART TRUE TIME AT
+	//NTP_SIM_START_SEC. THE DEVICE TICK KEEPS RUNNING (CONTEXTS OF THE
+	//PREVIOUS TEST MUST BE DESTROYED)
+
+	os_memset(_ntp_sim_events, 0, sizeof(_ntp_sim_events));
+	os_memset(_ntp_sim_servers, 0, sizeof(_ntp_sim_servers));
+	_ntp_sim_server_count = 0;
+	_ntp_sim_awaiting = 0;
+	_ntp_sim_reset_us = _ntp_sim_true_us;
+	_ntp_sim_start_sec = NTP_SIM_START_SEC;
+	_ntp_sim_random = 0x2545F491;
+	NTP_SIM_SetDrift(0);
+	NTP_SIM_UseConcurrentTransport(0);
+}
+
+NTP_SIM_SERVER* NTP_SIM_AddServer(const char* name, uint8_t host)
+{
+	//A WELL BEHAVED STRATUM 2 SERVER AT 10.0.0.host, 5 MS AWAY
+
+	NTP_SIM_SERVER* s;
+
+	if(_ntp_sim_server_count >= NTP_SIM_MAX_SERVERS)
+	{
+		printf("ntp_sim: too many servers\n");
+		exit(2);
+	}
+	s = &_ntp_sim_servers[_ntp_sim_server_count++];
+	s->name = name;
+	s->ip = NTP_SIM_IP(host);
+	s->delay_us = 5000;
+	s->dns_ms = 20;
+	s->stratum = 2;
+	return s;
+}
+
+void NTP_SIM_UseConcurrentTransport(uint8_t enable)
+{
+	//INSTALL THE FAKE TRANSPORT WITH (1) OR WITHOUT (0) lookup/send_to
+
+	ESP8266_NTP_SetTransport(enable ? &_ntp_sim_concurrent_transport : &_ntp_sim_exchange_transport);
+}
+
+void NTP_SIM_Run(uint32_t ms)
+{
+	//ADVANCE TRUE TIME BY ms, FIRING TIMERS AND NETWORK EVENTS IN ORDER
+
+	uint64_t end = _ntp_sim_true_us + (uint64_t)ms * 1000;
+	uint64_t now_dev;
+	uint64_t due;
+	uint64_t timer_due;
+	os_timer_t* timer;
+	os_timer_t* t;
+	NTP_SIM_EVENT* event;
+	NTP_SIM_EVENT fired;
+	uint8_t i;
+
+	for(;;)
+	{
+		event = NULL;
+		for(i = 0; i < NTP_SIM_MAX_EVENTS; i++)
+		{
+			if(_ntp_sim_events[i].used &&
+				(event == NULL || _ntp_sim_events[i].due_us < event->due_us ||
+				(_ntp_sim_events[i].due_us == event->due_us && _ntp_sim_events[i].seq < event->seq)))
+			{
+				event = &_ntp_sim_events[i];
+			}
+		}
+
+		timer = NULL;
+		timer_due = 0;
+		now_dev = _ntp_sim_device_us(_ntp_sim_true_us);
+		for(t = _ntp_sim_timers; t != NULL; t = t->next)
+		{
+			due = _ntp_sim_true_at(now_dev + (uint64_t)(int64_t)(int32_t)(t->expire_us - (uint32_t)now_dev));
+			if(timer == NULL || due < timer_due)
+			{
+				timer = t;
+				timer_due = due;
+			}
+		}
+
+		if(event != NULL && event->due_us <= end && (timer == NULL || event->due_us <= timer_due))
+		{
+			if(event->due_us > _ntp_sim_true_us)
+			{
+				_ntp_sim_true_us = event->due_us;
+			}
+			fired = *event;
+			event->used = 0;
+			_ntp_sim_fire(&fired);
+		}
+		else if(timer != NULL && timer_due <= end)
+		{
+			_ntp_sim_true_us = timer_due;
+			if(timer->period_ms > 0)
+			{
+				timer->expire_us += timer->period_ms * 1000;
+			}
+			else
+			{
+				_ntp_sim_timer_unlink(timer);
+			}
+			timer->func(timer->arg);
+		}
+		else
+		{
+			_ntp_sim_true_us = end;
+			return;
+		}
+	}
+}
+
+uint32_t NTP_SIM_Sync(ESP8266_NTP_CONTEXT* ctx, uint32_t max_ms)
+{
+	//START A SYNC AND RUN UNTIL IT ENDS OR max_ms PASS. RETURNS THE
+	//MILLISECONDS IT TOOK
+
+	uint32_t ms = 0;
+	ESP8266_NTP_SYNC_STATE state;
+
+	ESP8266_NTP_GetTimeCtx(ctx);
+	while(ms < max_ms)
+	{
+		NTP_SIM_Run(1);
+		ms++;
+		state = ESP8266_NTP_GetSyncStateCtx(ctx);
+		if(state == ESP8266_NTP_SYNC_DONE || state == ESP8266_NTP_SYNC_FAILED)
+		{
+			break;
+		}
+	}
+	return ms;
+}
+
+int64_t NTP_SIM_ClockErrorUs(ESP8266_NTP_CONTEXT* ctx)
+{
+	//DEVICE CLOCK - TRUE TIME IN MICROSECONDS (WITHIN ~30 MINUTES)
+
+	uint32_t seconds;
+	uint32_t fraction;
+	int64_t diff;
+
+	ESP8266_NTP_NowCtx(ctx, &seconds, &fraction);
+	diff = (int64_t)((((uint64_t)seconds << 32) | fraction) - NTP_SIM_TrueNtp());
+	return ((diff >> 16) * 1000000) >> 16;
+}
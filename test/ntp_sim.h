@@ -0,0 +1,121 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* HOST TEST HARNESS
+*
+* RUNS THE LIBRARY (BUILT WITH -DESP8266_NTP_HOST) AS A PLAIN
+* PROCESS AGAINST A SIMULATED WORLD :
+*
+*   A VIRTUAL CLOCK. TRUE TIME ONLY MOVES IN NTP_SIM_Run, SO EVERY
+*   SCENARIO IS DETERMINISTIC AND A DAY OF POLLING TAKES MILLISECONDS.
+*   THE DEVICE TICK (TICK SOURCE, system_get_time, os_timer) RUNS
+*   NTP_SIM_SetDrift PPB FAST OR SLOW AGAINST IT
+*
+*   A FAKE NTP NETWORK BEHIND THE TRANSPORT HOOKS. EVERY SERVER IS A
+*   NAME, AN ADDRESS AND A CLOCK, AND CAN INJECT DELAY, JITTER, LOSS,
+*   DNS FAILURE, KISS-O'-DEATH, LEAP WARNINGS AND BOGUS OR DUPLICATE
+*   REPLIES. THE EXCHANGE BEHAVES LIKE ESP8266_UDP_CLIENT : THE FIRST
+*   DATAGRAM OR THE TIMEOUT ENDS THE WAIT
+*
+* USAGE
+* ------------
+*   NTP_SIM_Reset();
+*   NTP_SIM_UseConcurrentTransport(1);		//OPTIONAL, ADDS lookup / send_to
+*   s = NTP_SIM_AddServer("a.test", 1);
+*   s->offset_us = 250000;
+*   ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+*   NTP_SIM_Sync(&ctx, 10000);
+*   NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+*   return NTP_CHECK_Done();
+****************************************************************/
+
+#ifndef _NTP_SIM_H_
+#define _NTP_SIM_H_
+
+#include "ESP8266_NTP.h"
+#include "ntp_check.h"
+
+//DEFINES////////////////////////////////////////////////
+//TRUE TIME AT NTP_SIM_Reset : 40 DAYS AFTER THE DEFAULT ERA PIVOT,
+//UNLESS NTP_SIM_SetStart MOVES IT
+#define NTP_SIM_START_SEC			(NTP_ERA_PIVOT + (40 * 86400ULL))
+#define NTP_SIM_MAX_SERVERS			8
+#define NTP_SIM_MAX_EVENTS			64
+//LONGEST DATAGRAM A MANGLED REPLY CAN GROW TO
+#define NTP_SIM_MAX_DATAGRAM		96
+
+//THE FAKE SERVERS LIVE IN 10.0.0.0/24. host IS THE LAST OCTET
+#define NTP_SIM_IP(host)			((uint32_t)(10 | ((uint32_t)(host) << 24)))
+//END DEFINES////////////////////////////////////////////
+
+//CUSTOM VARIABLE STRUCTURES/////////////////////////////
+typedef struct NTP_SIM_SERVER NTP_SIM_SERVER;
+
+struct NTP_SIM_SERVER
+{
+	//CONFIGURATION, SET AFTER NTP_SIM_AddServer
+	const char* name;
+	uint32_t ip;				//NETWORK BYTE ORDER
+	int64_t offset_us;			//SERVER CLOCK - TRUE TIME
+	uint32_t delay_us;			//ONE WAY NETWORK DELAY
+	uint32_t jitter_us;			//UNIFORM EXTRA DELAY, EACH WAY
+	uint8_t loss_pct;			//REQUESTS LOST
+	uint32_t dns_ms;			//NAME LOOKUP LATENCY
+	uint8_t dns_fail;
+	uint8_t silent;				//NEVER ANSWERS
+	char kod[5];				//NOT EMPTY : ANSWER WITH THIS KISS CODE
+	uint8_t bogus;				//SEND A REPLY ECHOING A WRONG ORIGIN FIRST
+	uint8_t duplicate;			//SEND EVERY REPLY TWICE
+	uint8_t stratum;
+	uint8_t leap;				//LEAP INDICATOR OF THE REPLIES
+	//NOT NULL : CALLED WITH EVERY REPLY (NTP_PACKET_SIZE BYTES IN A
+	//NTP_SIM_MAX_DATAGRAM BUFFER) BEFORE IT IS SENT. MAY CHANGE ITS
+	//BYTES AND LENGTH (1 - NTP_SIM_MAX_DATAGRAM)
+	void (*mangle)(NTP_SIM_SERVER* s, uint8_t* reply, uint16_t* length);
+
+	//COUNTERS
+	uint32_t lookups;
+	uint32_t requests;
+	uint32_t replies;
+};
+
+//SOMETHING THE FAKE NETWORK DOES AT A TRUE TIME
+typedef enum
+{
+	NTP_SIM_EV_RESOLVED,		//resolve OF THE EXCHANGE ANSWERED
+	NTP_SIM_EV_FOUND,			//lookup ANSWERED
+	NTP_SIM_EV_SENT,			//REQUEST OF THE EXCHANGE LEFT
+	NTP_SIM_EV_TIMEOUT,		//EXCHANGE TIMED OUT
+	NTP_SIM_EV_DATAGRAM		//DATAGRAM ARRIVES AT THE DEVICE
+} NTP_SIM_EVENT_TYPE;
+
+typedef struct
+{
+	uint8_t used;
+	uint8_t type;				//NTP_SIM_EVENT_TYPE
+	uint64_t due_us;			//TRUE TIME
+	uint32_t seq;				//ORDER OF EVENTS DUE AT THE SAME TIME
+	uint32_t exchange;			//EXCHANGE A TIMEOUT BELONGS TO
+	uint32_t ip;				//RESOLVED ADDRESS, 0 ON FAILURE
+	const char* hostname;
+	void (*found_cb)(const char* hostname, ip_addr_t* ip, void* arg);
+	void* arg;
+	uint16_t length;
+	uint8_t data[NTP_SIM_MAX_DATAGRAM];
+} NTP_SIM_EVENT;
+//END CUSTOM VARIABLE STRUCTURES/////////////////////////
+
+//FUNCTION PROTOTYPES/////////////////////////////////////
+//WORLD
+void NTP_SIM_Reset(void);
+NTP_SIM_SERVER* NTP_SIM_AddServer(const char* name, uint8_t host);
+void NTP_SIM_SetDrift(int32_t ppb);
+void NTP_SIM_SetStart(uint64_t seconds);
+uint64_t NTP_SIM_TrueUs(void);
+uint64_t NTP_SIM_TrueNtp(void);
+void NTP_SIM_Run(uint32_t ms);
+uint32_t NTP_SIM_Sync(ESP8266_NTP_CONTEXT* ctx, uint32_t max_ms);
+int64_t NTP_SIM_ClockErrorUs(ESP8266_NTP_CONTEXT* ctx);
+uint32_t NTP_SIM_Random(void);
+void NTP_SIM_UseConcurrentTransport(uint8_t enable);
+//END FUNCTION PROTOTYPES/////////////////////////////////
+#endif
@@ -0,0 +1,258 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* ALARM CHECKS
+*
+* ALARMS SET ON A SIMULATED CLOCK ARE RUN FOR HOURS TO DAYS AND EVERY
+* FIRING IS RECORDED WITH THE DEVICE TIME IT HAPPENED AT : ONE SHOT,
+* RECURRING AND DAILY ALARMS FIRE ON THEIR SECOND, DAILY ALARMS FOLLOW
+* THE TIME ZONE ACROSS BOTH DST CHANGES, CANCELLED ALARMS STAY QUIET
+* AND A SERVER OFFSET STEP EITHER WAY FIRES WHAT IT SKIPPED ONCE AND
+* PUTS RECURRING ALARMS BACK ON THEIR GRID
+****************************************************************/
+
+#include "ntp_sim.h"
+
+//2024-03-30 00:00:00 UTC, THE SATURDAY BEFORE CET -> CEST
+#define NTP_ALARM_T0			(1711756800ULL + NTP_UNIX_EPOCH_OFFSET)
+//2024-10-26 22:00:00 UTC, 3 HOURS BEFORE CEST -> CET
+#define NTP_ALARM_T1			(1729980000ULL + NTP_UNIX_EPOCH_OFFSET)
+#define NTP_ALARM_TZ			"CET-1CEST,M3.5.0,M10.5.0/3"
+#define NTP_ALARM_MAX_FIRED		64
+//A FIRING ON ITS SECOND HAPPENS WITHIN THE FIRST 10 MS OF IT
+#define NTP_ALARM_LATE_FRAC		(0x100000000ULL / 100)
+
+typedef struct
+{
+	uint16_t id;
+	uint64_t seconds;			//DEVICE CLOCK AT THE FIRING
+	uint32_t fraction;
+} NTP_ALARM_FIRED;
+
+static ESP8266_NTP_CONTEXT ctx;
+static NTP_ALARM_FIRED fired[NTP_ALARM_MAX_FIRED];
+static uint32_t fired_count;
+
+static void record(uint16_t id, void* arg)
+{
+	ESP8266_NTP_TIME now;
+
+	(void)arg;
+	ESP8266_NTP_NowTimeCtx(&ctx, &now);
+	if(fired_count < NTP_ALARM_MAX_FIRED)
+	{
+		fired[fired_count].id = id;
+		fired[fired_count].seconds = now.seconds;
+		fired[fired_count].fraction = now.fraction;
+	}
+	fired_count++;
+}
+
+static uint8_t fired_at(uint32_t n, uint16_t id, uint64_t seconds)
+{
+	//FIRING n IS ALARM id, ON THE SECOND seconds
+
+	return n < fired_count && n < NTP_ALARM_MAX_FIRED
+		&& fired[n].id == id
+		&& fired[n].seconds == seconds
+		&& fired[n].fraction < NTP_ALARM_LATE_FRAC;
+}
+
+static NTP_SIM_SERVER* create(uint64_t start)
+{
+	NTP_SIM_SERVER* a;
+
+	NTP_SIM_Reset();
+	NTP_SIM_SetStart(start);
+	a = NTP_SIM_AddServer("a.test", 1);
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+	ESP8266_NTP_SetTimeZoneCtx(&ctx, NTP_ALARM_TZ);
+	fired_count = 0;
+	return a;
+}
+
+static void run_to_device(uint64_t seconds)
+{
+	//RUN UNTIL THE DEVICE CLOCK READS seconds + 500 MS
+
+	ESP8266_NTP_TIME now;
+
+	do
+	{
+		NTP_SIM_Run(100);
+		ESP8266_NTP_NowTimeCtx(&ctx, &now);
+	} while(now.seconds < seconds || (now.seconds == seconds && now.fraction < 0x80000000UL));
+}
+
+static void daily_spring(void)
+{
+	//07:30 EVERY DAY, 02:30 EVERY DAY AND 08:00 ON SUNDAYS OVER THE
+	//WEEKEND OF CET -> CEST. SET BEFORE THE FIRST SYNC, THEY WAIT FOR IT.
+	//02:30 DOES NOT EXIST ON 03-31 AND FIRES ONE HOUR LATE (03:30 CEST)
+
+	uint16_t d;
+	uint16_t g;
+	uint16_t s;
+
+	NTP_CHECK_Begin("daily, CET -> CEST");
+	create(NTP_ALARM_T0 - 60);
+	d = ESP8266_NTP_AlarmDailyCtx(&ctx, 7, 30, NTP_ALARM_EVERY_DAY, record, NULL);
+	g = ESP8266_NTP_AlarmDailyCtx(&ctx, 2, 30, NTP_ALARM_EVERY_DAY, record, NULL);
+	s = ESP8266_NTP_AlarmDailyCtx(&ctx, 8, 0, 1 << 0, record, NULL);
+	NTP_CHECK(d != 0 && g != 0 && s != 0);
+	NTP_CHECK(ESP8266_NTP_AlarmDailyCtx(&ctx, 24, 0, NTP_ALARM_EVERY_DAY, record, NULL) == 0);
+	NTP_CHECK(ESP8266_NTP_AlarmDailyCtx(&ctx, 8, 0, 0, record, NULL) == 0);
+
+	NTP_SIM_Run(10000);
+	NTP_CHECK(fired_count == 0);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+
+	run_to_device(NTP_ALARM_T0 + (3 * 86400) - 60);
+	NTP_CHECK(fired_count == 7);
+	NTP_CHECK(fired_at(0, g, NTP_ALARM_T0 + (1 * 3600) + 1800));				//03-30 02:30 CET
+	NTP_CHECK(fired_at(1, d, NTP_ALARM_T0 + (6 * 3600) + 1800));				//03-30 07:30 CET
+	NTP_CHECK(fired_at(2, g, NTP_ALARM_T0 + 86400 + (1 * 3600) + 1800));		//03-31 03:30 CEST
+	NTP_CHECK(fired_at(3, d, NTP_ALARM_T0 + 86400 + (5 * 3600) + 1800));		//03-31 07:30 CEST
+	NTP_CHECK(fired_at(4, s, NTP_ALARM_T0 + 86400 + (6 * 3600)));				//03-31 08:00 CEST
+	NTP_CHECK(fired_at(5, g, NTP_ALARM_T0 + (2 * 86400) + 1800));				//04-01 02:30 CEST
+	NTP_CHECK(fired_at(6, d, NTP_ALARM_T0 + (2 * 86400) + (5 * 3600) + 1800));	//04-01 07:30 CEST
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void daily_autumn(void)
+{
+	//02:30 HAPPENS TWICE ON 10-27. THE ALARM FIRES ON THE FIRST (CEST)
+	//ONLY, THEN AT 02:30 CET THE NEXT DAY
+
+	uint16_t g;
+
+	NTP_CHECK_Begin("daily, CEST -> CET");
+	create(NTP_ALARM_T1);
+	NTP_SIM_Sync(&ctx, 5000);
+	g = ESP8266_NTP_AlarmDailyCtx(&ctx, 2, 30, NTP_ALARM_EVERY_DAY, record, NULL);
+
+	run_to_device(NTP_ALARM_T1 + (30 * 3600));
+	NTP_CHECK(fired_count == 2);
+	NTP_CHECK(fired_at(0, g, NTP_ALARM_T1 + (2 * 3600) + 1800));				//10-27 02:30 CEST
+	NTP_CHECK(fired_at(1, g, NTP_ALARM_T1 + 86400 + (3 * 3600) + 1800));		//10-28 02:30 CET
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void once_every_cancel(void)
+{
+	//A ONE SHOT AND A 15 MINUTE ALARM OVER AN HOUR. A CANCELLED ONE SHOT
+	//NEVER FIRES, A FIRED ONE IS GONE, A CANCELLED RECURRING ONE STOPS
+
+	uint16_t e;
+	uint16_t a;
+	uint16_t c;
+
+	NTP_CHECK_Begin("once, every, cancel");
+	create(NTP_ALARM_T0);
+	NTP_SIM_Sync(&ctx, 5000);
+	e = ESP8266_NTP_AlarmEveryCtx(&ctx, 900, record, NULL);
+	a = ESP8266_NTP_AlarmAtCtx(&ctx, NTP_ALARM_T0 + 1000, record, NULL);
+	c = ESP8266_NTP_AlarmAtCtx(&ctx, NTP_ALARM_T0 + 2000, record, NULL);
+	NTP_CHECK(e != 0 && a != 0 && c != 0);
+	NTP_CHECK(ESP8266_NTP_AlarmEveryCtx(&ctx, 0, record, NULL) == 0);
+	NTP_CHECK(ESP8266_NTP_AlarmCancelCtx(&ctx, c));
+	NTP_CHECK(!ESP8266_NTP_AlarmCancelCtx(&ctx, c));
+
+	run_to_device(NTP_ALARM_T0 + 3600);
+	NTP_CHECK(fired_count == 5);
+	NTP_CHECK(fired_at(0, e, NTP_ALARM_T0 + 900));
+	NTP_CHECK(fired_at(1, a, NTP_ALARM_T0 + 1000));
+	NTP_CHECK(fired_at(2, e, NTP_ALARM_T0 + 1800));
+	NTP_CHECK(fired_at(3, e, NTP_ALARM_T0 + 2700));
+	NTP_CHECK(fired_at(4, e, NTP_ALARM_T0 + 3600));
+	NTP_CHECK(!ESP8266_NTP_AlarmCancelCtx(&ctx, a));
+
+	NTP_CHECK(ESP8266_NTP_AlarmCancelCtx(&ctx, e));
+	NTP_SIM_Run(3600 * 1000);
+	NTP_CHECK(fired_count == 5);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void offset_step(void)
+{
+	//A 300 S STEP FORWARD FIRES THE ONE SHOT AND THE MINUTE ALARM IT
+	//SKIPPED ONCE EACH, NOT ONCE PER MISSED MINUTE. THE STEP BACK PUTS
+	//THE MINUTE ALARM ON THE NEW TIME'S GRID AND THE FIRED ONE SHOT DOES
+	//NOT FIRE AGAIN
+
+	NTP_SIM_SERVER* srv;
+	uint16_t e;
+	uint16_t a;
+	uint16_t b;
+	uint32_t i;
+	uint32_t n;
+	uint32_t bad = 0;
+	uint32_t a_count = 0;
+	ESP8266_NTP_TIME now;
+
+	NTP_CHECK_Begin("across server offset steps");
+	srv = create(NTP_ALARM_T0);
+	NTP_SIM_Sync(&ctx, 5000);
+	e = ESP8266_NTP_AlarmEveryCtx(&ctx, 60, record, NULL);
+	a = ESP8266_NTP_AlarmAtCtx(&ctx, NTP_ALARM_T0 + 100, record, NULL);
+	b = ESP8266_NTP_AlarmAtCtx(&ctx, NTP_ALARM_T0 + 1000, record, NULL);
+
+	NTP_SIM_Run(30000);
+	NTP_CHECK(fired_count == 0);
+	srv->offset_us = 300LL * 1000000;
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), 299000000LL, 301000000LL);
+	NTP_SIM_Run(1100);
+	NTP_CHECK(fired_count == 2);
+	NTP_CHECK(fired_count == 2 && fired[0].id != fired[1].id && (fired[0].id == e || fired[0].id == a) && (fired[1].id == e || fired[1].id == a));
+	NTP_CHECK(fired[0].seconds >= NTP_ALARM_T0 + 330 && fired[1].seconds >= NTP_ALARM_T0 + 330);
+
+	run_to_device(NTP_ALARM_T0 + 420);
+	NTP_CHECK(fired_count == 4);
+	NTP_CHECK(fired_at(2, e, NTP_ALARM_T0 + 360));
+	NTP_CHECK(fired_at(3, e, NTP_ALARM_T0 + 420));
+
+	srv->offset_us = 0;
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1000, 1000);
+	ESP8266_NTP_NowTimeCtx(&ctx, &now);
+	NTP_CHECK(now.seconds < NTP_ALARM_T0 + 180);
+	n = fired_count;
+
+	//BACK ON THE GRID FROM THE NEW TIME : EVERY MINUTE FROM THE NEXT ONE
+	//TO 1000 S, AND b ONCE AT 1000 S
+	run_to_device(NTP_ALARM_T0 + 1000);
+	NTP_CHECK(fired_count == n + ((NTP_ALARM_T0 + 960 - (now.seconds - (now.seconds % 60))) / 60) + 1);
+	for(i = n; i < fired_count && i < NTP_ALARM_MAX_FIRED; i++)
+	{
+		a_count += (fired[i].id == a);
+		if(fired[i].id == b)
+		{
+			bad += !fired_at(i, b, NTP_ALARM_T0 + 1000);
+			continue;
+		}
+		bad += (fired[i].seconds <= now.seconds) || (fired[i].seconds % 60) != 0;
+		bad += !fired_at(i, e, fired[i].seconds);
+		bad += (i > n && fired[i - 1].id == e && fired[i].seconds != fired[i - 1].seconds + 60);
+	}
+	NTP_CHECK(bad == 0);
+	NTP_CHECK(a_count == 0);
+	NTP_CHECK(fired_at(fired_count - 1, b, NTP_ALARM_T0 + 1000));
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_alarm\n");
+	daily_spring();
+	daily_autumn();
+	once_every_cancel();
+	offset_step();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,153 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* HEAP USE CHECK
+*
+* THE LIBRARY KEEPS ALL OF ITS STATE IN CALLER SUPPLIED CONTEXTS AND
+* MUST NEVER TOUCH THE HEAP. THIS TEST IS LINKED WITH
+* -Wl,--wrap=malloc ETC., SO EVERY ALLOCATOR CALL MADE FROM THE
+* LIBRARY (AND THE HARNESS) GOES THROUGH THE COUNTERS BELOW, AND RUNS
+* THE LIBRARY THROUGH SETUP, REPEATED REINITIALISATION, SYNCS IN BOTH
+* MODES, AUTO SYNC, ALARMS AND FORMATTING
+****************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ntp_sim.h"
+
+static ESP8266_NTP_CONTEXT ctx;
+static uint32_t allocs;
+static uint32_t frees;
+static uint32_t alarms;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+void __real_free(void* p);
+char* __real_strdup(const char* s);
+
+void* __wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size)
+{
+	allocs++;
+	return __real_realloc(p, size);
+}
+
+void __wrap_free(void* p)
+{
+	frees++;
+	__real_free(p);
+}
+
+char* __wrap_strdup(const char* s)
+{
+	allocs++;
+	return __real_strdup(s);
+}
+
+static void alarm_cb(uint16_t id, void* arg)
+{
+	(void)id;
+	(void)arg;
+	alarms++;
+}
+
+static void wrapped(void)
+{
+	//THE COUNTERS MUST SEE A CALL, OR A ZERO BELOW PROVES NOTHING
+
+	void* volatile p;
+
+	NTP_CHECK_Begin("allocator calls are counted");
+	p = malloc(16);
+	free(p);
+	NTP_CHECK(allocs == 1 && frees == 1);
+	allocs = 0;
+	frees = 0;
+}
+
+static void lifecycle(void)
+{
+	ESP8266_NTP_FORMAT fmt;
+	char text[64];
+	uint8_t i;
+
+	NTP_CHECK_Begin("create, sync, auto sync, alarms, format");
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(1);
+	NTP_SIM_AddServer("a.test", 1);
+	NTP_SIM_AddServer("b.test", 2);
+	NTP_SIM_AddServer("c.test", 3);
+
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", "b.test", "c.test", 0, 0, 1000);
+	NTP_CHECK(ESP8266_NTP_SetTimeZoneCtx(&ctx, "CET-1CEST,M3.5.0,M10.5.0/3"));
+	NTP_CHECK(ESP8266_NTP_FormatCompile(&fmt, "%Y-%m-%d %H:%M:%S %Z", 0));
+	ESP8266_NTP_SetMultiServerModeCtx(&ctx, 1);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 1);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+
+	NTP_CHECK(ESP8266_NTP_AlarmEveryCtx(&ctx, 60, alarm_cb, NULL) != 0);
+	for(i = 0; i < 120; i++)
+	{
+		NTP_SIM_Run(60000);
+		ESP8266_NTP_RefreshDataCtx(&ctx);
+		NTP_CHECK(ESP8266_NTP_FormatCtx(&ctx, &fmt, text, sizeof(text)) > 0);
+	}
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes > 2);
+	NTP_CHECK(alarms >= 119);
+
+	ESP8266_NTP_Destroy(&ctx);
+	NTP_CHECK(allocs == 0 && frees == 0);
+}
+
+static void reinitialize(void)
+{
+	//THE LEGACY INITIALIZE AFTER EVERY (SIMULATED) WI-FI RECONNECT
+	//RECONFIGURES THE SAME STORAGE
+
+	NTP_SIM_SERVER* a;
+	uint8_t i;
+
+	NTP_CHECK_Begin("repeated ESP8266_NTP_Initialize");
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	NTP_SIM_AddServer("b.test", 2);
+
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_SetContext(&ctx);
+	for(i = 0; i < 50; i++)
+	{
+		ESP8266_NTP_Initialize("a.test", "b.test", NULL, 1, 0, 1000);
+		ESP8266_NTP_SetAutoSync(0);
+		NTP_SIM_Sync(&ctx, 5000);
+		NTP_CHECK(ESP8266_NTP_GetState() == ESP8266_NTP_STATE_OK);
+		NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	}
+	NTP_CHECK(a->requests == 50);
+	NTP_CHECK(ESP8266_NTP_GetTimeZoneHour() == 1);
+
+	ESP8266_NTP_Destroy(&ctx);
+	NTP_CHECK(allocs == 0 && frees == 0);
+}
+
+int main(void)
+{
+	printf("test_alloc\n");
+	wrapped();
+	lifecycle();
+	reinitialize();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,362 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* CALENDAR CONVERSION CHECKS
+*
+* EVERY MULTIPLY-SHIFT RECIPROCAL OF _esp8266_ntp_secs_to_fields IS
+* CHECKED AGAINST A DIVISION OVER ITS WHOLE INPUT RANGE, AND THE
+* CONVERSION ITSELF AGAINST THE HOST gmtime_r FOR EVERY DAY OF ERAS
+* 0 AND 1 (SECS < 2^33). THE INCREMENTAL UPDATE IS CHECKED AGAINST
+* THE FULL RECOMPUTE AFTER EVERY STEP OF LONG RANDOMIZED RUNS, AND
+* BOTH AGAINST DST TRANSITION INSTANTS TAKEN FROM THE TZ DATABASE
+****************************************************************/
+
+#include <string.h>
+#include <time.h>
+#include "ntp_sim.h"
+
+//LAST SECOND THE CONVERSION COVERS
+#define NTP_CAL_MAX_SECS		((1ULL << 33) - 1)
+#define NTP_CAL_MAX_DAYS		((uint32_t)(NTP_CAL_MAX_SECS / 86400))
+//RANDOM SECONDS COMPARED ON TOP OF THE PER DAY SWEEP
+#define NTP_CAL_RANDOM			4000000UL
+//INCREMENTAL UPDATE RUNS : WALKS PER ZONE AND STEPS PER WALK
+#define NTP_CAL_WALKS			20000UL
+#define NTP_CAL_WALK_STEPS		400
+
+static ESP8266_NTP_CONTEXT ctx;
+static ESP8266_NTP_CONTEXT ref;
+
+static uint64_t random_secs(void)
+{
+	return ((((uint64_t)NTP_SIM_Random()) << 32) | NTP_SIM_Random()) & NTP_CAL_MAX_SECS;
+}
+
+static uint8_t matches_gmtime(uint64_t secs)
+{
+	//COMPARE ONE CONVERSION WITH THE HOST C LIBRARY
+
+	ESP8266_NTP_DATA d;
+	struct tm tm;
+	time_t t = (time_t)((int64_t)secs - (int64_t)NTP_UNIX_EPOCH_OFFSET);
+
+	os_memset(&d, 0, sizeof(d));
+	_esp8266_ntp_secs_to_fields(secs, &d);
+	gmtime_r(&t, &tm);
+	return d.year == tm.tm_year + 1900
+		&& d.month_num == tm.tm_mon + 1
+		&& d.date == tm.tm_mday
+		&& d.day_num == tm.tm_wday
+		&& d.hour == tm.tm_hour
+		&& d.min == tm.tm_min
+		&& d.sec == tm.tm_sec
+		&& d.day_text != NULL
+		&& d.month_text != NULL;
+}
+
+static void reciprocals(void)
+{
+	//x / d == (x * MUL) >> SHIFT FOR EVERY x THE CONVERSION CAN FEED IN
+
+	uint32_t x;
+	uint32_t bad;
+
+	NTP_CHECK_Begin("reciprocals, whole input range");
+
+	//DAYS : (SECS >> 7) / 675, SECS < 2^33
+	bad = 0;
+	for(x = 0; x < (1UL << 26); x++)
+	{
+		bad += ((((uint64_t)x * NTP_DIV675_MUL) >> NTP_DIV675_SHIFT) != x / 675);
+	}
+	NTP_CHECK(bad == 0);
+
+	bad = 0;
+	for(x = 0; x < 86400; x++)
+	{
+		bad += (((x * NTP_DIV3600_MUL) >> NTP_DIV3600_SHIFT) != x / 3600);
+	}
+	NTP_CHECK(bad == 0);
+
+	bad = 0;
+	for(x = 0; x < 3600; x++)
+	{
+		bad += (((x * NTP_DIV60_MUL) >> NTP_DIV60_SHIFT) != x / 60);
+	}
+	NTP_CHECK(bad == 0);
+
+	//WEEKDAY : DAYS + 1
+	bad = 0;
+	for(x = 0; x < (1UL << 22); x++)
+	{
+		bad += ((((uint64_t)x * NTP_DIV7_MUL) >> NTP_DIV7_SHIFT) != x / 7);
+	}
+	NTP_CHECK(bad == 0);
+	NTP_CHECK(NTP_CAL_MAX_DAYS + 1 < (1UL << 22));
+
+	//CENTURIES : n1 = 4 * (DAYS + NTP_RATA_DIE_1900) + 3
+	bad = 0;
+	for(x = 0; x <= 4 * (NTP_CAL_MAX_DAYS + NTP_RATA_DIE_1900) + 3; x++)
+	{
+		bad += ((((uint64_t)x * NTP_DIV146097_MUL) >> NTP_DIV146097_SHIFT) != x / 146097);
+	}
+	NTP_CHECK(bad == 0);
+
+	//YEAR OF CENTURY AND DAY OF YEAR : n2 < 146097 + 3, THE LOW WORD OF
+	//2939745 * n2 GIVES (n2 % 1461) / 4
+	bad = 0;
+	for(x = 0; x < 146100; x++)
+	{
+		uint64_t p2 = 2939745ULL * x;
+
+		bad += ((uint32_t)(p2 >> 32) != x / 1461);
+		bad += ((uint32_t)(((uint64_t)(uint32_t)p2 * NTP_DIV11758980_MUL) >> NTP_DIV11758980_SHIFT) != (x % 1461) / 4);
+	}
+	NTP_CHECK(bad == 0);
+
+	//DATE : LOW HALF OF n3 = 2141 * DAY OF YEAR + 197913
+	bad = 0;
+	for(x = 0; x < 0x10000; x++)
+	{
+		bad += (((x * NTP_DIV2141_MUL) >> NTP_DIV2141_SHIFT) != x / 2141);
+	}
+	NTP_CHECK(bad == 0);
+}
+
+static void every_day(void)
+{
+	//EVERY DAY OF ERAS 0 AND 1, AT A SECOND OF DAY THAT WALKS THROUGH
+	//THE DAY, PLUS ITS FIRST AND LAST SECOND
+
+	uint32_t day;
+	uint32_t bad = 0;
+	uint64_t secs;
+
+	NTP_CHECK_Begin("every day of eras 0 and 1");
+	for(day = 0; day <= NTP_CAL_MAX_DAYS; day++)
+	{
+		secs = (uint64_t)day * 86400;
+		bad += !matches_gmtime(secs);
+		bad += !matches_gmtime(secs + ((day * 7919UL) % 86400));
+		if(secs + 86399 <= NTP_CAL_MAX_SECS)
+		{
+			bad += !matches_gmtime(secs + 86399);
+		}
+	}
+	NTP_CHECK(bad == 0);
+	NTP_CHECK(matches_gmtime(NTP_CAL_MAX_SECS));
+}
+
+static void every_second(void)
+{
+	//EVERY SECOND OF DAYS AROUND THE EDGES OF THE RANGE AND OF THE
+	//CALENDAR (LEAP DAYS, CENTURIES, THE ERA 0 -> 1 ROLLOVER)
+
+	static const uint64_t days[] =
+	{
+		0,								//1900-01-01
+		58,								//1900-02-28, NOT A LEAP YEAR
+		36583,							//2000-02-29
+		36584,							//2000-03-01
+		49710,							//2036-02-07, ERA ROLLOVER
+		50422,							//2038-01-19, UNIX 2^31
+		NTP_CAL_MAX_DAYS				//2172-03-15
+	};
+	uint8_t i;
+	uint32_t s;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("every second of edge days");
+	for(i = 0; i < sizeof(days) / sizeof(days[0]); i++)
+	{
+		for(s = 0; s < 86400 && days[i] * 86400 + s <= NTP_CAL_MAX_SECS; s++)
+		{
+			bad += !matches_gmtime(days[i] * 86400 + s);
+		}
+	}
+	NTP_CHECK(bad == 0);
+}
+
+static void random_seconds(void)
+{
+	uint32_t i;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("random seconds");
+	for(i = 0; i < NTP_CAL_RANDOM; i++)
+	{
+		bad += !matches_gmtime(random_secs());
+	}
+	NTP_CHECK(bad == 0);
+}
+
+static uint8_t matches_full(void)
+{
+	//RECOMPUTE THE FIELDS OF THE SAME TIMESTAMP IN ref FROM SCRATCH
+
+	ref.data.timestamp = ctx.data.timestamp;
+	_esp8266_ntp_convert_time_to_text(&ref);
+	return ctx.data.year == ref.data.year
+		&& ctx.data.month_num == ref.data.month_num
+		&& ctx.data.month_text == ref.data.month_text
+		&& ctx.data.date == ref.data.date
+		&& ctx.data.day_num == ref.data.day_num
+		&& ctx.data.day_text == ref.data.day_text
+		&& ctx.data.hour == ref.data.hour
+		&& ctx.data.min == ref.data.min
+		&& ctx.data.sec == ref.data.sec
+		&& ctx.data.utc_offset_s == ref.data.utc_offset_s
+		&& ctx.data.dst == ref.data.dst
+		&& strcmp(ctx.data.tz_name, ref.data.tz_name) == 0;
+}
+
+static void incremental(const char* name, const char* tz)
+{
+	//NTP_CAL_WALKS RANDOM WALKS OF NTP_CAL_WALK_STEPS STEPS, MOSTLY ONE
+	//SECOND TICKS AND SOME UP TO TWICE NTP_INCREMENTAL_MAX_SECS. EVEN
+	//WALKS START SHORTLY BEFORE A LOCAL MIDNIGHT, SO EVERY ONE CARRIES
+	//INTO THE NEXT DAY (AND NOW AND THEN MONTH AND YEAR). ODD WALKS
+	//START AT A LOCAL 00:00 - 02:00 AND PASS THE USUAL DST CHANGE
+	//HOURS. THE FIRST WALKS START AT FIXED EDGE DAYS, THE OTHERS ON
+	//RANDOM DAYS OF ERAS 0 AND 1
+
+	static const uint32_t edge_days[] =
+	{
+		36583,		//2000-02-29
+		49710,		//2036-02-07, ERA ROLLOVER
+		50422,		//2038-01-19
+		36891		//2000-12-31
+	};
+	uint32_t walk;
+	uint32_t i;
+	uint32_t r;
+	uint32_t day;
+	uint64_t start;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin(name);
+	os_memset(&ctx, 0, sizeof(ctx));
+	os_memset(&ref, 0, sizeof(ref));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_Create(&ref, "a.test", NULL, NULL, 0, 0, 1000);
+	NTP_CHECK(ESP8266_NTP_SetTimeZoneCtx(&ctx, tz));
+	NTP_CHECK(ESP8266_NTP_SetTimeZoneCtx(&ref, tz));
+
+	for(walk = 0; walk < NTP_CAL_WALKS; walk++)
+	{
+		r = NTP_SIM_Random();
+		if(walk < 2 * (sizeof(edge_days) / sizeof(edge_days[0])))
+		{
+			day = edge_days[walk >> 1];
+		}
+		else
+		{
+			day = 1 + (r % (NTP_CAL_MAX_DAYS - 2));
+		}
+		start = (uint64_t)day * 86400;
+		start -= (uint64_t)(int64_t)_esp8266_ntp_tz_offset(&ref.tz, start);
+		start = (walk & 1) ? start + ((r >> 8) % 7200) : start - ((r >> 8) % 1800);
+
+		ctx.data.timestamp = start;
+		_esp8266_ntp_convert_time_to_text(&ctx);
+		for(i = 0; i < NTP_CAL_WALK_STEPS; i++)
+		{
+			r = NTP_SIM_Random();
+			ESP8266_NTP_AdvanceSecondsCtx(&ctx, ((r & 7) != 0) ? 1 : ((r >> 3) % (2 * NTP_INCREMENTAL_MAX_SECS)));
+			bad += !matches_full();
+		}
+	}
+	NTP_CHECK(bad == 0);
+
+	ESP8266_NTP_Destroy(&ref);
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+typedef struct
+{
+	const char* name;
+	uint8_t hms[3];				//LOCAL HH:MM:SS
+	int32_t offset_s;
+	uint8_t dst;
+} NTP_CAL_LOCAL;
+
+typedef struct
+{
+	const char* tz;
+	int64_t at;					//UNIX SECONDS OF THE TRANSITION
+	NTP_CAL_LOCAL before;		//ONE SECOND BEFORE
+	NTP_CAL_LOCAL after;		//AT THE TRANSITION
+} NTP_CAL_TRANSITION;
+
+static uint8_t matches_local(const NTP_CAL_LOCAL* l)
+{
+	return strcmp(ctx.data.tz_name, l->name) == 0
+		&& ctx.data.hour == l->hms[0]
+		&& ctx.data.min == l->hms[1]
+		&& ctx.data.sec == l->hms[2]
+		&& ctx.data.utc_offset_s == l->offset_s
+		&& ctx.data.dst == l->dst;
+}
+
+static void transitions(void)
+{
+	//THE SECOND BEFORE AND THE SECOND OF KNOWN TRANSITIONS, FROM THE
+	//FULL CONVERSION AND FROM A ONE SECOND INCREMENTAL STEP. THE
+	//INSTANTS COME FROM THE TZ DATABASE, NOT FROM THE RULE CODE
+
+	static const NTP_CAL_TRANSITION t[] =
+	{
+		//2024-03-31 01:00Z, 2024-10-27 01:00Z
+		{ "CET-1CEST,M3.5.0,M10.5.0/3", 1711846800LL, { "CET", { 1, 59, 59 }, 3600, 0 }, { "CEST", { 3, 0, 0 }, 7200, 1 } },
+		{ "CET-1CEST,M3.5.0,M10.5.0/3", 1729990800LL, { "CEST", { 2, 59, 59 }, 7200, 1 }, { "CET", { 2, 0, 0 }, 3600, 0 } },
+		//2024-03-10 07:00Z, 2024-11-03 06:00Z
+		{ "EST5EDT,M3.2.0,M11.1.0", 1710054000LL, { "EST", { 1, 59, 59 }, -18000, 0 }, { "EDT", { 3, 0, 0 }, -14400, 1 } },
+		{ "EST5EDT,M3.2.0,M11.1.0", 1730613600LL, { "EDT", { 1, 59, 59 }, -14400, 1 }, { "EST", { 1, 0, 0 }, -18000, 0 } },
+		//2024-04-06 14:00Z, 2024-09-28 14:00Z (LOCAL DATES A DAY LATER)
+		{ "NZST-12NZDT,M9.5.0,M4.1.0/3", 1712412000LL, { "NZDT", { 2, 59, 59 }, 46800, 1 }, { "NZST", { 2, 0, 0 }, 43200, 0 } },
+		{ "NZST-12NZDT,M9.5.0,M4.1.0/3", 1727532000LL, { "NZST", { 1, 59, 59 }, 43200, 0 }, { "NZDT", { 3, 0, 0 }, 46800, 1 } },
+		//2037-03-29 01:00Z, 2037-11-01 06:00Z : PAST THE ERA ROLLOVER
+		{ "CET-1CEST,M3.5.0,M10.5.0/3", 2121901200LL, { "CET", { 1, 59, 59 }, 3600, 0 }, { "CEST", { 3, 0, 0 }, 7200, 1 } },
+		{ "EST5EDT,M3.2.0,M11.1.0", 2140668000LL, { "EDT", { 1, 59, 59 }, -14400, 1 }, { "EST", { 1, 0, 0 }, -18000, 0 } }
+	};
+	uint8_t i;
+	uint64_t at;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("fixed DST transitions");
+	for(i = 0; i < sizeof(t) / sizeof(t[0]); i++)
+	{
+		os_memset(&ctx, 0, sizeof(ctx));
+		ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+		bad += !ESP8266_NTP_SetTimeZoneCtx(&ctx, t[i].tz);
+		at = (uint64_t)(t[i].at + (int64_t)NTP_UNIX_EPOCH_OFFSET);
+
+		ctx.data.timestamp = at - 1;
+		_esp8266_ntp_convert_time_to_text(&ctx);
+		bad += !matches_local(&t[i].before);
+		ESP8266_NTP_AdvanceSecondsCtx(&ctx, 1);
+		bad += !matches_local(&t[i].after);
+
+		ctx.data.timestamp = at;
+		_esp8266_ntp_convert_time_to_text(&ctx);
+		bad += !matches_local(&t[i].after);
+		ESP8266_NTP_Destroy(&ctx);
+	}
+	NTP_CHECK(bad == 0);
+}
+
+int main(void)
+{
+	printf("test_calendar\n");
+	NTP_SIM_Reset();
+	reciprocals();
+	every_day();
+	every_second();
+	random_seconds();
+	incremental("incremental, UTC", "UTC0");
+	incremental("incremental, CET / CEST", "CET-1CEST,M3.5.0,M10.5.0/3");
+	incremental("incremental, EST / EDT", "EST5EDT,M3.2.0,M11.1.0");
+	incremental("incremental, NZST / NZDT", "NZST-12NZDT,M9.5.0,M4.1.0/3");
+	incremental("incremental, half hour zone", "<+0330>-3:30");
+	transitions();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,120 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* CLOCK DISCIPLINE SCENARIOS
+*
+* THE DEVICE TICK RUNS NTP_SIM_SetDrift PPB OFF TRUE TIME AND THE
+* SERVER PATH ADDS JITTER. WITH AUTO SYNC ON, THE DISCIPLINE MUST
+* LEARN THE DRIFT, KEEP THE CLOCK CLOSE AND STRETCH THE POLL
+* INTERVAL TO NTP_MAX_POLL_EXP. A FIRST SYNC BURST (REPLIES SECONDS
+* APART) MUST NOT BE TAKEN FOR A FREQUENCY MEASUREMENT
+****************************************************************/
+
+#include "ntp_sim.h"
+
+#define NTP_DISC_HOURS			12
+#define NTP_DISC_SETTLE_HOURS	4
+
+static ESP8266_NTP_CONTEXT ctx;
+
+static void create(uint8_t burst)
+{
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 1);
+	ESP8266_NTP_SetBurstCtx(&ctx, burst);
+}
+
+static void converge(int32_t drift_ppb, uint32_t jitter_us, int64_t max_error_us, uint8_t burst)
+{
+	//RUN NTP_DISC_HOURS ON AUTO SYNC, SAMPLING THE CLOCK ERROR EVERY
+	//MINUTE ONCE THE LOOP HAD NTP_DISC_SETTLE_HOURS TO LOCK
+
+	NTP_SIM_SERVER* a;
+	uint32_t minute;
+	int64_t err;
+	int64_t worst = 0;
+	uint32_t requests_settled = 0;
+
+	NTP_SIM_Reset();
+	NTP_SIM_SetDrift(drift_ppb);
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->jitter_us = jitter_us;
+	create(burst);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetPollIntervalCtx(&ctx) == (1U << NTP_MIN_POLL_EXP));
+
+	for(minute = 0; minute < NTP_DISC_HOURS * 60; minute++)
+	{
+		NTP_SIM_Run(60000);
+		if(minute == NTP_DISC_SETTLE_HOURS * 60)
+		{
+			requests_settled = a->requests;
+		}
+		if(minute >= NTP_DISC_SETTLE_HOURS * 60)
+		{
+			err = NTP_SIM_ClockErrorUs(&ctx);
+			err = (err < 0) ? -err : err;
+			worst = (err > worst) ? err : worst;
+		}
+	}
+
+	//THE CORRECTION CANCELS THE DRIFT, THE POLL INTERVAL IS AT ITS
+	//MAXIMUM AND THE SETTLED LOOP SENDS AT MOST A TENTH OF THE
+	//REQUESTS A FIXED NTP_MIN_POLL_EXP INTERVAL WOULD
+	NTP_CHECK_RANGE(ESP8266_NTP_GetDriftPPBCtx(&ctx) + drift_ppb, -2000, 2000);
+	NTP_CHECK(ESP8266_NTP_GetPollIntervalCtx(&ctx) == (1U << NTP_MAX_POLL_EXP));
+	NTP_CHECK(worst <= max_error_us);
+	NTP_CHECK((a->requests - requests_settled) * 10 <= ((NTP_DISC_HOURS - NTP_DISC_SETTLE_HOURS) * 3600) >> NTP_MIN_POLL_EXP);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void burst_free_run(int32_t drift_ppb)
+{
+	//ONE BURST SYNC WITH 20 MS JITTER, THEN 100 MINUTES WITHOUT A SYNC.
+	//THE BURST SPANS A FEW SECONDS, FAR TOO SHORT TO MEASURE THE
+	//FREQUENCY, SO NONE IS LEARNED AND THE CLOCK ONLY DRIFTS BY THE
+	//INJECTED drift_ppb
+
+	NTP_SIM_SERVER* a;
+	int64_t err;
+	int64_t drift_us = (int64_t)drift_ppb * 6000 / 1000;
+
+	NTP_SIM_Reset();
+	NTP_SIM_SetDrift(drift_ppb);
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->jitter_us = 20000;
+	create(4);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+
+	NTP_SIM_Sync(&ctx, 20000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(a->replies == 4);
+	NTP_CHECK(ESP8266_NTP_GetDriftPPBCtx(&ctx) == 0);
+
+	NTP_SIM_Run(100 * 60000);
+	err = NTP_SIM_ClockErrorUs(&ctx) - drift_us;
+	NTP_CHECK_RANGE(err, -25000, 25000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_discipline\n");
+	NTP_CHECK_Begin("+80 ppm, no jitter");
+	converge(80000, 0, 200, 0);
+	NTP_CHECK_Begin("-120 ppm, 2 ms jitter");
+	converge(-120000, 2000, 2000, 0);
+	NTP_CHECK_Begin("+35 ppm, 10 ms jitter");
+	converge(35000, 10000, 10000, 0);
+	NTP_CHECK_Begin("+35 ppm, 10 ms jitter, first sync burst");
+	converge(35000, 10000, 10000, 4);
+	NTP_CHECK_Begin("burst of 4, 20 ms jitter, no drift, free running");
+	burst_free_run(0);
+	NTP_CHECK_Begin("burst of 4, 20 ms jitter, -50 ppm, free running");
+	burst_free_run(-50000);
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,239 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* ERA BOUNDARY CHECKS
+*
+* THE 2036-02-07 06:28:16 NTP ERA ROLLOVER, THE 2038-01-19 03:14:08
+* SIGNED 32 BIT UNIX LIMIT AND THE 2^33 END OF THE CALENDAR RANGE :
+* ERA EXTENSION AROUND THE WRAP, EVERY SECOND OF THE CONVERSION NEAR
+* EACH BOUNDARY, UNIX TIME PAST 2038, AND SIMULATED SYNCS THAT RUN
+* THROUGH THE ROLLOVER OR START ON THE FAR SIDE OF IT
+****************************************************************/
+
+#include <time.h>
+#include "ntp_sim.h"
+
+#define NTP_ERA1_SEC			(1ULL << 32)							//2036-02-07 06:28:16
+#define NTP_Y2038_SEC			((1ULL << 31) + NTP_UNIX_EPOCH_OFFSET)	//2038-01-19 03:14:08
+#define NTP_ERA_END_SEC			(1ULL << 33)
+//SECONDS ON EACH SIDE OF A BOUNDARY CONVERTED ONE BY ONE
+#define NTP_ERA_WINDOW			(2 * 86400UL)
+//RANDOM (WIRE, REFERENCE) PAIRS FOR THE ERA EXTENSION
+#define NTP_ERA_RANDOM			4000000UL
+
+static ESP8266_NTP_CONTEXT ctx;
+
+static uint64_t extend_reference(uint32_t seconds, uint64_t reference)
+{
+	//THE ONE VALUE CONGRUENT TO seconds MOD 2^32 IN
+	//[reference - 2^31, reference + 2^31), THE SLOW WAY
+
+	uint64_t v = (reference & ~0xFFFFFFFFULL) | seconds;
+
+	if(v + (1ULL << 31) < reference)
+	{
+		v += 1ULL << 32;
+	}
+	else if(v >= reference + (1ULL << 31))
+	{
+		v -= 1ULL << 32;
+	}
+	return v;
+}
+
+static void era_extend(void)
+{
+	//EVERY WIRE VALUE WITHIN 2^20 S OF THE WRAP AGAINST REFERENCES ON
+	//BOTH SIDES OF THE ROLLOVER AND AT THE EDGES OF THEIR WINDOW, THEN
+	//RANDOM PAIRS
+
+	static const uint64_t refs[] =
+	{
+		NTP_ERA_PIVOT,
+		NTP_ERA1_SEC - (1ULL << 31),
+		NTP_ERA1_SEC - (1ULL << 31) + 1,
+		NTP_ERA1_SEC - 1,
+		NTP_ERA1_SEC,
+		NTP_ERA1_SEC + 1,
+		NTP_Y2038_SEC,
+		NTP_ERA1_SEC + (1ULL << 31) - 1,
+		NTP_ERA1_SEC + (1ULL << 31)
+	};
+	uint8_t i;
+	uint32_t w;
+	uint32_t n;
+	uint64_t reference;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("era extension around the rollover");
+	for(i = 0; i < sizeof(refs) / sizeof(refs[0]); i++)
+	{
+		for(n = 0, w = 0xFFF00000UL; n < 0x200000UL; n++, w++)
+		{
+			bad += (_esp8266_ntp_era_extend(w, refs[i]) != extend_reference(w, refs[i]));
+		}
+	}
+	for(n = 0; n < NTP_ERA_RANDOM; n++)
+	{
+		reference = (1ULL << 31) + ((((uint64_t)NTP_SIM_Random() << 32) | NTP_SIM_Random()) % ((1ULL << 34) - (1ULL << 32)));
+		w = NTP_SIM_Random();
+		bad += (_esp8266_ntp_era_extend(w, reference) != extend_reference(w, reference));
+	}
+	NTP_CHECK(bad == 0);
+
+	//THE ROLLOVER ITSELF, SEEN FROM EITHER SIDE
+	NTP_CHECK(_esp8266_ntp_era_extend(0, NTP_ERA1_SEC - 1) == NTP_ERA1_SEC);
+	NTP_CHECK(_esp8266_ntp_era_extend(0xFFFFFFFFUL, NTP_ERA1_SEC) == NTP_ERA1_SEC - 1);
+	NTP_CHECK(_esp8266_ntp_era_extend(3600, NTP_ERA_PIVOT) == NTP_ERA1_SEC + 3600);
+}
+
+static uint8_t matches_gmtime(uint64_t secs)
+{
+	ESP8266_NTP_DATA d;
+	ESP8266_NTP_TIME t;
+	struct tm tm;
+	time_t unix_secs = (time_t)((int64_t)secs - (int64_t)NTP_UNIX_EPOCH_OFFSET);
+
+	os_memset(&d, 0, sizeof(d));
+	_esp8266_ntp_secs_to_fields(secs, &d);
+	gmtime_r(&unix_secs, &tm);
+	t.seconds = secs;
+	t.fraction = 0;
+	return ESP8266_NTP_TimeToUnix(&t) == (int64_t)unix_secs
+		&& d.year == tm.tm_year + 1900
+		&& d.month_num == tm.tm_mon + 1
+		&& d.date == tm.tm_mday
+		&& d.day_num == tm.tm_wday
+		&& d.hour == tm.tm_hour
+		&& d.min == tm.tm_min
+		&& d.sec == tm.tm_sec;
+}
+
+static void boundaries(void)
+{
+	//EVERY SECOND WITHIN NTP_ERA_WINDOW OF EACH BOUNDARY (BEFORE ONLY
+	//FOR THE END OF THE RANGE)
+
+	static const uint64_t edges[] = { NTP_ERA1_SEC, NTP_Y2038_SEC, NTP_ERA_END_SEC };
+	ESP8266_NTP_DATA d;
+	ESP8266_NTP_TIME t;
+	uint8_t i;
+	uint64_t s;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("every second around 2036, 2038 and 2^33");
+	for(i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+	{
+		for(s = edges[i] - NTP_ERA_WINDOW; s < edges[i] + NTP_ERA_WINDOW && s < NTP_ERA_END_SEC; s++)
+		{
+			bad += !matches_gmtime(s);
+		}
+	}
+	NTP_CHECK(bad == 0);
+
+	_esp8266_ntp_secs_to_fields(NTP_ERA1_SEC, &d);
+	NTP_CHECK(d.year == 2036 && d.month_num == 2 && d.date == 7 && d.hour == 6 && d.min == 28 && d.sec == 16);
+	_esp8266_ntp_secs_to_fields(NTP_Y2038_SEC, &d);
+	NTP_CHECK(d.year == 2038 && d.month_num == 1 && d.date == 19 && d.hour == 3 && d.min == 14 && d.sec == 8);
+
+	//UNIX TIME GOES PAST 2^31 - 1 AND BEFORE 1970 WITHOUT WRAPPING
+	t.fraction = 0;
+	t.seconds = NTP_Y2038_SEC;
+	NTP_CHECK(ESP8266_NTP_TimeToUnix(&t) == 2147483648LL);
+	t.seconds = NTP_ERA1_SEC;
+	NTP_CHECK(ESP8266_NTP_TimeToUnix(&t) == 2085978496LL);
+	t.seconds = 0;
+	NTP_CHECK(ESP8266_NTP_TimeToUnix(&t) == -2208988800LL);
+}
+
+static uint32_t era_error_s(void)
+{
+	//DISTANCE OF THE ERA EXTENDED CLOCK FROM TRUE TIME, IN SECONDS
+
+	ESP8266_NTP_TIME now;
+	uint64_t truth = NTP_SIM_TrueNtp() >> 32;
+	uint64_t expected = _esp8266_ntp_era_extend((uint32_t)truth, NTP_ERA1_SEC);
+
+	ESP8266_NTP_NowTimeCtx(&ctx, &now);
+	return (now.seconds > expected) ? (uint32_t)(now.seconds - expected) : (uint32_t)(expected - now.seconds);
+}
+
+static void sync_across(const char* name, uint64_t start, uint64_t edge)
+{
+	//SYNC 10 MINUTES BEFORE THE EDGE WITH AUTO SYNC ON AND RUN 20
+	//MINUTES INTO THE NEXT. THE CLOCK, ITS FIELDS AND UNIX TIME STAY
+	//RIGHT EVERY SECOND OF THE WAY
+
+	ESP8266_NTP_TIME now;
+	uint32_t i;
+	uint32_t bad_clock = 0;
+	uint32_t bad_fields = 0;
+	uint64_t prev = 0;
+	uint32_t bad_order = 0;
+
+	NTP_CHECK_Begin(name);
+	NTP_SIM_Reset();
+	NTP_SIM_SetStart(start);
+	NTP_SIM_AddServer("a.test", 1);
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 1);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	for(i = 0; i < 30 * 60; i++)
+	{
+		NTP_SIM_Run(1000);
+		ESP8266_NTP_NowTimeCtx(&ctx, &now);
+		ESP8266_NTP_RefreshDataCtx(&ctx);
+		bad_clock += (era_error_s() > 1) || (NTP_SIM_ClockErrorUs(&ctx) < -1000) || (NTP_SIM_ClockErrorUs(&ctx) > 1000);
+		bad_fields += !matches_gmtime(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->timestamp);
+		bad_fields += (ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->timestamp != now.seconds);
+		bad_order += (now.seconds < prev);
+		prev = now.seconds;
+	}
+	NTP_CHECK(bad_clock == 0);
+	NTP_CHECK(bad_fields == 0);
+	NTP_CHECK(bad_order == 0);
+	NTP_CHECK(now.seconds > edge + 15 * 60);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes > 10);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void first_sync_after(void)
+{
+	//AN UNSYNCED CLOCK STARTS AT THE ERA 0 PIVOT. A FIRST REPLY FROM
+	//ERA 1 (SMALL WIRE SECONDS) MUST LAND IN ERA 1, NOT IN 1900
+
+	ESP8266_NTP_TIME now;
+
+	NTP_CHECK_Begin("first sync after the rollover");
+	NTP_SIM_Reset();
+	NTP_SIM_SetStart(NTP_ERA1_SEC + 3 * 86400);
+	NTP_SIM_AddServer("a.test", 1);
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_NowTimeCtx(&ctx, &now));
+	NTP_CHECK((now.seconds >> 32) == 1);
+	NTP_CHECK(era_error_s() == 0);
+	NTP_CHECK(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->year == 2036);
+	NTP_CHECK(ESP8266_NTP_TimeToUnix(&now) > 2085978496LL);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_era\n");
+	NTP_SIM_Reset();
+	era_extend();
+	boundaries();
+	sync_across("sync through the 2036 rollover", NTP_ERA1_SEC - 10 * 60, NTP_ERA1_SEC);
+	sync_across("sync through 2038-01-19 03:14:08", NTP_Y2038_SEC - 10 * 60, NTP_Y2038_SEC);
+	first_sync_after();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,180 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* TIME FORMAT CHECKS
+*
+* THE PREDEFINED PATTERNS AND EVERY CONVERSION ARE FORMATTED FOR FIXED
+* TIMES AND ZONES AND COMPARED WITH STRINGS WORKED OUT BY HAND. A
+* BUFFER ONE BYTE TOO SMALL AND PATTERNS THAT DO NOT COMPILE GIVE AN
+* EMPTY STRING
+****************************************************************/
+
+#include <string.h>
+#include "ntp_sim.h"
+
+//2024-07-04 12:34:56 UTC (THURSDAY)
+#define NTP_FMT_JUL			3929085296ULL
+//2024-01-15 23:05:09 UTC (MONDAY, TUESDAY IN CET)
+#define NTP_FMT_JAN			3914348709ULL
+//2036-02-07 06:28:16 UTC, FIRST SECOND OF ERA 1
+#define NTP_FMT_ERA1		4294967296ULL
+//2024-03-31 01:00:00 UTC, CET -> CEST
+#define NTP_FMT_CEST		3920835600ULL
+
+#define NTP_FMT_CET			"CET-1CEST,M3.5.0,M10.5.0/3"
+#define NTP_FMT_EST			"EST5EDT,M3.2.0,M11.1.0"
+
+typedef struct
+{
+	const char* tz;
+	const char* pattern;
+	uint8_t utc;
+	uint64_t seconds;
+	uint32_t usec;
+	const char* expected;
+} NTP_FMT_CASE;
+
+static ESP8266_NTP_CONTEXT ctx;
+static ESP8266_NTP_FORMAT fmt;
+
+static uint16_t format(const char* tz, uint64_t seconds, uint32_t usec, char* buf, uint16_t size)
+{
+	//FORMAT A FIXED TIME WITH THE COMPILED fmt IN ZONE tz
+
+	ESP8266_NTP_TIME t;
+
+	ESP8266_NTP_SetTimeZoneCtx(&ctx, tz);
+	t.seconds = seconds;
+	t.fraction = (uint32_t)((((uint64_t)usec << 32) + NTP_USEC_PER_SEC - 1) / NTP_USEC_PER_SEC);
+	return ESP8266_NTP_FormatTimeCtx(&ctx, &fmt, &t, buf, size);
+}
+
+static void expected(void)
+{
+	static const NTP_FMT_CASE c[] =
+	{
+		{ NTP_FMT_CET, NTP_FORMAT_ISO8601, 0, NTP_FMT_JUL, 0, "2024-07-04T14:34:56+02:00" },
+		{ NTP_FMT_CET, NTP_FORMAT_ISO8601, 1, NTP_FMT_JUL, 0, "2024-07-04T12:34:56+00:00" },
+		{ "<+0330>-3:30", NTP_FORMAT_ISO8601, 0, NTP_FMT_JUL, 0, "2024-07-04T16:04:56+03:30" },
+		{ NTP_FMT_CET, NTP_FORMAT_ISO8601, 0, NTP_FMT_CEST - 1, 0, "2024-03-31T01:59:59+01:00" },
+		{ NTP_FMT_CET, NTP_FORMAT_ISO8601, 0, NTP_FMT_CEST, 0, "2024-03-31T03:00:00+02:00" },
+		{ NTP_FMT_CET, NTP_FORMAT_RFC3339, 0, NTP_FMT_JUL, 789654, "2024-07-04T14:34:56.789+02:00" },
+		{ NTP_FMT_CET, NTP_FORMAT_RFC3339, 0, NTP_FMT_JAN, 999999, "2024-01-16T00:05:09.999+01:00" },
+		{ NTP_FMT_EST, NTP_FORMAT_RFC3339, 0, NTP_FMT_JAN, 5000, "2024-01-15T18:05:09.005-05:00" },
+		{ NTP_FMT_CET, NTP_FORMAT_RFC3339, 1, NTP_FMT_ERA1, 0, "2036-02-07T06:28:16.000+00:00" },
+		{ NTP_FMT_CET, NTP_FORMAT_HTTP_DATE, 1, NTP_FMT_JUL, 0, "Thu, 04 Jul 2024 12:34:56 GMT" },
+		{ NTP_FMT_CET, NTP_FORMAT_HTTP_DATE, 1, NTP_FMT_JAN, 0, "Mon, 15 Jan 2024 23:05:09 GMT" },
+		{ NTP_FMT_CET, NTP_FORMAT_HTTP_DATE, 1, NTP_FMT_ERA1, 0, "Thu, 07 Feb 2036 06:28:16 GMT" },
+		{ NTP_FMT_CET, "%A %e %B %y %I:%M %p %Z %z %s %%", 0, NTP_FMT_JUL, 0,
+			"Thursday  4 July 24 02:34 PM CEST +0200 1720096496 %" },
+		{ NTP_FMT_CET, "%A %e %B %y %I:%M %p %Z %z", 0, NTP_FMT_JAN, 0, "Tuesday 16 January 24 12:05 AM CET +0100" },
+		{ NTP_FMT_EST, "%a %b %d %H %Z %z %s", 0, NTP_FMT_JAN, 0, "Mon Jan 15 18 EST -0500 1705359909" },
+		{ NTP_FMT_CET, "%S.%6N %1N %N", 1, NTP_FMT_JUL, 789654, "56.789654 7 789654" },
+		{ NTP_FMT_CET, "%s", 1, NTP_FMT_ERA1, 0, "2085978496" }
+	};
+	char buf[80];
+	uint8_t i;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("expected strings");
+	for(i = 0; i < sizeof(c) / sizeof(c[0]); i++)
+	{
+		bad += !ESP8266_NTP_FormatCompile(&fmt, c[i].pattern, c[i].utc);
+		bad += (format(c[i].tz, c[i].seconds, c[i].usec, buf, sizeof(buf)) != strlen(c[i].expected));
+		if(strcmp(buf, c[i].expected) != 0)
+		{
+			printf("    \"%s\" : \"%s\", expected \"%s\"\n", c[i].pattern, buf, c[i].expected);
+			bad++;
+		}
+	}
+	NTP_CHECK(bad == 0);
+}
+
+static void small_buffer(void)
+{
+	//THE BUFFER MUST HOLD THE LONGEST OUTPUT OF THE PATTERN AND THE NUL
+
+	char buf[40];
+
+	NTP_CHECK_Begin("buffer too small");
+	NTP_CHECK(ESP8266_NTP_FormatCompile(&fmt, NTP_FORMAT_HTTP_DATE, 1));
+	NTP_CHECK(fmt.max_length == 29);
+	os_memset(buf, 'x', sizeof(buf));
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JUL, 0, buf, 29) == 0);
+	NTP_CHECK(buf[0] == '\0' && buf[1] == 'x');
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JUL, 0, buf, 30) == 29);
+	NTP_CHECK(strcmp(buf, "Thu, 04 Jul 2024 12:34:56 GMT") == 0);
+
+	//%A IS CHECKED AT ITS LONGEST, "WEDNESDAY", EVEN FOR SHORTER NAMES
+	NTP_CHECK(ESP8266_NTP_FormatCompile(&fmt, "%A", 0));
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JAN, 0, buf, 9) == 0);
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JAN, 0, buf, 10) == 7);
+	NTP_CHECK(strcmp(buf, "Tuesday") == 0);
+
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JAN, 0, buf, 0) == 0);
+	NTP_CHECK(buf[0] == 'T');
+}
+
+static void bad_pattern(void)
+{
+	//UNKNOWN CONVERSIONS, A TRAILING %, BAD FRACTION WIDTHS AND PATTERNS
+	//PAST THE OP LIST OR LITERAL POOL DO NOT COMPILE AND FORMAT NOTHING
+
+	static const char* p[] =
+	{
+		"%Q",
+		"%Y-%m-%",
+		"%:Y",
+		"%7N",
+		"%0N",
+		"%3S",
+		"0123456789012345678901234567890123456789",
+		"%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S"
+	};
+	char buf[80];
+	uint8_t i;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("bad patterns");
+	for(i = 0; i < sizeof(p) / sizeof(p[0]); i++)
+	{
+		os_memset(buf, 'x', sizeof(buf));
+		bad += ESP8266_NTP_FormatCompile(&fmt, p[i], 0);
+		bad += (fmt.count != 0 || fmt.max_length != 0);
+		bad += (format(NTP_FMT_CET, NTP_FMT_JUL, 0, buf, sizeof(buf)) != 0);
+		bad += (buf[0] != '\0');
+	}
+	NTP_CHECK(bad == 0);
+
+	//THE LIMITS THEMSELVES STILL COMPILE
+	NTP_CHECK(ESP8266_NTP_FormatCompile(&fmt, "0123456789012345678901234567890%%", 0));
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JUL, 0, buf, sizeof(buf)) == 32);
+	NTP_CHECK(ESP8266_NTP_FormatCompile(&fmt, "%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S%S", 0));
+	NTP_CHECK(format(NTP_FMT_CET, NTP_FMT_JUL, 0, buf, sizeof(buf)) == 64);
+}
+
+static void unsynced(void)
+{
+	//THE CURRENT TIME OF A CLOCK NEVER SYNCED FORMATS AS NOTHING
+
+	char buf[40];
+
+	NTP_CHECK_Begin("unsynced clock");
+	NTP_CHECK(ESP8266_NTP_FormatCompile(&fmt, NTP_FORMAT_ISO8601, 0));
+	os_memset(buf, 'x', sizeof(buf));
+	NTP_CHECK(ESP8266_NTP_FormatCtx(&ctx, &fmt, buf, sizeof(buf)) == 0);
+	NTP_CHECK(buf[0] == '\0');
+}
+
+int main(void)
+{
+	printf("test_format\n");
+	NTP_SIM_Reset();
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	expected();
+	small_buffer();
+	bad_pattern();
+	unsynced();
+	ESP8266_NTP_Destroy(&ctx);
+	return NTP_CHECK_Done();
+}
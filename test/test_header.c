@@ -0,0 +1,229 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* HEADER VIEW AND RECEIVE PATH FUZZING
+*
+* ESP8266_NTP_HeaderView AND ITS ACCESSORS ARE FED RANDOM BYTES OF
+* RANDOM LENGTH AT EVERY ALIGNMENT AND COMPARED WITH A PLAIN BIG
+* ENDIAN DECODE. THEN A FAKE SERVER MANGLES ITS REPLIES (BIT FLIPS,
+* RANDOM FIELDS, RUNTS, TRAILING BYTES) ON THE WAY TO THE SINGLE
+* SERVER AND THE MULTI SERVER RECEIVE PATHS. EVERY SYNC MUST STILL
+* END, EVERY DATAGRAM MUST BE ACCOUNTED FOR, AND AN UNCHANGED REPLY
+* MUST BE ACCEPTED. BUILT WITH THE SANITIZERS BY THE MAKEFILE, SO AN
+* OUT OF BOUNDS OR MISALIGNED READ FAILS THE TEST
+****************************************************************/
+
+#include "ntp_sim.h"
+
+#define NTP_FUZZ_VIEWS			2000000UL
+#define NTP_FUZZ_SYNCS			20000UL
+
+//WHAT THE MANGLER DID TO THE LAST REPLY
+typedef enum
+{
+	NTP_FUZZ_NONE,
+	NTP_FUZZ_RUNT,			//SHORTER THAN A HEADER
+	NTP_FUZZ_ORIGIN,		//ORIGIN TIMESTAMP CHANGED : BOGUS
+	NTP_FUZZ_FIELDS,		//ANY OTHER HEADER BYTES CHANGED
+	NTP_FUZZ_TRAILER		//BYTES APPENDED, HEADER UNCHANGED
+} NTP_FUZZ_KIND;
+
+static ESP8266_NTP_CONTEXT ctx;
+static uint8_t fuzz_kind;
+
+static uint32_t be32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t view_matches(const uint8_t* buf, uint16_t length)
+{
+	//THE VIEW IS THE BUFFER ITSELF, OR NULL FOR A RUNT, AND EVERY
+	//ACCESSOR AGREES WITH THE REFERENCE DECODE
+
+	const ESP8266_NTP_HEADER* hdr = ESP8266_NTP_HeaderView((const char*)buf, length);
+
+	if(length < NTP_PACKET_SIZE)
+	{
+		return hdr == NULL;
+	}
+	return (const uint8_t*)hdr == buf
+		&& NTP_HDR_LI(hdr) == (buf[0] >> 6)
+		&& NTP_HDR_VN(hdr) == ((buf[0] >> 3) & 7)
+		&& NTP_HDR_MODE(hdr) == (buf[0] & 7)
+		&& hdr->stratum == buf[1]
+		&& hdr->poll == (int8_t)buf[2]
+		&& hdr->precision == (int8_t)buf[3]
+		&& ESP8266_NTP_HeaderRootDelay(hdr) == be32(buf + 4)
+		&& ESP8266_NTP_HeaderRootDispersion(hdr) == be32(buf + 8)
+		&& ESP8266_NTP_HeaderReferenceId(hdr) == be32(buf + 12)
+		&& ESP8266_NTP_HeaderTimestamp(hdr->reference_ts) == (((uint64_t)be32(buf + 16) << 32) | be32(buf + 20))
+		&& ESP8266_NTP_HeaderTimestamp(hdr->originate_ts) == (((uint64_t)be32(buf + 24) << 32) | be32(buf + 28))
+		&& ESP8266_NTP_HeaderTimestamp(hdr->receive_ts) == (((uint64_t)be32(buf + 32) << 32) | be32(buf + 36))
+		&& ESP8266_NTP_HeaderTimestamp(hdr->transmit_ts) == (((uint64_t)be32(buf + 40) << 32) | be32(buf + 44));
+}
+
+static void header_view(void)
+{
+	//RANDOM BYTES, RANDOM LENGTH 0 - NTP_SIM_MAX_DATAGRAM, RANDOM
+	//ALIGNMENT. BYTES >= 0x80 ARE COMMON, SO SIGN EXTENSION SHOWS UP
+
+	static uint8_t storage[NTP_SIM_MAX_DATAGRAM + 8];
+	uint8_t* buf;
+	uint16_t length;
+	uint32_t i;
+	uint16_t j;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("header view, random datagrams");
+	NTP_SIM_Reset();
+	for(i = 0; i < NTP_FUZZ_VIEWS; i++)
+	{
+		buf = storage + (i & 7);
+		length = (uint16_t)(NTP_SIM_Random() % (NTP_SIM_MAX_DATAGRAM + 1));
+		for(j = 0; j < length; j++)
+		{
+			buf[j] = (uint8_t)NTP_SIM_Random();
+		}
+		bad += !view_matches(buf, length);
+	}
+	NTP_CHECK(bad == 0);
+	NTP_CHECK(ESP8266_NTP_HeaderView(NULL, NTP_PACKET_SIZE) == NULL);
+	NTP_CHECK(sizeof(ESP8266_NTP_HEADER) == NTP_PACKET_SIZE);
+
+	//ALL ONES : NO FIELD MAY SIGN EXTEND INTO ITS NEIGHBOUR
+	os_memset(storage, 0xFF, sizeof(storage));
+	NTP_CHECK(view_matches(storage + 1, NTP_PACKET_SIZE));
+	NTP_CHECK(ESP8266_NTP_HeaderTimestamp(storage) == 0xFFFFFFFFFFFFFFFFULL);
+}
+
+static void mangle(NTP_SIM_SERVER* s, uint8_t* reply, uint16_t* length)
+{
+	//ONE RANDOM KIND OF DAMAGE PER REPLY
+
+	uint32_t r = NTP_SIM_Random();
+	uint8_t n;
+	uint8_t pos;
+
+	(void)s;
+	switch(r % 8)
+	{
+		case 0:
+			fuzz_kind = NTP_FUZZ_NONE;
+			break;
+
+		case 1:
+			fuzz_kind = NTP_FUZZ_RUNT;
+			*length = 1 + (uint16_t)((r >> 8) % (NTP_PACKET_SIZE - 1));
+			break;
+
+		case 2:
+			fuzz_kind = NTP_FUZZ_ORIGIN;
+			reply[24 + ((r >> 8) & 7)] ^= (uint8_t)(1 + ((r >> 16) % 255));
+			break;
+
+		case 3:
+			fuzz_kind = NTP_FUZZ_TRAILER;
+			*length = NTP_PACKET_SIZE + 1 + (uint16_t)((r >> 8) % (NTP_SIM_MAX_DATAGRAM - NTP_PACKET_SIZE));
+			for(pos = NTP_PACKET_SIZE; pos < *length; pos++)
+			{
+				reply[pos] = (uint8_t)NTP_SIM_Random();
+			}
+			break;
+
+		default:
+			//FLIP 1 - 8 BITS OR RANDOMISE 1 - 8 BYTES OUTSIDE THE ORIGIN
+			fuzz_kind = NTP_FUZZ_FIELDS;
+			for(n = 0; n < 1 + ((r >> 3) & 7); n++)
+			{
+				pos = (uint8_t)(NTP_SIM_Random() % (NTP_PACKET_SIZE - 8));
+				pos = (pos < 24) ? pos : pos + 8;
+				if(r & 0x100)
+				{
+					reply[pos] ^= (uint8_t)(1 << (NTP_SIM_Random() & 7));
+				}
+				else
+				{
+					reply[pos] = (uint8_t)NTP_SIM_Random();
+				}
+			}
+			break;
+	}
+}
+
+static void receive_path(const char* name, uint8_t multi)
+{
+	//a MANGLES EVERY REPLY, b AND c ARE CLEAN. EVERY EXCHANGE GETS ONE
+	//REPLY, SO ALL OF THEM REACH THE LIBRARY. A FRESH CONTEXT PER SYNC
+	//SO AN ACCEPTED GARBAGE SAMPLE CAN NOT SKEW THE NEXT ONE
+
+	NTP_SIM_SERVER* s[3];
+	ESP8266_NTP_PACKET_STATS* ps;
+	uint32_t sent;
+	uint32_t i;
+	uint32_t bad_end = 0;
+	uint32_t bad_count = 0;
+	uint32_t bad_clean = 0;
+	uint32_t bad_origin = 0;
+	uint32_t runt;
+
+	NTP_CHECK_Begin(name);
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(multi);
+	s[0] = NTP_SIM_AddServer("a.test", 1);
+	s[0]->mangle = mangle;
+	s[1] = NTP_SIM_AddServer("b.test", 2);
+	s[2] = NTP_SIM_AddServer("c.test", 3);
+	s[2]->delay_us = 8000;
+
+	for(i = 0; i < NTP_FUZZ_SYNCS; i++)
+	{
+		os_memset(&ctx, 0, sizeof(ctx));
+		ESP8266_NTP_Create(&ctx, "a.test", "b.test", "c.test", 0, 0, 500);
+		ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+		ESP8266_NTP_SetMultiServerModeCtx(&ctx, multi);
+
+		sent = s[0]->replies + s[1]->replies + s[2]->replies;
+		NTP_SIM_Sync(&ctx, 10000);
+		sent = s[0]->replies + s[1]->replies + s[2]->replies - sent;
+		ps = ESP8266_NTP_GetPacketStatsCtx(&ctx);
+		runt = (fuzz_kind == NTP_FUZZ_RUNT);
+
+		//THE CLEAN SERVERS ALWAYS LET THE SYNC SUCCEED
+		bad_end += (ESP8266_NTP_GetSyncStateCtx(&ctx) != ESP8266_NTP_SYNC_DONE);
+
+		//EVERY DATAGRAM IS A RUNT (A STRAY) OR RECEIVED, AND EVERY
+		//RECEIVED ONE IS ACCEPTED OR REJECTED
+		bad_count += (ps->received + runt != sent);
+		bad_count += (ps->received != ps->accepted + ps->rejected);
+		bad_count += (runt > ps->stray);
+
+		//AN UNCHANGED HEADER IS ACCEPTED, TRAILING BYTES OR NOT
+		if(fuzz_kind == NTP_FUZZ_NONE || fuzz_kind == NTP_FUZZ_TRAILER)
+		{
+			bad_clean += (ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes != 1);
+		}
+
+		//A WRONG ORIGIN IS NEVER TAKEN AS a's REPLY
+		if(fuzz_kind == NTP_FUZZ_ORIGIN)
+		{
+			bad_origin += (ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes != 0);
+		}
+
+		ESP8266_NTP_Destroy(&ctx);
+		NTP_SIM_Run(100);
+	}
+	NTP_CHECK(bad_end == 0);
+	NTP_CHECK(bad_count == 0);
+	NTP_CHECK(bad_clean == 0);
+	NTP_CHECK(bad_origin == 0);
+	NTP_CHECK(s[0]->replies == NTP_FUZZ_SYNCS);
+}
+
+int main(void)
+{
+	printf("test_header\n");
+	header_view();
+	receive_path("single server receive path, mangled replies", 0);
+	receive_path("multi server receive path, mangled replies", 1);
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,251 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* LEAP SECOND CHECKS
+*
+* A SERVER ANNOUNCES THE 2016-12-31 LEAP SECOND AND THE CLOCK IS
+* WATCHED THROUGH IT : THE REPEATED (INSERT) OR SKIPPED (DELETE)
+* 23:59:59 OF STEP MODE, THE LINEAR 1 S OF SMEAR MODE, THE GUARD
+* WINDOW THAT KEEPS SAMPLES NEAR THE LEAP OUT OF THE DISCIPLINE AND
+* THE STALE ANNOUNCEMENT A SERVER KEEPS SENDING AFTER THE LEAP
+****************************************************************/
+
+#include "ntp_sim.h"
+
+//2017-01-01 00:00:00 UTC, THE END OF THE LEAP DAY
+#define NTP_LEAP_SEC			3692217600ULL
+//SMEAR WINDOW OF THE SMEAR CHECKS
+#define NTP_LEAP_TEST_SMEAR_S	3600UL
+
+static ESP8266_NTP_CONTEXT ctx;
+
+static NTP_SIM_SERVER* create(uint8_t leap, uint64_t start)
+{
+	NTP_SIM_SERVER* a;
+
+	NTP_SIM_Reset();
+	NTP_SIM_SetStart(start);
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->leap = leap;
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+	return a;
+}
+
+static void run_to(uint64_t secs, uint32_t ms)
+{
+	//RUN UNTIL TRUE TIME IS secs SECONDS AND ms MILLISECONDS
+
+	uint64_t target = (secs * 1000) + ms;
+	uint64_t now = (NTP_SIM_TrueNtp() * 1000) >> 32;
+
+	if(target > now)
+	{
+		NTP_SIM_Run((uint32_t)(target - now));
+	}
+}
+
+static void step(const char* name, uint8_t leap)
+{
+	//SAMPLE THE CLOCK EVERY 100 MS FROM 2 S BEFORE TO 2 S AFTER THE
+	//LEAP. INSERT SHOWS 23:59:59 FOR 2 S AND GOES BACK ONCE, DELETE
+	//NEVER SHOWS IT
+
+	ESP8266_NTP_TIME now;
+	ESP8266_NTP_DATA* d = ESP8266_NTP_GetNTPDataStructureCtx(&ctx);
+	uint8_t i;
+	uint32_t shown = 0;
+	uint32_t backwards = 0;
+	uint32_t bad_fields = 0;
+	uint64_t prev = 0;
+
+	NTP_CHECK_Begin(name);
+	create(leap, NTP_LEAP_SEC - 1200);
+	ESP8266_NTP_SetLeapModeCtx(&ctx, ESP8266_NTP_LEAP_MODE_STEP, 0);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(d->leap == leap);
+	NTP_CHECK(ctx.leap_at == NTP_LEAP_SEC);
+
+	run_to(NTP_LEAP_SEC - 2, 0);
+	for(i = 0; i < 40; i++)
+	{
+		ESP8266_NTP_NowTimeCtx(&ctx, &now);
+		ESP8266_NTP_RefreshDataCtx(&ctx);
+		if(now.seconds == NTP_LEAP_SEC - 1)
+		{
+			shown++;
+			bad_fields += !(d->hour == 23 && d->min == 59 && d->sec == 59 && d->date == 31);
+		}
+		backwards += (((now.seconds << 32) | now.fraction) < prev);
+		prev = (now.seconds << 32) | now.fraction;
+		NTP_SIM_Run(100);
+	}
+	NTP_CHECK(shown == ((leap == ESP8266_NTP_LEAP_INSERT) ? 20 : 0));
+	NTP_CHECK(backwards == ((leap == ESP8266_NTP_LEAP_INSERT) ? 1 : 0));
+	NTP_CHECK(bad_fields == 0);
+
+	//THE WHOLE SECOND IS IN THE CLOCK AND THE LEAP IS DONE
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx) - ((leap == ESP8266_NTP_LEAP_INSERT) ? -1000000 : 1000000), -1000, 1000);
+	NTP_CHECK(d->leap == ESP8266_NTP_LEAP_NONE);
+	NTP_CHECK(ctx.leap == ESP8266_NTP_LEAP_NONE && ctx.leap_applied_us == 0);
+	NTP_CHECK(ctx.leap_stale);
+	ESP8266_NTP_RefreshDataCtx(&ctx);
+	NTP_CHECK(d->year == 2017 && d->month_num == 1 && d->date == 1 && d->hour == 0 && d->min == 0);
+	NTP_CHECK(d->sec == ((leap == ESP8266_NTP_LEAP_INSERT) ? 1 : 3));
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void smear(void)
+{
+	//AN INSERTED LEAP SMEARED OVER AN HOUR CENTERED ON MIDNIGHT. THE
+	//CLOCK NEVER GOES BACK, RUNS AT MOST 1/3600 SLOW AND ENDS EXACTLY
+	//1 S BEHIND
+
+	ESP8266_NTP_TIME now;
+	uint32_t i;
+	uint64_t prev = 0;
+	uint64_t t;
+	uint32_t bad_rate = 0;
+	uint32_t bad_ramp = 0;
+	int64_t expected;
+
+	NTP_CHECK_Begin("smear");
+	create(ESP8266_NTP_LEAP_INSERT, NTP_LEAP_SEC - 2400);
+	ESP8266_NTP_SetLeapModeCtx(&ctx, ESP8266_NTP_LEAP_MODE_SMEAR, NTP_LEAP_TEST_SMEAR_S);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ctx.leap_at == NTP_LEAP_SEC);
+
+	run_to(NTP_LEAP_SEC - (NTP_LEAP_TEST_SMEAR_S / 2) - 60, 0);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1000, 1000);
+	for(i = 0; i <= NTP_LEAP_TEST_SMEAR_S + 120; i++)
+	{
+		ESP8266_NTP_NowTimeCtx(&ctx, &now);
+		t = (now.seconds << 32) | now.fraction;
+		if(prev != 0)
+		{
+			//ONE TRUE SECOND : 1 S LESS AT MOST 1/3600 S (+ 1 US ROUNDING)
+			bad_rate += (t <= prev) || ((t - prev) > (1ULL << 32)) ||
+						((t - prev) < (1ULL << 32) - ((1ULL << 32) / NTP_LEAP_TEST_SMEAR_S) - 4300);
+		}
+		prev = t;
+
+		//LINEAR FROM leap_at - 1800 TO leap_at + 1800
+		expected = ((int64_t)i - 60) * 1000000 / (int64_t)NTP_LEAP_TEST_SMEAR_S;
+		expected = (expected < 0) ? 0 : (expected > 1000000) ? 1000000 : expected;
+		bad_ramp += (NTP_SIM_ClockErrorUs(&ctx) > -expected + 1000) || (NTP_SIM_ClockErrorUs(&ctx) < -expected - 1000);
+		NTP_SIM_Run(1000);
+	}
+	NTP_CHECK(bad_rate == 0);
+	NTP_CHECK(bad_ramp == 0);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1001000, -999000);
+	NTP_CHECK(ctx.leap == ESP8266_NTP_LEAP_NONE && ctx.leap_applied_us == 0);
+	NTP_CHECK(ctx.leap_stale);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void guard(void)
+{
+	//WITHIN NTP_LEAP_GUARD_S OF THE LEAP (AND HALF THE SMEAR WINDOW) A
+	//SAMPLE UNDER 2 S OFF IS NOT USED, ONE FURTHER OFF STILL IS
+
+	NTP_SIM_SERVER* a;
+	static const int32_t around[] = { -(int32_t)NTP_LEAP_GUARD_S - 1, -(int32_t)NTP_LEAP_GUARD_S + 1, 0,
+										(int32_t)NTP_LEAP_GUARD_S - 1, (int32_t)NTP_LEAP_GUARD_S + 1 };
+	static const uint8_t inside[] = { 0, 1, 1, 1, 0 };
+	uint8_t i;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("guard window");
+	a = create(ESP8266_NTP_LEAP_INSERT, NTP_LEAP_SEC - 1200);
+	NTP_CHECK(!_esp8266_ntp_leap_guard(&ctx));
+	NTP_SIM_Sync(&ctx, 5000);
+
+	for(i = 0; i < sizeof(around) / sizeof(around[0]); i++)
+	{
+		ctx.clock_sec = NTP_LEAP_SEC + around[i];
+		bad += (_esp8266_ntp_leap_guard(&ctx) != inside[i]);
+	}
+	ctx.leap_mode = ESP8266_NTP_LEAP_MODE_SMEAR;
+	ctx.leap_smear_s = NTP_LEAP_TEST_SMEAR_S;
+	for(i = 0; i < sizeof(around) / sizeof(around[0]); i++)
+	{
+		ctx.clock_sec = NTP_LEAP_SEC + around[i] + ((around[i] < 0) ? -1 : 1) * (int32_t)(NTP_LEAP_TEST_SMEAR_S / 2);
+		bad += (_esp8266_ntp_leap_guard(&ctx) != inside[i]);
+	}
+	NTP_CHECK(bad == 0);
+	ESP8266_NTP_Destroy(&ctx);
+
+	//A 300 MS OFFSET 5 MINUTES BEFORE THE LEAP IS HELD BACK
+	a = create(ESP8266_NTP_LEAP_INSERT, NTP_LEAP_SEC - 1200);
+	NTP_SIM_Sync(&ctx, 5000);
+	run_to(NTP_LEAP_SEC - 300, 0);
+	a->offset_us = 300000;
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes == 2);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1000, 1000);
+
+	//ONE 3 S OFF IS NOT A LEAP AND STEPS THE CLOCK
+	a->offset_us = 3000000;
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), 2999000, 3001000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void stale(void)
+{
+	//THE SERVER KEEPS ANNOUNCING THE LEAP AFTER IT. THAT DOES NOT ARM
+	//ANOTHER ONE AT THE END OF JANUARY UNTIL THE INDICATOR CLEARS
+
+	NTP_SIM_SERVER* a;
+	ESP8266_NTP_DATA* d = ESP8266_NTP_GetNTPDataStructureCtx(&ctx);
+
+	NTP_CHECK_Begin("stale announcement");
+	a = create(ESP8266_NTP_LEAP_INSERT, NTP_LEAP_SEC - 1200);
+	NTP_SIM_Sync(&ctx, 5000);
+	run_to(NTP_LEAP_SEC + 1200, 0);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1001000, -999000);
+	NTP_CHECK(ctx.leap_stale);
+
+	//THE SERVER HAS INSERTED THE SECOND TOO
+	a->offset_us = -1000000;
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes == 2);
+	NTP_CHECK(ctx.leap == ESP8266_NTP_LEAP_NONE);
+	NTP_CHECK(d->leap == ESP8266_NTP_LEAP_NONE);
+	NTP_CHECK(ctx.leap_stale);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1001000, -999000);
+
+	a->leap = ESP8266_NTP_LEAP_NONE;
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(!ctx.leap_stale);
+
+	//A NEW ANNOUNCEMENT ARMS THE END OF JANUARY
+	a->leap = ESP8266_NTP_LEAP_INSERT;
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(d->leap == ESP8266_NTP_LEAP_INSERT);
+	NTP_CHECK(ctx.leap_at == NTP_LEAP_SEC + 31 * 86400);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_leap\n");
+	step("step, insert", ESP8266_NTP_LEAP_INSERT);
+	step("step, delete", ESP8266_NTP_LEAP_DELETE);
+	smear();
+	guard();
+	stale();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,246 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* LINUX BACKEND LOOPBACK TEST
+*
+* SYNCS THE LIBRARY, RUNNING ON THE EPOLL BACKEND, AGAINST A FAKE
+* SERVER THREAD ON THE LOOPBACK INTERFACE. THE SERVER CLOCK IS THE
+* HOST REAL TIME CLOCK PLUS NTP_LOOP_OFFSET_US AND EVERY ANSWER IS
+* PRECEDED BY A COPY ECHOING THE WRONG ORIGIN, WHICH THE BACKEND MUST
+* DROP. THE LIBRARY ALWAYS QUERIES PORT 123, SO THE TEST IS SKIPPED
+* WHEN IT CANNOT BE BOUND
+****************************************************************/
+
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "ESP8266_NTP_LINUX.h"
+#include "ntp_check.h"
+
+#define NTP_LOOP_OFFSET_US		2500000LL
+#define NTP_LOOP_SERVERS		3			//127.0.0.1 .. 127.0.0.3
+
+static ESP8266_NTP_CONTEXT ctx;
+static struct pollfd server_fds[NTP_LOOP_SERVERS];
+static volatile int server_stop;
+static volatile uint32_t server_requests;
+
+static uint64_t real_ntp(int64_t offset_us)
+{
+	struct timespec ts;
+	int64_t us;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + offset_us;
+	return ((uint64_t)(us / 1000000 + NTP_UNIX_EPOCH_OFFSET) << 32) | ((((uint64_t)(us % 1000000)) << 32) / 1000000);
+}
+
+static void put(uint8_t* p, uint64_t v)
+{
+	uint8_t i;
+
+	for(i = 0; i < 8; i++)
+	{
+		p[i] = (uint8_t)(v >> (56 - 8 * i));
+	}
+}
+
+static void server_answer(int fd)
+{
+	uint8_t req[64];
+	uint8_t reply[NTP_PACKET_SIZE];
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	uint64_t t2;
+	ssize_t n;
+
+	n = recvfrom(fd, req, sizeof(req), 0, (struct sockaddr*)&from, &from_len);
+	t2 = real_ntp(NTP_LOOP_OFFSET_US);
+	if(n < NTP_PACKET_SIZE)
+	{
+		return;
+	}
+	server_requests++;
+
+	os_memset(reply, 0, sizeof(reply));
+	reply[0] = NTP_LI_VN_MODE(0, 4, NTP_MODE_SERVER);
+	reply[1] = 1;
+	reply[3] = (uint8_t)-20;
+	os_memcpy(reply + 12, "LOOP", 4);
+	put(reply + 16, t2 - (1ULL << 32));
+	put(reply + 32, t2);
+
+	//BOGUS FIRST : WRONG ORIGIN
+	os_memcpy(reply + 24, req + 40, 8);
+	reply[31] ^= 0x5A;
+	put(reply + 40, real_ntp(NTP_LOOP_OFFSET_US));
+	sendto(fd, reply, sizeof(reply), 0, (struct sockaddr*)&from, from_len);
+
+	reply[31] ^= 0x5A;
+	put(reply + 40, real_ntp(NTP_LOOP_OFFSET_US));
+	sendto(fd, reply, sizeof(reply), 0, (struct sockaddr*)&from, from_len);
+}
+
+static void* server_main(void* arg)
+{
+	uint8_t i;
+
+	(void)arg;
+	while(!server_stop)
+	{
+		if(poll(server_fds, NTP_LOOP_SERVERS, 100) <= 0)
+		{
+			continue;
+		}
+		for(i = 0; i < NTP_LOOP_SERVERS; i++)
+		{
+			if(server_fds[i].revents & POLLIN)
+			{
+				server_answer(server_fds[i].fd);
+			}
+		}
+	}
+	return NULL;
+}
+
+static int server_start(pthread_t* thread)
+{
+	//ONE SOCKET PER ADDRESS, SO EVERY REPLY COMES FROM THE ADDRESS
+	//ITS REQUEST WENT TO
+
+	struct sockaddr_in addr;
+	uint8_t i;
+
+	for(i = 0; i < NTP_LOOP_SERVERS; i++)
+	{
+		server_fds[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+		server_fds[i].events = POLLIN;
+		os_memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(NTP_PORT);
+		addr.sin_addr.s_addr = htonl(0x7F000001 + i);
+		if(server_fds[i].fd < 0 || bind(server_fds[i].fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			return 0;
+		}
+	}
+	return pthread_create(thread, NULL, server_main, NULL) == 0;
+}
+
+static int64_t clock_error_us(void)
+{
+	uint32_t seconds;
+	uint32_t fraction;
+	int64_t diff;
+
+	ESP8266_NTP_NowCtx(&ctx, &seconds, &fraction);
+	diff = (int64_t)((((uint64_t)seconds << 32) | fraction) - real_ntp(NTP_LOOP_OFFSET_US));
+	return ((diff >> 16) * 1000000) >> 16;
+}
+
+static void sync_wait(void)
+{
+	uint16_t i;
+	ESP8266_NTP_SYNC_STATE state;
+
+	ESP8266_NTP_GetTimeCtx(&ctx);
+	for(i = 0; i < 300; i++)
+	{
+		ESP8266_NTP_LINUX_Poll(10);
+		state = ESP8266_NTP_GetSyncStateCtx(&ctx);
+		if(state == ESP8266_NTP_SYNC_DONE || state == ESP8266_NTP_SYNC_FAILED)
+		{
+			break;
+		}
+	}
+}
+
+static void single_server(void)
+{
+	NTP_CHECK_Begin("single server over loopback");
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "127.0.0.1", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+
+	sync_wait();
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->accepted == 1);
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->stray == 0);
+	NTP_CHECK_RANGE(clock_error_us(), -5000, 5000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void multi_server(void)
+{
+	uint8_t i;
+
+	NTP_CHECK_Begin("multi server round over loopback");
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "127.0.0.1", "127.0.0.2", "127.0.0.3", 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+	ESP8266_NTP_SetMultiServerModeCtx(&ctx, 1);
+
+	sync_wait();
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	for(i = 1; i <= 3; i++)
+	{
+		NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, i)->successes == 1);
+	}
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->stray == 0);
+	NTP_CHECK_RANGE(clock_error_us(), -5000, 5000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void names(void)
+{
+	//NAMES GO THROUGH THE RESOLVER THREAD. THE FIRST ONE DOES NOT
+	//RESOLVE, SO THE SYNC FAILS OVER TO THE SECOND
+
+	NTP_CHECK_Begin("names resolved off the event loop");
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "nothing.invalid", "localhost", NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+
+	sync_wait();
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->dns_failures == 1);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 2)->successes == 1);
+	NTP_CHECK_RANGE(clock_error_us(), -5000, 5000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	pthread_t thread;
+	uint8_t i;
+
+	printf("test_linux\n");
+	if(!server_start(&thread))
+	{
+		printf("SKIPPED: cannot bind UDP port %d\n", NTP_PORT);
+		return 0;
+	}
+	if(!ESP8266_NTP_LINUX_Open())
+	{
+		printf("ESP8266_NTP_LINUX_Open failed\n");
+		return 1;
+	}
+
+	single_server();
+	multi_server();
+	names();
+
+	ESP8266_NTP_LINUX_Close();
+	server_stop = 1;
+	pthread_join(thread, NULL);
+	for(i = 0; i < NTP_LOOP_SERVERS; i++)
+	{
+		close(server_fds[i].fd);
+	}
+	NTP_CHECK(server_requests == 5);
+	return NTP_CHECK_Done();
+}
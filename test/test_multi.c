@@ -0,0 +1,184 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* MULTI SERVER MODE SCENARIOS
+****************************************************************/
+
+#include "ntp_sim.h"
+
+static ESP8266_NTP_CONTEXT ctx;
+
+static void create(uint16_t timeout_ms)
+{
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", "b.test", "c.test", 0, 0, timeout_ms);
+	ESP8266_NTP_SetMultiServerModeCtx(&ctx, 1);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+}
+
+static void concurrent_round(void)
+{
+	//ALL THREE SERVERS ARE 60 MS AWAY. ONE ROUND TAKES ONE LOOKUP AND
+	//ONE ROUND TRIP, NOT THREE OF EACH
+
+	NTP_SIM_SERVER* s[3];
+	uint8_t i;
+	uint32_t ms;
+
+	NTP_CHECK_Begin("concurrent round");
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(1);
+	s[0] = NTP_SIM_AddServer("a.test", 1);
+	s[1] = NTP_SIM_AddServer("b.test", 2);
+	s[2] = NTP_SIM_AddServer("c.test", 3);
+	for(i = 0; i < 3; i++)
+	{
+		s[i]->delay_us = 30000;
+		s[i]->offset_us = 40000 + i * 1000;
+	}
+	create(1000);
+
+	ms = NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_DONE);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK_RANGE(ms, 80, 150);
+	for(i = 0; i < 3; i++)
+	{
+		NTP_CHECK(s[i]->lookups == 1);
+		NTP_CHECK(s[i]->requests == 1);
+	}
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), 40000 - 2000, 42000 + 2000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void dead_server(void)
+{
+	//A SILENT SERVER DOES NOT HOLD THE ROUND FOR THE WHOLE REPLY
+	//TIMEOUT ONCE THE OTHERS HAVE ANSWERED
+
+	uint32_t ms;
+
+	NTP_CHECK_Begin("dead server");
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(1);
+	NTP_SIM_AddServer("a.test", 1);
+	NTP_SIM_AddServer("b.test", 2);
+	NTP_SIM_AddServer("c.test", 3)->silent = 1;
+	create(3000);
+
+	ms = NTP_SIM_Sync(&ctx, 10000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK_RANGE(ms, NTP_GATHER_GRACE_MS, NTP_GATHER_GRACE_MS + 100);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 3)->timeouts == 1);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -2000, 2000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void falseticker(void)
+{
+	//ONE SERVER 5 S OFF IS OUTVOTED BY THE OTHER TWO
+
+	NTP_CHECK_Begin("falseticker");
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(1);
+	NTP_SIM_AddServer("a.test", 1)->offset_us = 5000000;
+	NTP_SIM_AddServer("b.test", 2)->offset_us = 1000;
+	NTP_SIM_AddServer("c.test", 3)->offset_us = -1000;
+	create(1000);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) != 1);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -3000, 3000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void stale_cache(void)
+{
+	//A FAILED LOOKUP FALLS BACK TO THE EXPIRED CACHED ADDRESS
+
+	NTP_SIM_SERVER* a;
+
+	NTP_CHECK_Begin("dns failure, stale cache");
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(1);
+	a = NTP_SIM_AddServer("a.test", 1);
+	NTP_SIM_AddServer("b.test", 2);
+	NTP_SIM_AddServer("c.test", 3);
+	create(1000);
+	ESP8266_NTP_SetDnsCacheTTLCtx(&ctx, 1);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(a->requests == 1);
+
+	a->dns_fail = 1;
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS + 1000);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(a->lookups == 2);
+	NTP_CHECK(a->requests == 2);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes == 2);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void stray_replies(void)
+{
+	//ALL DATAGRAMS REACH THE LIBRARY IN A ROUND. BOGUS AND DUPLICATE
+	//REPLIES ARE DROPPED AS STRAYS AND THE REAL ONES STILL COUNT. c IS
+	//SLOW SO THE ROUND IS STILL OPEN WHEN THE DUPLICATE ARRIVES
+
+	NTP_CHECK_Begin("bogus and duplicate replies");
+	NTP_SIM_Reset();
+	NTP_SIM_UseConcurrentTransport(1);
+	NTP_SIM_AddServer("a.test", 1)->bogus = 1;
+	NTP_SIM_AddServer("b.test", 2)->duplicate = 1;
+	NTP_SIM_AddServer("c.test", 3)->delay_us = 20000;
+	create(1000);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->stray == 2);
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->accepted == 3);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->successes == 1);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 2)->successes == 1);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void no_hooks(void)
+{
+	//WITHOUT lookup / send_to THE SYNC FAILS OVER ONE SERVER AT A TIME
+
+	NTP_SIM_SERVER* b;
+	uint32_t ms;
+
+	NTP_CHECK_Begin("transport without lookup / send_to");
+	NTP_SIM_Reset();
+	NTP_SIM_AddServer("a.test", 1)->silent = 1;
+	b = NTP_SIM_AddServer("b.test", 2);
+	NTP_SIM_AddServer("c.test", 3);
+	create(1000);
+
+	ms = NTP_SIM_Sync(&ctx, 10000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) == 2);
+	NTP_CHECK(b->requests == 1);
+	NTP_CHECK_RANGE(ms, 1000, 2000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_multi\n");
+	concurrent_round();
+	dead_server();
+	falseticker();
+	stale_cache();
+	stray_replies();
+	no_hooks();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,292 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* SNTP SERVER CHECKS
+*
+* A FAKE LISTENER HANDS HAND BUILT REQUESTS TO THE SERVER OF A
+* SIMULATED INSTANCE AND KEEPS THE REPLIES : STRATUM ONE BELOW THE
+* SOURCE, ITS ADDRESS AS REFERENCE ID, ORIGINATE, VERSION AND POLL
+* ECHOED, THE RECEIVE TIMESTAMP BACKED UP TO THE ARRIVAL TICK, NOTHING
+* ANSWERED BEFORE THE FIRST SYNC OR PAST NTP_SERVE_MAX_ERROR_US, AND
+* ANYTHING BUT A CLIENT REQUEST COUNTED AS INVALID
+****************************************************************/
+
+#include <string.h>
+#include "ntp_sim.h"
+
+static ESP8266_NTP_CONTEXT ctx;
+
+//FAKE LISTENER
+static void (*listener_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick);
+static uint16_t listener_port;
+static uint8_t listener_open_ok;
+static uint8_t listener_open;
+static uint8_t reply[NTP_PACKET_SIZE];
+static uint16_t reply_length;
+static void* reply_peer;
+static uint32_t reply_count;
+
+static uint8_t fake_open(uint16_t port, void (*recv_cb)(char* data, uint16_t length, void* peer, uint32_t rx_tick))
+{
+	if(!listener_open_ok)
+	{
+		return 0;
+	}
+	listener_cb = recv_cb;
+	listener_port = port;
+	listener_open = 1;
+	return 1;
+}
+
+static void fake_close(void)
+{
+	listener_open = 0;
+}
+
+static void fake_reply(void* peer, uint8_t* data, uint16_t length)
+{
+	reply_peer = peer;
+	reply_length = length;
+	os_memcpy(reply, data, (length < NTP_PACKET_SIZE) ? length : NTP_PACKET_SIZE);
+	reply_count++;
+}
+
+static const ESP8266_NTP_LISTENER fake_listener =
+{
+	fake_open,
+	fake_close,
+	fake_reply
+};
+
+static uint64_t get_ts(const uint8_t* p)
+{
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+			((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | p[7];
+}
+
+static uint8_t request(uint8_t li_vn_mode, uint16_t length, uint32_t age_us)
+{
+	//SEND A REQUEST THAT ARRIVED age_us AGO. RETURNS 1 IF ANSWERED
+
+	static int peer;
+	char req[NTP_PACKET_SIZE + 8];
+	uint32_t n = reply_count;
+	uint8_t i;
+
+	os_memset(req, 0, sizeof(req));
+	req[0] = (char)li_vn_mode;
+	req[2] = 6;
+	for(i = 0; i < 8; i++)
+	{
+		req[40 + i] = (char)(0xA0 + i);
+	}
+	listener_cb(req, length, &peer, system_get_time() - age_us);
+	return reply_count != n && reply_peer == &peer && reply_length == NTP_PACKET_SIZE;
+}
+
+static NTP_SIM_SERVER* create(uint8_t stratum)
+{
+	NTP_SIM_SERVER* a;
+
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->stratum = stratum;
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+	ESP8266_NTP_SetListener(&fake_listener);
+	listener_open_ok = 1;
+	reply_count = 0;
+	return a;
+}
+
+static void start_stop(void)
+{
+	//NO LISTENER OR A PORT THAT DOES NOT OPEN FAILS. STOP CLOSES THE
+	//PORT AND A LATE DATAGRAM IS IGNORED
+
+	NTP_CHECK_Begin("start / stop");
+	create(2);
+	ESP8266_NTP_SetListener(NULL);
+	NTP_CHECK(!ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	ESP8266_NTP_SetListener(&fake_listener);
+	listener_open_ok = 0;
+	NTP_CHECK(!ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_CHECK(!listener_open);
+
+	listener_open_ok = 1;
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_CHECK(listener_open && listener_port == NTP_PORT);
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 1123));
+	NTP_CHECK(listener_open && listener_port == 1123);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->requests == 1);
+
+	ESP8266_NTP_ServeStop();
+	NTP_CHECK(!listener_open);
+	NTP_CHECK(!request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->requests == 1);
+
+	//A NEW START CLEARS THE COUNTERS
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->requests == 0 && ESP8266_NTP_GetServeStats()->answered == 0);
+
+	ESP8266_NTP_ServeStop();
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void reply_fields(void)
+{
+	//THE REPLY OF A NODE SYNCED TO A STRATUM 2 SERVER
+
+	ESP8266_NTP_TIME now;
+	static const uint8_t versions[] = { 1, 3, 4 };
+	uint64_t t2;
+	uint64_t t3;
+	int64_t backup_us;
+	uint8_t i;
+	uint32_t bad = 0;
+
+	NTP_CHECK_Begin("reply fields");
+	create(2);
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_SIM_Run(500);
+
+	for(i = 0; i < sizeof(versions); i++)
+	{
+		bad += !request(NTP_LI_VN_MODE(0, versions[i], NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0);
+		bad += (reply[0] != NTP_LI_VN_MODE(0, versions[i], NTP_MODE_SERVER));
+	}
+	NTP_CHECK(bad == 0);
+
+	//STRATUM, POLL, PRECISION, REFERENCE ID, ORIGINATE
+	NTP_CHECK(reply[1] == 3);
+	NTP_CHECK(reply[2] == 6);
+	NTP_CHECK((int8_t)reply[3] == NTP_SERVE_PRECISION);
+	NTP_CHECK(reply[12] == 10 && reply[13] == 0 && reply[14] == 0 && reply[15] == 1);
+	NTP_CHECK(reply[40 - 16] == 0xA0 && reply[47 - 16] == 0xA7);
+
+	//RECEIVE AND TRANSMIT ARE THE CLOCK NOW, REFERENCE IS THE SYNC
+	t2 = get_ts(reply + 32);
+	t3 = get_ts(reply + 40);
+	ESP8266_NTP_NowTimeCtx(&ctx, &now);
+	NTP_CHECK(t3 >= t2 && (t3 - t2) < (1ULL << 32) / 1000);
+	NTP_CHECK(((now.seconds << 32) | now.fraction) - (((now.seconds & ~0xFFFFFFFFULL) << 32) | t3) < (1ULL << 32) / 1000);
+	NTP_CHECK((t3 >> 32) - (get_ts(reply + 16) >> 32) <= 1);
+
+	//T2 IS BACKED UP TO THE ARRIVAL TICK, UNLESS THAT IS A SECOND OR
+	//MORE AGO (NOT A TICK OF THIS DATAGRAM)
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 3000));
+	backup_us = (int64_t)(((get_ts(reply + 40) - get_ts(reply + 32)) * 1000000) >> 32);
+	NTP_CHECK_RANGE(backup_us, 2990, 3010);
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 2000000));
+	backup_us = (int64_t)(((get_ts(reply + 40) - get_ts(reply + 32)) * 1000000) >> 32);
+	NTP_CHECK_RANGE(backup_us, 0, 10);
+
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->requests == 5);
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->answered == 5);
+
+	ESP8266_NTP_ServeStop();
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void invalid(void)
+{
+	//RUNTS, OTHER MODES AND UNKNOWN VERSIONS
+
+	static const uint8_t li_vn_mode[] =
+	{
+		NTP_LI_VN_MODE(0, 4, 1),
+		NTP_LI_VN_MODE(0, 4, 2),
+		NTP_LI_VN_MODE(0, 4, NTP_MODE_SERVER),
+		NTP_LI_VN_MODE(0, 4, 5),
+		NTP_LI_VN_MODE(0, 4, 6),
+		NTP_LI_VN_MODE(0, 4, 7),
+		NTP_LI_VN_MODE(0, 0, NTP_MODE_CLIENT),
+		NTP_LI_VN_MODE(0, 5, NTP_MODE_CLIENT)
+	};
+	uint8_t i;
+	uint32_t answered = 0;
+
+	NTP_CHECK_Begin("invalid requests");
+	create(2);
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_SIM_Sync(&ctx, 5000);
+
+	for(i = 0; i < sizeof(li_vn_mode); i++)
+	{
+		answered += request(li_vn_mode[i], NTP_PACKET_SIZE, 0);
+	}
+	answered += request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE - 1, 0);
+	answered += request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), 0, 0);
+	NTP_CHECK(answered == 0);
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->requests == sizeof(li_vn_mode) + 2);
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->invalid == sizeof(li_vn_mode) + 2);
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->unsynced == 0);
+
+	//A LONGER DATAGRAM (EXTENSION FIELDS, MAC) IS STILL A REQUEST
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE + 8, 0));
+
+	ESP8266_NTP_ServeStop();
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void unfit(void)
+{
+	//NOTHING IS SERVED BEFORE THE FIRST SYNC, ONCE THE ERROR BOUND HAS
+	//GROWN PAST NTP_SERVE_MAX_ERROR_US OR FROM A STRATUM 15 SOURCE
+
+	NTP_CHECK_Begin("unsynced / unfit clock");
+	create(2);
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_CHECK(!request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->unsynced == 1);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+
+	//THE BOUND GROWS BY NTP_CLOCK_TOLERANCE_PPM WITHOUT SYNCS
+	NTP_SIM_Run(((NTP_SERVE_MAX_ERROR_US - ESP8266_NTP_GetErrorBoundCtx(&ctx)) / NTP_CLOCK_TOLERANCE_PPM - 10) * 1000);
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_SIM_Run(20 * 1000);
+	NTP_CHECK(ESP8266_NTP_GetErrorBoundCtx(&ctx) > NTP_SERVE_MAX_ERROR_US);
+	NTP_CHECK(!request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->unsynced == 2);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_SIM_Run(1000);
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->answered == 3);
+	ESP8266_NTP_ServeStop();
+	ESP8266_NTP_Destroy(&ctx);
+
+	create(15);
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(!request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(ESP8266_NTP_GetServeStats()->unsynced == 1);
+	ESP8266_NTP_ServeStop();
+	ESP8266_NTP_Destroy(&ctx);
+
+	create(14);
+	NTP_CHECK(ESP8266_NTP_ServeStartCtx(&ctx, 0));
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(request(NTP_LI_VN_MODE(0, 4, NTP_MODE_CLIENT), NTP_PACKET_SIZE, 0));
+	NTP_CHECK(reply[1] == 15);
+	ESP8266_NTP_ServeStop();
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_serve\n");
+	start_stop();
+	reply_fields();
+	invalid();
+	unfit();
+	ESP8266_NTP_SetListener(NULL);
+	return NTP_CHECK_Done();
+}
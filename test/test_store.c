@@ -0,0 +1,279 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* WARM START CHECKS
+*
+* AN IN MEMORY STORE AND AN RTC COUNTER RUNNING ON TRUE TIME STAND IN
+* FOR RTC USER MEMORY AND THE RTC TIMER. AN INSTANCE IS SYNCED, SAVED
+* AND DESTROYED, SIMULATED TIME PASSES (THE RESET OR DEEP SLEEP) AND A
+* NEW INSTANCE IS RESTORED : CLOCK, DRIFT, POLL INTERVAL AND DNS CACHE
+* COME BACK, THE ERROR BOUND GROWS BY THE RTC TOLERANCE ACROSS THE GAP,
+* BROKEN SNAPSHOTS AND TOO LONG GAPS START COLD, AND SyncIfNeeded
+* ONLY SYNCS ONCE THE BOUND PASSES THE THRESHOLD
+****************************************************************/
+
+#include "ntp_sim.h"
+
+//RTC COUNTER PERIOD (8 US, IN 2^-12 US UNITS). IT WRAPS EVERY ~9.5 H
+#define NTP_STORE_TEST_RTC_US	8
+//THRESHOLD OF THE SyncIfNeeded CHECK
+#define NTP_STORE_TEST_THRESHOLD_US	200000UL
+
+static ESP8266_NTP_CONTEXT ctx;
+static ESP8266_NTP_SNAPSHOT mem;
+static uint8_t mem_valid;
+static uint8_t rtc_kept;
+
+static uint8_t mem_read(void* buf, uint16_t size)
+{
+	if(!mem_valid || size != sizeof(mem))
+	{
+		return 0;
+	}
+	os_memcpy(buf, &mem, size);
+	return 1;
+}
+
+static uint8_t mem_write(const void* buf, uint16_t size)
+{
+	if(size != sizeof(mem))
+	{
+		return 0;
+	}
+	os_memcpy(&mem, buf, size);
+	mem_valid = 1;
+	return 1;
+}
+
+static uint8_t mem_rtc_now(uint32_t* ticks, uint32_t* period_q12)
+{
+	*ticks = (uint32_t)(NTP_SIM_TrueUs() / NTP_STORE_TEST_RTC_US);
+	*period_q12 = NTP_STORE_TEST_RTC_US << 12;
+	return 1;
+}
+
+static uint8_t mem_rtc_kept(void)
+{
+	return rtc_kept;
+}
+
+static const ESP8266_NTP_STORE mem_store =
+{
+	mem_read,
+	mem_write,
+	mem_rtc_now,
+	mem_rtc_kept
+};
+
+static NTP_SIM_SERVER* world(void)
+{
+	NTP_SIM_SERVER* a;
+
+	NTP_SIM_Reset();
+	NTP_SIM_SetDrift(40000);
+	a = NTP_SIM_AddServer("a.test", 1);
+	ESP8266_NTP_SetStore(&mem_store);
+	mem_valid = 0;
+	rtc_kept = 1;
+	return a;
+}
+
+static void boot(void)
+{
+	//A NEW INSTANCE, AS AFTER A RESET
+
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+}
+
+static void first_boot(void)
+{
+	//NOTHING STORED YET. SYNC OVER TWO HOURS SO THE DRIFT AND THE POLL
+	//INTERVAL MOVE OFF THEIR START VALUES, THEN SAVE
+
+	boot();
+	NTP_CHECK(!ESP8266_NTP_RestoreCtx(&ctx));
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 1);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_SIM_Run(2 * 3600 * 1000UL);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetDriftPPBCtx(&ctx) != 0);
+	NTP_CHECK(ctx.poll_exp > NTP_MIN_POLL_EXP);
+	NTP_CHECK(mem_valid);
+	NTP_CHECK(ESP8266_NTP_SaveCtx(&ctx));
+}
+
+static void round_trip(void)
+{
+	//60 S OFF : THE CLOCK, DRIFT, POLL INTERVAL AND DNS CACHE COME BACK
+	//AND THE NEXT SYNC NEEDS NO LOOKUP
+
+	NTP_SIM_SERVER* a;
+	int32_t drift;
+	uint8_t poll_exp;
+	uint32_t lookups;
+
+	NTP_CHECK_Begin("round trip");
+	a = world();
+	first_boot();
+	drift = ESP8266_NTP_GetDriftPPBCtx(&ctx);
+	poll_exp = ctx.poll_exp;
+	lookups = a->lookups;
+	ESP8266_NTP_Destroy(&ctx);
+
+	NTP_SIM_Run(60 * 1000);
+	boot();
+	NTP_CHECK(ESP8266_NTP_RestoreCtx(&ctx));
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -2000, 2000);
+	NTP_CHECK(ESP8266_NTP_GetDriftPPBCtx(&ctx) == drift);
+	NTP_CHECK(ctx.poll_exp == poll_exp);
+	NTP_CHECK(ctx.freq_hold);
+	NTP_CHECK(ctx.dns_cache[0].valid && ctx.dns_cache[0].ip.addr == NTP_SIM_IP(1));
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(a->lookups == lookups);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -1000, 1000);
+
+	ESP8266_NTP_Destroy(&ctx);
+	ESP8266_NTP_SetStore(NULL);
+}
+
+static void error_growth(uint32_t gap_s)
+{
+	//THE BOUND AFTER THE RESTORE IS THE SAVED ONE PLUS
+	//NTP_RTC_TOLERANCE_PPM OF THE GAP
+
+	ESP8266_NTP_TIME now;
+	uint64_t expected;
+	char name[48];
+
+	os_sprintf(name, "error bound over a %lu s gap", (unsigned long)gap_s);
+	NTP_CHECK_Begin(name);
+	world();
+	first_boot();
+	ESP8266_NTP_Destroy(&ctx);
+
+	NTP_SIM_Run(gap_s * 1000);
+	boot();
+	NTP_CHECK(ESP8266_NTP_RestoreCtx(&ctx));
+	NTP_CHECK(ESP8266_NTP_NowTimeCtx(&ctx, &now));
+	expected = mem.error_us + ((uint64_t)gap_s * NTP_RTC_TOLERANCE_PPM);
+	NTP_CHECK_RANGE(ESP8266_NTP_GetErrorBoundCtx(&ctx), expected - 100, expected + 100);
+
+	ESP8266_NTP_Destroy(&ctx);
+	ESP8266_NTP_SetStore(NULL);
+}
+
+static void cold(const char* name, uint8_t what)
+{
+	//A BROKEN SNAPSHOT IS NOT USED AT ALL. A GOOD ONE WHOSE GAP CAN NOT
+	//BE BRIDGED GIVES BACK THE DRIFT AND POLL INTERVAL BUT NO CLOCK
+
+	ESP8266_NTP_TIME now;
+	int32_t drift;
+
+	NTP_CHECK_Begin(name);
+	world();
+	first_boot();
+	drift = ESP8266_NTP_GetDriftPPBCtx(&ctx);
+	ESP8266_NTP_Destroy(&ctx);
+	NTP_SIM_Run(60 * 1000);
+
+	switch(what)
+	{
+		case 0: mem.clock_sec ^= 1; break;
+		case 1: mem.size--; break;
+		case 2: mem.version++; break;
+		case 3: mem.magic ^= 0x01000000UL; break;
+		case 4: NTP_SIM_Run((NTP_STORE_MAX_GAP_S + 60) * 1000); break;
+		case 5: rtc_kept = 0; break;
+	}
+	if(what >= 1 && what <= 3)
+	{
+		//ONLY THE FIELD IS WRONG, NOT THE CHECKSUM
+		mem.crc = _esp8266_ntp_crc32(&mem, (uint16_t)((uint8_t*)&mem.crc - (uint8_t*)&mem));
+	}
+
+	boot();
+	NTP_CHECK(!ESP8266_NTP_RestoreCtx(&ctx));
+	NTP_CHECK(!ESP8266_NTP_NowTimeCtx(&ctx, &now));
+	NTP_CHECK(ESP8266_NTP_GetErrorBoundCtx(&ctx) == 0xFFFFFFFFUL);
+	NTP_CHECK(ESP8266_NTP_SyncIfNeededCtx(&ctx));
+	if(what <= 3)
+	{
+		NTP_CHECK(ESP8266_NTP_GetDriftPPBCtx(&ctx) == 0);
+		NTP_CHECK(!ctx.dns_cache[0].valid);
+	}
+	else
+	{
+		NTP_CHECK(ESP8266_NTP_GetDriftPPBCtx(&ctx) == drift);
+		NTP_CHECK(ctx.dns_cache[0].valid);
+	}
+
+	ESP8266_NTP_Destroy(&ctx);
+	ESP8266_NTP_SetStore(NULL);
+}
+
+static void sync_if_needed(void)
+{
+	//RIGHT AFTER THE RESTORE THE BOUND IS UNDER THE THRESHOLD AND NO
+	//SYNC STARTS. IT GROWS BY NTP_CLOCK_TOLERANCE_PPM, AND ONCE PAST THE
+	//THRESHOLD A SYNC RUNS AND BRINGS IT DOWN AGAIN
+
+	NTP_SIM_SERVER* a;
+	uint32_t requests;
+	uint32_t bound;
+	uint32_t wait_s;
+
+	NTP_CHECK_Begin("sync if needed");
+	a = world();
+	first_boot();
+	ESP8266_NTP_Destroy(&ctx);
+	NTP_SIM_Run(20 * 1000);
+
+	boot();
+	ESP8266_NTP_SetSyncThresholdCtx(&ctx, NTP_STORE_TEST_THRESHOLD_US);
+	NTP_CHECK(ESP8266_NTP_RestoreCtx(&ctx));
+	requests = a->requests;
+	bound = ESP8266_NTP_GetErrorBoundCtx(&ctx);
+	NTP_CHECK(bound < NTP_STORE_TEST_THRESHOLD_US);
+	NTP_CHECK(!ESP8266_NTP_SyncIfNeededCtx(&ctx));
+	NTP_SIM_Run(5000);
+	NTP_CHECK(a->requests == requests);
+
+	wait_s = (NTP_STORE_TEST_THRESHOLD_US - bound) / NTP_CLOCK_TOLERANCE_PPM;
+	NTP_SIM_Run((wait_s - 10) * 1000);
+	NTP_CHECK(!ESP8266_NTP_SyncIfNeededCtx(&ctx));
+	NTP_SIM_Run(5000);
+	NTP_CHECK(a->requests == requests);
+
+	NTP_SIM_Run(20 * 1000);
+	NTP_CHECK(ESP8266_NTP_GetErrorBoundCtx(&ctx) > NTP_STORE_TEST_THRESHOLD_US);
+	NTP_CHECK(ESP8266_NTP_SyncIfNeededCtx(&ctx));
+	NTP_SIM_Run(5000);
+	NTP_CHECK(a->requests == requests + 1);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_DONE);
+	NTP_CHECK(ESP8266_NTP_GetErrorBoundCtx(&ctx) < NTP_STORE_TEST_THRESHOLD_US);
+	NTP_CHECK(!ESP8266_NTP_SyncIfNeededCtx(&ctx));
+
+	ESP8266_NTP_Destroy(&ctx);
+	ESP8266_NTP_SetStore(NULL);
+}
+
+int main(void)
+{
+	printf("test_store\n");
+	round_trip();
+	error_growth(60);
+	error_growth(3600);
+	cold("bad checksum", 0);
+	cold("bad size", 1);
+	cold("bad version", 2);
+	cold("bad magic", 3);
+	cold("gap over NTP_STORE_MAX_GAP_S", 4);
+	cold("rtc counter reset", 5);
+	sync_if_needed();
+	return NTP_CHECK_Done();
+}
@@ -0,0 +1,360 @@
+/****************************************************************
+* ESP8266 NTP LIBRARY
+* SINGLE SERVER SYNC SCENARIOS
+****************************************************************/
+
+#include "ntp_sim.h"
+
+static ESP8266_NTP_CONTEXT ctx;
+static ESP8266_NTP_CONTEXT ctx2;
+static uint32_t ready_calls;
+
+static void create(uint16_t timeout_ms)
+{
+	os_memset(&ctx, 0, sizeof(ctx));
+	ESP8266_NTP_Create(&ctx, "a.test", "b.test", NULL, 0, 0, timeout_ms);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx, 0);
+}
+
+static void ready(ESP8266_NTP_CONTEXT* c, ESP8266_NTP_DATA* data, uint16_t length, void* arg)
+{
+	(void)c;
+	(void)data;
+	(void)length;
+	(void)arg;
+	ready_calls++;
+}
+
+static uint8_t run_until(ESP8266_NTP_CONTEXT* c, ESP8266_NTP_SYNC_STATE state, uint32_t max_ms)
+{
+	//RUN UNTIL THE INSTANCE REACHES state. 0 IF IT DID NOT IN max_ms
+
+	uint32_t ms;
+
+	for(ms = 0; ms < max_ms; ms++)
+	{
+		if(ESP8266_NTP_GetSyncStateCtx(c) == state)
+		{
+			return 1;
+		}
+		NTP_SIM_Run(1);
+	}
+	return 0;
+}
+
+static void basic(void)
+{
+	//FIRST SYNC SETS THE CLOCK. THE ERROR IS THE PATH ASYMMETRY (NONE)
+
+	NTP_SIM_SERVER* a;
+	uint32_t ms;
+
+	NTP_CHECK_Begin("basic sync");
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	NTP_SIM_AddServer("b.test", 2);
+	create(1000);
+
+	ms = NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_DONE);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) == 1);
+	NTP_CHECK(a->lookups == 1 && a->requests == 1);
+	NTP_CHECK_RANGE(ms, 30, 40);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -200, 200);
+	NTP_CHECK_RANGE(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->delay_us, 9000, 11000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void offset_step(void)
+{
+	//A SYNCED CLOCK 300 MS OFF IS STEPPED, 50 MS OFF IS SLEWED
+
+	NTP_SIM_SERVER* a;
+
+	NTP_CHECK_Begin("offset step / slew");
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	NTP_SIM_AddServer("b.test", 2);
+	create(1000);
+	NTP_SIM_Sync(&ctx, 5000);
+
+	a->offset_us = 300000;
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK_RANGE(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->offset_us, 299000, 301000);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), 299000, 301000);
+
+	//SLEWED AT UP TO ~488 PPM, SO 50 MS TAKES ~100 S. THE FREQUENCY
+	//LOOP READS 50 MS OVER 1000 S AS A SMALL RESIDUAL DRIFT
+	a->offset_us = 350000;
+	NTP_SIM_Run(1000000);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK_RANGE(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->offset_us, 49000, 51000);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), 299000, 301000);
+	NTP_SIM_Run(200000);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), 349000, 354000);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void delay_jitter(void)
+{
+	//ASYMMETRIC JITTER LIMITS THE ERROR TO HALF THE ROUND TRIP
+
+	NTP_SIM_SERVER* a;
+	uint8_t i;
+
+	NTP_CHECK_Begin("delay and jitter");
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->delay_us = 40000;
+	a->jitter_us = 20000;
+	NTP_SIM_AddServer("b.test", 2);
+	create(1000);
+
+	for(i = 0; i < 8; i++)
+	{
+		NTP_SIM_Sync(&ctx, 5000);
+		NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+		NTP_CHECK_RANGE(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->delay_us, 80000, 120100);
+		NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -20000, 20000);
+		NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	}
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void loss_failover(void)
+{
+	//A SERVER THAT DROPS EVERY REQUEST TIMES OUT AND THE NEXT ONE IS USED
+
+	NTP_SIM_SERVER* a;
+	uint32_t ms;
+
+	NTP_CHECK_Begin("loss, failover");
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->loss_pct = 100;
+	NTP_SIM_AddServer("b.test", 2);
+	create(500);
+
+	ms = NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) == 2);
+	NTP_CHECK(a->requests == 1 && a->replies == 0);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->timeouts == 1);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->last_error == ESP8266_NTP_ERROR_TIMEOUT);
+	NTP_CHECK_RANGE(ms, 500, 600);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void all_lost(void)
+{
+	//NO SERVER ANSWERS. THE SYNC GIVES UP AND REPORTS AN ERROR
+
+	NTP_CHECK_Begin("all servers lost");
+	NTP_SIM_Reset();
+	NTP_SIM_AddServer("a.test", 1)->silent = 1;
+	NTP_SIM_AddServer("b.test", 2)->silent = 1;
+	create(500);
+
+	NTP_SIM_Sync(&ctx, 60000);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_FAILED);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_ERROR);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void dns_failure(void)
+{
+	//A NAME THAT DOES NOT RESOLVE IS COUNTED AND SKIPPED
+
+	NTP_CHECK_Begin("dns failure");
+	NTP_SIM_Reset();
+	NTP_SIM_AddServer("a.test", 1)->dns_fail = 1;
+	NTP_SIM_AddServer("b.test", 2);
+	create(1000);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) == 2);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->dns_failures == 1);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->queries == 0);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void kod(const char* code, uint8_t disabled)
+{
+	//A KISS-O'-DEATH NEVER SETS THE CLOCK. DENY STOPS QUERIES TO THE
+	//SERVER FOR GOOD, RATE BACKS IT OFF
+
+	NTP_SIM_SERVER* a;
+
+	NTP_CHECK_Begin(code);
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	os_memcpy(a->kod, code, 4);
+	NTP_SIM_AddServer("b.test", 2);
+	create(1000);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) == 2);
+	NTP_CHECK(ESP8266_NTP_GetServerStatsCtx(&ctx, 1)->last_error == ESP8266_NTP_ERROR_KOD);
+	NTP_CHECK(ctx.sched[0].disabled == disabled);
+
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS);
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(a->requests == 1);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void bogus_reply(void)
+{
+	//A REPLY ECHOING THE WRONG ORIGIN IS DROPPED WITHOUT ENDING THE
+	//EXCHANGE. THE UDP CLIENT STOPS LISTENING AFTER IT, SO THE REAL
+	//REPLY IS LOST AND THE LIBRARY TIMES THE SERVER OUT ITSELF
+
+	NTP_CHECK_Begin("bogus reply");
+	NTP_SIM_Reset();
+	NTP_SIM_AddServer("a.test", 1)->bogus = 1;
+	NTP_SIM_AddServer("b.test", 2);
+	create(500);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetLastNTPServerUsedNumberCtx(&ctx) == 2);
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->stray == 1);
+	NTP_CHECK(ESP8266_NTP_GetPacketStatsCtx(&ctx)->test_failed[1] == 1);
+	NTP_CHECK_RANGE(NTP_SIM_ClockErrorUs(&ctx), -200, 200);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void leap_warning(void)
+{
+	//A LEAP INDICATOR IN THE REPLY IS REPORTED
+
+	NTP_CHECK_Begin("leap warning");
+	NTP_SIM_Reset();
+	NTP_SIM_AddServer("a.test", 1)->leap = ESP8266_NTP_LEAP_INSERT;
+	create(1000);
+
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(ESP8266_NTP_GetNTPDataStructureCtx(&ctx)->leap == ESP8266_NTP_LEAP_INSERT);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void cancel(const char* name, ESP8266_NTP_SYNC_STATE state)
+{
+	//A SYNC CANCELLED WHILE IT RESOLVES OR WAITS FOR THE REPLY ENDS
+	//WITHOUT A CALLBACK, DROPS THE SYNC REQUESTED AFTER IT AND HANDS THE
+	//UDP CLIENT TO THE NEXT QUEUED INSTANCE
+
+	NTP_SIM_SERVER* a;
+	ESP8266_NTP_TIME now;
+
+	NTP_CHECK_Begin(name);
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->dns_ms = 500;
+	a->delay_us = 200000;
+	create(1000);
+	os_memset(&ctx2, 0, sizeof(ctx2));
+	ESP8266_NTP_Create(&ctx2, "a.test", NULL, NULL, 0, 0, 1000);
+	ESP8266_NTP_SetAutoSyncCtx(&ctx2, 0);
+	ESP8266_NTP_SetCallbackFunctionsCtx(&ctx, ready, NULL);
+	ready_calls = 0;
+
+	ESP8266_NTP_GetTimeCtx(&ctx);
+	NTP_CHECK(run_until(&ctx, state, 2000));
+	ESP8266_NTP_GetTimeCtx(&ctx);
+	ESP8266_NTP_GetTimeCtx(&ctx2);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx2) == ESP8266_NTP_SYNC_QUEUED);
+
+	ESP8266_NTP_CancelCtx(&ctx);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_IDLE);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx2) != ESP8266_NTP_SYNC_QUEUED);
+
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS + 5000);
+	NTP_CHECK(ready_calls == 0);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_IDLE);
+	NTP_CHECK(!ESP8266_NTP_NowTimeCtx(&ctx, &now));
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx2) == ESP8266_NTP_SYNC_DONE);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx2) == ESP8266_NTP_STATE_OK);
+	NTP_CHECK(a->requests == ((state == ESP8266_NTP_SYNC_AWAITING) ? 2 : 1));
+
+	//THE CANCELLED INSTANCE CAN SYNC AGAIN
+	NTP_SIM_Sync(&ctx, 5000);
+	NTP_CHECK(ready_calls == 1);
+	NTP_CHECK(ESP8266_NTP_GetStateCtx(&ctx) == ESP8266_NTP_STATE_OK);
+
+	ESP8266_NTP_Destroy(&ctx2);
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+static void requeue(void)
+{
+	//SYNCS REQUESTED WHILE ONE RUNS START ONE MORE SYNC AFTER IT ENDS,
+	//NOT ONE EACH
+
+	NTP_SIM_SERVER* a;
+
+	NTP_CHECK_Begin("sync requested while one runs");
+	NTP_SIM_Reset();
+	a = NTP_SIM_AddServer("a.test", 1);
+	a->delay_us = 200000;
+	create(1000);
+	ESP8266_NTP_SetCallbackFunctionsCtx(&ctx, ready, NULL);
+	ready_calls = 0;
+
+	ESP8266_NTP_GetTimeCtx(&ctx);
+	NTP_CHECK(run_until(&ctx, ESP8266_NTP_SYNC_AWAITING, 2000));
+	ESP8266_NTP_GetTimeCtx(&ctx);
+	ESP8266_NTP_GetTimeCtx(&ctx);
+
+	//THE FOLLOW UP STARTS FROM THE CALLBACK OF THE FIRST, SO THE
+	//INSTANCE DOES NOT STAY IN DONE
+	NTP_SIM_Run(2000);
+	NTP_CHECK(ready_calls == 1);
+	NTP_CHECK(a->requests == 1);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_WAITING);
+
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS + 5000);
+	NTP_CHECK(ESP8266_NTP_GetSyncStateCtx(&ctx) == ESP8266_NTP_SYNC_DONE);
+	NTP_CHECK(ready_calls == 2);
+	NTP_CHECK(a->requests == 2);
+
+	//NOTHING IS LEFT QUEUED
+	NTP_SIM_Run(NTP_MIN_QUERY_INTERVAL_MS + 5000);
+	NTP_CHECK(ready_calls == 2);
+	NTP_CHECK(a->requests == 2);
+
+	ESP8266_NTP_Destroy(&ctx);
+}
+
+int main(void)
+{
+	printf("test_sync\n");
+	basic();
+	offset_step();
+	delay_jitter();
+	loss_failover();
+	all_lost();
+	dns_failure();
+	kod("DENY", 1);
+	kod("RATE", 0);
+	bogus_reply();
+	leap_warning();
+	cancel("cancel while resolving", ESP8266_NTP_SYNC_RESOLVING);
+	cancel("cancel while awaiting the reply", ESP8266_NTP_SYNC_AWAITING);
+	requeue();
+	return NTP_CHECK_Done();
+}